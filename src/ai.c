@@ -63,6 +63,9 @@
 #include <stdio.h> /* malloc realloc */
 #include <string.h> /* strncpy strlen strncat strcmp strdup */
 #include <math.h>
+#if HAS_POSIX
+#include <sys/time.h>
+#endif /* HAS_POSIX */
 
 /* yay more lua */
 #include "lauxlib.h"
@@ -85,6 +88,8 @@
 #include "nlua_pilot.h"
 #include "nlua_faction.h"
 #include "board.h"
+#include "conf.h"
+#include "threadpool.h"
 
 
 /**
@@ -124,6 +129,53 @@
 static AI_Profile* profiles = NULL; /**< Array of AI_Profiles loaded. */
 static int nprofiles = 0; /**< Number of AI_Profiles loaded. */
 static lua_State *equip_L = NULL; /**< Equipment state. */
+static int equip_ref = LUA_NOREF; /**< Equipment function. */
+
+
+/*
+ * scheduling
+ *
+ * When conf.ai_budget is set only as many pilots as fit in the budget think
+ *  each frame, the rest keep their last steering and firing.
+ */
+#define AI_THINK_MAXWAIT   0.5 /**< Longest a pilot can go without thinking. */
+#define AI_THINK_NEAR      2500. /**< Distance to the player considered near. */
+#define AI_THINK_BOOST     4. /**< Priority multiplier for combat and nearness. */
+#define AI_THINK_SMOOTH    0.05 /**< Weight of the newest sample in the cost average. */
+/**
+ * @brief Pilot waiting to think.
+ */
+typedef struct AIThinkCand_ {
+   Pilot *p; /**< Pilot waiting. */
+   double prio; /**< Priority, higher thinks first. */
+} AIThinkCand;
+static AIThinkCand *ai_cand = NULL; /**< Candidates to think this frame. */
+static int ai_mcand = 0; /**< Allocated candidates. */
+static double ai_thinkCost = 0.; /**< Running average of a think in ms. */
+
+
+/*
+ * parallel thinking
+ *
+ * Each thread gets its own copy of every profile, called a lane.  Pilots
+ *  always use the lane given by their ID so their memory stays in one state.
+ *  While thinking in parallel, anything that touches other pilots or the rest
+ *  of the game goes into the pilot's command buffer instead and gets done on
+ *  the main thread afterwards.
+ */
+/**
+ * @brief Copy of the AI states run by a single thread.
+ */
+typedef struct AILane_ {
+   Pilot **pilots; /**< Pilots to think this frame. */
+   int npilots; /**< Number of pilots to think. */
+   int mpilots; /**< Memory allocated for pilots. */
+   RNGState rng; /**< Random number generator of the lane. */
+} AILane;
+static AILane *ai_lanes = NULL; /**< Lanes, only used when thinking in parallel. */
+static int ai_nlanes = 1; /**< Number of lanes. */
+static AI_Profile *ai_laneProfiles = NULL; /**< Profiles of the lanes past the first. */
+static NTHREADLOCAL int ai_defer = 0; /**< Actions get stored instead of done. */
 
 
 /*
@@ -137,11 +189,31 @@ extern int pilot_nstack;
  * prototypes
  */
 /* Internal C routines */
-static void ai_run( lua_State *L, const char *funcname );
+static int ai_getFunc( lua_State *L, const char *name );
+static int ai_taskRef( AI_Profile *prof, const char *name );
+static void ai_run( lua_State *L, int ref, const char *funcname );
 static int ai_loadProfile( const char* filename );
+static int ai_loadState( AI_Profile *prof, const char* filename );
+static void ai_freeState( AI_Profile *prof );
+static int ai_loadLanes (void);
+static AI_Profile* ai_laneProfile( AI_Profile *prof, unsigned int id );
 static void ai_setMemory (void);
 static void ai_create( Pilot* pilot, char *param );
 static int ai_loadEquip (void);
+static double ai_timeMS (void);
+static int ai_mustThink( const Pilot *p );
+static int ai_candCmp( const void *p1, const void *p2 );
+static void ai_updateCost( double t );
+static void ai_thinkRun( Pilot *pilot );
+static void ai_thinkEnd( Pilot *p, double acc, double turn, int flags,
+      int firemode, const char *distress );
+static void ai_thinkStore( Pilot *p );
+static void ai_thinkLanes( void *data, int start, int end, int thread );
+/* Commands. */
+static int ai_command( AI_CmdType type, unsigned int id, const char *str );
+static int ai_cmdRun( Pilot *p, AI_CmdType type, unsigned int id, const char *str );
+static void ai_cmdApply( Pilot *p );
+static void ai_cmdClear( AI_Commands *c );
 
 
 /*
@@ -311,19 +383,19 @@ static const luaL_reg aiL_methods[] = {
 /*
  * current pilot "thinking" and assorted variables
  */
-static Pilot *cur_pilot = NULL; /**< Current pilot.  All functions use this. */
-static double pilot_acc = 0.; /**< Current pilot's acceleration. */
-static double pilot_turn = 0.; /**< Current pilot's turning. */
-static int pilot_flags = 0; /**< Handle stuff like weapon firing. */
-static int pilot_firemode = 0; /**< Method pilot is using to shoot. */
-static char aiL_distressmsg[PATH_MAX]; /**< Buffer to store distress message. */
+static NTHREADLOCAL Pilot *cur_pilot = NULL; /**< Current pilot.  All functions use this. */
+static NTHREADLOCAL double pilot_acc = 0.; /**< Current pilot's acceleration. */
+static NTHREADLOCAL double pilot_turn = 0.; /**< Current pilot's turning. */
+static NTHREADLOCAL int pilot_flags = 0; /**< Handle stuff like weapon firing. */
+static NTHREADLOCAL int pilot_firemode = 0; /**< Method pilot is using to shoot. */
+static NTHREADLOCAL char aiL_distressmsg[PATH_MAX]; /**< Buffer to store distress message. */
 
 /*
  * ai status, used so that create functions can't be used elsewhere
  */
 #define AI_STATUS_NORMAL      1 /**< Normal ai function behaviour. */
 #define AI_STATUS_CREATE      2 /**< AI is running create function. */
-static int aiL_status = AI_STATUS_NORMAL; /**< Current AI run status. */
+static NTHREADLOCAL int aiL_status = AI_STATUS_NORMAL; /**< Current AI run status. */
 
 
 /**
@@ -360,25 +432,75 @@ void ai_setPilot( Pilot *p )
 }
 
 
+/**
+ * @brief Gets a reference to a global function.
+ *
+ *    @param L Lua state to get function from.
+ *    @param name Name of the function.
+ *    @return Registry reference to the function or LUA_NOREF if it doesn't exist.
+ */
+static int ai_getFunc( lua_State *L, const char *name )
+{
+   lua_getglobal(L, name);
+   if (!lua_isfunction(L,-1)) {
+      lua_pop(L,1);
+      return LUA_NOREF;
+   }
+   return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+
+/**
+ * @brief Gets the reference to a task function of a profile.
+ *
+ * Each task is only looked up once per profile, after that the reference
+ *  is reused.
+ *
+ *    @param prof Profile to get task of.
+ *    @param name Name of the task.
+ *    @return Registry reference to the task function.
+ */
+static int ai_taskRef( AI_Profile *prof, const char *name )
+{
+   int i, ref;
+
+   if (prof == NULL)
+      return LUA_NOREF;
+
+   for (i=0; i<prof->ntasks; i++)
+      if (strcmp(prof->task_names[i], name)==0)
+         return prof->task_refs[i];
+
+   /* Not found, look it up. */
+   ref = ai_getFunc( prof->L, name );
+   prof->ntasks++;
+   prof->task_names = realloc( prof->task_names, sizeof(char*) * prof->ntasks );
+   prof->task_refs  = realloc( prof->task_refs, sizeof(int) * prof->ntasks );
+   prof->task_names[prof->ntasks-1] = strdup(name);
+   prof->task_refs[prof->ntasks-1]  = ref;
+   return ref;
+}
+
+
 /**
  * @brief Attempts to run a function.
  *
  *    @param[in] L Lua state to run function on.
- *    @param[in] funcname Function to run.
+ *    @param[in] ref Registry reference of the function to run.
+ *    @param[in] funcname Name of the function, for errors.
  */
-static void ai_run( lua_State *L, const char *funcname )
+static void ai_run( lua_State *L, int ref, const char *funcname )
 {
-   lua_getglobal(L, funcname);
-
 #ifdef DEBUGGING
-   if (lua_isnil(L, -1)) {
+   if (ref == LUA_NOREF) {
       WARN("Pilot '%s' ai -> '%s': attempting to run non-existant function",
             cur_pilot->name, funcname );
-      lua_pop(L,1);
       return;
    }
 #endif /* DEBUGGING */
 
+   lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+
    if (lua_pcall(L, 0, 0, 0)) { /* error has occured */
       WARN("Pilot '%s' ai -> '%s': %s", cur_pilot->name, funcname, lua_tostring(L,-1));
       lua_pop(L,1);
@@ -427,7 +549,7 @@ int ai_pinit( Pilot *p, const char *ai )
    prof = ai_getProfile(buf);
    if (prof == NULL)
       WARN("AI Profile '%s' not found.", buf);
-   p->ai = prof;
+   p->ai = ai_laneProfile( prof, p->id );
    L = p->ai->L;
 
    /* Set fuel.  Hack until we do it through AI itself. */
@@ -457,6 +579,10 @@ int ai_pinit( Pilot *p, const char *ai )
    ai_create( p, (n!=0) ? param : NULL );
    pilot_setFlag(p, PILOT_CREATED_AI);
 
+   /* Think as soon as possible. */
+   p->ai_wait  = AI_THINK_MAXWAIT;
+   p->ai_think = 1;
+
    return 0;
 }
 
@@ -494,6 +620,12 @@ void ai_destroy( Pilot* p )
 
    /* Clear the tasks. */
    ai_cleartasks( p );
+
+   /* Clear the commands. */
+   ai_cmdClear( &p->ai_cmd );
+   free( p->ai_cmd.cmds );
+   p->ai_cmd.cmds  = NULL;
+   p->ai_cmd.mcmds = 0;
 }
 
 
@@ -533,6 +665,9 @@ int ai_load (void)
    /* More clean up. */
    free(files);
 
+   /* Copies for thinking in parallel. */
+   ai_loadLanes();
+
    /* Load equipment thingy. */
    return ai_loadEquip();
 }
@@ -543,32 +678,38 @@ int ai_load (void)
  */
 static int ai_loadEquip (void)
 {
-   char *buf;
+   const char *buf;
    uint32_t bufsize;
    const char *filename = "ai/equip/equip.lua";
    lua_State *L;
 
    /* Make sure doesn't already exist. */
    if (equip_L != NULL)
-      lua_close(equip_L);
+      nlua_close(equip_L);
 
    /* Create new state. */
    equip_L = nlua_newState();
    L = equip_L;
+   nlua_setOwner( L, "ai equip", NULL );
+   nlua_gcManage( L );
 
    /* Prepare state. */
    nlua_loadStandard(L,0);
 
    /* Load the file. */
-   buf = ndata_read( filename, &bufsize );
+   buf = ndata_borrow( filename, &bufsize );
    if (luaL_dobuffer(L, buf, bufsize, filename) != 0) {
       ERR("Error loading file: %s\n"
           "%s\n"
           "Most likely Lua file has improper syntax, please check",
             filename, lua_tostring(L,-1));
+      ndata_release(buf);
       return -1;
    }
-   free(buf);
+   ndata_release(buf);
+
+   /* Resolve the entry point. */
+   equip_ref = ai_getFunc( L, "equip" );
 
    return 0;
 }
@@ -582,10 +723,6 @@ static int ai_loadEquip (void)
  */
 static int ai_loadProfile( const char* filename )
 {
-   char* buf = NULL;
-   uint32_t bufsize = 0;
-   lua_State *L;
-
    profiles = realloc( profiles, sizeof(AI_Profile)*(++nprofiles) );
 
    profiles[nprofiles-1].name =
@@ -594,14 +731,36 @@ static int ai_loadProfile( const char* filename )
          strlen(filename)-strlen(AI_PREFIX)-strlen(AI_SUFFIX)+1,
          "%s", filename+strlen(AI_PREFIX) );
 
-   profiles[nprofiles-1].L = nlua_newState();
+   return ai_loadState( &profiles[nprofiles-1], filename );
+}
+
+
+/**
+ * @brief Creates the Lua state of a profile.
+ *
+ *    @param prof Profile to create state of.
+ *    @param[in] filename File to create the state from.
+ *    @return 0 on no error.
+ */
+static int ai_loadState( AI_Profile *prof, const char* filename )
+{
+   const char* buf = NULL;
+   uint32_t bufsize = 0;
+   lua_State *L;
+
+   prof->L = nlua_newState();
+   prof->task_names = NULL;
+   prof->task_refs  = NULL;
+   prof->ntasks     = 0;
 
-   if (profiles[nprofiles-1].L == NULL) {
+   if (prof->L == NULL) {
       ERR("Unable to create a new Lua state");
       return -1;
    }
+   nlua_setOwner( prof->L, "ai", prof->name );
+   nlua_gcManage( prof->L );
 
-   L = profiles[nprofiles-1].L;
+   L = prof->L;
 
    /* open basic lua stuff */
    nlua_loadBasic(L);
@@ -630,20 +789,111 @@ static int ai_loadProfile( const char* filename )
    lua_pop(L,1);                 /* */
 
    /* now load the file since all the functions have been previously loaded */
-   buf = ndata_read( filename, &bufsize );
+   buf = ndata_borrow( filename, &bufsize );
    if (luaL_dobuffer(L, buf, bufsize, filename) != 0) {
       ERR("Error loading AI file: %s\n"
           "%s\n"
           "Most likely Lua file has improper syntax, please check",
             filename, lua_tostring(L,-1));
+      ndata_release(buf);
       return -1;
    }
-   free(buf);
+   ndata_release(buf);
+
+   /* Resolve the entry points. */
+   prof->ref_control  = ai_getFunc( L, "control" );
+   prof->ref_attacked = ai_getFunc( L, "attacked" );
+   prof->ref_distress = ai_getFunc( L, "distress" );
+   prof->ref_create   = ai_getFunc( L, "create" );
+   lua_getglobal(L, "control_rate");
+   prof->control_rate = lua_tonumber(L,-1);
+   lua_pop(L,1);
 
    return 0;
 }
 
 
+/**
+ * @brief Frees the Lua state of a profile.
+ *
+ *    @param prof Profile to free state of.
+ */
+static void ai_freeState( AI_Profile *prof )
+{
+   int i;
+
+   nlua_close(prof->L);
+   for (i=0; i<prof->ntasks; i++)
+      free(prof->task_names[i]);
+   free(prof->task_names);
+   free(prof->task_refs);
+}
+
+
+/**
+ * @brief Creates the copies of the profiles needed to think in parallel.
+ *
+ *    @return 0 on no error.
+ */
+static int ai_loadLanes (void)
+{
+   int i, j;
+   char path[PATH_MAX];
+   AI_Profile *prof;
+
+   ai_nlanes = 1;
+#if HAS_THREADLOCAL
+   if (conf.ai_parallel)
+      ai_nlanes = threadpool_threads();
+#endif /* HAS_THREADLOCAL */
+   if (ai_nlanes <= 1)
+      return 0;
+
+   ai_lanes        = calloc( ai_nlanes, sizeof(AILane) );
+   ai_laneProfiles = calloc( (ai_nlanes-1) * nprofiles, sizeof(AI_Profile) );
+   for (i=0; i<ai_nlanes; i++) {
+      /* Seeded from the global generator so runs can be repeated. */
+      rng_stateSeed( &ai_lanes[i].rng, randint() );
+
+      /* First lane uses the normal profiles. */
+      if (i == 0)
+         continue;
+
+      for (j=0; j<nprofiles; j++) {
+         prof       = &ai_laneProfiles[ (i-1)*nprofiles + j ];
+         prof->name = profiles[j].name;
+         snprintf( path, PATH_MAX, AI_PREFIX"%s"AI_SUFFIX, profiles[j].name );
+         if (ai_loadState( prof, path ))
+            WARN("Error loading AI profile '%s'", path);
+      }
+   }
+
+   DEBUG("Thinking in %d lanes", ai_nlanes);
+   return 0;
+}
+
+
+/**
+ * @brief Gets the copy of a profile a pilot should use.
+ *
+ *    @param prof Profile to get copy of.
+ *    @param id ID of the pilot.
+ *    @return Profile of the pilot's lane.
+ */
+static AI_Profile* ai_laneProfile( AI_Profile *prof, unsigned int id )
+{
+   int lane;
+
+   if ((prof == NULL) || (ai_nlanes <= 1))
+      return prof;
+
+   lane = id % ai_nlanes;
+   if (lane == 0)
+      return prof;
+   return &ai_laneProfiles[ (lane-1)*nprofiles + (prof - profiles) ];
+}
+
+
 /**
  * @brief Gets the AI_Profile by name.
  *
@@ -672,29 +922,185 @@ void ai_exit (void)
 {
    int i;
 
+   /* Free lanes. */
+   for (i=0; i<(ai_nlanes-1)*nprofiles; i++)
+      ai_freeState( &ai_laneProfiles[i] );
+   free(ai_laneProfiles);
+   ai_laneProfiles = NULL;
+   for (i=0; i<ai_nlanes && ai_lanes!=NULL; i++)
+      free(ai_lanes[i].pilots);
+   free(ai_lanes);
+   ai_lanes  = NULL;
+   ai_nlanes = 1;
+
    /* Free AI profiles. */
    for (i=0; i<nprofiles; i++) {
       free(profiles[i].name);
-      lua_close(profiles[i].L);
+      ai_freeState( &profiles[i] );
    }
    free(profiles);
 
    /* Free equipment Lua. */
    if (equip_L != NULL)
-      lua_close(equip_L);
-   equip_L = NULL;
+      nlua_close(equip_L);
+   equip_L   = NULL;
+   equip_ref = LUA_NOREF;
+
+   /* Free scheduler. */
+   free(ai_cand);
+   ai_cand  = NULL;
+   ai_mcand = 0;
 }
 
 
 /**
- * @brief Heart of the AI, brains of the pilot.
+ * @brief Gets the current time in milliseconds for measuring thinks.
+ */
+static double ai_timeMS (void)
+{
+#if HAS_POSIX
+   struct timeval tv;
+   gettimeofday( &tv, NULL );
+   return (double)tv.tv_sec * 1000. + (double)tv.tv_usec / 1000.;
+#else /* HAS_POSIX */
+   return (double)SDL_GetTicks();
+#endif /* HAS_POSIX */
+}
+
+
+/**
+ * @brief Checks to see if a pilot can't wait any longer to think.
  *
- *    @param pilot Pilot that needs to think.
+ *    @param p Pilot to check.
+ *    @return 1 if the pilot must think this frame.
  */
-void ai_think( Pilot* pilot, const double dt )
+static int ai_mustThink( const Pilot *p )
 {
-   (void) dt;
+   return (p->tcontrol < 0.) || (p->task == NULL) ||
+         (p->ai_wait >= AI_THINK_MAXWAIT) ||
+         pilot_isFlag(p, PILOT_MANUAL_CONTROL);
+}
+
+
+/**
+ * @brief Sorts candidates by priority, ties go to the lower ID.
+ */
+static int ai_candCmp( const void *p1, const void *p2 )
+{
+   const AIThinkCand *c1, *c2;
+   c1 = (const AIThinkCand*) p1;
+   c2 = (const AIThinkCand*) p2;
+   if (c1->prio > c2->prio)
+      return -1;
+   else if (c1->prio < c2->prio)
+      return +1;
+   if (c1->p->id < c2->p->id)
+      return -1;
+   else if (c1->p->id > c2->p->id)
+      return +1;
+   return 0;
+}
+
 
+/**
+ * @brief Decides which pilots think this frame.
+ *
+ * Pilots whose control tick is up, who have nothing to do or who have waited
+ *  too long always think.  The rest are ordered by how long they've waited,
+ *  with pilots in combat or near the player going first, and think until the
+ *  budget runs out.
+ *
+ *    @param dt Current delta tick.
+ */
+void ai_schedule( double dt )
+{
+   int i, n;
+   Pilot *p;
+   double budget, used, prio;
+
+   budget = conf.ai_budget;
+   used   = 0.;
+   n      = 0;
+   for (i=0; i<pilot_nstack; i++) {
+      p = pilot_stack[i];
+      if (p->ai == NULL)
+         continue;
+
+      p->ai_wait += dt;
+      if ((budget <= 0.) || ai_mustThink(p)) {
+         p->ai_think = 1;
+         used       += ai_thinkCost;
+         continue;
+      }
+      p->ai_think = 0;
+
+      /* Add as candidate. */
+      prio = p->ai_wait;
+      if (pilot_isFlag(p, PILOT_COMBAT))
+         prio *= AI_THINK_BOOST;
+      if ((player != NULL) &&
+            (vect_dist2(&p->solid->pos, &player->solid->pos) <
+               pow2(AI_THINK_NEAR)))
+         prio *= AI_THINK_BOOST;
+      if (n >= ai_mcand) {
+         ai_mcand = (ai_mcand==0) ? 64 : 2*ai_mcand;
+         ai_cand  = realloc( ai_cand, sizeof(AIThinkCand) * ai_mcand );
+      }
+      ai_cand[n].p    = p;
+      ai_cand[n].prio = prio;
+      n++;
+   }
+
+   /* Fill the rest of the budget. */
+   if (n == 0)
+      return;
+   qsort( ai_cand, n, sizeof(AIThinkCand), ai_candCmp );
+   for (i=0; i<n; i++) {
+      if (used + ai_thinkCost > budget)
+         break;
+      ai_cand[i].p->ai_think = 1;
+      used += ai_thinkCost;
+   }
+}
+
+
+/**
+ * @brief Adds a sample to the think cost estimate.
+ *
+ *    @param t Time a think took in ms.
+ */
+static void ai_updateCost( double t )
+{
+   ai_thinkCost = (ai_thinkCost <= 0.) ? t :
+         (1.-AI_THINK_SMOOTH) * ai_thinkCost + AI_THINK_SMOOTH * t;
+}
+
+
+/**
+ * @brief Keeps a pilot that didn't get to think doing what it was doing.
+ *
+ * Turn and thrust stay set on their own, only firing has to be repeated.
+ *
+ *    @param p Pilot to update.
+ */
+void ai_coast( Pilot *p )
+{
+   if (p->ai_fire & AI_PRIMARY)
+      pilot_shoot(p, p->ai_firemode);
+   if (p->ai_fire & AI_SECONDARY)
+      pilot_shootSecondary(p);
+}
+
+
+/**
+ * @brief Runs the Lua part of thinking.
+ *
+ * Results are left in pilot_acc, pilot_turn, pilot_flags and friends.
+ *
+ *    @param pilot Pilot that needs to think.
+ */
+static void ai_thinkRun( Pilot *pilot )
+{
    lua_State *L;
 
    ai_setPilot(pilot);
@@ -710,36 +1116,347 @@ void ai_think( Pilot* pilot, const double dt )
    /* control function if pilot is idle or tick is up */
    if (!pilot_isFlag(cur_pilot, PILOT_MANUAL_CONTROL) &&
          ((cur_pilot->tcontrol < 0.) || (cur_pilot->task == NULL))) {
-      ai_run(L, "control"); /* run control */
-      lua_getglobal(L,"control_rate");
-      cur_pilot->tcontrol = lua_tonumber(L,-1);
-      lua_pop(L,1);
+      ai_run(L, cur_pilot->ai->ref_control, "control"); /* run control */
+      cur_pilot->tcontrol = cur_pilot->ai->control_rate;
    }
 
    /* pilot has a currently running task */
    if (cur_pilot->task) {
-      ai_run(L, cur_pilot->task->name);
+      ai_run(L, cur_pilot->task->func, cur_pilot->task->name);
       if ((cur_pilot->task==NULL) && pilot_isFlag(cur_pilot, PILOT_MANUAL_CONTROL))
-         pilot_runHook( cur_pilot, PILOT_HOOK_IDLE );
+         ai_command( AI_CMD_IDLE, 0, NULL );
    }
 
    /* make sure pilot_acc and pilot_turn are legal */
    pilot_acc   = CLAMP( 0., 1., pilot_acc );
    pilot_turn  = CLAMP( -1., 1., pilot_turn );
+}
 
+
+/**
+ * @brief Applies the results of thinking.
+ *
+ *    @param p Pilot that thought.
+ *    @param acc Thrust to set.
+ *    @param turn Turn to set.
+ *    @param flags Weapons to fire and distress.
+ *    @param firemode Primary weapon mode.
+ *    @param distress Distress message.
+ */
+static void ai_thinkEnd( Pilot *p, double acc, double turn, int flags,
+      int firemode, const char *distress )
+{
    /* Set turn and thrust. */
-   pilot_setTurn( cur_pilot, pilot_turn );
-   pilot_setThrust( cur_pilot, pilot_acc );
+   pilot_setTurn( p, turn );
+   pilot_setThrust( p, acc );
 
    /* fire weapons if needed */
-   if (ai_isFlag(AI_PRIMARY))
-      pilot_shoot(cur_pilot, pilot_firemode); /* primary */
-   if (ai_isFlag(AI_SECONDARY))
-      pilot_shootSecondary(cur_pilot); /* secondary */
+   if (flags & AI_PRIMARY)
+      pilot_shoot(p, firemode); /* primary */
+   if (flags & AI_SECONDARY)
+      pilot_shootSecondary(p); /* secondary */
 
    /* other behaviours. */
-   if (ai_isFlag(AI_DISTRESS))
-      pilot_distress(cur_pilot, aiL_distressmsg, 0);
+   if (flags & AI_DISTRESS)
+      pilot_distress(p, distress, 0);
+
+   /* Remember what to keep doing until the next think. */
+   p->ai_wait     = 0.;
+   p->ai_think    = 0;
+   p->ai_fire     = flags & (AI_PRIMARY | AI_SECONDARY);
+   p->ai_firemode = firemode;
+}
+
+
+/**
+ * @brief Stores the results of thinking in the pilot's command buffer.
+ *
+ *    @param p Pilot that thought.
+ */
+static void ai_thinkStore( Pilot *p )
+{
+   AI_Commands *c;
+
+   c           = &p->ai_cmd;
+   c->acc      = pilot_acc;
+   c->turn     = pilot_turn;
+   c->flags    = pilot_flags;
+   c->firemode = pilot_firemode;
+   c->distress = (pilot_flags & AI_DISTRESS) ? strdup(aiL_distressmsg) : NULL;
+   c->ready    = 1;
+}
+
+
+/**
+ * @brief Heart of the AI, brains of the pilot.
+ *
+ *    @param pilot Pilot that needs to think.
+ */
+void ai_think( Pilot* pilot, const double dt )
+{
+   (void) dt;
+
+   double t;
+
+   /* Already thought in parallel, only has to be applied. */
+   if (pilot->ai_cmd.ready) {
+      ai_cmdApply( pilot );
+      return;
+   }
+
+   t = ai_timeMS();
+   ai_thinkRun( pilot );
+   ai_thinkEnd( pilot, pilot_acc, pilot_turn, pilot_flags, pilot_firemode,
+         aiL_distressmsg );
+
+   /* Update the cost estimate for the scheduler. */
+   ai_updateCost( ai_timeMS() - t );
+}
+
+
+/**
+ * @brief Thinks all the pilots of a range of lanes.
+ */
+static void ai_thinkLanes( void *data, int start, int end, int thread )
+{
+   (void) data;
+   (void) thread;
+   int i, j;
+   AILane *lane;
+
+   for (i=start; i<end; i++) {
+      lane = &ai_lanes[i];
+
+      /* Lanes have their own generator so they don't depend on each other. */
+      rng_setState( &lane->rng );
+      ai_defer = 1;
+
+      for (j=0; j<lane->npilots; j++) {
+         ai_thinkRun( lane->pilots[j] );
+         ai_thinkStore( lane->pilots[j] );
+      }
+
+      ai_defer = 0;
+      rng_setState( NULL );
+   }
+}
+
+
+/**
+ * @brief Checks to see if the AI thinks in parallel.
+ *
+ *    @return 1 if ai_thinkParallel should be used.
+ */
+int ai_isParallel (void)
+{
+   return (ai_nlanes > 1);
+}
+
+
+/**
+ * @brief Runs the thinking of pilots ahead of time in parallel.
+ *
+ * The results are applied when ai_think gets called on them.  Nothing may
+ *  modify the pilots while this runs, so the stack is the snapshot the AI
+ *  sees.  Does nothing if not thinking in parallel.
+ *
+ *    @param pilots Pilots that will think this frame.
+ *    @param n Number of pilots.
+ */
+void ai_thinkParallel( Pilot **pilots, int n )
+{
+   int i;
+   Pilot *p;
+   AILane *lane;
+   double t;
+
+   if (ai_nlanes <= 1)
+      return;
+
+   /* Get rid of thoughts that never got applied. */
+   for (i=0; i<pilot_nstack; i++)
+      if (pilot_stack[i]->ai_cmd.ready)
+         ai_cmdClear( &pilot_stack[i]->ai_cmd );
+
+   /* Sort the pilots into their lanes, keeping the order. */
+   for (i=0; i<ai_nlanes; i++)
+      ai_lanes[i].npilots = 0;
+   for (i=0; i<n; i++) {
+      p    = pilots[i];
+      lane = &ai_lanes[ p->id % ai_nlanes ];
+      if (lane->npilots >= lane->mpilots) {
+         lane->mpilots = (lane->mpilots==0) ? 32 : 2*lane->mpilots;
+         lane->pilots  = realloc( lane->pilots, sizeof(Pilot*) * lane->mpilots );
+      }
+      lane->pilots[ lane->npilots++ ] = p;
+   }
+
+   /* Think. */
+   t = ai_timeMS();
+   threadpool_for( ai_thinkLanes, NULL, ai_nlanes, 1 );
+   if (n > 0)
+      ai_updateCost( (ai_timeMS() - t) / (double)n );
+}
+
+
+/**
+ * @brief Does an action or stores it if thinking in parallel.
+ *
+ *    @param type Type of action.
+ *    @param id Pilot or flag parameter.
+ *    @param str Message parameter.
+ *    @return Result of the action, always 0 if stored.
+ */
+static int ai_command( AI_CmdType type, unsigned int id, const char *str )
+{
+   AI_Commands *c;
+   AI_Cmd *cmd;
+
+   if (!ai_defer)
+      return ai_cmdRun( cur_pilot, type, id, str );
+
+   c = &cur_pilot->ai_cmd;
+   if (c->ncmds >= c->mcmds) {
+      c->mcmds = (c->mcmds==0) ? 4 : 2*c->mcmds;
+      c->cmds  = realloc( c->cmds, sizeof(AI_Cmd) * c->mcmds );
+   }
+   cmd       = &c->cmds[ c->ncmds++ ];
+   cmd->type = type;
+   cmd->id   = id;
+   cmd->str  = (str != NULL) ? strdup(str) : NULL;
+   return 0;
+}
+
+
+/**
+ * @brief Does an action.
+ *
+ *    @param p Pilot doing the action.
+ *    @param type Type of action.
+ *    @param id Pilot or flag parameter.
+ *    @param str Message parameter.
+ *    @return Result of the action.
+ */
+static int ai_cmdRun( Pilot *p, AI_CmdType type, unsigned int id, const char *str )
+{
+   int ret;
+   Pilot *t;
+
+   ret = 0;
+   switch (type) {
+      case AI_CMD_STOP:
+         if (VMOD(p->solid->vel) < MIN_VEL_ERR)
+            vect_pset( &p->solid->vel, 0., 0. );
+         break;
+
+      case AI_CMD_HYPERSPACE:
+         ret = space_hyperspace(p);
+         if (ret == 0) {
+            pilot_shootStop( p, 0 );
+            pilot_shootStop( p, 1 );
+         }
+         break;
+
+      case AI_CMD_E_ATTACK:
+         ret = escorts_attack(p);
+         break;
+      case AI_CMD_E_HOLD:
+         ret = escorts_hold(p);
+         break;
+      case AI_CMD_E_CLEAR:
+         ret = escorts_clear(p);
+         break;
+      case AI_CMD_E_RETURN:
+         ret = escorts_return(p);
+         break;
+
+      case AI_CMD_DOCK:
+         t = pilot_get(id);
+         if (t != NULL) /* Might have died in the meantime. */
+            pilot_dock(p, t, 1);
+         break;
+
+      case AI_CMD_COMBAT:
+         if (id)
+            pilot_setFlag(p, PILOT_COMBAT);
+         else
+            pilot_rmFlag(p, PILOT_COMBAT);
+         break;
+
+      case AI_CMD_HOSTILE:
+         pilot_setHostile(p);
+         break;
+
+      case AI_CMD_BOARD:
+         ret = pilot_board(p);
+         break;
+
+      case AI_CMD_REFUEL:
+         ret = pilot_refuelStart(p);
+         break;
+
+      case AI_CMD_COMM:
+         pilot_message( p, id, str, 0 );
+         break;
+
+      case AI_CMD_BROADCAST:
+         pilot_broadcast( p, str, 0 );
+         break;
+
+      case AI_CMD_IDLE:
+         pilot_runHook( p, PILOT_HOOK_IDLE );
+         break;
+   }
+
+   return ret;
+}
+
+
+/**
+ * @brief Applies the command buffer of a pilot.
+ *
+ *    @param p Pilot to apply command buffer of.
+ */
+static void ai_cmdApply( Pilot *p )
+{
+   int i;
+   AI_Commands c;
+
+   /* Take the buffer, actions like hooks might touch the pilot's AI. */
+   c = p->ai_cmd;
+   memset( &p->ai_cmd, 0, sizeof(AI_Commands) );
+
+   /* Do actions in order, then the rest like a normal think. */
+   for (i=0; i<c.ncmds; i++)
+      ai_cmdRun( p, c.cmds[i].type, c.cmds[i].id, c.cmds[i].str );
+   ai_thinkEnd( p, c.acc, c.turn, c.flags, c.firemode, c.distress );
+
+   /* Give the memory back. */
+   ai_cmdClear( &c );
+   if (p->ai_cmd.cmds == NULL) {
+      p->ai_cmd.cmds  = c.cmds;
+      p->ai_cmd.mcmds = c.mcmds;
+   }
+   else
+      free( c.cmds );
+}
+
+
+/**
+ * @brief Clears a command buffer, keeping its memory.
+ *
+ *    @param c Command buffer to clear.
+ */
+static void ai_cmdClear( AI_Commands *c )
+{
+   int i;
+
+   for (i=0; i<c->ncmds; i++)
+      free( c->cmds[i].str );
+   c->ncmds = 0;
+   free( c->distress );
+   c->distress = NULL;
+   c->ready    = 0;
 }
 
 
@@ -765,7 +1482,7 @@ void ai_attacked( Pilot* attacked, const unsigned int attacker )
 
    ai_setPilot(attacked);
    L = cur_pilot->ai->L;
-   lua_getglobal(L, "attacked");
+   lua_rawgeti(L, LUA_REGISTRYINDEX, cur_pilot->ai->ref_attacked);
    lua_pushnumber(L, attacker);
    if (lua_pcall(L, 1, 0, 0)) {
       WARN("Pilot '%s' ai -> 'attacked': %s", cur_pilot->name, lua_tostring(L,-1));
@@ -788,6 +1505,7 @@ void ai_refuel( Pilot* refueler, unsigned int target )
    t = malloc(sizeof(Task));
    t->next     = NULL;
    t->name     = strdup("refuel");
+   t->func     = ai_taskRef(refueler->ai, "refuel");
    t->dtype    = TASKDATA_INT;
    t->dat.num  = target;
 
@@ -818,11 +1536,9 @@ void ai_getDistress( Pilot* p, const Pilot* distressed )
    L = cur_pilot->ai->L;
 
    /* See if function exists. */
-   lua_getglobal(L, "distress");
-   if (lua_isnil(L,-1)) {
-      lua_pop(L,1);
+   if (cur_pilot->ai->ref_distress == LUA_NOREF)
       return;
-   }
+   lua_rawgeti(L, LUA_REGISTRYINDEX, cur_pilot->ai->ref_distress);
 
    /* Run the function. */
    lua_pushnumber(L, distressed->id);
@@ -858,7 +1574,7 @@ static void ai_create( Pilot* pilot, char *param )
    /* Create equipment first - only if creating for the first time. */
    if ((aiL_status==AI_STATUS_CREATE) || !pilot_isFlag(pilot, PILOT_EMPTY)) {
       L = equip_L;
-      lua_getglobal(L, "equip");
+      lua_rawgeti(L, LUA_REGISTRYINDEX, equip_ref);
       lp.pilot = cur_pilot->id;
       lua_pushpilot(L,lp); 
       lf.f = cur_pilot->faction;
@@ -871,7 +1587,7 @@ static void ai_create( Pilot* pilot, char *param )
 
    /* Prepare stack. */
    L = cur_pilot->ai->L;
-   lua_getglobal(L, "create");
+   lua_rawgeti(L, LUA_REGISTRYINDEX, cur_pilot->ai->ref_create);
 
    /* Parse parameter. */
    if (param != NULL) {
@@ -909,6 +1625,7 @@ Task *ai_newtask( Pilot *p, const char *func, int pos )
    t        = malloc(sizeof(Task));
    t->next  = NULL;
    t->name  = strdup(func);
+   t->func  = ai_taskRef(p->ai, func);
    t->dtype = TASKDATA_NULL;
 
    /* Attach the task. */
@@ -1783,13 +2500,20 @@ static int aiL_getlandplanet( lua_State *L )
 static int aiL_hyperspace( lua_State *L )
 {
    int dist;
-   
-   dist = space_hyperspace(cur_pilot);
-   if (dist == 0.) {
-      pilot_shootStop( cur_pilot, 0 );
-      pilot_shootStop( cur_pilot, 1 );
-      return 0;
+
+   /* Guess what will happen when thinking in parallel. */
+   if (ai_defer) {
+      if (cur_pilot->fuel < HYPERSPACE_FUEL)
+         dist = -3;
+      else if (!space_canHyperspace(cur_pilot))
+         dist = -1;
+      else
+         dist = ai_command( AI_CMD_HYPERSPACE, 0, NULL );
    }
+   else
+      dist = ai_command( AI_CMD_HYPERSPACE, 0, NULL );
+   if (dist == 0.)
+      return 0;
 
    lua_pushnumber(L,dist);
    return 1;
@@ -1831,8 +2555,7 @@ static int aiL_stop( lua_State *L )
 {
    (void) L; /* avoid gcc warning */
 
-   if (VMOD(cur_pilot->solid->vel) < MIN_VEL_ERR)
-      vect_pset( &cur_pilot->solid->vel, 0., 0. );
+   ai_command( AI_CMD_STOP, 0, NULL );
 
    return 0;
 }
@@ -1843,7 +2566,10 @@ static int aiL_stop( lua_State *L )
 static int aiL_e_attack( lua_State *L )
 {
    int ret;
-   ret = escorts_attack(cur_pilot);
+   if (ai_defer) /* Assume it works if there are escorts. */
+      ret = (cur_pilot->nescorts == 0) || ai_command( AI_CMD_E_ATTACK, 0, NULL );
+   else
+      ret = ai_command( AI_CMD_E_ATTACK, 0, NULL );
    lua_pushboolean(L,!ret);
    return 1;
 }
@@ -1854,7 +2580,10 @@ static int aiL_e_attack( lua_State *L )
 static int aiL_e_hold( lua_State *L )
 {
    int ret;
-   ret = escorts_hold(cur_pilot);
+   if (ai_defer) /* Assume it works if there are escorts. */
+      ret = (cur_pilot->nescorts == 0) || ai_command( AI_CMD_E_HOLD, 0, NULL );
+   else
+      ret = ai_command( AI_CMD_E_HOLD, 0, NULL );
    lua_pushboolean(L,!ret);
    return 1;
 }
@@ -1865,7 +2594,10 @@ static int aiL_e_hold( lua_State *L )
 static int aiL_e_clear( lua_State *L )
 {
    int ret;
-   ret = escorts_clear(cur_pilot);
+   if (ai_defer) /* Assume it works if there are escorts. */
+      ret = (cur_pilot->nescorts == 0) || ai_command( AI_CMD_E_CLEAR, 0, NULL );
+   else
+      ret = ai_command( AI_CMD_E_CLEAR, 0, NULL );
    lua_pushboolean(L,!ret);
    return 1;
 }
@@ -1876,7 +2608,10 @@ static int aiL_e_clear( lua_State *L )
 static int aiL_e_return( lua_State *L )
 {
    int ret;
-   ret = escorts_return(cur_pilot);
+   if (ai_defer) /* Assume it works if there are escorts. */
+      ret = (cur_pilot->nescorts == 0) || ai_command( AI_CMD_E_RETURN, 0, NULL );
+   else
+      ret = ai_command( AI_CMD_E_RETURN, 0, NULL );
    lua_pushboolean(L,!ret);
    return 1;
 }
@@ -1896,7 +2631,7 @@ static int aiL_dock( lua_State *L )
       NLUA_ERROR(L, "Pilot ID does not belong to a pilot.");
       return 0;
    }
-   pilot_dock(cur_pilot, p, 1);
+   ai_command( AI_CMD_DOCK, id, NULL );
 
    return 0;
 }
@@ -1967,10 +2702,10 @@ static int aiL_combat( lua_State *L )
 
    if (lua_gettop(L) > 0) {
       i = lua_toboolean(L,1);
-      if (i==1) pilot_setFlag(cur_pilot, PILOT_COMBAT);
-      else if (i==0) pilot_rmFlag(cur_pilot, PILOT_COMBAT);
+      if (i==1) ai_command( AI_CMD_COMBAT, 1, NULL );
+      else if (i==0) ai_command( AI_CMD_COMBAT, 0, NULL );
    }
-   else pilot_setFlag(cur_pilot, PILOT_COMBAT);
+   else ai_command( AI_CMD_COMBAT, 1, NULL );
 
    return 0;
 }
@@ -2183,7 +2918,7 @@ static int aiL_hostile( lua_State *L )
    }
 
    if (p->faction == FACTION_PLAYER)
-      pilot_setHostile(cur_pilot);
+      ai_command( AI_CMD_HOSTILE, 0, NULL );
 
    return 0;
 }
@@ -2262,7 +2997,15 @@ static int aiL_canboard( lua_State *L )
  */
 static int aiL_board( lua_State *L )
 {
-   lua_pushboolean(L, pilot_board( cur_pilot ));
+   int ret;
+   if (ai_defer) { /* Another pilot might beat us to it. */
+      ret = pilot_canBoard( cur_pilot );
+      if (ret)
+         ai_command( AI_CMD_BOARD, 0, NULL );
+   }
+   else
+      ret = ai_command( AI_CMD_BOARD, 0, NULL );
+   lua_pushboolean(L, ret);
    return 1;
 }
 
@@ -2286,7 +3029,16 @@ static int aiL_donerefuel( lua_State *L )
  */
 static int aiL_refuel( lua_State *L )
 {
-   lua_pushboolean(L,pilot_refuelStart(cur_pilot));
+   int ret;
+   if (ai_defer) {
+      /* Only queue it if it can succeed, like pilot_refuelStart checks. */
+      ret = pilot_canRefuel( cur_pilot );
+      if (ret)
+         ai_command( AI_CMD_REFUEL, 0, NULL );
+   }
+   else
+      ret = ai_command( AI_CMD_REFUEL, 0, NULL );
+   lua_pushboolean(L,ret);
    return 1;
 }
 
@@ -2335,7 +3087,7 @@ static int aiL_comm( lua_State *L )
    s = luaL_checkstring(L,2);
 
    /* Send the message. */
-   pilot_message( cur_pilot, p, s, 0 );
+   ai_command( AI_CMD_COMM, p, s );
 
    return 0;
 }
@@ -2348,7 +3100,7 @@ static int aiL_broadcast( lua_State *L )
    const char *str;
 
    str = luaL_checkstring(L,1);
-   pilot_broadcast( cur_pilot, str, 0 );
+   ai_command( AI_CMD_BROADCAST, 0, str );
 
    return 0;
 }
@@ -42,6 +42,7 @@ typedef enum TaskData_ {
 typedef struct Task_ {
    struct Task_* next; /**< Next task */
    char *name; /**< Task name. */
+   int func; /**< Registry reference to the task function. */
    
    TaskData dtype; /**< Data type. */
    union {
@@ -59,9 +60,74 @@ typedef struct Task_ {
 typedef struct AI_Profile_ {
    char* name; /**< Name of the profile. */
    lua_State *L; /**< Assosciated lua State. */
+
+   /* Entry points, stored as registry references. */
+   int ref_control; /**< control() */
+   int ref_attacked; /**< attacked() */
+   int ref_distress; /**< distress() */
+   int ref_create; /**< create() */
+   double control_rate; /**< How often control() gets run. */
+
+   /* Task functions resolved so far. */
+   char **task_names; /**< Names of the tasks. */
+   int *task_refs; /**< Registry references of the tasks. */
+   int ntasks; /**< Number of tasks resolved. */
 } AI_Profile;
 
 
+/**
+ * @enum AI_CmdType
+ *
+ * @brief Actions the AI can't do while thinking in parallel.
+ */
+typedef enum AI_CmdType_ {
+   AI_CMD_STOP, /**< Stops the pilot if it's slow enough. */
+   AI_CMD_HYPERSPACE, /**< Starts hyperspacing. */
+   AI_CMD_E_ATTACK, /**< Orders escorts to attack. */
+   AI_CMD_E_HOLD, /**< Orders escorts to hold. */
+   AI_CMD_E_CLEAR, /**< Clears escort orders. */
+   AI_CMD_E_RETURN, /**< Orders escorts to return. */
+   AI_CMD_DOCK, /**< Docks with a pilot. */
+   AI_CMD_COMBAT, /**< Sets the combat flag. */
+   AI_CMD_HOSTILE, /**< Marks the pilot hostile to the player. */
+   AI_CMD_BOARD, /**< Boards the target. */
+   AI_CMD_REFUEL, /**< Starts refueling the target. */
+   AI_CMD_COMM, /**< Sends a message to a pilot. */
+   AI_CMD_BROADCAST, /**< Broadcasts a message. */
+   AI_CMD_IDLE /**< Runs the idle hook. */
+} AI_CmdType;
+
+
+/**
+ * @struct AI_Cmd
+ *
+ * @brief Action waiting to be done on the main thread.
+ */
+typedef struct AI_Cmd_ {
+   AI_CmdType type; /**< Type of action. */
+   unsigned int id; /**< Pilot or flag parameter. */
+   char *str; /**< Message parameter. */
+} AI_Cmd;
+
+
+/**
+ * @struct AI_Commands
+ *
+ * @brief Results of a think run in parallel, applied later on the main thread.
+ */
+typedef struct AI_Commands_ {
+   int ready; /**< Holds a think that hasn't been applied yet. */
+   double acc; /**< Thrust to set. */
+   double turn; /**< Turn to set. */
+   int flags; /**< Weapons to fire and distress. */
+   int firemode; /**< Primary weapon mode. */
+   char *distress; /**< Distress message. */
+   AI_Cmd *cmds; /**< Actions in the order they were done. */
+   int ncmds; /**< Number of actions. */
+   int mcmds; /**< Memory allocated for actions. */
+} AI_Commands;
+
+
 /*
  * misc
  */
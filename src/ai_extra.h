@@ -36,6 +36,14 @@ void ai_destroy( Pilot* p );
 void ai_think( Pilot* pilot, const double dt );
 void ai_setPilot( Pilot *p );
 
+/*
+ * Scheduling.
+ */
+void ai_schedule( double dt );
+void ai_coast( Pilot *p );
+int ai_isParallel (void);
+void ai_thinkParallel( Pilot **pilots, int n );
+
 
 
 #endif /* AI_EXTRA_H */
@@ -0,0 +1,1123 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+/**
+ * @file bench.c
+ *
+ * @brief Headless combat benchmark.
+ *
+ * Loads the data without opening a window or setting up sound, spawns some
+ *  fleets into a system and runs the simulation with a fixed tick, timing
+ *  each subsystem.  The random seed is fixed so that two runs with the same
+ *  arguments simulate exactly the same thing.  Results are printed as JSON,
+ *  anything logged while benchmarking goes to stderr so they can be parsed.
+ *
+ * It can also land on a planet over and over again, generating and throwing
+ *  away the computer and bar missions each time like the player refreshing
+ *  the lists would.
+ *
+ * Faction relations are always checked both by scanning the ally and enemy
+ *  lists like they used to be and with the relation matrix.
+ *
+ * The data is loaded twice, first parsing it and writing the data cache to a
+ *  temporary file and then loading it back from there, so both startup times
+ *  are measured without touching the user's cache.
+ *
+ * Only built into the naev-bench target.
+ */
+
+
+#include "bench.h"
+
+#include "naev.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#if HAS_POSIX
+#include <time.h>
+#endif /* HAS_POSIX */
+
+#include "SDL.h"
+
+#include "lauxlib.h"
+
+#include "nxml.h"
+#include "log.h"
+#include "conf.h"
+#include "opengl.h"
+#include "input.h"
+#include "ndata.h"
+#include "rng.h"
+#include "threadpool.h"
+#include "sound.h"
+#include "music.h"
+#include "space.h"
+#include "fleet.h"
+#include "pilot.h"
+#include "ai.h"
+#include "ai_extra.h"
+#include "weapon.h"
+#include "spfx.h"
+#include "mission.h"
+#include "event.h"
+#include "faction.h"
+#include "player.h"
+#include "land.h"
+#include "timer.h"
+#include "dcache.h"
+#include "nlua.h"
+#include "nlua_var.h"
+
+
+#define BENCH_SYSTEM_DEF   "Gamma Polaris" /**< Default system to fight in. */
+#define BENCH_TICKS_DEF    3000 /**< Default amount of ticks to run. */
+#define BENCH_DT_DEF       (1./60.) /**< Default tick length. */
+#define BENCH_SEED_DEF     1 /**< Default random seed. */
+#define BENCH_RADIUS_DEF   2000. /**< Default radius to spawn fleets in. */
+#define BENCH_FLEETS_MAX   32 /**< Maximum amount of fleets that can be passed. */
+#define BENCH_LAND_SHIP    "Llama" /**< Ship the player lands with. */
+#define BENCH_VARS_LOOKUPS 1000000 /**< Minimum amount of variable lookups. */
+#define BENCH_FACTION_LOOKUPS 1000000 /**< Minimum amount of faction relation lookups. */
+
+
+/*
+ * pilot stuff
+ */
+extern Pilot** pilot_stack;
+extern int pilot_nstack;
+
+
+/**
+ * @brief Subsystems that get timed.
+ */
+typedef enum BenchTimer_ {
+   BENCH_SPACE, /**< space_update */
+   BENCH_WEAPONS, /**< weapons_update */
+   BENCH_SPFX, /**< spfx_update */
+   BENCH_PILOTS, /**< pilots_update, includes the AI */
+   BENCH_AI, /**< ai_think, only applying the results when thinking in parallel */
+   BENCH_TIMERS, /**< timers_update, runs the mission and event timers */
+   BENCH_TICK, /**< Whole tick. */
+   BENCH_LAND, /**< Generating the missions of a landing. */
+   BENCH_GC, /**< nlua_gcUpdate */
+   BENCH_VARS, /**< var_checkflag over all the variables once */
+   BENCH_FACTION_SCAN, /**< Old relations over all the faction pairs once */
+   BENCH_FACTION_MATRIX, /**< areEnemies and areAllies over all the faction pairs once */
+   BENCH_NTIMERS /**< Number of timers. */
+} BenchTimer;
+
+
+/**
+ * @brief Accumulated time of a subsystem.
+ */
+typedef struct BenchTime_ {
+   double total; /**< Total time in seconds. */
+   double max; /**< Longest single run in seconds. */
+   unsigned long calls; /**< Times it was run. */
+} BenchTime;
+
+
+/**
+ * @brief Fleet to spawn.
+ */
+typedef struct BenchFleet_ {
+   char *name; /**< Name of the fleet. */
+   int count; /**< Times to spawn it. */
+} BenchFleet;
+
+
+/**
+ * @brief Results of a run, each part of the benchmark fills in its own.
+ */
+typedef struct BenchResults_ {
+   /* Simulation. */
+   const char *sysname; /**< System fought in. */
+   unsigned int seed; /**< Random seed. */
+   int ticks; /**< Ticks run. */
+   double dt; /**< Length of a tick. */
+   const BenchFleet *fleets; /**< Fleets spawned. */
+   int nfleets; /**< Number of fleets. */
+   int pilots_start; /**< Pilots once the fleets were spawned. */
+   double wall; /**< Time the simulation took. */
+   /* Loading. */
+   double load_parse; /**< Time parsing the data took. */
+   double load_cache; /**< Time loading from the cache took, negative if off. */
+   /* Landing. */
+   const Planet *land_planet; /**< Planet landed on, NULL if not landing. */
+   int land_cycles; /**< Times landed. */
+   int land_missions; /**< Missions generated. */
+   /* Mission variables. */
+   int vars_count; /**< Variables looked up, 0 if not looking them up. */
+   int vars_lookups; /**< Lookups done. */
+   /* Faction relations. */
+   int faction_lookups; /**< Lookups done each way. */
+   int faction_mismatches; /**< Pairs where both ways disagree. */
+} BenchResults;
+
+
+static const char *bench_timerNames[BENCH_NTIMERS] = {
+   "space_update",
+   "weapons_update",
+   "spfx_update",
+   "pilots_update",
+   "ai_think",
+   "timers_update",
+   "tick",
+   "land_refresh",
+   "lua_gc",
+   "var_lookup",
+   "faction_scan",
+   "faction_matrix"
+}; /**< Names of the timers in the output. */
+static BenchTime bench_times[BENCH_NTIMERS]; /**< Subsystem timings. */
+
+
+/* Allocation counting, only possible when the linker wraps malloc and friends. */
+#ifdef BENCH_WRAP_MALLOC
+static unsigned long bench_nmalloc  = 0; /**< Calls to malloc. */
+static unsigned long bench_ncalloc  = 0; /**< Calls to calloc. */
+static unsigned long bench_nrealloc = 0; /**< Calls to realloc. */
+static unsigned long bench_nfree    = 0; /**< Calls to free. */
+void *__real_malloc( size_t size );
+void *__real_calloc( size_t nmemb, size_t size );
+void *__real_realloc( void *ptr, size_t size );
+void __real_free( void *ptr );
+void *__wrap_malloc( size_t size );
+void *__wrap_calloc( size_t nmemb, size_t size );
+void *__wrap_realloc( void *ptr, size_t size );
+void __wrap_free( void *ptr );
+#endif /* BENCH_WRAP_MALLOC */
+
+
+/*
+ * Prototypes.
+ */
+static double bench_time (void);
+static void bench_timerAdd( BenchTimer t, double dt );
+static void bench_load( BenchResults *res );
+static void bench_think( Pilot *p, const double dt );
+static void bench_hookThink (void);
+static void bench_addFleet( Fleet *flt, double radius );
+static int bench_parseFleet( BenchFleet *bf, const char *arg );
+static Planet* bench_landPlanet( const char *name );
+static void bench_land( BenchResults *res, Planet *pnt, int cycles );
+static void bench_vars( BenchResults *res, int nvars );
+static int bench_scanRel( int a, int b, int enemy );
+static void bench_factions( BenchResults *res );
+static void bench_printString( FILE *f, const char *str );
+static void bench_printRun( FILE *f, const BenchResults *res );
+static void bench_printLand( FILE *f, const BenchResults *res );
+static void bench_printVars( FILE *f, const BenchResults *res );
+static void bench_printFactions( FILE *f, const BenchResults *res );
+static void bench_printAllocs( FILE *f );
+static void bench_print( FILE *f, const BenchResults *res );
+static void bench_usage( char **argv );
+
+
+#ifdef BENCH_WRAP_MALLOC
+/**
+ * @brief Counts calls to malloc.
+ */
+void *__wrap_malloc( size_t size )
+{
+   __sync_fetch_and_add( &bench_nmalloc, 1 );
+   return __real_malloc( size );
+}
+/**
+ * @brief Counts calls to calloc.
+ */
+void *__wrap_calloc( size_t nmemb, size_t size )
+{
+   __sync_fetch_and_add( &bench_ncalloc, 1 );
+   return __real_calloc( nmemb, size );
+}
+/**
+ * @brief Counts calls to realloc.
+ */
+void *__wrap_realloc( void *ptr, size_t size )
+{
+   __sync_fetch_and_add( &bench_nrealloc, 1 );
+   return __real_realloc( ptr, size );
+}
+/**
+ * @brief Counts calls to free.
+ */
+void __wrap_free( void *ptr )
+{
+   if (ptr != NULL)
+      __sync_fetch_and_add( &bench_nfree, 1 );
+   __real_free( ptr );
+}
+#endif /* BENCH_WRAP_MALLOC */
+
+
+/**
+ * @brief Gets the current time in seconds with the best precision available.
+ */
+static double bench_time (void)
+{
+#if HAS_POSIX && defined(CLOCK_MONOTONIC)
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else /* HAS_POSIX && defined(CLOCK_MONOTONIC) */
+   return (double)SDL_GetTicks() / 1000.;
+#endif /* HAS_POSIX && defined(CLOCK_MONOTONIC) */
+}
+
+
+/**
+ * @brief Adds a run to a timer.
+ */
+static void bench_timerAdd( BenchTimer t, double dt )
+{
+   bench_times[t].total += dt;
+   bench_times[t].max    = MAX( bench_times[t].max, dt );
+   bench_times[t].calls++;
+}
+
+
+/**
+ * @brief Times ai_think, replaces it as the think function of the pilots.
+ */
+static void bench_think( Pilot *p, const double dt )
+{
+   double t;
+
+   t = bench_time();
+   ai_think( p, dt );
+   bench_timerAdd( BENCH_AI, bench_time() - t );
+}
+
+
+/**
+ * @brief Makes sure all the AI pilots are timed, including new ones.
+ */
+static void bench_hookThink (void)
+{
+   int i;
+
+   for (i=0; i<pilot_nstack; i++)
+      if (pilot_stack[i]->think == ai_think)
+         pilot_stack[i]->think = bench_think;
+}
+
+
+/**
+ * @brief Spawns a fleet somewhere in the system.
+ *
+ * Unlike normal spawning all the pilots are always created so the load
+ *  doesn't depend on luck.
+ *
+ *    @param flt Fleet to spawn.
+ *    @param radius Radius around the center of the system to spawn in.
+ */
+static void bench_addFleet( Fleet *flt, double radius )
+{
+   int i;
+   double a;
+   Vector2d vp, vv, vn;
+
+   vectnull( &vn );
+   vectnull( &vv );
+   vect_pset( &vp, RNGF()*radius, RNGF()*2.*M_PI );
+
+   for (i=0; i<flt->npilots; i++) {
+      /* Split up like normal fleets do. */
+      vect_cadd( &vp, RNG(75,150) * (RNG(0,1) ? 1 : -1),
+            RNG(75,150) * (RNG(0,1) ? 1 : -1) );
+
+      /* Face the center. */
+      a = vect_angle( &vp, &vn );
+      if (a < 0.)
+         a += 2.*M_PI;
+
+      fleet_createPilot( flt, &flt->pilots[i], a, &vp, &vv, NULL, 0 );
+   }
+}
+
+
+/**
+ * @brief Parses a fleet argument in the form "name[:count]".
+ *
+ *    @param[out] bf Fleet to fill.
+ *    @param arg Argument to parse.
+ *    @return 0 on success.
+ */
+static int bench_parseFleet( BenchFleet *bf, const char *arg )
+{
+   const char *sep;
+   char *end;
+   long n;
+
+   bf->name  = strdup( arg );
+   bf->count = 1;
+
+   sep = strrchr( arg, ':' );
+   if (sep == NULL)
+      return 0;
+
+   n = strtol( sep+1, &end, 10 );
+   if ((end == sep+1) || (*end != '\0') || (n <= 0))
+      return 0; /* Just part of the name. */
+
+   bf->name[ sep - arg ] = '\0';
+   bf->count = (int)n;
+   return 0;
+}
+
+
+/**
+ * @brief Gets the planet to land on.
+ *
+ *    @param name Name of the planet or NULL to use the first one of the
+ *           current system with missions.
+ *    @return The planet or NULL if none found.
+ */
+static Planet* bench_landPlanet( const char *name )
+{
+   int i;
+   Planet *pnt;
+
+   if (name != NULL) {
+      pnt = planet_get( name );
+      if (pnt == NULL)
+         WARN("Planet '%s' not found", name);
+      return pnt;
+   }
+
+   for (i=0; i<cur_system->nplanets; i++) {
+      pnt = cur_system->planets[i];
+      if (planet_hasService( pnt, PLANET_SERVICE_MISSIONS ) ||
+            planet_hasService( pnt, PLANET_SERVICE_BAR ))
+         return pnt;
+   }
+   WARN("No planet with missions in system '%s'", cur_system->name);
+   return NULL;
+}
+
+
+/**
+ * @brief Lands on a planet over and over again.
+ *
+ * Each cycle generates the computer and bar missions and throws them away
+ *  again, which is what happens when the player lands and takes off without
+ *  accepting anything.  The garbage they leave is collected like in a frame.
+ *
+ *    @param res Results to fill in.
+ *    @param pnt Planet to land on.
+ *    @param cycles Times to land.
+ */
+static void bench_land( BenchResults *res, Planet *pnt, int cycles )
+{
+   int i, j, k, n, nmissions;
+   double t;
+   Mission *misn;
+   const int locs[] = { MIS_AVAIL_COMPUTER, MIS_AVAIL_BAR };
+
+   /* Missions need a player to look at. */
+   player = pilot_createEmpty( ship_get( BENCH_LAND_SHIP ), "Bench",
+         FACTION_PLAYER, NULL, PILOT_PLAYER );
+   player_name = strdup( "Bench" );
+   land_planet = pnt;
+
+   nmissions = 0;
+   for (i=0; i<cycles; i++) {
+      t = bench_time();
+      for (k=0; k<(int)(sizeof(locs)/sizeof(locs[0])); k++) {
+         misn = missions_genList( &n, pnt->faction, pnt->name,
+               cur_system->name, locs[k] );
+         for (j=0; j<n; j++)
+            mission_cleanup( &misn[j] );
+         free( misn );
+         nmissions += n;
+      }
+      /* The game collects the garbage every frame too. */
+      nlua_gcUpdate();
+      bench_timerAdd( BENCH_LAND, bench_time() - t );
+   }
+
+   land_planet = NULL;
+   pilot_free( player );
+   free( player_name );
+   player_name = NULL;
+
+   res->land_planet   = pnt;
+   res->land_cycles   = cycles;
+   res->land_missions = nmissions;
+}
+
+
+/**
+ * @brief Looks up mission variables like the conditionals do.
+ *
+ * Pushes nvars variables from Lua and then checks all of them over and over
+ *  until at least BENCH_VARS_LOOKUPS lookups have been done.
+ *
+ *    @param res Results to fill in.
+ *    @param nvars Number of variables to create.
+ */
+static void bench_vars( BenchResults *res, int nvars )
+{
+   int i, n, lookups;
+   double t;
+   char **names;
+   lua_State *L;
+
+   res->vars_count   = nvars;
+   res->vars_lookups = 0;
+
+   /* Create the variables the same way missions do. */
+   L = nlua_newState();
+   nlua_setOwner( L, "bench", NULL );
+   nlua_loadBasic( L );
+   nlua_loadVar( L, 0 );
+   lua_pushnumber( L, nvars );
+   lua_setglobal( L, "nvars" );
+   if (luaL_dostring( L, "for i=1,nvars do var.push( \"bench_var_\"..i, i ) end" ) != 0) {
+      WARN("Failed to create the variables: %s", lua_tostring(L,-1));
+      nlua_close( L );
+      return;
+   }
+
+   names = malloc( sizeof(char*) * nvars );
+   for (i=0; i<nvars; i++) {
+      names[i] = malloc( 32 );
+      snprintf( names[i], 32, "bench_var_%d", i+1 );
+   }
+
+   lookups = 0;
+   while (lookups < BENCH_VARS_LOOKUPS) {
+      t = bench_time();
+      n = 0;
+      for (i=0; i<nvars; i++)
+         n += var_checkflag( names[i] );
+      bench_timerAdd( BENCH_VARS, bench_time() - t );
+      if (n != nvars)
+         WARN("Only found %d of %d variables", n, nvars);
+      lookups += nvars;
+   }
+
+   for (i=0; i<nvars; i++)
+      free( names[i] );
+   free( names );
+   var_cleanup();
+   nlua_close( L );
+
+   res->vars_lookups = lookups;
+}
+
+
+/**
+ * @brief Checks a relation by scanning the lists like areEnemies and
+ *  areAllies did before the relations were cached in a matrix.
+ *
+ *    @param a Faction A.
+ *    @param b Faction B.
+ *    @param enemy Whether to check if they're enemies instead of allies.
+ *    @return 1 if the relation holds.
+ */
+static int bench_scanRel( int a, int b, int enemy )
+{
+   int i, n, *l;
+
+   if (a==b)
+      return !enemy;
+
+   /* Player relations depend on standing. */
+   if ((a==FACTION_PLAYER) || (b==FACTION_PLAYER)) {
+      if (a==FACTION_PLAYER)
+         a = b;
+      if (enemy)
+         return (faction_getPlayer(a) < PLAYER_ENEMY);
+      return (faction_getPlayer(a) > PLAYER_ALLY);
+   }
+
+   l = enemy ? faction_getEnemies( a, &n ) : faction_getAllies( a, &n );
+   for (i=0; i<n; i++)
+      if (l[i] == b)
+         return 1;
+   l = enemy ? faction_getEnemies( b, &n ) : faction_getAllies( b, &n );
+   for (i=0; i<n; i++)
+      if (l[i] == a)
+         return 1;
+   return 0;
+}
+
+
+/**
+ * @brief Compares the old and new faction relation checks.
+ *
+ * Checks whether every pair of factions are enemies and allies over and over
+ *  until at least BENCH_FACTION_LOOKUPS lookups have been done, first by
+ *  scanning the lists and then with the matrix.
+ *
+ *    @param res Results to fill in.
+ */
+static void bench_factions( BenchResults *res )
+{
+   int a, b, n, lookups, mismatches;
+   int scan, matrix;
+   double t;
+
+   n = faction_ngrid;
+   res->faction_lookups    = 0;
+   res->faction_mismatches = 0;
+   if (n <= 0)
+      return;
+
+   /* Make sure they agree. */
+   mismatches = 0;
+   for (a=0; a<n; a++) {
+      for (b=0; b<n; b++) {
+         if ((bench_scanRel(a,b,1) != areEnemies(a,b)) ||
+               (bench_scanRel(a,b,0) != areAllies(a,b)))
+            mismatches++;
+      }
+   }
+   if (mismatches > 0)
+      WARN("%d faction pairs have different relations", mismatches);
+
+   scan   = 0;
+   matrix = 0;
+   for (lookups=0; lookups < BENCH_FACTION_LOOKUPS; lookups += 2*n*n) {
+      t = bench_time();
+      for (a=0; a<n; a++)
+         for (b=0; b<n; b++)
+            scan += bench_scanRel(a,b,1) + bench_scanRel(a,b,0);
+      bench_timerAdd( BENCH_FACTION_SCAN, bench_time() - t );
+
+      t = bench_time();
+      for (a=0; a<n; a++)
+         for (b=0; b<n; b++)
+            matrix += areEnemies(a,b) + areAllies(a,b);
+      bench_timerAdd( BENCH_FACTION_MATRIX, bench_time() - t );
+   }
+
+   /* Also keeps the loops from being optimized out. */
+   if (scan != matrix)
+      WARN("Faction relations found %d times by scanning and %d times with"
+            " the matrix", scan, matrix);
+
+   res->faction_lookups    = lookups;
+   res->faction_mismatches = mismatches;
+}
+
+
+/**
+ * @brief Loads the data, timing both parsing it and loading it from the cache.
+ *
+ * The cache is kept in a temporary file that's removed afterwards.
+ *
+ *    @param res Results to fill in.
+ */
+static void bench_load( BenchResults *res )
+{
+   char path[PATH_MAX];
+   const char *tmp;
+   double t;
+   int fd;
+
+   res->load_cache = -1.;
+   fd              = -1;
+   if (conf.data_cache) {
+      tmp = getenv( "TMPDIR" );
+      snprintf( path, sizeof(path), "%s/naev-bench-XXXXXX",
+            (tmp != NULL) ? tmp : "/tmp" );
+      fd = mkstemp( path );
+      if (fd < 0) {
+         WARN("Unable to create a temporary data cache, not timing it: %s",
+               strerror(errno));
+         conf.data_cache = 0;
+      }
+      else {
+         close( fd );
+         dcache_setPath( path );
+      }
+   }
+
+   /* The empty file doesn't match, so the data is parsed and cached. */
+   t = bench_time();
+   load_all();
+   res->load_parse = bench_time() - t;
+   if (fd < 0)
+      return;
+
+   /* Load it again from the cache. */
+   unload_all();
+   xmlInitParser();
+   t = bench_time();
+   load_all();
+   res->load_cache = bench_time() - t;
+   if (dcache_state() != DCACHE_HIT)
+      WARN("Data wasn't loaded from the cache.");
+
+   remove( path );
+   dcache_setPath( NULL );
+}
+
+
+/**
+ * @brief Prints a JSON string.
+ */
+static void bench_printString( FILE *f, const char *str )
+{
+   fputc( '"', f );
+   for ( ; *str != '\0'; str++) {
+      if ((*str == '"') || (*str == '\\'))
+         fputc( '\\', f );
+      if ((unsigned char)*str < 0x20)
+         fprintf( f, "\\u%04x", (unsigned char)*str );
+      else
+         fputc( *str, f );
+   }
+   fputc( '"', f );
+}
+
+
+/**
+ * @brief Prints the results of the simulation.
+ */
+static void bench_printRun( FILE *f, const BenchResults *res )
+{
+   int i;
+   const BenchTime *t;
+
+   fprintf( f, "   \"system\": " );
+   bench_printString( f, res->sysname );
+   fprintf( f, ",\n" );
+   fprintf( f, "   \"seed\": %u,\n", res->seed );
+   fprintf( f, "   \"ticks\": %d,\n", res->ticks );
+   fprintf( f, "   \"dt\": %.9f,\n", res->dt );
+   fprintf( f, "   \"threads\": %d,\n", threadpool_threads() );
+   fprintf( f, "   \"ai_parallel\": %s,\n", ai_isParallel() ? "true" : "false" );
+
+   fprintf( f, "   \"fleets\": [" );
+   for (i=0; i<res->nfleets; i++) {
+      fprintf( f, "%s\n      { \"name\": ", (i==0) ? "" : "," );
+      bench_printString( f, res->fleets[i].name );
+      fprintf( f, ", \"count\": %d }", res->fleets[i].count );
+   }
+   fprintf( f, "\n   ],\n" );
+
+   fprintf( f, "   \"pilots\": { \"start\": %d, \"end\": %d },\n",
+         res->pilots_start, pilot_nstack );
+   fprintf( f, "   \"load_ms\": %.3f,\n",
+         ((res->load_cache >= 0.) ? res->load_cache : res->load_parse) * 1000. );
+   fprintf( f, "   \"load_parse_ms\": %.3f,\n", res->load_parse * 1000. );
+   if (res->load_cache >= 0.)
+      fprintf( f, "   \"load_cache_ms\": %.3f,\n", res->load_cache * 1000. );
+   else
+      fprintf( f, "   \"load_cache_ms\": null,\n" );
+   fprintf( f, "   \"data_cache\": \"%s\",\n",
+         (dcache_state()==DCACHE_HIT) ? "hit" :
+         (dcache_state()==DCACHE_MISS) ? "miss" : "off" );
+   fprintf( f, "   \"wall_ms\": %.3f,\n", res->wall * 1000. );
+
+   fprintf( f, "   \"timings\": {" );
+   for (i=0; i<BENCH_NTIMERS; i++) {
+      t = &bench_times[i];
+      fprintf( f, "%s\n      \"%s\": { \"total_ms\": %.3f, \"avg_us\": %.3f,"
+            " \"max_us\": %.3f, \"calls\": %lu }",
+            (i==0) ? "" : ",", bench_timerNames[i],
+            t->total * 1000.,
+            (t->calls > 0) ? t->total * 1e6 / (double)t->calls : 0.,
+            t->max * 1e6, t->calls );
+   }
+   fprintf( f, "\n   },\n" );
+}
+
+
+/**
+ * @brief Prints the results of landing.
+ */
+static void bench_printLand( FILE *f, const BenchResults *res )
+{
+   const BenchTime *t;
+
+   if (res->land_planet == NULL) {
+      fprintf( f, "   \"land\": null,\n" );
+      return;
+   }
+
+   t = &bench_times[BENCH_LAND];
+   fprintf( f, "   \"land\": { \"planet\": " );
+   bench_printString( f, res->land_planet->name );
+   fprintf( f, ", \"cycles\": %d, \"missions\": %d,"
+         " \"cycles_per_s\": %.3f },\n",
+         res->land_cycles, res->land_missions,
+         (t->total > 0.) ? (double)res->land_cycles / t->total : 0. );
+}
+
+
+/**
+ * @brief Prints the results of looking up the mission variables.
+ */
+static void bench_printVars( FILE *f, const BenchResults *res )
+{
+   const BenchTime *t;
+
+   if (res->vars_count <= 0) {
+      fprintf( f, "   \"vars\": null,\n" );
+      return;
+   }
+
+   t = &bench_times[BENCH_VARS];
+   fprintf( f, "   \"vars\": { \"count\": %d, \"lookups\": %d,"
+         " \"lookups_per_s\": %.3f },\n",
+         res->vars_count, res->vars_lookups,
+         (t->total > 0.) ? (double)res->vars_lookups / t->total : 0. );
+}
+
+
+/**
+ * @brief Prints the results of checking the faction relations.
+ */
+static void bench_printFactions( FILE *f, const BenchResults *res )
+{
+   fprintf( f, "   \"factions\": { \"count\": %d, \"lookups\": %d,"
+         " \"mismatches\": %d, \"scan_ms\": %.3f, \"matrix_ms\": %.3f },\n",
+         faction_ngrid, res->faction_lookups, res->faction_mismatches,
+         bench_times[BENCH_FACTION_SCAN].total * 1000.,
+         bench_times[BENCH_FACTION_MATRIX].total * 1000. );
+}
+
+
+/**
+ * @brief Prints the allocations made during the simulation, the last entry.
+ */
+static void bench_printAllocs( FILE *f )
+{
+#ifdef BENCH_WRAP_MALLOC
+   fprintf( f, "   \"allocations\": { \"malloc\": %lu, \"calloc\": %lu,"
+         " \"realloc\": %lu, \"free\": %lu }\n",
+         bench_nmalloc, bench_ncalloc, bench_nrealloc, bench_nfree );
+#else /* BENCH_WRAP_MALLOC */
+   fprintf( f, "   \"allocations\": null\n" );
+#endif /* BENCH_WRAP_MALLOC */
+}
+
+
+/**
+ * @brief Prints the results as JSON.
+ */
+static void bench_print( FILE *f, const BenchResults *res )
+{
+   fprintf( f, "{\n" );
+   bench_printRun( f, res );
+   bench_printLand( f, res );
+   bench_printVars( f, res );
+   bench_printFactions( f, res );
+   bench_printAllocs( f );
+   fprintf( f, "}\n" );
+}
+
+
+/**
+ * @brief Prints the usage.
+ */
+static void bench_usage( char **argv )
+{
+   LOG("Usage: %s [OPTIONS] [DATA]", argv[0]);
+   LOG("Options are:");
+   LOG("   -s n, --system n      system to fight in (default "BENCH_SYSTEM_DEF")");
+   LOG("   -f n, --fleet n[:c]   spawns fleet n c times, can be repeated");
+   LOG("   -t n, --ticks n       number of ticks to run");
+   LOG("   -d n, --dt n          length of a tick in seconds");
+   LOG("   -r n, --seed n        random seed");
+   LOG("   -R n, --radius n      radius to spawn the fleets in");
+   LOG("   -j n, --threads n     threads to use, 0 is one per processor");
+   LOG("   -S, --spawn           let the system spawn its own fleets too");
+   LOG("   -P, --parallel-ai     run the AI in parallel");
+   LOG("   -l n, --land n        lands n times afterwards, generating the missions");
+   LOG("   -p n, --planet n      planet to land on (default first with missions)");
+   LOG("   -v n, --vars n        times looking up n mission variables afterwards");
+   LOG("   -X, --no-data-cache   only parses the data, without timing the cache");
+   LOG("   -o f, --output f      writes the results to f instead of stdout");
+   LOG("   -h, --help            display this message and exit");
+}
+
+
+/**
+ * @brief Runs the benchmark.
+ *
+ *    @param[in] argc Number of arguments.
+ *    @param[in] argv Array of argc arguments.
+ *    @return EXIT_SUCCESS on success.
+ */
+int bench_main( int argc, char** argv )
+{
+   static struct option long_options[] = {
+      { "system", required_argument, 0, 's' },
+      { "fleet", required_argument, 0, 'f' },
+      { "ticks", required_argument, 0, 't' },
+      { "dt", required_argument, 0, 'd' },
+      { "seed", required_argument, 0, 'r' },
+      { "radius", required_argument, 0, 'R' },
+      { "threads", required_argument, 0, 'j' },
+      { "spawn", no_argument, 0, 'S' },
+      { "parallel-ai", no_argument, 0, 'P' },
+      { "land", required_argument, 0, 'l' },
+      { "planet", required_argument, 0, 'p' },
+      { "vars", required_argument, 0, 'v' },
+      { "no-data-cache", no_argument, 0, 'X' },
+      { "output", required_argument, 0, 'o' },
+      { "help", no_argument, 0, 'h' },
+      { NULL, 0, 0, 0 } };
+   int option_index = 1;
+   int c, fd;
+   int i, j;
+   const char *sysname, *output, *pntname;
+   BenchFleet fleets[BENCH_FLEETS_MAX];
+   int nfleets;
+   int ticks, threads, spawn, cycles, nvars;
+   unsigned int seed;
+   double dt, radius, t, tick;
+   Fleet *flt;
+   StarSystem *sys;
+   Planet *pnt;
+   FILE *f;
+   BenchResults res;
+
+   /* Defaults. */
+   sysname = BENCH_SYSTEM_DEF;
+   output  = NULL;
+   nfleets = 0;
+   ticks   = BENCH_TICKS_DEF;
+   dt      = BENCH_DT_DEF;
+   seed    = BENCH_SEED_DEF;
+   radius  = BENCH_RADIUS_DEF;
+   threads = 0;
+   spawn   = 0;
+   cycles  = 0;
+   pntname = NULL;
+   nvars   = 0;
+   memset( &res, 0, sizeof(res) );
+
+   /* Initializes SDL for threads. */
+   SDL_Init(0);
+
+   /* We'll be parsing XML. */
+   LIBXML_TEST_VERSION
+   xmlInitParser();
+
+   /* The stages create Lua states from the worker threads. */
+   if (nlua_init())
+      ERR("Failed to initialize Lua.");
+
+   /* Input must be initialized for the default config. */
+   input_init();
+   conf_setDefaults();
+
+   while ((c = getopt_long(argc, argv,
+         "s:f:t:d:r:R:j:SPl:p:v:Xo:h",
+         long_options, &option_index)) != -1) {
+      switch (c) {
+         case 's':
+            sysname = optarg;
+            break;
+         case 'f':
+            if (nfleets >= BENCH_FLEETS_MAX) {
+               WARN("Too many fleets, ignoring '%s'", optarg);
+               break;
+            }
+            bench_parseFleet( &fleets[nfleets++], optarg );
+            break;
+         case 't':
+            ticks = atoi(optarg);
+            break;
+         case 'd':
+            dt = atof(optarg);
+            break;
+         case 'r':
+            seed = (unsigned int)strtoul( optarg, NULL, 10 );
+            break;
+         case 'R':
+            radius = atof(optarg);
+            break;
+         case 'j':
+            threads = atoi(optarg);
+            break;
+         case 'S':
+            spawn = 1;
+            break;
+         case 'P':
+            conf.ai_parallel = 1;
+            break;
+         case 'l':
+            cycles = atoi(optarg);
+            break;
+         case 'p':
+            pntname = optarg;
+            break;
+         case 'v':
+            nvars = atoi(optarg);
+            break;
+         case 'X':
+            conf.data_cache = 0;
+            break;
+         case 'o':
+            output = optarg;
+            break;
+         case 'h':
+         default:
+            bench_usage(argv);
+            exit( (c=='h') ? EXIT_SUCCESS : EXIT_FAILURE );
+      }
+   }
+   if (optind < argc)
+      conf.ndata = strdup( argv[ optind ] );
+
+   /* Results go to stdout unless told otherwise, so the logs can't go there. */
+   f = NULL;
+   if (output != NULL) {
+      f = fopen( output, "w" );
+      if (f == NULL)
+         WARN("Unable to open '%s' for writing, using stdout", output);
+   }
+   if (f == NULL) {
+      fflush( stdout );
+      fd = dup( STDOUT_FILENO );
+      f  = (fd >= 0) ? fdopen( fd, "w" ) : NULL;
+      if (f != NULL)
+         dup2( STDERR_FILENO, STDOUT_FILENO );
+      else
+         f = stdout;
+   }
+
+   /* Default battle. */
+   if (nfleets == 0) {
+      bench_parseFleet( &fleets[nfleets++], "Dvaered Med Force:4" );
+      bench_parseFleet( &fleets[nfleets++], "Pirate Hyena Pack:6" );
+   }
+
+   /* No window nor sound. */
+   conf.nosound   = 1;
+   sound_disabled = 1;
+   music_disabled = 1;
+   gl_screen.flags |= OPENGL_HEADLESS;
+   gl_screen.w      = gl_screen.rw = gl_screen.nw = conf.width;
+   gl_screen.h      = gl_screen.rh = gl_screen.nh = conf.height;
+   gl_screen.scale  = 1.;
+
+   /* Open data. */
+   if (ndata_open() != 0)
+      ERR("Failed to open ndata.");
+
+   /* Everything that follows must be repeatable. */
+   rng_seed( seed );
+   threadpool_init( threads );
+
+   /* Load the data, seeding again so the cache doesn't change the run. */
+   bench_load( &res );
+   rng_seed( seed );
+
+   /* Set up the system, bypassing space_init which needs a player. */
+   sys = system_get( sysname );
+   if (sys == NULL)
+      ERR("System '%s' not found", sysname);
+   cur_system  = sys;
+   space_spawn = spawn;
+   pilot_updateSensorRange();
+
+   /* Spawn the fleets. */
+   for (i=0; i<nfleets; i++) {
+      flt = fleet_get( fleets[i].name );
+      if (flt == NULL) {
+         WARN("Fleet '%s' not found", fleets[i].name);
+         continue;
+      }
+      for (j=0; j<fleets[i].count; j++)
+         bench_addFleet( flt, radius );
+   }
+   res.sysname      = sysname;
+   res.seed         = seed;
+   res.ticks        = ticks;
+   res.dt           = dt;
+   res.fleets       = fleets;
+   res.nfleets      = nfleets;
+   res.pilots_start = pilot_nstack;
+
+   /* Run the simulation. */
+   memset( bench_times, 0, sizeof(bench_times) );
+#ifdef BENCH_WRAP_MALLOC
+   bench_nmalloc  = 0;
+   bench_ncalloc  = 0;
+   bench_nrealloc = 0;
+   bench_nfree    = 0;
+#endif /* BENCH_WRAP_MALLOC */
+   res.wall = bench_time();
+   for (i=0; i<ticks; i++) {
+      bench_hookThink();
+      tick = bench_time();
+
+      t = bench_time();
+      space_update(dt);
+      bench_timerAdd( BENCH_SPACE, bench_time() - t );
+
+      t = bench_time();
+      weapons_update(dt);
+      bench_timerAdd( BENCH_WEAPONS, bench_time() - t );
+
+      t = bench_time();
+      spfx_update(dt);
+      bench_timerAdd( BENCH_SPFX, bench_time() - t );
+
+      t = bench_time();
+      pilots_update(dt);
+      bench_timerAdd( BENCH_PILOTS, bench_time() - t );
+
+      t = bench_time();
+      timers_update(dt);
+      bench_timerAdd( BENCH_TIMERS, bench_time() - t );
+
+      bench_timerAdd( BENCH_TICK, bench_time() - tick );
+
+      /* Collected between frames like in the game. */
+      t = bench_time();
+      nlua_gcUpdate();
+      bench_timerAdd( BENCH_GC, bench_time() - t );
+   }
+   res.wall = bench_time() - res.wall;
+
+   /* Land. */
+   if (cycles > 0) {
+      pnt = bench_landPlanet( pntname );
+      if (pnt != NULL)
+         bench_land( &res, pnt, cycles );
+   }
+
+   /* Mission variables. */
+   if (nvars > 0)
+      bench_vars( &res, nvars );
+
+   /* Faction relations. */
+   bench_factions( &res );
+
+   /* Print results. */
+   bench_print( f, &res );
+   if (f != stdout)
+      fclose(f);
+
+   /* Clean up. */
+   weapon_exit();
+   pilots_free();
+   timers_exit();
+   unload_all();
+   ndata_close();
+   conf_cleanup();
+   ai_exit();
+   input_exit();
+   threadpool_exit();
+   nlua_exit();
+   for (i=0; i<nfleets; i++)
+      free( fleets[i].name );
+   SDL_Quit();
+
+   return EXIT_SUCCESS;
+}
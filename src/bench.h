@@ -0,0 +1,14 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+
+
+#ifndef BENCH_H
+#  define BENCH_H
+
+
+int bench_main( int argc, char** argv );
+
+
+#endif /* BENCH_H */
@@ -371,12 +371,12 @@ static void board_update( unsigned int wdw )
 
 
 /**
- * @brief Has a pilot attempt to board another pilot.
- * 
+ * @brief Checks to see if a pilot can board its target right now.
+ *
  *    @param p Pilot doing the boarding.
- *    @return 1 if target was boarded.
+ *    @return 1 if the target can be boarded.
  */
-int pilot_board( Pilot *p )
+int pilot_canBoard( const Pilot *p )
 {
    Pilot *target;
 
@@ -400,6 +400,25 @@ int pilot_board( Pilot *p )
    else if (pilot_isFlag(target,PILOT_BOARDED))
       return 0;
 
+   return 1;
+}
+
+
+/**
+ * @brief Has a pilot attempt to board another pilot.
+ * 
+ *    @param p Pilot doing the boarding.
+ *    @return 1 if target was boarded.
+ */
+int pilot_board( Pilot *p )
+{
+   Pilot *target;
+
+   /* Check if can board. */
+   if (!pilot_canBoard(p))
+      return 0;
+   target = pilot_get(p->target);
+
    /* Set the boarding flag. */
    pilot_setFlag(target, PILOT_BOARDED);
    pilot_setFlag(p, PILOT_BOARDING);
@@ -12,6 +12,7 @@
 
 void player_board (void);
 void board_unboard (void);
+int pilot_canBoard( const Pilot *p );
 int pilot_board( Pilot *p );
 void pilot_boardComplete( Pilot *p );
 
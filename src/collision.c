@@ -16,12 +16,73 @@
 #include "log.h"
 
 
+/*
+ * Prototypes.
+ */
+static uint64_t collide_getBits( const uint64_t *row, int words, int pos );
+static int collide_lowestBit( uint64_t bits );
+static int collide_maskIsTrans( const glMask *m, int x, int y );
+
+
+/**
+ * @brief Gets 64 bits of a mask row starting at an arbitrary pixel.
+ *
+ *    @param row Row to get bits from.
+ *    @param words Number of words in the row.
+ *    @param pos Pixel to start at.
+ *    @return Bits starting at pos, pixels past the end are transparent.
+ */
+static uint64_t collide_getBits( const uint64_t *row, int words, int pos )
+{
+   int k, r;
+   uint64_t v;
+
+   k = pos / 64;
+   r = pos % 64;
+   v = row[k] >> r;
+   if ((r != 0) && (k+1 < words))
+      v |= row[k+1] << (64 - r);
+   return v;
+}
+
+
+/**
+ * @brief Gets the position of the lowest set bit, bits must not be 0.
+ */
+static int collide_lowestBit( uint64_t bits )
+{
+#ifdef __GNUC__
+   return __builtin_ctzll( bits );
+#else /* __GNUC__ */
+   int i;
+   for (i=0; !(bits & 1); i++)
+      bits >>= 1;
+   return i;
+#endif /* __GNUC__ */
+}
+
+
+/**
+ * @brief Checks to see if a pixel of a mask is transparent.
+ */
+static int collide_maskIsTrans( const glMask *m, int x, int y )
+{
+   if ((x < 0) || (x >= m->w) || (y < 0) || (y >= m->h))
+      return 1;
+   return !(m->bits[ y*m->words + x/64 ] & (((uint64_t)1) << (x%64)));
+}
+
+
 /**
  * @brief Checks whether or not two sprites collide.
  *
  * This function does pixel perfect checks.  If the collision actually occurs,
  *  crash is set to store the real position of the collision.
  *
+ * Rows are tested 64 pixels at a time using the sprite collision masks, the
+ *  crash position is the first opaque pixel found scanning from the bottom
+ *  left of the intersection.
+ *
  *    @param[in] at Texture a.
  *    @param[in] asx Position of x of sprite a.
  *    @param[in] asy Position of y of sprita a.
@@ -37,20 +98,24 @@ int CollideSprite( const glTexture* at, const int asx, const int asy, const Vect
       const glTexture* bt, const int bsx, const int bsy, const Vector2d* bp,
       Vector2d* crash )
 {
-   int x,y;
+   int x,y, x0,x1;
    int ax1,ax2, ay1,ay2;
    int bx1,bx2, by1,by2;
    int inter_x0, inter_x1, inter_y0, inter_y1;
-   int rasy, rbsy;
-   int abx,aby, bbx, bby;
-
-   /* Make sure the surfaces have transparency maps. */
-   if (at->trans == NULL) {
-      WARN("Texture '%s' has no transparency map.", at->name);
+   const glMask *am, *bm;
+   const uint64_t *arow, *brow;
+   const int *aspan, *bspan;
+   uint64_t bits;
+
+   /* Make sure the surfaces have collision masks. */
+   am = gl_getMask( at, asx, asy );
+   if (am == NULL) {
+      WARN("Texture '%s' has no collision mask.", at->name);
       return 0;
    }
-   if (bt->trans == NULL) {
-      WARN("Texture '%s' has no transparency map.", bt->name);
+   bm = gl_getMask( bt, bsx, bsy );
+   if (bm == NULL) {
+      WARN("Texture '%s' has no collision mask.", bt->name);
       return 0;
    }
 
@@ -76,27 +141,31 @@ int CollideSprite( const glTexture* at, const int asx, const int asy, const Vect
    inter_y0 = MAX( ay1, by1 );
    inter_y1 = MIN( ay2, by2 );
 
-   /* real vertical sprite value (flipped) */
-   rasy = at->sy - asy - 1;
-   rbsy = bt->sy - bsy - 1;
-
-   /* set up the base points */
-   abx =  asx*(int)(at->sw) - ax1;
-   aby = rasy*(int)(at->sh) - ay1;
-   bbx =  bsx*(int)(bt->sw) - bx1;
-   bby = rbsy*(int)(bt->sh) - by1;
-
-   for (y=inter_y0; y<=inter_y1; y++)
-      for (x=inter_x0; x<=inter_x1; x++)
-         /* compute offsets for surface before pass to TransparentPixel test */ 
-         if ((!gl_isTrans(at, abx + x, aby + y)) &&
-               (!gl_isTrans(bt, bbx + x, bby + y))) {
-
+   for (y=inter_y0; y<=inter_y1; y++) {
+      aspan = &am->span[ 2*(y-ay1) ];
+      bspan = &bm->span[ 2*(y-by1) ];
+
+      /* Only look where both rows have opaque pixels. */
+      x0 = MAX( inter_x0, MAX( ax1 + aspan[0], bx1 + bspan[0] ) );
+      x1 = MIN( inter_x1, MIN( ax1 + aspan[1], bx1 + bspan[1] ) );
+      if (x0 > x1)
+         continue;
+
+      arow = &am->bits[ (y-ay1) * am->words ];
+      brow = &bm->bits[ (y-by1) * bm->words ];
+      for (x=x0; x<=x1; x+=64) {
+         bits = collide_getBits( arow, am->words, x-ax1 ) &
+               collide_getBits( brow, bm->words, x-bx1 );
+         if (x1-x < 63) /* Don't look past the intersection. */
+            bits &= (((uint64_t)1) << (x1-x+1)) - 1;
+         if (bits != 0) {
             /* Set the crash position. */
-            crash->x = x;
+            crash->x = x + collide_lowestBit( bits );
             crash->y = y;
             return 1;
          }
+      }
+   }
 
    return 0;
 }
@@ -175,14 +244,16 @@ int CollideLineSprite( const Vector2d* ap, double ad, double al,
       const glTexture* bt, const int bsx, const int bsy, const Vector2d* bp,
       Vector2d crash[2] )
 {
-   int x,y, rbsy, bbx,bby;
+   int x,y;
    double ep[2], bl[2], tr[2], v[2], mod;
    int hits, real_hits;
    Vector2d tmp_crash, border[2];
+   const glMask *bm;
 
-   /* Make sure texture has transparency map. */
-   if (bt->trans == NULL) {
-      WARN("Texture '%s' has no transparency map.", bt->name);
+   /* Make sure texture has collision mask. */
+   bm = gl_getMask( bt, bsx, bsy );
+   if (bm == NULL) {
+      WARN("Texture '%s' has no collision mask.", bt->name);
       return 0;
    }
 
@@ -253,18 +324,12 @@ int CollideLineSprite( const Vector2d* ap, double ad, double al,
    v[0] /= mod;
    v[1] /= mod;
 
-   /* real vertical sprite value (flipped) */
-   rbsy = bt->sy - bsy - 1;
-   /* set up the base points */
-   bbx =  bsx*(int)(bt->sw);
-   bby = rbsy*(int)(bt->sh);
-
    /* We start checking first border until we find collision. */
    x = border[0].x - bl[0] + v[0];
    y = border[0].y - bl[1] + v[1];
    while ((x > 0.) && (x < bt->sw) && (y > 0.) && (y < bt->sh)) {
       /* Is non-transparent. */
-      if (!gl_isTrans(bt, bbx+(int)x, bby+(int)y)) {
+      if (!collide_maskIsTrans(bm, (int)x, (int)y)) {
          crash[real_hits].x = x + bl[0];
          crash[real_hits].y = y + bl[1];
          real_hits++;
@@ -279,7 +344,7 @@ int CollideLineSprite( const Vector2d* ap, double ad, double al,
    y = border[1].y - bl[1] - v[1];
    while ((x > 0.) && (x < bt->sw) && (y > 0.) && (y < bt->sh)) {
       /* Is non-transparent. */
-      if (!gl_isTrans(bt, bbx+(int)x, bby+(int)y)) {
+      if (!collide_maskIsTrans(bm, (int)x, (int)y)) {
          crash[real_hits].x = x + bl[0];
          crash[real_hits].y = y + bl[1];
          real_hits++;
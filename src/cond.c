@@ -3,9 +3,9 @@
  */
 
 /**
- * @file mission.c
+ * @file cond.c
  *
- * @brief Handles missions.
+ * @brief Handles the Lua conditionals of missions and events.
  */
 
 
@@ -19,6 +19,15 @@
 
 
 static lua_State *cond_L = NULL; /** Conditional Lua state. */
+static int cond_ref      = LUA_NOREF; /**< Table of compiled conditionals by source. */
+static int cond_batchRef = LUA_NOREF; /**< Table of results of the current batch. */
+static int cond_batch    = 0; /**< Batch nesting depth. */
+
+
+/*
+ * Prototypes.
+ */
+static int cond_compile( const char *cond );
 
 
 /**
@@ -30,11 +39,16 @@ int cond_init (void)
       return 0;
 
    cond_L = nlua_newState();
+   nlua_setOwner( cond_L, "cond", NULL );
    if (nlua_loadStandard(cond_L,1)) {
       WARN("Failed to load standard Lua libraries.");
       return -1;
    }
 
+   /* Compiled conditionals. */
+   lua_newtable(cond_L);
+   cond_ref = luaL_ref(cond_L, LUA_REGISTRYINDEX);
+
    return 0;
 }
 
@@ -47,28 +61,115 @@ void cond_exit (void)
    if (cond_L == NULL)
       return;
 
-   lua_close(cond_L);
-   cond_L = NULL;
+   nlua_close(cond_L);
+   cond_L        = NULL;
+   cond_ref      = LUA_NOREF;
+   cond_batchRef = LUA_NOREF;
+   cond_batch    = 0;
 }
 
 
 /**
- * @brief Checks to see if a condition is true.
+ * @brief Starts a batch of conditional checks.
  *
- *    @param cond Condition to check.
- *    @return 0 if is false, 1 if is true, -1 on error.
+ * Conditionals can't change the game so until cond_batchEnd the result of
+ *  each one is only computed once, which helps when many missions share the
+ *  same condition.  Nothing that can change the result of a conditional may
+ *  happen during a batch.
  */
-int cond_check( const char* cond )
+void cond_batchStart (void)
+{
+   if (cond_L == NULL)
+      return;
+
+   if (cond_batch++ == 0) {
+      lua_newtable(cond_L);
+      cond_batchRef = luaL_ref(cond_L, LUA_REGISTRYINDEX);
+   }
+}
+
+
+/**
+ * @brief Ends a batch of conditional checks.
+ */
+void cond_batchEnd (void)
+{
+   if ((cond_L == NULL) || (cond_batch <= 0))
+      return;
+
+   if (--cond_batch == 0) {
+      luaL_unref(cond_L, LUA_REGISTRYINDEX, cond_batchRef);
+      cond_batchRef = LUA_NOREF;
+   }
+}
+
+
+/**
+ * @brief Pushes the compiled function of a conditional.
+ *
+ * Conditionals get compiled the first time they're used and kept for the
+ *  rest of the game.
+ *
+ *    @param cond Conditional to compile.
+ *    @return 0 on success with the function pushed, otherwise the error is
+ *            pushed.
+ */
+static int cond_compile( const char *cond )
 {
-   int b;
    int ret;
 
-   /* Load the string. */ 
+   /* Already compiled. */
+   lua_rawgeti(cond_L, LUA_REGISTRYINDEX, cond_ref);
+   lua_getfield(cond_L, -1, cond);
+   if (!lua_isnil(cond_L, -1)) {
+      lua_remove(cond_L, -2);
+      return 0;
+   }
+   lua_pop(cond_L, 1);
+
+   /* Load the string. */
    lua_pushstring(cond_L, "return ");
    lua_pushstring(cond_L, cond);
    lua_concat(cond_L, 2);
    ret = luaL_loadbuffer(cond_L, lua_tostring(cond_L,-1),
          lua_strlen(cond_L,-1), "Lua Conditional");
+   lua_remove(cond_L, -2);
+   if (ret != 0)
+      return ret;
+
+   /* Save it. */
+   lua_pushvalue(cond_L, -1);
+   lua_setfield(cond_L, -3, cond);
+   lua_remove(cond_L, -2);
+   return 0;
+}
+
+
+/**
+ * @brief Checks to see if a condition is true.
+ *
+ *    @param cond Condition to check.
+ *    @return 0 if is false, 1 if is true, -1 on error.
+ */
+int cond_check( const char* cond )
+{
+   int b;
+   int ret;
+
+   /* Already checked in this batch. */
+   if (cond_batch > 0) {
+      lua_rawgeti(cond_L, LUA_REGISTRYINDEX, cond_batchRef);
+      lua_getfield(cond_L, -1, cond);
+      if (lua_isboolean(cond_L, -1)) {
+         ret = lua_toboolean(cond_L, -1);
+         lua_settop(cond_L, 0);
+         return ret;
+      }
+      lua_settop(cond_L, 0);
+   }
+
+   /* Get the function. */
+   ret = cond_compile( cond );
    switch (ret) {
       case  LUA_ERRSYNTAX:
          WARN("Lua conditional syntax error: %s", lua_tostring(cond_L, -1));
@@ -105,6 +206,13 @@ int cond_check( const char* cond )
       else
          ret = 0;
 
+      /* Remember for the rest of the batch. */
+      if (cond_batch > 0) {
+         lua_rawgeti(cond_L, LUA_REGISTRYINDEX, cond_batchRef);
+         lua_pushboolean(cond_L, b);
+         lua_setfield(cond_L, -2, cond);
+      }
+
       /* Clear the stack. */
       lua_settop(cond_L, 0);
 
@@ -10,6 +10,8 @@
 int cond_init (void);
 void cond_exit (void);
 int cond_check( const char *cond );
+void cond_batchStart (void);
+void cond_batchEnd (void);
 
 
 #endif /* COND_H */
@@ -138,6 +138,13 @@ void conf_setDefaults (void)
 
    /* Misc. */
    conf.nosave       = 0;
+   conf.threads      = 0;
+   conf.ai_budget    = 0.;
+   conf.ai_parallel  = 0;
+   conf.lua_cache    = 1;
+   conf.data_cache   = 1;
+   conf.lua_memlimit = 0;
+   conf.lua_gc_budget = 1.;
 
    /* Gameplay. */
    conf_setGameplayDefaults();
@@ -280,6 +287,7 @@ int conf_loadConfig ( const char* file )
 
    /* Load the configuration. */
    lua_State *L = nlua_newState();
+   nlua_setOwner( L, "conf", NULL );
    if (luaL_dofile(L, file) == 0) {
 
       /* ndata. */
@@ -354,6 +362,13 @@ int conf_loadConfig ( const char* file )
       conf_loadBool("save_compress",conf.save_compress);
       conf_loadInt("afterburn_sensitivity",conf.afterburn_sens);
       conf_loadBool("conf_nosave",conf.nosave);
+      conf_loadInt("threads",conf.threads);
+      conf_loadFloat("ai_budget",conf.ai_budget);
+      conf_loadBool("ai_parallel",conf.ai_parallel);
+      conf_loadBool("lua_cache",conf.lua_cache);
+      conf_loadBool("data_cache",conf.data_cache);
+      conf_loadInt("lua_memlimit",conf.lua_memlimit);
+      conf_loadFloat("lua_gc_budget",conf.lua_gc_budget);
 
       /* Debugging. */
       conf_loadBool("fpu_except",conf.fpu_except);
@@ -466,11 +481,11 @@ int conf_loadConfig ( const char* file )
    else { /* failed to load the config file */
       WARN("Config file '%s' has invalid syntax:", file );
       WARN("   %s", lua_tostring(L,-1));
-      lua_close(L);
+      nlua_close(L);
       return 1;
    }
 
-   lua_close(L);
+   nlua_close(L);
    return 0;
 }
 
@@ -944,6 +959,34 @@ int conf_saveConfig ( const char* file )
    conf_saveInt("conf_nosave",conf.nosave);
    conf_saveEmptyLine();
 
+   conf_saveComment("Number of threads to use for the simulation (0 uses one per processor)");
+   conf_saveInt("threads",conf.threads);
+   conf_saveEmptyLine();
+
+   conf_saveComment("Milliseconds the AI may spend thinking each frame (0 is unlimited)");
+   conf_saveFloat("ai_budget",conf.ai_budget);
+   conf_saveEmptyLine();
+
+   conf_saveComment("Run the AI of different pilots in parallel, one Lua state per thread");
+   conf_saveBool("ai_parallel",conf.ai_parallel);
+   conf_saveEmptyLine();
+
+   conf_saveComment("Save compiled mission and event scripts so they don't have to be parsed again");
+   conf_saveBool("lua_cache",conf.lua_cache);
+   conf_saveEmptyLine();
+
+   conf_saveComment("Save the parsed data files so they don't have to be parsed again");
+   conf_saveBool("data_cache",conf.data_cache);
+   conf_saveEmptyLine();
+
+   conf_saveComment("KiB of memory each Lua state may use, 0 is unlimited");
+   conf_saveInt("lua_memlimit",conf.lua_memlimit);
+   conf_saveEmptyLine();
+
+   conf_saveComment("Milliseconds of Lua garbage collection per frame, 0 lets Lua collect whenever it wants");
+   conf_saveFloat("lua_gc_budget",conf.lua_gc_budget);
+   conf_saveEmptyLine();
+
    /* Debugging. */
    conf_saveComment("Enables FPU exceptions - only works on DEBUG builds");
    conf_saveBool("fpu_except",conf.fpu_except);
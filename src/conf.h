@@ -73,6 +73,13 @@ typedef struct PlayerConf_s {
    int save_compress; /**< Compress savegame. */
    unsigned int afterburn_sens; /**< Afterburn sensibility. */
    int nosave; /**< Disables conf saving. */
+   int threads; /**< Number of threads to use, 0 uses one per processor. */
+   double ai_budget; /**< Milliseconds of AI thinking per frame, 0 is unlimited. */
+   int ai_parallel; /**< Run the AI of different pilots in parallel. */
+   int lua_cache; /**< Save compiled Lua scripts to disk. */
+   int data_cache; /**< Save the parsed data files to disk. */
+   int lua_memlimit; /**< KiB of memory each Lua state may use, 0 is unlimited. */
+   double lua_gc_budget; /**< Milliseconds of Lua garbage collection per frame, 0 lets Lua decide. */
 
    /* Debugging. */
    int fpu_except; /**< Enable FPU exceptions? */
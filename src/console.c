@@ -268,6 +268,7 @@ int cli_init (void)
 
    /* Create the state. */
    cli_state   = nlua_newState();
+   nlua_setOwner( cli_state, "console", NULL );
    nlua_loadStandard( cli_state, 0 );
    nlua_loadTk( cli_state );
    nlua_loadCLI( cli_state );
@@ -296,7 +297,7 @@ void cli_exit (void)
 {
    /* Destroy the state. */
    if (cli_state != NULL) {
-      lua_close( cli_state );
+      nlua_close( cli_state );
       cli_state = NULL;
    }
 
@@ -0,0 +1,761 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+/**
+ * @file dcache.c
+ *
+ * @brief Cache of the parsed data files.
+ *
+ * Parsing the XML of the outfits, ships, fleets, factions, commodities,
+ *  planets and systems is most of what load_all does.  After they've been
+ *  parsed once the modules write what they parsed to the cache, and on the
+ *  next run they read it back instead of touching the XML.
+ *
+ * Structures are mostly written as they are in memory, so reading them is
+ *  little more than a copy.  Pointers get fixed up afterwards: strings are
+ *  stored in a string table of each section and referred to by their index,
+ *  references within a module by index in its stack and references to other
+ *  modules by the name of what they refer to.  Textures are stored by path
+ *  and loaded again.
+ *
+ * The cache is identified by a hash of the data files and the sounds, if any
+ *  of them change the data gets parsed again and the cache is rewritten.
+ *  load_all runs before any save is loaded, so unidiffs are never applied to
+ *  what gets cached, they're applied on top of it afterwards.  The cache is
+ *  only meant to be read by the same build that wrote it, DCACHE_VERSION must
+ *  be bumped when the layout of a cached structure changes without changing
+ *  its size.
+ */
+
+
+#include "dcache.h"
+
+#include "naev.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include "log.h"
+#include "conf.h"
+#include "md5.h"
+#include "ndata.h"
+#include "nfile.h"
+#include "sound.h"
+#include "economy.h"
+#include "faction.h"
+#include "outfit.h"
+#include "ship.h"
+#include "fleet.h"
+#include "space.h"
+
+
+#define DCACHE_FILE     "datacache" /**< File in the user's directory the cache is saved in. */
+#define DCACHE_MAGIC    "NAEVDCCH" /**< Identifies the cache file, unlike a packfile. */
+#define DCACHE_VERSION  2 /**< Version of the cache layout. */
+#define DCACHE_CHUNK    4096 /**< Size to grow the buffers by. */
+
+
+/**
+ * @brief A section of the data cache.
+ *
+ * When reading the data and strings point into the cache file.
+ */
+struct DCache_ {
+   char *data; /**< Data of the section. */
+   size_t len; /**< Length of the data. */
+   size_t size; /**< Allocated size of the data when writing. */
+   size_t pos; /**< Position when reading. */
+   char *str; /**< Strings of the section, one after the other. */
+   size_t strlen; /**< Length of the strings. */
+   size_t strsize; /**< Allocated size of the strings when writing. */
+   uint32_t *stroff; /**< Offset of each string when reading. */
+   uint32_t nstr; /**< Number of strings. */
+   int error; /**< Ran out of data or found a bad reference. */
+};
+
+
+/**
+ * @brief Header of the cache file.
+ *
+ * Each section is made of the number of strings and their length followed
+ *  by the strings and the data.  The CRC32 of each section catches a file
+ *  that was truncated or damaged since it was written.
+ */
+typedef struct DCacheHeader_ {
+   char magic[8]; /**< DCACHE_MAGIC. */
+   uint32_t version; /**< DCACHE_VERSION. */
+   md5_byte_t key[16]; /**< Hash of what the data depends on. */
+   uint32_t offset[DCACHE_SECTIONS]; /**< Offset of each section. */
+   uint32_t len[DCACHE_SECTIONS]; /**< Length of each section. */
+   uint32_t crc[DCACHE_SECTIONS]; /**< CRC32 of each section. */
+} DCacheHeader;
+
+
+/**
+ * @brief Data files the cached data is parsed from, or that it depends on.
+ */
+static const char *dcache_files[] = {
+   "dat/commodity.xml",
+   "dat/faction.xml",
+   "dat/spfx.xml",
+   "dat/outfit.xml",
+   "dat/ship.xml",
+   "dat/fleet.xml",
+   "dat/fleetgroup.xml",
+   "dat/planet.xml",
+   "dat/ssys.xml",
+   NULL
+};
+
+
+/**
+ * @brief Name of each section for the log.
+ */
+static const char *dcache_names[DCACHE_SECTIONS] = {
+   "commodities", "factions", "outfits", "ships", "fleets", "star systems"
+};
+
+
+/**
+ * @brief Writes each section of the cache.
+ */
+static int (*dcache_writers[DCACHE_SECTIONS])( DCache *dc ) = {
+   commodity_saveCache,
+   factions_saveCache,
+   outfit_saveCache,
+   ships_saveCache,
+   fleet_saveCache,
+   space_saveCache
+};
+
+
+static DCacheState dcache_cur = DCACHE_OFF; /**< State of the cache. */
+static md5_byte_t dcache_key[16]; /**< Key of the current data. */
+static char *dcache_file      = NULL; /**< Cache file being read. */
+static char *dcache_path      = NULL; /**< Where to keep the cache, NULL for the default. */
+static DCache dcache_sections[DCACHE_SECTIONS]; /**< Sections being read. */
+static int dcache_failed[DCACHE_SECTIONS]; /**< Sections that couldn't be read. */
+
+
+/*
+ * Prototypes.
+ */
+static void dcache_hash( md5_byte_t key[16] );
+static void dcache_filename( char *path );
+static int dcache_parse( char *file, int len );
+static int dcache_parseSection( DCache *dc, char *data, size_t len );
+static int dcache_save (void);
+static void dcache_free( DCache *dc );
+static const void* dcache_read( DCache *dc, size_t len );
+static void dcache_write( DCache *dc, const void *data, size_t len );
+
+
+/**
+ * @brief Hashes everything the parsed data depends on.
+ *
+ *    @param[out] key Hash of the data.
+ */
+static void dcache_hash( md5_byte_t key[16] )
+{
+   md5_state_t md5;
+   const char *buf, *name;
+   uint32_t bufsize;
+   int i;
+   int layout[] = {
+      DCACHE_VERSION, (int)sizeof(void*), (int)sizeof(Outfit),
+      (int)sizeof(Ship), (int)sizeof(ShipOutfitSlot), (int)sizeof(Planet),
+      (int)sizeof(StarSystem)
+   };
+   int opts[2];
+
+   md5_init( &md5 );
+
+   /* Build. */
+   name = naev_version(0);
+   md5_append( &md5, (const md5_byte_t*)name, strlen(name)+1 );
+   md5_append( &md5, (const md5_byte_t*)layout, sizeof(layout) );
+
+   /* Data files. */
+   for (i=0; dcache_files[i] != NULL; i++) {
+      md5_append( &md5, (const md5_byte_t*)dcache_files[i],
+            strlen(dcache_files[i])+1 );
+      buf = ndata_borrow( dcache_files[i], &bufsize );
+      if (buf == NULL)
+         continue;
+      md5_append( &md5, (const md5_byte_t*)&bufsize, sizeof(bufsize) );
+      md5_append( &md5, (const md5_byte_t*)buf, bufsize );
+      ndata_release( buf );
+   }
+
+   /* Sounds are stored by their ID. */
+   opts[0] = sound_disabled;
+   opts[1] = conf.engineglow;
+   md5_append( &md5, (const md5_byte_t*)opts, sizeof(opts) );
+   for (i=0; (name = sound_name(i)) != NULL; i++)
+      md5_append( &md5, (const md5_byte_t*)name, strlen(name)+1 );
+
+   md5_finish( &md5, key );
+}
+
+
+/**
+ * @brief Sets where the data cache is kept.
+ *
+ *    @param path File to keep the cache in, NULL for the user's directory.
+ */
+void dcache_setPath( const char *path )
+{
+   free( dcache_path );
+   dcache_path = (path != NULL) ? strdup( path ) : NULL;
+}
+
+
+/**
+ * @brief Gets the name of the cache file.
+ *
+ *    @param[out] path Name of the file, must be PATH_MAX long.
+ */
+static void dcache_filename( char *path )
+{
+   if (dcache_path != NULL)
+      snprintf( path, PATH_MAX, "%s", dcache_path );
+   else
+      snprintf( path, PATH_MAX, "%s"DCACHE_FILE, nfile_basePath() );
+}
+
+
+/**
+ * @brief Opens the data cache, must be called before loading the data.
+ *
+ * If the cache matches the data the modules will read from it, otherwise
+ *  they'll parse the data and it'll be written by dcache_close.
+ */
+void dcache_open (void)
+{
+   int i, len;
+   char path[PATH_MAX];
+
+   memset( dcache_sections, 0, sizeof(dcache_sections) );
+   memset( dcache_failed, 0, sizeof(dcache_failed) );
+
+   if (!conf.data_cache) {
+      dcache_cur = DCACHE_OFF;
+      return;
+   }
+
+   dcache_hash( dcache_key );
+   dcache_cur = DCACHE_MISS;
+
+   dcache_filename( path );
+   if (!nfile_fileExists( "%s", path ))
+      return;
+   dcache_file = nfile_readFile( &len, "%s", path );
+   if (dcache_file == NULL)
+      return;
+
+   if (dcache_parse( dcache_file, len )) {
+      DEBUG("Data cache is out of date, parsing the data.");
+      for (i=0; i<DCACHE_SECTIONS; i++)
+         free( dcache_sections[i].stroff );
+      memset( dcache_sections, 0, sizeof(dcache_sections) );
+      free( dcache_file );
+      dcache_file = NULL;
+      return;
+   }
+   dcache_cur = DCACHE_HIT;
+}
+
+
+/**
+ * @brief Checks the cache file and sets up the sections.
+ *
+ *    @param file Cache file.
+ *    @param len Length of the file.
+ *    @return 0 if the file can be used.
+ */
+static int dcache_parse( char *file, int len )
+{
+   DCacheHeader hdr;
+   int i;
+
+   if (len < (int)sizeof(DCacheHeader))
+      return -1;
+   memcpy( &hdr, file, sizeof(DCacheHeader) );
+   if ((memcmp( hdr.magic, DCACHE_MAGIC, sizeof(hdr.magic) ) != 0) ||
+         (hdr.version != DCACHE_VERSION) ||
+         (memcmp( hdr.key, dcache_key, sizeof(dcache_key) ) != 0))
+      return -1;
+
+   for (i=0; i<DCACHE_SECTIONS; i++) {
+      if ((hdr.offset[i] < sizeof(DCacheHeader)) ||
+            (hdr.offset[i] > (uint32_t)len) ||
+            (hdr.len[i] > (uint32_t)len - hdr.offset[i]))
+         return -1;
+      if (crc32( crc32(0L, Z_NULL, 0), (const Bytef*)&file[ hdr.offset[i] ],
+               hdr.len[i] ) != hdr.crc[i]) {
+         WARN("Data cache of the %s is damaged.", dcache_names[i]);
+         return -1;
+      }
+      if (dcache_parseSection( &dcache_sections[i],
+               &file[ hdr.offset[i] ], hdr.len[i] ))
+         return -1;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Sets up a section for reading.
+ *
+ *    @param dc Section to set up.
+ *    @param data Data of the section.
+ *    @param len Length of the section.
+ *    @return 0 on success.
+ */
+static int dcache_parseSection( DCache *dc, char *data, size_t len )
+{
+   uint32_t i, n[2];
+   size_t off;
+   char *end;
+
+   memset( dc, 0, sizeof(DCache) );
+   if (len < sizeof(n))
+      return -1;
+   memcpy( n, data, sizeof(n) );
+   if (n[1] > len - sizeof(n))
+      return -1;
+   dc->nstr    = n[0];
+   dc->str     = &data[ sizeof(n) ];
+   dc->strlen  = n[1];
+   dc->data    = &dc->str[ dc->strlen ];
+   dc->len     = len - sizeof(n) - dc->strlen;
+
+   /* Find the strings. */
+   if (dc->nstr > dc->strlen)
+      return -1;
+   dc->stroff = malloc( sizeof(uint32_t) * (dc->nstr+1) );
+   off = 0;
+   for (i=0; i<dc->nstr; i++) {
+      end = memchr( &dc->str[off], '\0', dc->strlen - off );
+      if (end == NULL) {
+         free( dc->stroff );
+         dc->stroff = NULL;
+         return -1;
+      }
+      dc->stroff[i] = off;
+      off = end - dc->str + 1;
+   }
+   return 0;
+}
+
+
+/**
+ * @brief Closes the data cache, must be called once the data is loaded.
+ *
+ *    @param save Whether the data loaded fine and can be cached.
+ */
+void dcache_close( int save )
+{
+   int i, stale;
+
+   stale = (dcache_cur == DCACHE_MISS);
+   for (i=0; i<DCACHE_SECTIONS; i++) {
+      if (dcache_failed[i])
+         stale = 1;
+      free( dcache_sections[i].stroff );
+   }
+   memset( dcache_sections, 0, sizeof(dcache_sections) );
+   free( dcache_file );
+   dcache_file = NULL;
+
+   if ((dcache_cur != DCACHE_OFF) && stale && save)
+      dcache_save();
+}
+
+
+/**
+ * @brief Writes the data cache.
+ *
+ *    @return 0 on success.
+ */
+static int dcache_save (void)
+{
+   DCache w[DCACHE_SECTIONS];
+   DCacheHeader hdr;
+   uint32_t n[2];
+   size_t len;
+   char *buf, path[PATH_MAX];
+   int i, ret;
+
+   /* Have the modules write their data. */
+   memset( w, 0, sizeof(w) );
+   ret = 0;
+   for (i=0; i<DCACHE_SECTIONS; i++) {
+      if (dcache_writers[i]( &w[i] ) || w[i].error) {
+         WARN("Unable to cache the %s.", dcache_names[i]);
+         ret = -1;
+         break;
+      }
+   }
+
+   /* Put it together. */
+   if (ret == 0) {
+      memset( &hdr, 0, sizeof(hdr) );
+      memcpy( hdr.magic, DCACHE_MAGIC, sizeof(hdr.magic) );
+      hdr.version = DCACHE_VERSION;
+      memcpy( hdr.key, dcache_key, sizeof(hdr.key) );
+      len = sizeof(hdr);
+      for (i=0; i<DCACHE_SECTIONS; i++) {
+         hdr.offset[i] = len;
+         hdr.len[i]    = sizeof(n) + w[i].strlen + w[i].len;
+         len          += hdr.len[i];
+      }
+
+      buf = malloc( len );
+      for (i=0; i<DCACHE_SECTIONS; i++) {
+         n[0] = w[i].nstr;
+         n[1] = w[i].strlen;
+         memcpy( &buf[ hdr.offset[i] ], n, sizeof(n) );
+         memcpy( &buf[ hdr.offset[i] + sizeof(n) ], w[i].str, w[i].strlen );
+         memcpy( &buf[ hdr.offset[i] + sizeof(n) + w[i].strlen ],
+               w[i].data, w[i].len );
+         hdr.crc[i] = crc32( crc32(0L, Z_NULL, 0),
+               (const Bytef*)&buf[ hdr.offset[i] ], hdr.len[i] );
+      }
+      memcpy( buf, &hdr, sizeof(hdr) );
+
+      if (dcache_path == NULL)
+         nfile_dirMakeExist( "%s", nfile_basePath() );
+      dcache_filename( path );
+      ret = nfile_writeFile( buf, len, "%s", path );
+      if (ret == 0)
+         DEBUG("Saved the data cache (%lu KiB)", (unsigned long)len/1024);
+      free( buf );
+   }
+
+   for (i=0; i<DCACHE_SECTIONS; i++)
+      dcache_free( &w[i] );
+   return ret;
+}
+
+
+/**
+ * @brief Frees a section that was written.
+ */
+static void dcache_free( DCache *dc )
+{
+   free( dc->data );
+   free( dc->str );
+   memset( dc, 0, sizeof(DCache) );
+}
+
+
+/**
+ * @brief Gets the state of the data cache.
+ *
+ *    @return The state of the cache since it was last opened.
+ */
+DCacheState dcache_state (void)
+{
+   return dcache_cur;
+}
+
+
+/**
+ * @brief Loads a section of the data from the cache.
+ *
+ * If the section can't be read what was loaded is freed so the data can be
+ *  parsed instead, the cache is then written again once everything is
+ *  loaded.  The loader must leave what it loaded safe to free even if it
+ *  fails halfway.
+ *
+ *    @param s Section to load.
+ *    @param load Reads the section.
+ *    @param unload Frees what the loader loaded.
+ *    @return 0 if the data was loaded from the cache.
+ */
+int dcache_load( DCacheSection s, int (*load)( DCache *dc ), void (*unload)( void ) )
+{
+   DCache *dc;
+
+   if (dcache_cur != DCACHE_HIT)
+      return -1;
+
+   dc = &dcache_sections[s];
+   if ((load( dc ) != 0) || dc->error || (dc->pos != dc->len)) {
+      WARN("Data cache of the %s is corrupt, parsing them instead.",
+            dcache_names[s]);
+      unload();
+      dcache_failed[s] = 1;
+      return -1;
+   }
+   return 0;
+}
+
+
+/**
+ * @brief Checks whether reading a section failed.
+ *
+ * Once an error is found all reads return zeroes so the structures being
+ *  read stay safe to free.
+ *
+ *    @param dc Section being read.
+ *    @return Nonzero if something went wrong.
+ */
+int dcache_error( DCache *dc )
+{
+   return dc->error;
+}
+
+
+/**
+ * @brief Gets the next bytes of a section.
+ *
+ *    @param dc Section to read from.
+ *    @param len Bytes to read.
+ *    @return The bytes or NULL if there aren't that many left.
+ */
+static const void* dcache_read( DCache *dc, size_t len )
+{
+   const void *p;
+
+   if (dc->error || (len > dc->len - dc->pos)) {
+      dc->error = 1;
+      return NULL;
+   }
+   p = &dc->data[ dc->pos ];
+   dc->pos += len;
+   return p;
+}
+
+
+/**
+ * @brief Reads an integer.
+ */
+int dcache_readInt( DCache *dc )
+{
+   int32_t i;
+   dcache_readData( dc, &i, sizeof(i) );
+   return i;
+}
+
+
+/**
+ * @brief Reads the number of elements of something.
+ *
+ * Makes sure there's enough data left for them so a bad count can't make the
+ *  reader allocate huge amounts of memory.
+ *
+ *    @param dc Section to read from.
+ *    @param size Fewest bytes each element takes up.
+ *    @return The number of elements, 0 on error.
+ */
+int dcache_readCount( DCache *dc, size_t size )
+{
+   int n;
+
+   n = dcache_readInt( dc );
+   if ((n < 0) || ((size_t)n > (dc->len - dc->pos) / MAX(size,1))) {
+      dc->error = 1;
+      return 0;
+   }
+   return n;
+}
+
+
+/**
+ * @brief Reads a double.
+ */
+double dcache_readDouble( DCache *dc )
+{
+   double d;
+   dcache_readData( dc, &d, sizeof(d) );
+   return d;
+}
+
+
+/**
+ * @brief Reads raw data.
+ *
+ *    @param dc Section to read from.
+ *    @param[out] data Where to read to, cleared on error.
+ *    @param len Bytes to read.
+ */
+void dcache_readData( DCache *dc, void *data, size_t len )
+{
+   const void *p;
+
+   p = dcache_read( dc, len );
+   if (p == NULL)
+      memset( data, 0, len );
+   else
+      memcpy( data, p, len );
+}
+
+
+/**
+ * @brief Reads a string without copying it.
+ *
+ *    @param dc Section to read from.
+ *    @return The string, valid until the cache is closed, or NULL.
+ */
+const char* dcache_readName( DCache *dc )
+{
+   uint32_t i;
+   const void *p;
+
+   p = dcache_read( dc, sizeof(i) );
+   if (p == NULL)
+      return NULL;
+   memcpy( &i, p, sizeof(i) );
+   if (i == 0)
+      return NULL;
+   if (i > dc->nstr) {
+      dc->error = 1;
+      return NULL;
+   }
+   return &dc->str[ dc->stroff[i-1] ];
+}
+
+
+/**
+ * @brief Reads a string.
+ *
+ *    @param dc Section to read from.
+ *    @return A newly allocated copy of the string or NULL.
+ */
+char* dcache_readString( DCache *dc )
+{
+   const char *str;
+
+   str = dcache_readName( dc );
+   if (str == NULL)
+      return NULL;
+   return strdup( str );
+}
+
+
+/**
+ * @brief Reads a texture, loading it again.
+ *
+ *    @param dc Section to read from.
+ *    @param flags Flags to load the texture with.
+ *    @return The texture or NULL.
+ */
+glTexture* dcache_readTexture( DCache *dc, unsigned int flags )
+{
+   const char *name;
+   int sx, sy;
+
+   name = dcache_readName( dc );
+   sx   = dcache_readInt( dc );
+   sy   = dcache_readInt( dc );
+   if ((name == NULL) || dc->error)
+      return NULL;
+
+   if ((sx == 1) && (sy == 1))
+      return gl_newImage( name, flags );
+   return gl_newSprite( name, sx, sy, flags );
+}
+
+
+/**
+ * @brief Appends bytes to a section.
+ */
+static void dcache_write( DCache *dc, const void *data, size_t len )
+{
+   if (len == 0)
+      return;
+   if (dc->len + len > dc->size) {
+      dc->size = MAX( dc->size + DCACHE_CHUNK, dc->len + len );
+      dc->data = realloc( dc->data, dc->size );
+   }
+   memcpy( &dc->data[ dc->len ], data, len );
+   dc->len += len;
+}
+
+
+/**
+ * @brief Writes an integer.
+ */
+void dcache_writeInt( DCache *dc, int i )
+{
+   int32_t v;
+   v = i;
+   dcache_write( dc, &v, sizeof(v) );
+}
+
+
+/**
+ * @brief Writes a double.
+ */
+void dcache_writeDouble( DCache *dc, double d )
+{
+   dcache_write( dc, &d, sizeof(d) );
+}
+
+
+/**
+ * @brief Writes raw data.
+ *
+ * Pointers in the data are meaningless once read, they must be written
+ *  separately.
+ */
+void dcache_writeData( DCache *dc, const void *data, size_t len )
+{
+   dcache_write( dc, data, len );
+}
+
+
+/**
+ * @brief Writes a string, it's stored in the string table.
+ *
+ *    @param dc Section to write to.
+ *    @param str String to write, may be NULL.
+ */
+void dcache_writeString( DCache *dc, const char *str )
+{
+   uint32_t i;
+   size_t len;
+
+   if (str == NULL) {
+      i = 0;
+      dcache_write( dc, &i, sizeof(i) );
+      return;
+   }
+
+   len = strlen(str) + 1;
+   if (dc->strlen + len > dc->strsize) {
+      dc->strsize = MAX( dc->strsize + DCACHE_CHUNK, dc->strlen + len );
+      dc->str     = realloc( dc->str, dc->strsize );
+   }
+   memcpy( &dc->str[ dc->strlen ], str, len );
+   dc->strlen += len;
+
+   i = ++dc->nstr;
+   dcache_write( dc, &i, sizeof(i) );
+}
+
+
+/**
+ * @brief Writes a texture, only the path and sprites are stored.
+ *
+ *    @param dc Section to write to.
+ *    @param tex Texture to write, may be NULL.
+ */
+void dcache_writeTexture( DCache *dc, const glTexture *tex )
+{
+   if ((tex != NULL) && (tex->name == NULL)) {
+      /* Generated textures can't be loaded again. */
+      dc->error = 1;
+      tex = NULL;
+   }
+   dcache_writeString( dc, (tex != NULL) ? tex->name : NULL );
+   dcache_writeInt( dc, (tex != NULL) ? (int)tex->sx : 1 );
+   dcache_writeInt( dc, (tex != NULL) ? (int)tex->sy : 1 );
+}
@@ -0,0 +1,79 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+
+
+#ifndef DCACHE_H
+#  define DCACHE_H
+
+
+#include <stddef.h>
+
+#include "opengl.h"
+
+
+/**
+ * @brief Sections of the data cache, one for each module that caches its data.
+ */
+typedef enum DCacheSection_ {
+   DCACHE_COMMODITY, /**< Commodities. */
+   DCACHE_FACTION, /**< Factions. */
+   DCACHE_OUTFIT, /**< Outfits. */
+   DCACHE_SHIP, /**< Ships. */
+   DCACHE_FLEET, /**< Fleets and fleetgroups. */
+   DCACHE_SPACE, /**< Planets and systems. */
+   DCACHE_SECTIONS /**< Number of sections. */
+} DCacheSection;
+
+
+/**
+ * @brief State of the data cache.
+ */
+typedef enum DCacheState_ {
+   DCACHE_OFF, /**< Cache is disabled. */
+   DCACHE_MISS, /**< Data was parsed, the cache is written after loading. */
+   DCACHE_HIT /**< Data was loaded from the cache. */
+} DCacheState;
+
+
+/**
+ * @brief A section of the data cache being read or written.
+ */
+typedef struct DCache_ DCache;
+
+
+/*
+ * Cache file.
+ */
+void dcache_setPath( const char *path );
+void dcache_open (void);
+void dcache_close( int save );
+DCacheState dcache_state (void);
+int dcache_load( DCacheSection s, int (*load)( DCache *dc ), void (*unload)( void ) );
+
+
+/*
+ * Reading.
+ */
+int dcache_error( DCache *dc );
+int dcache_readInt( DCache *dc );
+int dcache_readCount( DCache *dc, size_t size );
+double dcache_readDouble( DCache *dc );
+void dcache_readData( DCache *dc, void *data, size_t len );
+char* dcache_readString( DCache *dc );
+const char* dcache_readName( DCache *dc );
+glTexture* dcache_readTexture( DCache *dc, unsigned int flags );
+
+
+/*
+ * Writing.
+ */
+void dcache_writeInt( DCache *dc, int i );
+void dcache_writeDouble( DCache *dc, double d );
+void dcache_writeData( DCache *dc, const void *data, size_t len );
+void dcache_writeString( DCache *dc, const char *str );
+void dcache_writeTexture( DCache *dc, const glTexture *tex );
+
+
+#endif /* DCACHE_H */
@@ -73,6 +73,7 @@ static cs *econ_G             = NULL; /**< Admittance matrix. */
 /* Commodity. */
 static void commodity_freeOne( Commodity* com );
 static int commodity_parse( Commodity *temp, xmlNodePtr parent );
+static int commodity_loadCache( DCache *dc );
 /* Economy. */
 static double econ_calcJumpR( StarSystem *A, StarSystem *B );
 static int econ_createGMatrix (void);
@@ -223,13 +224,27 @@ void commodity_Jettison( int pilot, Commodity* com, int quantity )
  */
 int commodity_load (void)
 {
+   int i;
    uint32_t bufsize;
-   char *buf;
+   const char *buf;
    xmlNodePtr node;
    xmlDocPtr doc;
 
+   /* Try the cache first. */
+   if (dcache_load( DCACHE_COMMODITY, commodity_loadCache, commodity_free ) == 0) {
+      for (i=0; i<commodity_nstack; i++) {
+         if (commodity_stack[i].price > 0.) {
+            econ_nprices++;
+            econ_comm = realloc(econ_comm, econ_nprices * sizeof(int));
+            econ_comm[econ_nprices-1] = i;
+         }
+      }
+      DEBUG("Loaded %d Commodit%s", commodity_nstack, (commodity_nstack==1) ? "y" : "ies" );
+      return 0;
+   }
+
    /* Load the file. */
-   buf = ndata_read( COMMODITY_DATA, &bufsize);
+   buf = ndata_borrow( COMMODITY_DATA, &bufsize);
    if (buf == NULL)
       return -1;
 
@@ -272,7 +287,7 @@ int commodity_load (void)
    } while (xml_nextNode(node));
 
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    DEBUG("Loaded %d Commodit%s", commodity_nstack, (commodity_nstack==1) ? "y" : "ies" );
 
@@ -282,6 +297,61 @@ int commodity_load (void)
 }
 
 
+/**
+ * @brief Loads the commodities from the data cache.
+ *
+ * Commodities are still added to the economy by commodity_load.
+ *
+ *    @param dc Section of the cache to load from.
+ *    @return 0 on success.
+ */
+static int commodity_loadCache( DCache *dc )
+{
+   int i, n;
+   Commodity *com;
+
+   n = dcache_readCount( dc, sizeof(int) );
+   if (dcache_error(dc))
+      return -1;
+
+   commodity_stack = calloc( n, sizeof(Commodity) );
+   for (i=0; i<n; i++) {
+      com = &commodity_stack[i];
+      com->name         = dcache_readString( dc );
+      com->description  = dcache_readString( dc );
+      com->price        = dcache_readDouble( dc );
+      commodity_nstack++;
+      if (dcache_error(dc))
+         return -1;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Writes the commodities to the data cache.
+ *
+ *    @param dc Section of the cache to write to.
+ *    @return 0 on success.
+ */
+int commodity_saveCache( DCache *dc )
+{
+   int i;
+   Commodity *com;
+
+   dcache_writeInt( dc, commodity_nstack );
+   for (i=0; i<commodity_nstack; i++) {
+      com = &commodity_stack[i];
+      dcache_writeString( dc, com->name );
+      dcache_writeString( dc, com->description );
+      dcache_writeDouble( dc, com->price );
+   }
+
+   return 0;
+}
+
+
 /**
  * @brief Frees all the loaded commodities.
  */
@@ -10,6 +10,8 @@
 
 #include <stdint.h>
 
+#include "dcache.h"
+
 
 /**
  * @struct Commodity
@@ -32,6 +34,7 @@ typedef struct Commodity_ {
 Commodity* commodity_get( const char* name );
 int commodity_load (void);
 void commodity_free (void);
+int commodity_saveCache( DCache *dc );
 
 
 /*
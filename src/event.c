@@ -34,6 +34,7 @@
 #include "hook.h"
 #include "player.h"
 #include "npc.h"
+#include "timer.h"
 
 
 #define XML_EVENT_ID          "Events" /**< XML document identifier */
@@ -67,6 +68,9 @@ typedef struct EventData_s {
  */
 static EventData_t *event_data   = NULL; /**< Allocated event data. */
 static int event_ndata           = 0; /**< Number of actual event data. */
+#define EVENT_NTRIGGERS    (EVENT_TRIGGER_LAND+1) /**< Number of triggers. */
+static int *event_trigger[EVENT_NTRIGGERS]; /**< Events of each trigger. */
+static int event_ntrigger[EVENT_NTRIGGERS]; /**< Number of events of each trigger. */
 
 
 /*
@@ -86,6 +90,7 @@ static int event_alreadyRunning( int data );
 static int event_parse( EventData_t *temp, const xmlNodePtr parent );
 static void event_freeData( EventData_t *event );
 static int event_create( int dataid );
+static int event_timerRun( unsigned int eventid, void *data );
 
 
 /**
@@ -201,8 +206,7 @@ int event_isUnique( unsigned int eventid )
 static int event_create( int dataid )
 {
    lua_State *L;
-   uint32_t bufsize;
-   char *buf;
+   int ret;
    Event_t *ev;
    EventData_t *data;
 
@@ -223,25 +227,26 @@ static int event_create( int dataid )
    /* Open the new state. */
    ev->L = nlua_newState();
    L = ev->L;
+   nlua_setOwner( L, "event", data->name );
+   nlua_gcManage( L );
    nlua_loadStandard(L,0);
    nlua_loadEvt(L);
    nlua_loadHook(L);
    nlua_loadTk(L);
 
    /* Load file. */
-   buf = ndata_read( data->lua, &bufsize );
-   if (buf == NULL) {
+   ret = nlua_doChunk( L, data->lua );
+   if (ret == LUA_ERRFILE) {
       WARN("Event '%s' Lua script not found.", data->lua );
       return -1;
    }
-   if (luaL_dobuffer(L, buf, bufsize, data->lua) != 0) {
+   else if (ret != 0) {
       WARN("Error loading event file: %s\n"
             "%s\n"
             "Most likely Lua file has improper syntax, please check",
             data->lua, lua_tostring(L,-1));
       return -1;
    }
-   free(buf);
 
    /* Run Lua. */
    event_runLua( ev, "create" );
@@ -260,7 +265,7 @@ static void event_cleanup( Event_t *ev )
    int i;
 
    /* Destroy Lua. */
-   lua_close(ev->L);
+   nlua_close(ev->L);
 
    /* Free hooks. */
    hook_rmEventParent(ev->id);
@@ -269,12 +274,12 @@ static void event_cleanup( Event_t *ev )
    npc_rm_parentEvent(ev->id);
 
    /* Free timers. */
-   for (i=0; i<EVENT_TIMER_MAX; i++) {
-      if (ev->tfunc[i] != NULL) {
-         free(ev->tfunc[i]);
-         ev->tfunc[i] = NULL;
-      }
-   }
+   for (i=0; i<ev->ntimers; i++)
+      event_timerStop( ev, i );
+   if (ev->timers != NULL)
+      free(ev->timers);
+   ev->timers  = NULL;
+   ev->ntimers = 0;
 }
 
 
@@ -308,41 +313,76 @@ void event_remove( unsigned int eventid )
 
 
 /**
- * @brief Runs event timer stuff.
+ * @brief Runs an event timer that is up.
+ *
+ *    @param eventid ID of the event that started the timer.
+ *    @param data Slot of the timer in the event.
+ *    @return 0, the timer is always done.
  */
-void events_update( double dt )
+static int event_timerRun( unsigned int eventid, void *data )
 {
-   int i, j;
+   int t;
    Event_t *ev;
-   char *tfunc;
+   char *func;
 
-   for (i=0; i<event_nactive; i++) {
-      ev = &event_active[i];
-     
-      /* Decrement timers see if must run. */
-      for (j=0; j<EVENT_TIMER_MAX; j++) {
+   ev = event_get( eventid );
+   if (ev == NULL)
+      return 0;
+
+   /* Free the slot before running since the event can go away. */
+   t    = (int)(intptr_t)data;
+   func = ev->timers[t].func;
+   ev->timers[t].id   = 0;
+   ev->timers[t].func = NULL;
+
+   event_runLua( ev, func );
+   free(func);
+   return 0;
+}
 
-         if (ev->timer[j] > 0.) {
 
-            ev->timer[j] -= dt;
+/**
+ * @brief Starts an event timer.
+ *
+ *    @param ev Event starting the timer.
+ *    @param func Function to run when the timer is up.
+ *    @param delay Seconds until the timer is up.
+ *    @return The slot of the timer.
+ */
+int event_timerStart( Event_t *ev, const char *func, double delay )
+{
+   int t;
+
+   /* Reuse a free slot if possible. */
+   for (t=0; t<ev->ntimers; t++)
+      if (ev->timers[t].id == 0)
+         break;
+   if (t >= ev->ntimers) {
+      ev->ntimers++;
+      ev->timers = realloc( ev->timers, sizeof(EventTimer) * ev->ntimers );
+   }
 
-            /* Timer is up - trigger function. */
-            if (ev->timer[j] < 0.) {
+   ev->timers[t].id   = timer_add( delay, event_timerRun, ev->id, (void*)(intptr_t)t );
+   ev->timers[t].func = strdup(func);
+   return t;
+}
 
-               /* Destroy timer. */
-               ev->timer[j] = 0.;
-               tfunc = ev->tfunc[j];
-               ev->tfunc[j] = NULL;
 
-               /* Run function. */
-               event_runLua( ev, tfunc );
+/**
+ * @brief Stops an event timer.
+ *
+ *    @param ev Event that started the timer.
+ *    @param t Slot of the timer.
+ */
+void event_timerStop( Event_t *ev, int t )
+{
+   if ((t < 0) || (t >= ev->ntimers) || (ev->timers[t].id == 0))
+      return;
 
-               /* Free remainder stuff. */
-               free(tfunc);
-            }
-         }
-      }
-   }
+   timer_cancel( ev->timers[t].id );
+   ev->timers[t].id = 0;
+   free(ev->timers[t].func);
+   ev->timers[t].func = NULL;
 }
 
 
@@ -375,12 +415,14 @@ static int event_alreadyRunning( int data )
  */
 void events_trigger( EventTrigger_t trigger )
 {
-   int i, c;
+   int i, j, c;
 
-   for (i=0; i<event_ndata; i++) {
-      /* Make sure trigger matches. */
-      if (event_data[i].trigger != trigger)
-         continue;
+   if ((trigger < 0) || (trigger >= EVENT_NTRIGGERS))
+      return;
+
+   /* Only the events of the trigger, in ID order. */
+   for (j=0; j<event_ntrigger[trigger]; j++) {
+      i = event_trigger[trigger][j];
 
       /* Make sure chance is succeeded. */
       if (RNGF() > event_data[i].chance)
@@ -419,7 +461,7 @@ static int event_parse( EventData_t *temp, const xmlNodePtr parent )
 {
    xmlNodePtr node, cur;
    char str[PATH_MAX] = "\0";
-   char *buf;
+   const char *buf;
 
 #ifdef DEBUGGING
    /* To check if mission is valid. */
@@ -450,13 +492,13 @@ static int event_parse( EventData_t *temp, const xmlNodePtr parent )
 #ifdef DEBUGGING
          /* Check to see if syntax is valid. */
          L = luaL_newstate();
-         buf = ndata_read( temp->lua, &len );
+         buf = ndata_borrow( temp->lua, &len );
          ret = luaL_loadbuffer(L, buf, len, temp->name );
          if (ret == LUA_ERRSYNTAX) {
             WARN("Event Lua '%s' of mission '%s' syntax error: %s",
                   temp->name, temp->lua, lua_tostring(L,-1) );
          }
-         free(buf);
+         ndata_release(buf);
          lua_close(L);
 #endif /* DEBUGGING */
 
@@ -518,14 +560,14 @@ static int event_parse( EventData_t *temp, const xmlNodePtr parent )
  */
 int events_load (void)
 {
-   int m;
+   int m, t;
    uint32_t bufsize;
-   char *buf;
+   const char *buf;
    xmlNodePtr node;
    xmlDocPtr doc;
  
    /* Load the data. */
-   buf = ndata_read( EVENT_DATA, &bufsize );
+   buf = ndata_borrow( EVENT_DATA, &bufsize );
    if (buf == NULL) {
       WARN("Unable to read data from '%s'", EVENT_DATA);
       return -1;
@@ -571,9 +613,18 @@ int events_load (void)
    /* Shrink to minimum. */
    event_data = realloc(event_data, sizeof(EventData_t)*event_ndata);
 
+   /* Group by trigger. */
+   for (m=0; m<event_ndata; m++) {
+      t = event_data[m].trigger;
+      if ((t <= EVENT_TRIGGER_NULL) || (t >= EVENT_NTRIGGERS))
+         continue;
+      event_trigger[t] = realloc( event_trigger[t], sizeof(int) * (event_ntrigger[t]+1) );
+      event_trigger[t][ event_ntrigger[t]++ ] = m;
+   }
+
    /* Clean up. */                                                        
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    DEBUG("Loaded %d Event%s", event_ndata, (event_ndata==1) ? "" : "s" );
 
@@ -640,6 +691,11 @@ void events_exit (void)
    }
    event_data  = NULL;
    event_ndata = 0;
+   for (i=0; i<EVENT_NTRIGGERS; i++) {
+      free( event_trigger[i] );
+      event_trigger[i]  = NULL;
+      event_ntrigger[i] = 0;
+   }
 }
 
 
@@ -10,7 +10,13 @@
 #include "nlua.h"
 
 
-#define EVENT_TIMER_MAX       3 /**< Maximum amount of event timers. */
+/**
+ * @brief Timer started by an event.
+ */
+typedef struct EventTimer_ {
+   unsigned int id; /**< ID of the timer, 0 if the slot is free. */
+   char *func; /**< Function to run when the timer is up. */
+} EventTimer;
 
 
 /**
@@ -22,8 +28,8 @@ typedef struct Event_s {
    lua_State *L; /**< Event Lua State. */
 
    /* Timers. */
-   double timer[EVENT_TIMER_MAX]; /**< Event timers. */
-   char *tfunc[EVENT_TIMER_MAX]; /**< Functions assosciated to the timers. */
+   EventTimer *timers; /**< Event timers, the index is the Lua ID. */
+   int ntimers; /**< Number of timer slots. */
 } Event_t;
 
 
@@ -46,9 +52,10 @@ void events_cleanup (void);
 
 
 /*
- * Updating.
+ * Timers.
  */
-void events_update( double dt );
+int event_timerStart( Event_t *ev, const char *func, double delay );
+void event_timerStop( Event_t *ev, int t );
 
 
 /*
@@ -32,10 +32,6 @@
 #define FACTION_LOGO_PATH  "gfx/logo/" /**< Path to logo gfx. */
 
 
-#define PLAYER_ALLY        70. /**< Above this player is considered ally. */
-#define PLAYER_ENEMY       0. /**< Below this the player is considered an enemy. */
-
-
 #define CHUNK_SIZE         32 /**< Size of chunk for allocation. */
 
 
@@ -59,6 +55,7 @@ typedef struct Faction_ {
    glTexture *logo_small; /**< Small logo. */
    glTexture *logo_tiny; /**< Tiny logo. */
    glColour *colour; /**< Faction specific colour. */
+   char *colour_name; /**< Name of the colour. */
 
    /* Enemies */
    int *enemies; /**< Enemies by ID of the faction. */
@@ -78,13 +75,19 @@ typedef struct Faction_ {
 static Faction* faction_stack = NULL; /**< Faction stack. */
 static int faction_nstack = 0; /**< Number of factions in the faction stack. */
 
+unsigned char *faction_grid = NULL; /**< Relations between factions, faction_ngrid x faction_ngrid. */
+int faction_ngrid = 0; /**< Number of factions in the relation grid. */
+
 
 /*
  * Prototypes
  */
 /* static */
 static void faction_sanitizePlayer( Faction* faction );
+static void faction_computeGrid (void);
+static void faction_computePlayer( int f );
 static int faction_parse( Faction* temp, xmlNodePtr parent );
+static int factions_loadCache( DCache *dc );
 static void faction_parseSocial( xmlNodePtr parent );
 /* externed */
 int pfaction_save( xmlTextWriterPtr writer );
@@ -344,6 +347,7 @@ void faction_modPlayerRaw( int f, double mod )
 
    faction->player += mod;
    faction_sanitizePlayer(faction);
+   faction_computePlayer(f);
 }
 
 
@@ -456,136 +460,92 @@ char *faction_getStandingBroad( double mod )
 
 
 /**
- * @brief Checks whether two factions are enemies.
+ * @brief Handles relation checks with invalid factions.
  *
  *    @param a Faction A.
  *    @param b Faction B.
- *    @return 1 if A and B are enemies, 0 otherwise.
+ *    @param rel Relation being checked (FACTION_REL_ENEMY or FACTION_REL_ALLY).
+ *    @return 1 if the relation holds, 0 otherwise.
  */
-int areEnemies( int a, int b)
+int faction_relInvalid( int a, int b, int rel )
 {
-   Faction *fa, *fb;
-   int i;
-
-   if (a==b) return 0; /* luckily our factions aren't masochistic */
+   /* Same faction are always allies and never enemies. */
+   if (a==b)
+      return (rel & FACTION_REL_ALLY) ? 1 : 0;
+
+   if (!faction_isFaction(a))
+      WARN("%s: %d is an invalid faction",
+            (rel & FACTION_REL_ENEMY) ? "areEnemies" : "areAllies", a);
+   else
+      WARN("%s: %d is an invalid faction",
+            (rel & FACTION_REL_ENEMY) ? "areEnemies" : "areAllies", b);
+   return 0;
+}
 
-   /* player handled seperately */
-   if (a==FACTION_PLAYER) {
-      if (faction_isFaction(b)) {
-         if (faction_stack[b].player < PLAYER_ENEMY)
-            return 1;
-         else return 0;
-      }
-      else {
-         WARN("areEnemies: %d is an invalid faction", b);
-         return 0;
-      }
-   }
-   if (b==FACTION_PLAYER) {
-      if (faction_isFaction(a)) {
-         if (faction_stack[a].player < PLAYER_ENEMY)
-            return 1;
-         else return 0;
-      }
-      else {
-         WARN("areEnemies: %d is an invalid faction", a);
-         return 0;
-      }
-   }
 
-   /* handle a */
-   if (faction_isFaction(a)) fa = &faction_stack[a];
-   else { /* a isn't valid */
-      WARN("areEnemies: %d is an invalid faction", a);
-      return 0;
-   }
+/**
+ * @brief Updates the relations between the player and a faction.
+ *
+ *    @param f Faction whose standing with the player changed.
+ */
+static void faction_computePlayer( int f )
+{
+   unsigned char rel;
+   double player;
 
-   /* handle b */
-   if (faction_isFaction(b)) fb = &faction_stack[b];
-   else { /* b is invalid */
-      WARN("areEnemies: %d is an invalid faction", b);
-      return 0;
-   }
+   /* Player is always allied to itself. */
+   if (f == FACTION_PLAYER)
+      return;
 
-   /* both are factions */
-   if (fa && fb) {
-      for (i=0;i<fa->nenemies;i++)
-         if (fa->enemies[i] == b)
-            return 1;
-      for (i=0;i<fb->nenemies;i++)
-         if(fb->enemies[i] == a)
-            return 1;
-   }
+   player = faction_stack[f].player;
+   rel    = 0;
+   if (player < PLAYER_ENEMY)
+      rel |= FACTION_REL_ENEMY;
+   if (player > PLAYER_ALLY)
+      rel |= FACTION_REL_ALLY;
 
-   return 0;
+   faction_grid[ FACTION_PLAYER*faction_ngrid + f ] = rel;
+   faction_grid[ f*faction_ngrid + FACTION_PLAYER ] = rel;
 }
 
 
 /**
- * @brief Checks whether two factions are allies or not.
+ * @brief Rebuilds the relations between all the factions.
  *
- *    @param a Faction A.
- *    @param b Faction B.
- *    @return 1 if A and B are allies, 0 otherwise.
+ * Relations are symmetric so it's enough for either faction to list the
+ *  other as an ally or enemy.
  */
-int areAllies( int a, int b )
+static void faction_computeGrid (void)
 {
-   Faction *fa, *fb;
-   int i;
-
-   /* If they are the same they must be allies. */
-   if (a==b) return 1;
+   int i, j, n;
+   Faction *f;
 
-   /* we assume player becomes allies with high rating */
-   if (a==FACTION_PLAYER) {
-      if (faction_isFaction(b)) {
-         if (faction_stack[b].player > PLAYER_ALLY) return 1;
-         else return 0;
-      }
-      else {
-         WARN("%d is an invalid faction", b);
-         return 0;
-      }
-   }
-   if (b==FACTION_PLAYER) {
-      if (faction_isFaction(a)) {
-         if (faction_stack[a].player > PLAYER_ALLY) return 1;
-         else return 0;
-      }    
-      else {
-         WARN("%d is an invalid faction", a);
-         return 0;
-      }
+   n = faction_nstack;
+   if (n != faction_ngrid) {
+      faction_grid  = realloc( faction_grid, n*n );
+      faction_ngrid = n;
    }
+   memset( faction_grid, 0, n*n );
 
+   for (i=0; i<n; i++) {
+      f = &faction_stack[i];
 
-   if ((a==FACTION_PLAYER) || (b==FACTION_PLAYER)) /* player has no allies */
-      return 0;
+      /* Factions are allies with themselves. */
+      faction_grid[ i*n + i ] = FACTION_REL_ALLY;
 
-   /* handle a */
-   if (faction_isFaction(a)) fa = &faction_stack[a];
-   else { /* a isn't valid */
-      WARN("%d is an invalid faction", a);
-      return 0;
-   }
-
-   /* handle b */
-   if (faction_isFaction(b)) fb = &faction_stack[b];
-   else { /* b is invalid */
-      WARN("%d is an invalid faction", b);
-      return 0;
+      for (j=0; j<f->nallies; j++) {
+         faction_grid[ i*n + f->allies[j] ] |= FACTION_REL_ALLY;
+         faction_grid[ f->allies[j]*n + i ] |= FACTION_REL_ALLY;
+      }
+      for (j=0; j<f->nenemies; j++) {
+         faction_grid[ i*n + f->enemies[j] ] |= FACTION_REL_ENEMY;
+         faction_grid[ f->enemies[j]*n + i ] |= FACTION_REL_ENEMY;
+      }
    }
 
-   /* both are factions */
-   if (fa && fb) {
-      for (i=0;i<fa->nallies;i++)
-         if (fa->allies[i] == b)
-            return 1;
-      for (i=0;i<fb->nallies;i++)
-         if(fb->allies[i] == a)
-            return 1;
-   }
-   return 0;
+   /* Player relations depend on standing. */
+   for (i=0; i<n; i++)
+      faction_computePlayer(i);
 }
 
 
@@ -640,6 +600,8 @@ static int faction_parse( Faction* temp, xmlNodePtr parent )
       xmlr_strd(node,"longname",temp->longname);
       if (xml_isNode(node, "colour")) {
          temp->colour = col_fromName(xml_raw(node));
+         if (temp->colour != NULL)
+            temp->colour_name = strdup(xml_raw(node));
          continue;
       }
 
@@ -744,8 +706,10 @@ static void faction_parseSocial( xmlNodePtr parent )
 void factions_reset (void)
 {
    int i;
-   for (i=0; i<faction_nstack; i++)
+   for (i=0; i<faction_nstack; i++) {
       faction_stack[i].player = faction_stack[i].player_def;
+      faction_computePlayer(i);
+   }
 }
 
 
@@ -758,10 +722,19 @@ int factions_load (void)
 {
    int mem;
    uint32_t bufsize;
-   char *buf = ndata_read( FACTION_DATA, &bufsize);
-
+   const char *buf;
    xmlNodePtr factions, node;
-   xmlDocPtr doc = xmlParseMemory( buf, bufsize );
+   xmlDocPtr doc;
+
+   /* Try the cache first. */
+   if (dcache_load( DCACHE_FACTION, factions_loadCache, factions_free ) == 0) {
+      faction_computeGrid();
+      DEBUG("Loaded %d Faction%s", faction_nstack, (faction_nstack==1) ? "" : "s" );
+      return 0;
+   }
+
+   buf = ndata_borrow( FACTION_DATA, &bufsize);
+   doc = xmlParseMemory( buf, bufsize );
 
    node = doc->xmlChildrenNode; /* Factions node */
    if (!xml_isNode(node,XML_FACTION_ID)) {
@@ -847,8 +820,11 @@ int factions_load (void)
    }
 #endif /* DEBUGGING */
 
+   /* Cache the relations. */
+   faction_computeGrid();
+
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    DEBUG("Loaded %d Faction%s", faction_nstack, (faction_nstack==1) ? "" : "s" );
 
@@ -856,6 +832,105 @@ int factions_load (void)
 }
 
 
+/**
+ * @brief Loads the factions from the data cache.
+ *
+ *    @param dc Section of the cache to load from.
+ *    @return 0 on success.
+ */
+static int factions_loadCache( DCache *dc )
+{
+   int i, j, n;
+   Faction *f;
+
+   n = dcache_readCount( dc, sizeof(int) );
+   if (dcache_error(dc) || (n == 0))
+      return -1;
+
+   faction_stack = calloc( n, sizeof(Faction) );
+   for (i=0; i<n; i++) {
+      f = &faction_stack[i];
+      f->name        = dcache_readString( dc );
+      f->longname    = dcache_readString( dc );
+      f->logo_small  = dcache_readTexture( dc, 0 );
+      f->logo_tiny   = dcache_readTexture( dc, 0 );
+      f->colour_name = dcache_readString( dc );
+      if (f->colour_name != NULL)
+         f->colour   = col_fromName( f->colour_name );
+      f->player_def  = dcache_readDouble( dc );
+      f->player      = dcache_readDouble( dc );
+      f->flags       = dcache_readInt( dc );
+
+      /* Relations. */
+      f->nallies     = dcache_readCount( dc, sizeof(int) );
+      if (f->nallies > 0) {
+         f->allies   = malloc( sizeof(int) * f->nallies );
+         dcache_readData( dc, f->allies, sizeof(int) * f->nallies );
+      }
+      f->nenemies    = dcache_readCount( dc, sizeof(int) );
+      if (f->nenemies > 0) {
+         f->enemies  = malloc( sizeof(int) * f->nenemies );
+         dcache_readData( dc, f->enemies, sizeof(int) * f->nenemies );
+      }
+
+      faction_nstack++;
+      if (dcache_error(dc))
+         return -1;
+   }
+
+   /* Make sure the relations are valid. */
+   for (i=0; i<faction_nstack; i++) {
+      f = &faction_stack[i];
+      for (j=0; j<f->nallies; j++)
+         if ((f->allies[j] < 0) || (f->allies[j] >= faction_nstack))
+            break;
+      if (j < f->nallies)
+         break;
+      for (j=0; j<f->nenemies; j++)
+         if ((f->enemies[j] < 0) || (f->enemies[j] >= faction_nstack))
+            break;
+      if (j < f->nenemies)
+         break;
+   }
+   if (i < faction_nstack)
+      return -1;
+
+   return 0;
+}
+
+
+/**
+ * @brief Writes the factions to the data cache.
+ *
+ *    @param dc Section of the cache to write to.
+ *    @return 0 on success.
+ */
+int factions_saveCache( DCache *dc )
+{
+   int i;
+   Faction *f;
+
+   dcache_writeInt( dc, faction_nstack );
+   for (i=0; i<faction_nstack; i++) {
+      f = &faction_stack[i];
+      dcache_writeString( dc, f->name );
+      dcache_writeString( dc, f->longname );
+      dcache_writeTexture( dc, f->logo_small );
+      dcache_writeTexture( dc, f->logo_tiny );
+      dcache_writeString( dc, f->colour_name );
+      dcache_writeDouble( dc, f->player_def );
+      dcache_writeDouble( dc, f->player );
+      dcache_writeInt( dc, f->flags );
+      dcache_writeInt( dc, f->nallies );
+      dcache_writeData( dc, f->allies, sizeof(int) * f->nallies );
+      dcache_writeInt( dc, f->nenemies );
+      dcache_writeData( dc, f->enemies, sizeof(int) * f->nenemies );
+   }
+
+   return 0;
+}
+
+
 /**
  * @brief Frees the factions.
  */
@@ -868,6 +943,8 @@ void factions_free (void)
       free(faction_stack[i].name);
       if (faction_stack[i].longname != NULL)
          free(faction_stack[i].longname);
+      if (faction_stack[i].colour_name != NULL)
+         free(faction_stack[i].colour_name);
       if (faction_stack[i].logo_small != NULL)
          gl_freeTexture(faction_stack[i].logo_small);
       if (faction_stack[i].logo_tiny != NULL)
@@ -880,6 +957,9 @@ void factions_free (void)
    free(faction_stack);
    faction_stack = NULL;
    faction_nstack = 0;
+   free(faction_grid);
+   faction_grid = NULL;
+   faction_ngrid = 0;
 }
 
 
@@ -931,8 +1011,10 @@ int pfaction_load( xmlNodePtr parent )
             if (xml_isNode(cur,"faction")) {
                xmlr_attr(cur,"name",str); 
                faction = faction_get(str);
-               if (faction != -1) /* Faction is valid. */
+               if (faction != -1) { /* Faction is valid. */
                   faction_stack[faction].player = xml_getFloat(cur);
+                  faction_computePlayer(faction);
+               }
                free(str);
             }
          } while (xml_nextNode(cur));
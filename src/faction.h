@@ -9,10 +9,24 @@
 
 #include "opengl.h"
 #include "colour.h"
+#include "dcache.h"
 
 
 #define FACTION_PLAYER  0  /**< Hardcoded player faction identifier. */
 
+#define PLAYER_ALLY     70. /**< Above this player is considered ally. */
+#define PLAYER_ENEMY    0. /**< Below this the player is considered an enemy. */
+
+#define FACTION_REL_ENEMY  (1<<0) /**< Factions are enemies. */
+#define FACTION_REL_ALLY   (1<<1) /**< Factions are allies. */
+
+
+/*
+ * Relations between all the factions, use areEnemies and areAllies instead.
+ */
+extern unsigned char *faction_grid;
+extern int faction_ngrid;
+
 
 /* get stuff */
 int faction_isFaction( int f );
@@ -37,13 +51,45 @@ glColour* faction_getColour( int f );
 char faction_getColourChar( int f );
 
 /* works with only factions */
-int areEnemies( int a, int b );
-int areAllies( int a, int b );
+int faction_relInvalid( int a, int b, int rel );
+
+
+/**
+ * @brief Checks whether two factions are enemies.
+ *
+ *    @param a Faction A.
+ *    @param b Faction B.
+ *    @return 1 if A and B are enemies, 0 otherwise.
+ */
+__inline__ static int areEnemies( int a, int b )
+{
+   if (((unsigned int)a >= (unsigned int)faction_ngrid) ||
+         ((unsigned int)b >= (unsigned int)faction_ngrid))
+      return faction_relInvalid( a, b, FACTION_REL_ENEMY );
+   return (faction_grid[ a*faction_ngrid + b ] & FACTION_REL_ENEMY) ? 1 : 0;
+}
+
+
+/**
+ * @brief Checks whether two factions are allies or not.
+ *
+ *    @param a Faction A.
+ *    @param b Faction B.
+ *    @return 1 if A and B are allies, 0 otherwise.
+ */
+__inline__ static int areAllies( int a, int b )
+{
+   if (((unsigned int)a >= (unsigned int)faction_ngrid) ||
+         ((unsigned int)b >= (unsigned int)faction_ngrid))
+      return faction_relInvalid( a, b, FACTION_REL_ALLY );
+   return (faction_grid[ a*faction_ngrid + b ] & FACTION_REL_ALLY) ? 1 : 0;
+}
 
 /* load/free */
 int factions_load (void);
 void factions_free (void);
 void factions_reset (void);
+int factions_saveCache( DCache *dc );
 
 
 #endif /* FACTION_H */
@@ -47,6 +47,7 @@ static int nfleetgroups = 0; /**< Number of fleetgroups. */
  */
 static int fleet_parse( Fleet *temp, const xmlNodePtr parent );
 static int fleet_parseGroup( FleetGroup *fltgrp, xmlNodePtr parent );
+static int fleet_loadCache( DCache *dc );
 
 
 /**
@@ -248,12 +249,12 @@ static int fleet_loadFleets (void)
 {
    int mem;
    uint32_t bufsize;
-   char *buf;
+   const char *buf;
    xmlNodePtr node;
    xmlDocPtr doc;
  
    /* Load the data. */
-   buf = ndata_read( FLEET_DATA, &bufsize);
+   buf = ndata_borrow( FLEET_DATA, &bufsize);
    doc = xmlParseMemory( buf, bufsize );
 
    node = doc->xmlChildrenNode; /* fleets node */
@@ -286,7 +287,7 @@ static int fleet_loadFleets (void)
    fleet_stack = realloc(fleet_stack, sizeof(Fleet) * nfleets);
 
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    return 0;
 }
@@ -365,12 +366,12 @@ static int fleet_loadFleetGroups (void)
 {
    int mem;
    uint32_t bufsize;
-   char *buf;
+   const char *buf;
    xmlNodePtr node;
    xmlDocPtr doc;
   
    /* Create the document. */
-   buf = ndata_read( FLEETGROUP_DATA, &bufsize);
+   buf = ndata_borrow( FLEETGROUP_DATA, &bufsize);
    doc = xmlParseMemory( buf, bufsize );
 
    node = doc->xmlChildrenNode; /* fleetgroups node. */
@@ -403,7 +404,7 @@ static int fleet_loadFleetGroups (void)
    fleetgroup_stack = realloc(fleetgroup_stack, sizeof(FleetGroup) * nfleetgroups);
 
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    return 0;
 }
@@ -416,6 +417,12 @@ static int fleet_loadFleetGroups (void)
  */
 int fleet_load (void)
 {
+   /* Try the cache first. */
+   if (dcache_load( DCACHE_FLEET, fleet_loadCache, fleet_free ) == 0) {
+      DEBUG("Loaded %d Fleet%s", nfleets, (nfleets==1) ? "" : "s" );
+      return 0;
+   }
+
    if (fleet_loadFleets())
       return -1;
    if (fleet_loadFleetGroups())
@@ -427,6 +434,121 @@ int fleet_load (void)
 }
 
 
+/**
+ * @brief Loads the fleets and fleetgroups from the data cache.
+ *
+ *    @param dc Section of the cache to load from.
+ *    @return 0 on success.
+ */
+static int fleet_loadCache( DCache *dc )
+{
+   int i, j, n, id;
+   const char *name;
+   Fleet *f;
+   FleetPilot *p;
+   FleetGroup *g;
+
+   /* Fleets. */
+   n = dcache_readCount( dc, sizeof(int) );
+   if (dcache_error(dc))
+      return -1;
+   fleet_stack = calloc( n, sizeof(Fleet) );
+   for (i=0; i<n; i++) {
+      f = &fleet_stack[i];
+      f->name        = dcache_readString( dc );
+      f->faction     = dcache_readInt( dc );
+      f->ai          = dcache_readString( dc );
+      f->flags       = dcache_readInt( dc );
+      f->pilot_avg   = dcache_readDouble( dc );
+      f->mass_avg    = dcache_readDouble( dc );
+      f->npilots     = dcache_readCount( dc, sizeof(int) );
+      f->pilots      = calloc( f->npilots, sizeof(FleetPilot) );
+      for (j=0; j<f->npilots; j++) {
+         p = &f->pilots[j];
+         /* Ships are stored by name. */
+         name        = dcache_readName( dc );
+         p->ship     = (name != NULL) ? ship_get( name ) : NULL;
+         p->name     = dcache_readString( dc );
+         p->chance   = dcache_readInt( dc );
+         p->ai       = dcache_readString( dc );
+      }
+      nfleets++;
+      if (dcache_error(dc))
+         return -1;
+   }
+
+   /* Fleetgroups, fleets are stored by index. */
+   n = dcache_readCount( dc, sizeof(int) );
+   fleetgroup_stack = calloc( n, sizeof(FleetGroup) );
+   for (i=0; i<n; i++) {
+      g = &fleetgroup_stack[i];
+      g->name        = dcache_readString( dc );
+      g->nfleets     = dcache_readCount( dc, 2*sizeof(int) );
+      g->fleets      = calloc( g->nfleets, sizeof(Fleet*) );
+      g->chance      = calloc( g->nfleets, sizeof(int) );
+      for (j=0; j<g->nfleets; j++) {
+         id          = dcache_readInt( dc );
+         g->chance[j] = dcache_readInt( dc );
+         if ((id < 0) || (id >= nfleets))
+            break;
+         g->fleets[j] = &fleet_stack[id];
+      }
+      nfleetgroups++;
+      if (dcache_error(dc) || (j < g->nfleets))
+         return -1;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Writes the fleets and fleetgroups to the data cache.
+ *
+ *    @param dc Section of the cache to write to.
+ *    @return 0 on success.
+ */
+int fleet_saveCache( DCache *dc )
+{
+   int i, j;
+   Fleet *f;
+   FleetPilot *p;
+   FleetGroup *g;
+
+   dcache_writeInt( dc, nfleets );
+   for (i=0; i<nfleets; i++) {
+      f = &fleet_stack[i];
+      dcache_writeString( dc, f->name );
+      dcache_writeInt( dc, f->faction );
+      dcache_writeString( dc, f->ai );
+      dcache_writeInt( dc, f->flags );
+      dcache_writeDouble( dc, f->pilot_avg );
+      dcache_writeDouble( dc, f->mass_avg );
+      dcache_writeInt( dc, f->npilots );
+      for (j=0; j<f->npilots; j++) {
+         p = &f->pilots[j];
+         dcache_writeString( dc, (p->ship != NULL) ? p->ship->name : NULL );
+         dcache_writeString( dc, p->name );
+         dcache_writeInt( dc, p->chance );
+         dcache_writeString( dc, p->ai );
+      }
+   }
+
+   dcache_writeInt( dc, nfleetgroups );
+   for (i=0; i<nfleetgroups; i++) {
+      g = &fleetgroup_stack[i];
+      dcache_writeString( dc, g->name );
+      dcache_writeInt( dc, g->nfleets );
+      for (j=0; j<g->nfleets; j++) {
+         dcache_writeInt( dc, g->fleets[j] - fleet_stack );
+         dcache_writeInt( dc, g->chance[j] );
+      }
+   }
+
+   return 0;
+}
+
+
 /**
  * @brief Cleans up by freeing all the fleet data.
  */
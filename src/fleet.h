@@ -8,6 +8,7 @@
 
 
 #include "pilot.h"
+#include "dcache.h"
 
 
 /*
@@ -81,6 +82,7 @@ FleetGroup* fleet_getGroup( const char* name );
  */
 int fleet_load (void);
 void fleet_free (void);
+int fleet_saveCache( DCache *dc );
 
 
 /*
@@ -1786,7 +1786,7 @@ int gui_init (void)
 int gui_load( const char* name )
 {
    uint32_t bufsize;
-   char *buf = ndata_read( GUI_DATA, &bufsize );
+   const char *buf = ndata_borrow( GUI_DATA, &bufsize );
    char *tmp;
    int found = 0;
 
@@ -1825,7 +1825,7 @@ int gui_load( const char* name )
    } while (xml_nextNode(node));
 
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    if (!found) {
       WARN("GUI '%s' not found in '"GUI_DATA"'",name);
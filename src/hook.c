@@ -8,6 +8,11 @@
  * @brief Handles hooks.
  *
  * Currently only used in the mission system.
+ *
+ * Stack names get interned when the first hook is added to them, and each
+ *  stack keeps its own list of hooks in the order they were added.  Hooks
+ *  are also kept in a hash table by ID.  Removing hooks only marks them, the
+ *  lists get compacted in one go once no hooks are running.
  */
 
 
@@ -25,6 +30,7 @@
 
 
 #define HOOK_CHUNK   32 /**< Size to grow by when out of space */
+#define HOOK_HASH_MIN 64 /**< Minimum size of the hash table. */
 
 
 /**
@@ -45,9 +51,11 @@ typedef enum HookType_e {
  */
 typedef struct Hook_ {
    unsigned int id; /**< unique id */
-   char *stack; /**< stack it's a part of */
+   int stack; /**< stack it's a part of */
    HookType_t type; /**< Type of hook. */
    int delete; /**< indicates it should be deleted when possible */
+   int attached; /**< Whether it's attached to a pilot. */
+   unsigned int pilot; /**< Pilot the hook is attached to. */
    union {
       struct {
          unsigned int parent; /**< mission it's connected to */
@@ -65,14 +73,29 @@ typedef struct Hook_ {
 } Hook;
 
 
+/**
+ * @brief All the hooks of a stack.
+ */
+typedef struct HookStack_ {
+   char *name; /**< Name of the stack. */
+   Hook **hooks; /**< Hooks in the order they were added. */
+   int nhooks; /**< Number of hooks. */
+   int mhooks; /**< Allocated hooks. */
+   int ndelete; /**< Hooks marked for deletion. */
+} HookStack;
+
+
 /* 
  * the stack
  */
 static unsigned int hook_id   = 0; /**< Unique hook id generator. */
-static Hook* hook_stack       = NULL; /**< Stack of hooks. */
-static int hook_mstack        = 0; /**< Size of hook memory. */
-static int hook_nstack        = 0; /**< Number of hooks currently used. */
-static int hook_runningstack  = 0; /**< Check if stack is running. */
+static HookStack* hook_stacks = NULL; /**< Stacks of hooks. */
+static int hook_nstacks       = 0; /**< Number of stacks. */
+static int hook_runningstack  = 0; /**< Depth of hooks running. */
+static int hook_ndelete       = 0; /**< Hooks marked for deletion. */
+static Hook** hook_hash       = NULL; /**< Hooks by ID, open addressing. */
+static int hook_mhash         = 0; /**< Size of the hash table, power of two. */
+static int hook_nhash         = 0; /**< Hooks in the hash table. */
 
 
 /*
@@ -81,6 +104,14 @@ static int hook_runningstack  = 0; /**< Check if stack is running. */
 /* extern */
 extern int misn_run( Mission *misn, const char *func );
 /* intern */
+static int hook_stackGet( const char *stack, int create );
+static unsigned int hook_hashSlot( unsigned int id );
+static void hook_hashAdd( Hook *h );
+static void hook_hashRm( unsigned int id );
+static Hook* hook_get( unsigned int id );
+static void hook_mark( Hook *h );
+static void hook_compact (void);
+static int hook_cmp( const void *p1, const void *p2 );
 static Hook* hook_new( HookType_t type, const char *stack );
 static int hook_runMisn( Hook *hook );
 static int hook_runEvent( Hook *hook );
@@ -108,7 +139,7 @@ static int hook_runMisn( Hook *hook )
    /* Make sure it's valid. */
    if (hook->u.misn.parent == 0) {
       WARN("Trying to run hook with inexistant parent: deleting");
-      hook->delete = 1; /* so we delete it */
+      hook_mark( hook ); /* so we delete it */
       return -1;
    }
 
@@ -118,14 +149,14 @@ static int hook_runMisn( Hook *hook )
          break;
    if (i>=MISSION_MAX) {
       WARN("Trying to run hook with parent not in player mission stack: deleting");
-      hook->delete = 1; /* so we delete it */
+      hook_mark( hook ); /* so we delete it */
       return -1;
    }
    misn = &player_missions[i];
 
    /* Run mission code. */
    if (misn_run( misn, hook->u.misn.func ) < 0) { /* error has occured */
-      WARN("Hook [%s] '%d' -> '%s' failed", hook->stack,
+      WARN("Hook [%s] '%d' -> '%s' failed", hook_stacks[hook->stack].name,
             hook->id, hook->u.misn.func);
       return -1;
    }
@@ -142,12 +173,11 @@ static int hook_runMisn( Hook *hook )
  */
 static int hook_runEvent( Hook *hook )
 {
-   int ret, id;
-   id = hook->id;
+   int ret;
    ret = event_run( hook->u.event.parent, hook->u.event.func );
    if (ret < 0) {
-      hook_rm( id );
-      WARN("Hook [%s] '%d' -> '%s' failed", hook->stack,
+      hook_mark( hook );
+      WARN("Hook [%s] '%d' -> '%s' failed", hook_stacks[hook->stack].name,
             hook->id, hook->u.event.func);
       return -1;
    }
@@ -163,11 +193,10 @@ static int hook_runEvent( Hook *hook )
  */
 static int hook_runFunc( Hook *hook )
 {
-   int ret, id;
-   id = hook->id;
+   int ret;
    ret = hook->u.func.func( hook->u.func.data );
    if (ret != 0) {
-      hook_rm( id );
+      hook_mark( hook );
       return -1;
    }
    return 0;
@@ -197,12 +226,196 @@ static int hook_run( Hook *hook )
 
       default:
          WARN("Invalid hook type '%d', deleting.", hook->type);
-         hook->delete = 1;
+         hook_mark( hook );
          return -1;
    }
 }
 
 
+/**
+ * @brief Gets the ID of a stack.
+ *
+ *    @param stack Name of the stack.
+ *    @param create Whether to create the stack if it doesn't exist.
+ *    @return ID of the stack or -1 if not found.
+ */
+static int hook_stackGet( const char *stack, int create )
+{
+   int i;
+
+   for (i=0; i<hook_nstacks; i++)
+      if (strcmp( hook_stacks[i].name, stack ) == 0)
+         return i;
+
+   if (!create)
+      return -1;
+
+   hook_stacks = realloc( hook_stacks, sizeof(HookStack) * (hook_nstacks+1) );
+   memset( &hook_stacks[hook_nstacks], 0, sizeof(HookStack) );
+   hook_stacks[hook_nstacks].name = strdup( stack );
+   return hook_nstacks++;
+}
+
+
+/**
+ * @brief Gets the slot of the hash table an ID wants to be in.
+ */
+static unsigned int hook_hashSlot( unsigned int id )
+{
+   return (id * 2654435761U) & (unsigned int)(hook_mhash-1);
+}
+
+
+/**
+ * @brief Adds a hook to the hash table.
+ *
+ *    @param h Hook to add.
+ */
+static void hook_hashAdd( Hook *h )
+{
+   int i, oldm;
+   unsigned int j;
+   Hook **old;
+
+   /* Keep it at most half full. */
+   if (2*(hook_nhash+1) > hook_mhash) {
+      old         = hook_hash;
+      oldm        = hook_mhash;
+      hook_mhash  = MAX( HOOK_HASH_MIN, 2*hook_mhash );
+      hook_hash   = calloc( hook_mhash, sizeof(Hook*) );
+      for (i=0; i<oldm; i++) {
+         if (old[i] == NULL)
+            continue;
+         for (j=hook_hashSlot(old[i]->id); hook_hash[j]!=NULL;
+               j=(j+1) & (hook_mhash-1));
+         hook_hash[j] = old[i];
+      }
+      free(old);
+   }
+
+   for (j=hook_hashSlot(h->id); hook_hash[j]!=NULL; j=(j+1) & (hook_mhash-1));
+   hook_hash[j] = h;
+   hook_nhash++;
+}
+
+
+/**
+ * @brief Removes a hook from the hash table.
+ *
+ *    @param id ID of the hook to remove.
+ */
+static void hook_hashRm( unsigned int id )
+{
+   unsigned int i, j, k, mask;
+
+   if (hook_mhash == 0)
+      return;
+   mask = hook_mhash-1;
+
+   for (i=hook_hashSlot(id); hook_hash[i]!=NULL; i=(i+1) & mask)
+      if (hook_hash[i]->id == id)
+         break;
+   if (hook_hash[i] == NULL)
+      return;
+
+   /* Shift back the hooks that would no longer be found. */
+   j = i;
+   while (1) {
+      j = (j+1) & mask;
+      if (hook_hash[j] == NULL)
+         break;
+      k = hook_hashSlot( hook_hash[j]->id );
+      if ((i <= j) ? ((k <= i) || (k > j)) : ((k <= i) && (k > j))) {
+         hook_hash[i] = hook_hash[j];
+         i = j;
+      }
+   }
+   hook_hash[i] = NULL;
+   hook_nhash--;
+}
+
+
+/**
+ * @brief Gets a hook by ID.
+ *
+ *    @param id ID of the hook to get.
+ *    @return The hook or NULL if not found.
+ */
+static Hook* hook_get( unsigned int id )
+{
+   unsigned int i;
+
+   if (hook_mhash == 0)
+      return NULL;
+
+   for (i=hook_hashSlot(id); hook_hash[i]!=NULL; i=(i+1) & (hook_mhash-1))
+      if (hook_hash[i]->id == id)
+         return hook_hash[i];
+   return NULL;
+}
+
+
+/**
+ * @brief Marks a hook for deletion.
+ *
+ * It stops running right away, but only really gets removed by hook_compact.
+ *
+ *    @param h Hook to mark.
+ */
+static void hook_mark( Hook *h )
+{
+   if (h->delete)
+      return;
+
+   /* Remove from the pilot. */
+   if (h->attached) {
+      pilot_rmHook( pilot_get( h->pilot ), h->id );
+      h->attached = 0;
+   }
+
+   h->delete = 1;
+   hook_stacks[ h->stack ].ndelete++;
+   hook_ndelete++;
+}
+
+
+/**
+ * @brief Removes all the hooks marked for deletion.
+ *
+ * Does nothing while hooks are running.
+ */
+static void hook_compact (void)
+{
+   int i, j, n;
+   HookStack *hs;
+   Hook *h;
+
+   if (hook_runningstack || (hook_ndelete == 0))
+      return;
+
+   for (i=0; i<hook_nstacks; i++) {
+      hs = &hook_stacks[i];
+      if (hs->ndelete == 0)
+         continue;
+
+      n = 0;
+      for (j=0; j<hs->nhooks; j++) {
+         h = hs->hooks[j];
+         if (h->delete) {
+            hook_hashRm( h->id );
+            hook_free( h );
+            free( h );
+         }
+         else
+            hs->hooks[n++] = h;
+      }
+      hs->nhooks  = n;
+      hs->ndelete = 0;
+   }
+   hook_ndelete = 0;
+}
+
+
 /**
  * @brief Generates and allocates a new hook.
  *
@@ -212,24 +425,29 @@ static int hook_run( Hook *hook )
 static Hook* hook_new( HookType_t type, const char *stack )
 {
    Hook *new_hook;
+   HookStack *hs;
+   int id;
+
+   /* Get the stack. */
+   id = hook_stackGet( stack, 1 );
+   hs = &hook_stacks[id];
 
    /* if memory must grow */
-   if (hook_nstack+1 > hook_mstack) {
-      hook_mstack += HOOK_CHUNK;
-      hook_stack   = realloc(hook_stack, hook_mstack*sizeof(Hook));
+   if (hs->nhooks+1 > hs->mhooks) {
+      hs->mhooks += HOOK_CHUNK;
+      hs->hooks   = realloc( hs->hooks, hs->mhooks*sizeof(Hook*) );
    }
 
-   /* Get and create new hook. */
-   new_hook          = &hook_stack[hook_nstack];
-   memset( new_hook, 0, sizeof(Hook) );
+   /* Create new hook. */
+   new_hook = calloc( 1, sizeof(Hook) );
+   hs->hooks[ hs->nhooks++ ] = new_hook;
 
    /* Fill out generic details. */
    new_hook->type    = type;
    new_hook->id      = ++hook_id;
-   new_hook->stack   = strdup(stack);
+   new_hook->stack   = id;
 
-   /* Increment stack size. */
-   hook_nstack++;
+   hook_hashAdd( new_hook );
 
    return new_hook;
 }
@@ -305,6 +523,26 @@ unsigned hook_addFunc( int (*func)(void*), void* data, const char *stack )
 }
 
 
+/**
+ * @brief Attaches a hook to a pilot so it gets removed from the pilot with it.
+ *
+ * A hook can only be attached to one pilot.
+ *
+ *    @param id Identifier of the hook.
+ *    @param pilot ID of the pilot it's attached to.
+ */
+void hook_setPilot( unsigned int id, unsigned int pilot )
+{
+   Hook *h;
+
+   h = hook_get( id );
+   if (h != NULL) {
+      h->attached = 1;
+      h->pilot    = pilot;
+   }
+}
+
+
 /**
  * @brief Removes a hook.
  *
@@ -314,47 +552,18 @@ unsigned hook_addFunc( int (*func)(void*), void* data, const char *stack )
  */
 int hook_rm( unsigned int id )
 {
-   int l,m,h,f;
-
-   /* Remove from all the pilots. */
-   pilots_rmHook( id );
-
-   /* Binary search. */
-   f = 0;
-   l = 0;
-   h = hook_nstack-1;
-   while (l <= h) {
-      m = (l+h)/2;
-      if (hook_stack[m].id > id) h = m-1;
-      else if (hook_stack[m].id < id) l = m+1;
-      else {
-         f = 1;
-         break;
-      }
-   }
+   Hook *h;
 
-   /* Check if hook was found. */
-   if (f == 0)
+   h = hook_get( id );
+   if ((h == NULL) || h->delete)
       return 0;
 
-   /* Mark to delete, but do not delete yet, hooks are running. */
-   if (hook_runningstack) {
-      hook_stack[m].delete = 1;
+   /* Mark to delete, but do not delete yet if hooks are running. */
+   hook_mark( h );
+   if (hook_runningstack)
       return 2;
-   }
 
-   /* Free the hook. */
-   hook_free( &hook_stack[m] );
-
-   /* Last hook, just clip the stack. */
-   if (m == (hook_nstack-1)) {
-      hook_nstack--;
-      return 1;
-   }
-
-   /* Move it! */
-   memmove( &hook_stack[m], &hook_stack[m+1], sizeof(Hook) * (hook_nstack-m-1) );
-   hook_nstack--;
+   hook_compact();
    return 1;
 }
 
@@ -366,15 +575,17 @@ int hook_rm( unsigned int id )
  */
 void hook_rmMisnParent( unsigned int parent )
 {
-   int i;
+   int i, j;
+   Hook *h;
 
-   for (i=0; i<hook_nstack; i++)
-      if ((hook_stack[i].type==HOOK_TYPE_MISN) &&
-            (parent == hook_stack[i].u.misn.parent)) {
-         /* Only decrement if hook was actually removed. */
-         if (hook_rm( hook_stack[i].id ) == 1)
-            i--;
+   for (i=0; i<hook_nstacks; i++) {
+      for (j=0; j<hook_stacks[i].nhooks; j++) {
+         h = hook_stacks[i].hooks[j];
+         if ((h->type==HOOK_TYPE_MISN) && (parent == h->u.misn.parent))
+            hook_mark( h );
       }
+   }
+   hook_compact();
 }
 
 
@@ -385,15 +596,17 @@ void hook_rmMisnParent( unsigned int parent )
  */
 void hook_rmEventParent( unsigned int parent )
 {
-   int i;
+   int i, j;
+   Hook *h;
 
-   for (i=0; i<hook_nstack; i++)
-      if ((hook_stack[i].type==HOOK_TYPE_EVENT) &&
-            (parent == hook_stack[i].u.event.parent)) {
-         /* Only decrement if hook was actually removed. */
-         if (hook_rm( hook_stack[i].id ) == 1)
-            i--;
+   for (i=0; i<hook_nstacks; i++) {
+      for (j=0; j<hook_stacks[i].nhooks; j++) {
+         h = hook_stacks[i].hooks[j];
+         if ((h->type==HOOK_TYPE_EVENT) && (parent == h->u.event.parent))
+            hook_mark( h );
       }
+   }
+   hook_compact();
 }
 
 
@@ -405,25 +618,30 @@ void hook_rmEventParent( unsigned int parent )
  */
 int hooks_run( const char* stack )
 {
-   int i;
+   int i, id;
+   Hook *h;
 
    /* Don't update if player is dead. */
    if ((player==NULL) || player_isFlag(PLAYER_DESTROYED))
       return 0;
 
-   hook_runningstack = 1; /* running hooks */
-   for (i=0; i<hook_nstack; i++)
-      if ((strcmp(stack, hook_stack[i].stack)==0) && !hook_stack[i].delete) {
-         hook_run( &hook_stack[i] );
-      }
-   hook_runningstack = 0; /* not running hooks anymore */
+   /* No hooks were ever added to it. */
+   id = hook_stackGet( stack, 0 );
+   if (id < 0)
+      return 0;
+
+   hook_runningstack++; /* running hooks */
+   /* Hooks may add more hooks so the stacks can move. */
+   for (i=0; i<hook_stacks[id].nhooks; i++) {
+      h = hook_stacks[id].hooks[i];
+      if (!h->delete)
+         hook_run( h );
+   }
+   hook_runningstack--; /* not running hooks anymore */
+
+   /* Delete any that need deleting */
+   hook_compact();
 
-   for (i=0; i<hook_nstack; i++)
-      if (hook_stack[i].delete) { /* Delete any that need deleting */
-         hook_rm( hook_stack[i].id );
-         i--;
-      }
-   
    return 0;
 }
 
@@ -437,28 +655,24 @@ int hooks_run( const char* stack )
 int hook_runID( unsigned int id )
 {
    Hook *h;
-   int i, ret;
 
    /* Don't update if player is dead. */
    if ((player==NULL) || player_isFlag(PLAYER_DESTROYED))
       return 0;
 
-   /* Try to find the hook and run it. */
-   ret = 0;
-   for (i=0; i<hook_nstack; i++)
-      if (hook_stack[i].id == id) {
-         h     = &hook_stack[i];
-         hook_run( h );
-         ret   = 1;
-         break;
-      }
-
-   /* Hook not found. */
-   if (ret == 0) {
+   /* Try to find the hook. */
+   h = hook_get( id );
+   if (h == NULL) {
       WARN("Attempting to run hook of id '%d' which is not in the stack", id);
       return -1;
    }
 
+   /* Run it. */
+   hook_runningstack++;
+   hook_run( h );
+   hook_runningstack--;
+   hook_compact();
+
    return 0;
 }
 
@@ -470,10 +684,6 @@ int hook_runID( unsigned int id )
  */
 static void hook_free( Hook *h )
 {
-   /* Generic freeing. */
-   if (h->stack != NULL)
-      free(h->stack);
-
    switch (h->type) {
       case HOOK_TYPE_MISN:
          if (h->u.misn.func != NULL)
@@ -496,15 +706,25 @@ static void hook_free( Hook *h )
  */
 void hook_cleanup (void)
 {
-   int i;
+   int i, j;
 
-   for (i=0; i<hook_nstack; i++)
-      hook_free( &hook_stack[i] );
-   free( hook_stack );
+   for (i=0; i<hook_nstacks; i++) {
+      for (j=0; j<hook_stacks[i].nhooks; j++) {
+         hook_free( hook_stacks[i].hooks[j] );
+         free( hook_stacks[i].hooks[j] );
+      }
+      free( hook_stacks[i].hooks );
+      free( hook_stacks[i].name );
+   }
+   free( hook_stacks );
+   free( hook_hash );
    /* sane defaults just in case */
-   hook_stack  = NULL;
-   hook_nstack = 0;
-   hook_mstack = 0;
+   hook_stacks    = NULL;
+   hook_nstacks   = 0;
+   hook_ndelete   = 0;
+   hook_hash      = NULL;
+   hook_mhash     = 0;
+   hook_nhash     = 0;
 }
 
 
@@ -531,12 +751,28 @@ static int hook_needSave( Hook *h )
 
    /* Make sure it's in the proper stack. */
    for (i=0; strcmp(nosave[i],"end") != 0; i++)
-      if (strcmp(nosave[i],h->stack)==0) return 0;
+      if (strcmp(nosave[i],hook_stacks[h->stack].name)==0) return 0;
 
    return 1;
 }
 
 
+/**
+ * @brief Compares hooks by ID for qsort.
+ */
+static int hook_cmp( const void *p1, const void *p2 )
+{
+   const Hook *h1, *h2;
+   h1 = *(const Hook**) p1;
+   h2 = *(const Hook**) p2;
+   if (h1->id < h2->id)
+      return -1;
+   else if (h1->id > h2->id)
+      return +1;
+   return 0;
+}
+
+
 /**
  * @brief Saves all the hooks.
  *
@@ -545,12 +781,21 @@ static int hook_needSave( Hook *h )
  */
 int hook_save( xmlTextWriterPtr writer )
 {
-   int i;
-   Hook *h;
+   int i, j, n;
+   Hook *h, **hooks;
+
+   /* Save them in the order they were added. */
+   hooks = malloc( sizeof(Hook*) * MAX(1,hook_nhash) );
+   n     = 0;
+   for (i=0; i<hook_nstacks; i++)
+      for (j=0; j<hook_stacks[i].nhooks; j++)
+         if (!hook_stacks[i].hooks[j]->delete)
+            hooks[n++] = hook_stacks[i].hooks[j];
+   qsort( hooks, n, sizeof(Hook*), hook_cmp );
 
    xmlw_startElem(writer,"hooks");
-   for (i=0; i<hook_nstack; i++) {
-      h = &hook_stack[i];
+   for (i=0; i<n; i++) {
+      h = hooks[i];
 
       if (!hook_needSave(h)) continue; /* no need to save it */
 
@@ -579,11 +824,12 @@ int hook_save( xmlTextWriterPtr writer )
 
       /* Generic information. */
       /* xmlw_attr(writer,"id","%u",h->id); I don't think it's needed */
-      xmlw_elem(writer,"stack","%s",h->stack);
+      xmlw_elem(writer,"stack","%s",hook_stacks[h->stack].name);
 
       xmlw_endElem(writer); /* "hook" */
    }
    xmlw_endElem(writer); /* "hooks" */
+   free( hooks );
 
    return 0;
 }
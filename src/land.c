@@ -103,6 +103,14 @@ static glTexture *gfx_exterior = NULL; /**< Exterior graphic of the landed plane
 static Mission* mission_computer = NULL; /**< Missions at the computer. */
 static int mission_ncomputer = 0; /**< Number of missions at the computer. */
 
+/*
+ * missions not created yet
+ */
+static MissionCand* misn_cand = NULL; /**< Computer missions to create. */
+static int misn_ncand = -1; /**< Computer missions to create, -1 if created. */
+static MissionCand* bar_cand = NULL; /**< Bar missions to create. */
+static int bar_ncand = -1; /**< Bar missions to create, -1 if created. */
+
 /*
  * Bar stuff.
  */
@@ -149,6 +157,7 @@ static void shipyard_rmouse( unsigned int wid, char* widget_name );
 static void bar_getDim( int wid,
       int *w, int *h, int *iw, int *ih, int *bw, int *bh );
 static void bar_open( unsigned int wid );
+static void bar_create (void);
 static int bar_genList( unsigned int wid );
 static void bar_update( unsigned int wid, char* str );
 static void bar_close( unsigned int wid, char* str );
@@ -156,6 +165,7 @@ static void bar_approach( unsigned int wid, char* str );
 static int news_load (void);
 /* mission computer */
 static void misn_open( unsigned int wid );
+static void misn_create (void);
 static void misn_close( unsigned int wid, char *name );
 static void misn_accept( unsigned int wid, char* str );
 static void misn_genList( unsigned int wid, int first );
@@ -1075,6 +1085,19 @@ static void bar_open( unsigned int wid )
    bar_genList( wid );
 }
 
+/**
+ * @brief Creates the bar missions if they haven't been created yet.
+ */
+static void bar_create (void)
+{
+   if (bar_ncand < 0)
+      return;
+
+   npc_generate( bar_cand, bar_ncand );
+   free( bar_cand );
+   bar_cand  = NULL;
+   bar_ncand = -1;
+}
 /**
  * @brief Generates the misison list for the bar.
  *
@@ -1295,6 +1318,20 @@ static void misn_open( unsigned int wid )
 
    misn_genList(wid, 1);
 }
+/**
+ * @brief Creates the computer missions if they haven't been created yet.
+ */
+static void misn_create (void)
+{
+   if (misn_ncand < 0)
+      return;
+
+   mission_computer = missions_createCand( &mission_ncomputer,
+         misn_cand, misn_ncand );
+   free( misn_cand );
+   misn_cand  = NULL;
+   misn_ncand = -1;
+}
 /**
  * @brief Closes the mission computer window.
  *    @param wid Window to close.
@@ -1674,7 +1711,7 @@ void land( Planet* p )
     *
     *  1) Create main tab - must have decent background.
     *  2) Set landed, play music and run land hooks - so hooks run well.
-    *  3) Generate missions - so that campaigns are fluid.
+    *  3) Pick missions - so that campaigns are fluid.
     *  4) Create other tabs - lists depend on NPC and missions.
     */
 
@@ -1687,11 +1724,14 @@ void land( Planet* p )
    events_trigger( EVENT_TRIGGER_LAND );
    hooks_run("land");
 
-   /* 3) Generate computer and bar missions. */
-   mission_computer = missions_genList( &mission_ncomputer,
+   /* 3) Pick computer and bar missions, they only get created when their
+    *    tab is first shown so landing doesn't wait on all the scripts. */
+   misn_cand = missions_genCand( &misn_ncand,
          land_planet->faction, land_planet->name, cur_system->name,
          MIS_AVAIL_COMPUTER );
-   npc_generate(); /**< Generate bar npc. */
+   bar_cand = missions_genCand( &bar_ncand,
+         land_planet->faction, land_planet->name, cur_system->name,
+         MIS_AVAIL_BAR );
 
    /* 4) Create other tabs. */
    /* Basic - bar + missions */
@@ -1844,11 +1884,19 @@ static void land_changeTab( unsigned int wid, char *wgt, int tab )
                torun_hook = "shipyard";
                break;
             case LAND_WINDOW_BAR:
+               if (bar_ncand >= 0) {
+                  bar_create();
+                  bar_genList( w );
+               }
                bar_update( w, NULL );
                to_visit   = VISITED_BAR;
                torun_hook = "bar";
                break;
             case LAND_WINDOW_MISSION:
+               if (misn_ncand >= 0) {
+                  misn_create();
+                  misn_genList( w, 0 );
+               }
                misn_update( w, NULL );
                to_visit   = VISITED_MISSION;
                torun_hook = "mission";
@@ -1984,6 +2032,14 @@ void land_cleanup (void)
    mission_computer  = NULL;
    mission_ncomputer = 0;
 
+   /* Clean up missions that never got created. */
+   free( misn_cand );
+   misn_cand   = NULL;
+   misn_ncand  = -1;
+   free( bar_cand );
+   bar_cand    = NULL;
+   bar_ncand   = -1;
+
    /* Clean up bar missions. */
    npc_freeAll();
 }
@@ -34,6 +34,7 @@
 #include "cond.h"
 #include "gui_osd.h"
 #include "npc.h"
+#include "timer.h"
 
 
 #define XML_MISSION_ID        "Missions" /**< XML document identifier */
@@ -43,6 +44,7 @@
 #define MISSION_LUA_PATH      "dat/missions/" /**< Path to Lua files. */
 
 #define MISSION_CHUNK         32 /**< Chunk allocation. */
+#define MISSION_STATE_IDLE    16 /**< Maximum idle Lua states to keep around. */
 
 
 /*
@@ -59,12 +61,51 @@ static MissionData *mission_stack = NULL; /**< Unmuteable after creation */
 static int mission_nstack = 0; /**< Mssions in stack. */
 
 
+/*
+ * missions by location
+ */
+#define MISSION_NLOC    (MIS_AVAIL_COMMODITY+1) /**< Number of locations. */
+static int *mission_loc[MISSION_NLOC]; /**< IDs of the missions available at each location. */
+static int mission_nloc[MISSION_NLOC]; /**< Number of missions available at each location. */
+
+
+/**
+ * @brief Lua state missions can run in.
+ *
+ * Creating a state and loading all the libraries into it is expensive and
+ *  most missions created on landing are never accepted, so the states get
+ *  reused.  The mission itself runs in a thread of the state with its own
+ *  globals table that falls back to the state's globals, so throwing away
+ *  the thread gets rid of most of what it did.  Missions can still change
+ *  the state's globals through _G or the library tables, so those are put
+ *  back the way they were loaded when the state is given back.  Anything
+ *  deeper than that must not be changed by the scripts.
+ */
+typedef struct MissionState_ {
+   lua_State *L; /**< State with the mission libraries loaded. */
+   lua_State *T; /**< Thread the mission runs in, NULL if idle. */
+   int ref; /**< Registry reference keeping the thread alive. */
+   int globals; /**< Registry reference to a copy of the loaded globals. */
+   int libs; /**< Registry reference to copies of the loaded library tables. */
+} MissionState;
+static MissionState *mission_states = NULL; /**< Pool of mission states. */
+static int mission_nstates = 0; /**< Number of mission states. */
+static int mission_mstates = 0; /**< Allocated mission states. */
+
+
 /*
  * prototypes
  */
 /* static */
 /* Generation. */
 static unsigned int mission_genID (void);
+static lua_State* mission_stateGet (void);
+static void mission_stateRelease( lua_State *T );
+static void mission_stateSave( MissionState *ms );
+static void mission_stateReset( MissionState *ms );
+static void mission_tableCopy( lua_State *L, int t );
+static void mission_tableSet( lua_State *L, int t, int s );
+static void mission_stateFree (void);
 static int mission_init( Mission* mission, MissionData* misn, int genid, int create );
 static void mission_freeData( MissionData* mission );
 /* Matching. */
@@ -74,9 +115,11 @@ static int mission_meetReq( int mission, int faction,
       const char* planet, const char* sysname );
 static int mission_matchFaction( MissionData* misn, int faction );
 static int mission_location( const char* loc );
+static void missions_index (void);
 /* Loading. */
 static int mission_parse( MissionData* temp, const xmlNodePtr parent );
 static int missions_parseActive( xmlNodePtr parent );
+static int mission_timerRun( unsigned int id, void *data );
 /* Persistance. */
 static int mission_persistDataNode( lua_State *L, xmlTextWriterPtr writer, int intable );
 static int mission_persistData( lua_State *L, xmlTextWriterPtr writer );
@@ -137,6 +180,226 @@ MissionData* mission_get( int id )
 }
 
 
+/**
+ * @brief Gets a clean Lua state for a mission to run in.
+ *
+ *    @return The thread the mission should run in or NULL on error.
+ */
+static lua_State* mission_stateGet (void)
+{
+   int i;
+   MissionState *ms;
+   lua_State *L;
+
+   /* Try to reuse an idle state. */
+   ms = NULL;
+   for (i=0; i<mission_nstates; i++) {
+      if (mission_states[i].T == NULL) {
+         ms = &mission_states[i];
+         break;
+      }
+   }
+
+   /* Create a new one. */
+   if (ms == NULL) {
+      L = nlua_newState();
+      if (L == NULL)
+         return NULL;
+      nlua_loadBasic( L ); /* pairs and such */
+      misn_loadLibs( L ); /* load our custom libraries */
+      nlua_gcManage( L );
+
+      if (mission_nstates >= mission_mstates) {
+         mission_mstates += MISSION_CHUNK;
+         mission_states   = realloc( mission_states,
+               sizeof(MissionState) * mission_mstates );
+      }
+      ms = &mission_states[ mission_nstates++ ];
+      ms->L = L;
+      mission_stateSave( ms );
+   }
+   L = ms->L;
+
+   /* Thread with its own globals. */
+   ms->T = lua_newthread( L );
+   lua_newtable( L ); /* thread, env */
+   lua_newtable( L ); /* thread, env, meta */
+   lua_pushvalue( L, LUA_GLOBALSINDEX ); /* thread, env, meta, globals */
+   lua_setfield( L, -2, "__index" ); /* thread, env, meta */
+   lua_setmetatable( L, -2 ); /* thread, env */
+   lua_xmove( L, ms->T, 1 ); /* thread */
+   lua_replace( ms->T, LUA_GLOBALSINDEX );
+   ms->ref = luaL_ref( L, LUA_REGISTRYINDEX );
+
+   return ms->T;
+}
+
+
+/**
+ * @brief Gives back a state gotten with mission_stateGet.
+ *
+ *    @param T Thread the mission was running in.
+ */
+static void mission_stateRelease( lua_State *T )
+{
+   int i, idle;
+   MissionState *ms;
+
+   ms   = NULL;
+   idle = 0;
+   for (i=0; i<mission_nstates; i++) {
+      if (mission_states[i].T == T)
+         ms = &mission_states[i];
+      else if (mission_states[i].T == NULL)
+         idle++;
+   }
+   if (ms == NULL) {
+      WARN("Mission Lua state not found in pool.");
+      return;
+   }
+
+   /* Let the thread and everything the mission made get collected. */
+   luaL_unref( ms->L, LUA_REGISTRYINDEX, ms->ref );
+   ms->T   = NULL;
+   ms->ref = LUA_NOREF;
+   nlua_setOwner( ms->L, "mission", NULL );
+
+   /* Don't keep too many around. */
+   if (idle >= MISSION_STATE_IDLE) {
+      nlua_close( ms->L );
+      mission_nstates--;
+      if (ms != &mission_states[ mission_nstates ])
+         memcpy( ms, &mission_states[ mission_nstates ], sizeof(MissionState) );
+   }
+   else
+      mission_stateReset( ms );
+}
+
+
+/**
+ * @brief Remembers the globals of a new mission state.
+ *
+ *    @param ms State to remember the globals of.
+ */
+static void mission_stateSave( MissionState *ms )
+{
+   lua_State *L;
+
+   L = ms->L;
+   mission_tableCopy( L, LUA_GLOBALSINDEX ); /* globals */
+   lua_newtable( L ); /* globals, libs */
+   lua_pushnil( L ); /* globals, libs, nil */
+   while (lua_next( L, LUA_GLOBALSINDEX ) != 0) { /* globals, libs, k, v */
+      if (lua_istable( L, -1 ) && !lua_rawequal( L, -1, LUA_GLOBALSINDEX )) {
+         mission_tableCopy( L, lua_gettop(L) ); /* globals, libs, k, v, copy */
+         lua_rawset( L, -4 ); /* globals, libs, k */
+      }
+      else
+         lua_pop( L, 1 ); /* globals, libs, k */
+   }
+   ms->libs    = luaL_ref( L, LUA_REGISTRYINDEX ); /* globals */
+   ms->globals = luaL_ref( L, LUA_REGISTRYINDEX ); /* */
+}
+
+
+/**
+ * @brief Puts the globals of a mission state back the way they were loaded.
+ *
+ *    @param ms State to reset.
+ */
+static void mission_stateReset( MissionState *ms )
+{
+   lua_State *L;
+   int top;
+
+   L   = ms->L;
+   top = lua_gettop( L );
+   lua_rawgeti( L, LUA_REGISTRYINDEX, ms->globals ); /* globals */
+   mission_tableSet( L, LUA_GLOBALSINDEX, top+1 );
+   lua_rawgeti( L, LUA_REGISTRYINDEX, ms->libs ); /* globals, libs */
+   lua_pushnil( L ); /* globals, libs, nil */
+   while (lua_next( L, top+2 ) != 0) { /* globals, libs, t, copy */
+      mission_tableSet( L, top+3, top+4 );
+      lua_pop( L, 1 ); /* globals, libs, t */
+   }
+   lua_settop( L, top );
+}
+
+
+/**
+ * @brief Pushes a shallow copy of a table.
+ *
+ *    @param L State the table is in.
+ *    @param t Index of the table, must not be relative.
+ */
+static void mission_tableCopy( lua_State *L, int t )
+{
+   lua_newtable( L ); /* copy */
+   lua_pushnil( L ); /* copy, nil */
+   while (lua_next( L, t ) != 0) { /* copy, k, v */
+      lua_pushvalue( L, -2 ); /* copy, k, v, k */
+      lua_insert( L, -2 ); /* copy, k, k, v */
+      lua_rawset( L, -4 ); /* copy, k */
+   }
+}
+
+
+/**
+ * @brief Makes a table the same as a shallow copy of it.
+ *
+ *    @param L State the tables are in.
+ *    @param t Index of the table to change, must not be relative.
+ *    @param s Index of the copy, must not be relative.
+ */
+static void mission_tableSet( lua_State *L, int t, int s )
+{
+   /* Remove what was added, clearing fields while traversing is fine. */
+   lua_pushnil( L ); /* nil */
+   while (lua_next( L, t ) != 0) { /* k, v */
+      lua_pop( L, 1 ); /* k */
+      lua_pushvalue( L, -1 ); /* k, k */
+      lua_rawget( L, s ); /* k, sv */
+      if (lua_isnil( L, -1 )) {
+         lua_pushvalue( L, -2 ); /* k, nil, k */
+         lua_pushnil( L ); /* k, nil, k, nil */
+         lua_rawset( L, t ); /* k, nil */
+      }
+      lua_pop( L, 1 ); /* k */
+   }
+
+   /* Put back what was changed. */
+   lua_pushnil( L ); /* nil */
+   while (lua_next( L, s ) != 0) { /* k, v */
+      lua_pushvalue( L, -2 ); /* k, v, k */
+      lua_insert( L, -2 ); /* k, k, v */
+      lua_rawset( L, t ); /* k */
+   }
+}
+
+
+/**
+ * @brief Closes all the idle mission states.
+ */
+static void mission_stateFree (void)
+{
+   int i, n;
+
+   n = 0;
+   for (i=0; i<mission_nstates; i++) {
+      if (mission_states[i].T == NULL)
+         nlua_close( mission_states[i].L );
+      else
+         mission_states[n++] = mission_states[i];
+   }
+   mission_nstates = n;
+   if (mission_nstates == 0) {
+      free( mission_states );
+      mission_states  = NULL;
+      mission_mstates = 0;
+   }
+}
+
+
 /**
  * @brief Initializes a mission.
  *
@@ -148,9 +411,7 @@ MissionData* mission_get( int id )
  */
 static int mission_init( Mission* mission, MissionData* misn, int genid, int create )
 {
-   int i;
-   char *buf;
-   uint32_t bufsize;
+   int ret;
 
    /* clear the mission */
    memset(mission,0,sizeof(Mission));
@@ -163,35 +424,30 @@ static int mission_init( Mission* mission, MissionData* misn, int genid, int cre
       mission->desc  = strdup("No description.");
    }
 
-   /* Init the timers. */
-   for (i=0; i<MISSION_TIMER_MAX; i++) {
-      mission->timer[i] = 0.;
-      mission->tfunc[i] = NULL;
-   }
-
    /* init lua */
-   mission->L = nlua_newState();
+   mission->L = mission_stateGet();
    if (mission->L == NULL) {
       WARN("Unable to create a new lua state.");
+      mission_cleanup(mission);
       return -1;
    }
-   nlua_loadBasic( mission->L ); /* pairs and such */
-   misn_loadLibs( mission->L ); /* load our custom libraries */
+   nlua_setOwner( mission->L, "mission", misn->name );
 
    /* load the file */
-   buf = ndata_read( misn->lua, &bufsize );
-   if (buf == NULL) {
+   ret = nlua_doChunk( mission->L, misn->lua );
+   if (ret == LUA_ERRFILE) {
       WARN("Mission '%s' Lua script not found.", misn->lua );
+      mission_cleanup(mission);
       return -1;
    }
-   if (luaL_dobuffer(mission->L, buf, bufsize, misn->lua) != 0) {
+   else if (ret != 0) {
       WARN("Error loading mission file: %s\n"
           "%s\n"
           "Most likely Lua file has improper syntax, please check",
             misn->lua, lua_tostring(mission->L,-1));
+      mission_cleanup(mission);
       return -1;
    }
-   free(buf);
 
    /* run create function */
    if (create) {
@@ -274,7 +530,12 @@ static int mission_meetReq( int mission, int faction,
           mission_alreadyRunning(misn)))
       return 0;
 
-   /* Must meet Lua condition. */
+   /* Must meet previous mission requirements. */
+   if ((misn->avail.done != NULL) &&
+         (player_missionAlreadyDone( mission_getID(misn->avail.done) ) == 0))
+      return 0;
+
+   /* Must meet Lua condition, most expensive so goes last. */
    if (misn->avail.cond != NULL) {
       c = cond_check(misn->avail.cond);
       if (c < 0) {
@@ -285,11 +546,6 @@ static int mission_meetReq( int mission, int faction,
          return 0;
    }
 
-   /* Must meet previous mission requirements. */
-   if ((misn->avail.done != NULL) &&
-         (player_missionAlreadyDone( mission_getID(misn->avail.done) ) == 0))
-      return 0;
-
   return 1;
 }
 
@@ -306,24 +562,27 @@ void missions_run( int loc, int faction, const char* planet, const char* sysname
 {
    MissionData* misn;
    Mission mission;
-   int i;
+   int i, j;
    double chance;
 
-   for (i=0; i<mission_nstack; i++) {
+   if ((loc < 0) || (loc >= MISSION_NLOC))
+      return;
+
+   for (j=0; j<mission_nloc[loc]; j++) {
+      i    = mission_loc[loc][j];
       misn = &mission_stack[i];
-      if (misn->avail.loc==loc) {
 
-         if (!mission_meetReq(i, faction, planet, sysname))
-            continue;
+      /* Not batched, created missions may change what conditionals check. */
+      if (!mission_meetReq(i, faction, planet, sysname))
+         continue;
 
-         chance = (double)(misn->avail.chance % 100)/100.;
-         if (chance == 0.) /* We want to consider 100 -> 100% not 0% */
-            chance = 1.;
+      chance = (double)(misn->avail.chance % 100)/100.;
+      if (chance == 0.) /* We want to consider 100 -> 100% not 0% */
+         chance = 1.;
 
-         if (RNGF() < chance) {
-            mission_init( &mission, misn, 1, 1 );
-            mission_cleanup(&mission); /* it better clean up for itself or we do it */
-         }
+      if (RNGF() < chance) {
+         mission_init( &mission, misn, 1, 1 );
+         mission_cleanup(&mission); /* it better clean up for itself or we do it */
       }
    }
 }
@@ -443,40 +702,118 @@ int mission_unlinkCargo( Mission* misn, unsigned int cargo_id )
 
 
 /**
- * @brief Updates the missions triggering timers if needed.
+ * @brief Runs a mission timer that is up.
+ *
+ * Only accepted missions have their timers armed.  Timers that are up while
+ *  the player is dead get parked until the game is loaded again.
  *
- *    @param dt Current deltatick.
+ *    @param id ID of the mission that started the timer.
+ *    @param data Slot of the timer in the mission.
+ *    @return Always 0, the timer is done.
  */
-void missions_update( const double dt )
+static int mission_timerRun( unsigned int id, void *data )
 {
-   int i,j;
-
-   /* Don't update if player is dead. */
-   if ((player==NULL) || player_isFlag(PLAYER_DESTROYED))
-      return;
+   int i, t;
+   Mission *misn;
+   char *func;
 
+   misn = NULL;
    for (i=0; i<MISSION_MAX; i++) {
+      if (player_missions[i].id == id) {
+         misn = &player_missions[i];
+         break;
+      }
+   }
+   if (misn == NULL) {
+      WARN("Timer of mission %u which isn't running.", id);
+      return 0;
+   }
+   t = (int)(intptr_t)data;
 
-      /* Mission must be active. */
-      if (player_missions[i].id != 0) {
-         for (j=0; j<MISSION_TIMER_MAX; j++) {
+   /* Can't run while the player is dead. */
+   if ((player==NULL) || player_isFlag(PLAYER_DESTROYED)) {
+      misn->timers[t].id    = 0;
+      misn->timers[t].delay = 0.;
+      return 0;
+   }
 
-            /* Timer must be active. */
-            if (player_missions[i].timer[j] > 0.) {
+   /* Free the slot before running since the mission can go away. */
+   func = misn->timers[t].func;
+   misn->timers[t].id   = 0;
+   misn->timers[t].func = NULL;
 
-               player_missions[i].timer[j] -= dt;
+   misn_run( misn, func );
+   free(func);
+   return 0;
+}
 
-               /* Timer is up - trigger function. */
-               if (player_missions[i].timer[j] < 0.) {
-                  misn_run( &player_missions[i], player_missions[i].tfunc[j] );
-                  player_missions[i].timer[j] = 0.;
-                  free(player_missions[i].tfunc[j]);
-                  player_missions[i].tfunc[j] = NULL;
-               }
-            }
-         }
-      }
+
+/**
+ * @brief Starts a mission timer.
+ *
+ *    @param misn Mission starting the timer.
+ *    @param func Function to run when the timer is up.
+ *    @param delay Seconds until the timer is up.
+ *    @return The slot of the timer.
+ */
+int mission_timerStart( Mission *misn, const char *func, double delay )
+{
+   int t;
+
+   /* Reuse a free slot if possible. */
+   for (t=0; t<misn->ntimers; t++)
+      if (misn->timers[t].func == NULL)
+         break;
+   if (t >= misn->ntimers) {
+      misn->ntimers++;
+      misn->timers = realloc( misn->timers, sizeof(MissionTimer) * misn->ntimers );
    }
+
+   /* Missions on offer keep them parked until they're accepted. */
+   misn->timers[t].id    = 0;
+   misn->timers[t].func  = strdup(func);
+   misn->timers[t].delay = delay;
+   if (misn->accepted)
+      misn->timers[t].id = timer_add( delay, mission_timerRun, misn->id, (void*)(intptr_t)t );
+   return t;
+}
+
+
+/**
+ * @brief Stops a mission timer.
+ *
+ *    @param misn Mission that started the timer.
+ *    @param t Slot of the timer.
+ */
+void mission_timerStop( Mission *misn, int t )
+{
+   if ((t < 0) || (t >= misn->ntimers) || (misn->timers[t].func == NULL))
+      return;
+
+   if (misn->timers[t].id != 0)
+      timer_cancel( misn->timers[t].id );
+   misn->timers[t].id = 0;
+   free(misn->timers[t].func);
+   misn->timers[t].func = NULL;
+}
+
+
+/**
+ * @brief Arms the parked timers of a mission.
+ *
+ * Must be called once the mission is accepted, the timers start counting
+ *  from then.
+ *
+ *    @param misn Mission to arm the timers of.
+ */
+void mission_timerResume( Mission *misn )
+{
+   int t;
+
+   for (t=0; t<misn->ntimers; t++)
+      if ((misn->timers[t].func != NULL) && (misn->timers[t].id == 0))
+         misn->timers[t].id = timer_add( misn->timers[t].delay,
+               mission_timerRun, misn->id, (void*)(intptr_t)t );
 }
 
 
@@ -520,14 +857,14 @@ void mission_cleanup( Mission* misn )
       }
       free(misn->cargo);
    }
-   for (i=0; i<MISSION_TIMER_MAX; i++) {
-      if (misn->tfunc[i] != NULL)
-         free(misn->tfunc[i]);
-   }
+   for (i=0; i<misn->ntimers; i++)
+      mission_timerStop( misn, i );
+   if (misn->timers != NULL)
+      free(misn->timers);
    if (misn->osd > 0)
       osd_destroy(misn->osd);
    if (misn->L)
-      lua_close(misn->L);
+      mission_stateRelease(misn->L);
 
    /* Clear the memory. */
    memset( misn, 0, sizeof(Mission) );
@@ -618,66 +955,130 @@ static int mission_compare( const void* arg1, const void* arg2 )
 
 
 /**
- * @brief Generates a mission list. This runs create() so won't work with all
- *        missions.
+ * @brief Picks the missions that would be available without creating them.
  *
- *    @param[out] n Missions created.
+ * Only checks the requirements and rolls the chances, which is cheap compared
+ *  to running the create functions.  Each candidate gets its own seed so that
+ *  it comes out the same no matter when or in which order it's created.
+ *
+ *    @param[out] n Candidates picked.
  *    @param faction Faction of the planet.
  *    @param planet Name of the planet.
  *    @param sysname Name of the current system.
- *    @param loc Location 
- *    @return The stack of Missions created with n members.
+ *    @param loc Location
+ *    @return The candidates or NULL if there are none.
  */
-Mission* missions_genList( int *n, int faction,
+MissionCand* missions_genCand( int *n, int faction,
       const char* planet, const char* sysname, int loc )
 {
-   int i,j, m, alloced;
+   int i,j,k, m, alloced;
    double chance;
    int rep;
-   Mission* tmp;
+   MissionCand* tmp;
    MissionData* misn;
 
-   /* Find available missions. */
    tmp      = NULL;
    m        = 0;
    alloced  = 0;
-   for (i=0; i<mission_nstack; i++) {
+   if ((loc < 0) || (loc >= MISSION_NLOC)) {
+      (*n) = 0;
+      return NULL;
+   }
+
+   /* Nothing runs in between so conditionals can be shared. */
+   cond_batchStart();
+   for (k=0; k<mission_nloc[loc]; k++) {
+      i    = mission_loc[loc][k];
       misn = &mission_stack[i];
-      if (misn->avail.loc == loc) {
 
-         /* Must meet requirements. */
-         if (!mission_meetReq(i, faction, planet, sysname))
-            continue;
+      /* Must meet requirements. */
+      if (!mission_meetReq(i, faction, planet, sysname))
+         continue;
 
-         /* Must hit chance. */
-         chance = (double)(misn->avail.chance % 100)/100.;
-         if (chance == 0.) /* We want to consider 100 -> 100% not 0% */
-            chance = 1.;
-         rep = MAX(1, misn->avail.chance / 100);
-
-         for (j=0; j<rep; j++) /* random chance of rep appearances */
-            if (RNGF() < chance) {
-               m++;
-               /* Extra allocation. */
-               if (m > alloced) {
-                  alloced += 32;
-                  tmp      = realloc( tmp, sizeof(Mission) * alloced );
-               }
-               /* Initialize the mission. */
-               if (mission_init( &tmp[m-1], misn, 1, 1 ) < 0)
-                  m--;
+      /* Must hit chance. */
+      chance = (double)(misn->avail.chance % 100)/100.;
+      if (chance == 0.) /* We want to consider 100 -> 100% not 0% */
+         chance = 1.;
+      rep = MAX(1, misn->avail.chance / 100);
+
+      for (j=0; j<rep; j++) /* random chance of rep appearances */
+         if (RNGF() < chance) {
+            m++;
+            /* Extra allocation. */
+            if (m > alloced) {
+               alloced += MISSION_CHUNK;
+               tmp      = realloc( tmp, sizeof(MissionCand) * alloced );
             }
-      }
+            tmp[m-1].id    = i;
+            tmp[m-1].seed  = randint();
+         }
    }
+   cond_batchEnd();
 
-   /* Sort. */
-   if (tmp != NULL) {
-      qsort( tmp, m, sizeof(Mission), mission_compare );
-      (*n) = m;
-   }
-   else {
+   (*n) = m;
+   return tmp;
+}
+
+
+/**
+ * @brief Creates the missions picked by missions_genCand.
+ *
+ * Runs the create functions, missions that fail to create are left out.
+ *
+ *    @param[out] n Missions created.
+ *    @param cand Candidates to create.
+ *    @param ncand Number of candidates.
+ *    @return The stack of Missions created with n members.
+ */
+Mission* missions_createCand( int *n, const MissionCand *cand, int ncand )
+{
+   int i, m;
+   Mission* tmp;
+   RNGState rng;
+
+   if (ncand <= 0) {
       (*n) = 0;
+      return NULL;
    }
+
+   tmp = malloc( sizeof(Mission) * ncand );
+   m   = 0;
+   for (i=0; i<ncand; i++) {
+      rng_stateSeed( &rng, cand[i].seed );
+      rng_setState( &rng );
+      if (mission_init( &tmp[m], &mission_stack[ cand[i].id ], 1, 1 ) >= 0)
+         m++;
+      rng_setState( NULL );
+   }
+
+   /* Sort. */
+   qsort( tmp, m, sizeof(Mission), mission_compare );
+   (*n) = m;
+   return tmp;
+}
+
+
+/**
+ * @brief Generates a mission list. This runs create() so won't work with all
+ *        missions.
+ *
+ *    @param[out] n Missions created.
+ *    @param faction Faction of the planet.
+ *    @param planet Name of the planet.
+ *    @param sysname Name of the current system.
+ *    @param loc Location 
+ *    @return The stack of Missions created with n members.
+ */
+Mission* missions_genList( int *n, int faction,
+      const char* planet, const char* sysname, int loc )
+{
+   MissionCand *cand;
+   Mission *tmp;
+   int ncand;
+
+   cand = missions_genCand( &ncand, faction, planet, sysname, loc );
+   tmp  = missions_createCand( n, cand, ncand );
+   free( cand );
    return tmp;
 }
 
@@ -716,7 +1117,7 @@ static int mission_parse( MissionData* temp, const xmlNodePtr parent )
    /* To check if mission is valid. */
    lua_State *L;
    int ret;
-   char *buf;
+   const char *buf;
    uint32_t len;
 #endif /* DEBUGGING */
 
@@ -748,13 +1149,13 @@ static int mission_parse( MissionData* temp, const xmlNodePtr parent )
 #ifdef DEBUGGING
          /* Check to see if syntax is valid. */
          L = luaL_newstate();
-         buf = ndata_read( temp->lua, &len );
+         buf = ndata_borrow( temp->lua, &len );
          ret = luaL_loadbuffer(L, buf, len, temp->name );
          if (ret == LUA_ERRSYNTAX) {
             WARN("Mission Lua '%s' of mission '%s' syntax error: %s",
                   temp->name, temp->lua, lua_tostring(L,-1) );
          }
-         free(buf);
+         ndata_release(buf);
          lua_close(L);
 #endif /* DEBUGGING */
 
@@ -815,7 +1216,7 @@ int missions_load (void)
 {
    int m;
    uint32_t bufsize;
-   char *buf = ndata_read( MISSION_DATA, &bufsize );
+   const char *buf = ndata_borrow( MISSION_DATA, &bufsize );
 
    xmlNodePtr node;
    xmlDocPtr doc = xmlParseMemory( buf, bufsize );
@@ -850,10 +1251,11 @@ int missions_load (void)
 
    /* Shrink to minimum. */
    mission_stack = realloc(mission_stack, sizeof(MissionData)*mission_nstack);
+   missions_index();
 
    /* Clean up. */
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    DEBUG("Loaded %d Mission%s", mission_nstack, (mission_nstack==1) ? "" : "s" );
 
@@ -861,6 +1263,27 @@ int missions_load (void)
 }
 
 
+/**
+ * @brief Groups the missions by location.
+ *
+ * Missions at each location stay in ID order so they use the random number
+ *  generator in the same order as before.
+ */
+static void missions_index (void)
+{
+   int i, loc;
+
+   for (i=0; i<mission_nstack; i++) {
+      loc = mission_stack[i].avail.loc;
+      if ((loc < 0) || (loc >= MISSION_NLOC))
+         continue;
+      mission_loc[loc] = realloc( mission_loc[loc],
+            sizeof(int) * (mission_nloc[loc]+1) );
+      mission_loc[loc][ mission_nloc[loc]++ ] = i;
+   }
+}
+
+
 /**
  * @brief Frees all the mission data.
  */
@@ -877,6 +1300,14 @@ void missions_free (void)
    free( mission_stack );
    mission_stack = NULL;
    mission_nstack = 0;
+   for (i=0; i<MISSION_NLOC; i++) {
+      free( mission_loc[i] );
+      mission_loc[i]  = NULL;
+      mission_nloc[i] = 0;
+   }
+
+   /* Free the Lua states. */
+   mission_stateFree();
 }
 
 
@@ -1243,13 +1674,15 @@ int missions_saveActive( xmlTextWriterPtr writer )
 
          /* Timers. */
          xmlw_startElem(writer,"timers");
-         for (j=0; j<MISSION_TIMER_MAX; j++) {
-            if (player_missions[i].timer[j] > 0.) {
+         for (j=0; j<player_missions[i].ntimers; j++) {
+            if (player_missions[i].timers[j].func != NULL) {
                xmlw_startElem(writer,"timer");
               
                xmlw_attr(writer,"id","%d",j);
-               xmlw_attr(writer,"func","%s",player_missions[i].tfunc[j]);
-               xmlw_str(writer,"%f",player_missions[i].timer[j]);
+               xmlw_attr(writer,"func","%s",player_missions[i].timers[j].func);
+               xmlw_str(writer,"%f", (player_missions[i].timers[j].id != 0) ?
+                     timer_left(player_missions[i].timers[j].id) :
+                     player_missions[i].timers[j].delay );
 
                xmlw_endElem(writer); /* "timer" */
             }
@@ -1390,9 +1823,18 @@ static int missions_parseActive( xmlNodePtr parent )
                      i = atoi(buf);
                      free(buf);
                      xmlr_attr(nest,"func",buf);
-                     /* Set the timer. */
-                     misn->timer[i] = xml_getFloat(nest);
-                     misn->tfunc[i] = buf;
+                     /* Set the timer, keeping the slot it had. */
+                     if (i >= misn->ntimers) {
+                        misn->timers = realloc( misn->timers, sizeof(MissionTimer) * (i+1) );
+                        memset( &misn->timers[misn->ntimers], 0,
+                              sizeof(MissionTimer) * (i+1-misn->ntimers) );
+                        misn->ntimers = i+1;
+                     }
+                     mission_timerStop( misn, i );
+                     misn->timers[i].delay = xml_getFloat(nest);
+                     misn->timers[i].id    = timer_add( misn->timers[i].delay,
+                           mission_timerRun, misn->id, (void*)(intptr_t)i );
+                     misn->timers[i].func  = buf;
                   }
                } while (xml_nextNode(nest));
             }
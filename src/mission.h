@@ -29,7 +29,15 @@
 /* actual flags */
 #define MISSION_UNIQUE        (1<<0) /**< Unique missions can't be repeated */
 
-#define MISSION_TIMER_MAX     10 /**< Maximum amount of timers in a mission. */
+
+/**
+ * @brief Timer started by a mission.
+ */
+typedef struct MissionTimer_ {
+   unsigned int id; /**< ID of the timer, 0 if it's parked. */
+   char *func; /**< Function to run when the timer is up, NULL if the slot is free. */
+   double delay; /**< Seconds left of a parked timer. */
+} MissionTimer;
 
 
 /**
@@ -103,8 +111,8 @@ typedef struct Mission_ {
    SysMarker sys_markerType; /**< Type of the marker. */
 
    /* Timers. */
-   double timer[MISSION_TIMER_MAX]; /**< Mission timers. */
-   char *tfunc[MISSION_TIMER_MAX]; /**< Functions assosciated to the timers. */
+   MissionTimer *timers; /**< Mission timers, the index is the Lua ID. */
+   int ntimers; /**< Number of timer slots. */
 
    /* OSD. */
    unsigned int osd; /**< On-Screen Display ID. */
@@ -114,6 +122,17 @@ typedef struct Mission_ {
 } Mission;
 
 
+/**
+ * @brief Mission that can be created later.
+ *
+ * @sa missions_genCand
+ */
+typedef struct MissionCand_ {
+   int id; /**< ID of the MissionData. */
+   unsigned int seed; /**< Seed of the RNG used while creating it. */
+} MissionCand;
+
+
 /*
  * current player missions
  */
@@ -126,6 +145,9 @@ extern Mission player_missions[MISSION_MAX]; /**< Player's active missions. */
  */
 Mission* missions_genList( int *n, int faction,
       const char* planet, const char* sysname, int loc );
+MissionCand* missions_genCand( int *n, int faction,
+      const char* planet, const char* sysname, int loc );
+Mission* missions_createCand( int *n, const MissionCand *cand, int ncand );
 int mission_accept( Mission* mission ); /* player accepted mission for computer/bar */
 void missions_run( int loc, int faction, const char* planet, const char* sysname );
 int mission_start( const char *name );
@@ -133,7 +155,9 @@ int mission_start( const char *name );
 /*
  * misc
  */
-void missions_update( const double dt );
+int mission_timerStart( Mission *misn, const char *func, double delay );
+void mission_timerStop( Mission *misn, int t );
+void mission_timerResume( Mission *misn );
 int mission_getID( const char* name );
 MissionData* mission_get( int id );
 void mission_sysMark (void);
@@ -523,7 +523,7 @@ void music_setPos( double sec )
  */
 static int music_luaInit (void)
 {
-   char *buf;
+   const char *buf;
    uint32_t bufsize;
 
    if (music_disabled)
@@ -533,12 +533,13 @@ static int music_luaInit (void)
       music_luaQuit();
 
    music_lua = nlua_newState();
+   nlua_setOwner( music_lua, "music", NULL );
    nlua_loadBasic(music_lua);
    nlua_loadStandard(music_lua,1);
    nlua_loadMusic(music_lua,0); /* write it */
 
    /* load the actual lua music code */
-   buf = ndata_read( MUSIC_LUA_PATH, &bufsize );
+   buf = ndata_borrow( MUSIC_LUA_PATH, &bufsize );
    if (luaL_dobuffer(music_lua, buf, bufsize, MUSIC_LUA_PATH) != 0) {
       ERR("Error loading music file: %s\n"
           "%s\n"
@@ -546,7 +547,7 @@ static int music_luaInit (void)
             MUSIC_LUA_PATH, lua_tostring(music_lua,-1) );
       return -1;
    }
-   free(buf);
+   ndata_release(buf);
 
    return 0;
 }
@@ -563,7 +564,7 @@ static void music_luaQuit (void)
    if (music_lua == NULL)
       return;
 
-   lua_close(music_lua);
+   nlua_close(music_lua);
    music_lua = NULL;
 }
 
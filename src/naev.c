@@ -19,6 +19,7 @@
 /* localised global */
 #include "SDL.h"
 #include "SDL_image.h"
+#include "SDL_mutex.h"
 
 #include "naev.h"
 #include "log.h" /* for DEBUGGING */
@@ -65,6 +66,7 @@
 #include "economy.h"
 #include "menu.h"
 #include "mission.h"
+#include "nlua.h"
 #include "nlua_misn.h"
 #include "nfile.h"
 #include "nebula.h"
@@ -77,6 +79,12 @@
 #include "event.h"
 #include "cond.h"
 #include "land.h"
+#include "threadpool.h"
+#include "dcache.h"
+#include "timer.h"
+#ifdef NAEV_BENCH
+#include "bench.h"
+#endif /* NAEV_BENCH */
 
 
 #define CONF_FILE       "conf.lua" /**< Configuration file by default. */
@@ -116,8 +124,6 @@ static asymbol **syms = NULL;
 static void print_SDLversion (void);
 static void loadscreen_load (void);
 static void loadscreen_unload (void);
-static void load_all (void);
-static void unload_all (void);
 static void display_fps( const double dt );
 static void window_caption (void);
 static void debug_sigInit (void);
@@ -143,6 +149,11 @@ int main( int argc, char** argv )
 {
    char buf[PATH_MAX];
 
+#ifdef NAEV_BENCH
+   /* Benchmark runs the simulation on its own without a window. */
+   return bench_main( argc, argv );
+#endif /* NAEV_BENCH */
+
    /* Save the binary path. */
    binary_path = strdup(argv[0]);
    
@@ -182,6 +193,10 @@ int main( int argc, char** argv )
    LIBXML_TEST_VERSION
    xmlInitParser();
 
+   /* Lua states are created from here on, some by the worker threads. */
+   if (nlua_init())
+      ERR("Failed to initialize Lua.");
+
    /* Input must be initialized for config to work. */
    input_init(); 
 
@@ -212,6 +227,9 @@ int main( int argc, char** argv )
    /* random numbers */
    rng_init();
 
+   /* Worker threads. */
+   threadpool_init( conf.threads );
+
 
    /*
     * OpenGL
@@ -317,6 +335,7 @@ int main( int argc, char** argv )
    pilots_free(); /* frees the pilots, they were locked up :( */
    cond_exit(); /* destroy conditional subsystem. */
    land_exit(); /* Destroys landing vbo and friends. */
+   timers_exit(); /* Frees the mission and event timers. */
 
    /* data unloading */
    unload_all();
@@ -325,9 +344,6 @@ int main( int argc, char** argv )
    gl_freeFont(NULL);
    gl_freeFont(&gl_smallFont);
 
-   /* Close data. */
-   ndata_close();
-
    /* Destroy conf. */
    conf_cleanup(); /* Frees some memory the configuration allocated. */
 
@@ -342,6 +358,12 @@ int main( int argc, char** argv )
    sound_exit(); /* kills the sound */
    news_exit(); /* destroys the news. */
 
+   /* Close data, after the sound since music streams straight from it. */
+   ndata_close();
+
+   threadpool_exit(); /* stops the worker threads. */
+   nlua_exit(); /* frees the Lua locks, all the states are closed. */
+
    /* Free the icon. */
    if (naev_icon)
       free(naev_icon);
@@ -406,6 +428,10 @@ void loadscreen_render( double done, const char *msg )
    double x,y, w,h, rh;
    SDL_Event event;
 
+   /* Nothing to render to. */
+   if (gl_has(OPENGL_HEADLESS))
+      return;
+
    /* Clear background. */
    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -477,36 +503,234 @@ static void loadscreen_unload (void)
 }
 
 
+/**
+ * @brief Stages of loading the data, in an order that satisfies the
+ *        dependencies.
+ */
+enum {
+   LOAD_COMMODITY, /**< Commodities. */
+   LOAD_FACTION, /**< Factions. */
+   LOAD_AI, /**< AI profiles. */
+   LOAD_MISSION, /**< Missions. */
+   LOAD_EVENT, /**< Events. */
+   LOAD_SPFX, /**< Special effects. */
+   LOAD_OUTFIT, /**< Outfits. */
+   LOAD_SHIP, /**< Ships. */
+   LOAD_FLEET, /**< Fleets. */
+   LOAD_SPACE, /**< Planets and systems. */
+   LOAD_STAGES /**< Number of stages. */
+};
+#define LOAD_DEP(s)     (1U<<(s)) /**< Dependency on a stage. */
+#define LOAD_POLL       10 /**< Milliseconds to wait for a stage before updating the screen. */
+#define LOAD_UPLOADS    16 /**< Textures to upload between screen updates. */
+
+
+/**
+ * @brief A stage of loading the data.
+ */
+typedef struct LoadStage_ {
+   const char *msg; /**< Loading screen message. */
+   int (*load)(void); /**< Loads the stage. */
+   unsigned int deps; /**< Stages that must be loaded first. */
+   int main; /**< Must be loaded from the main thread. */
+} LoadStage;
+/**
+ * @brief What load_all loads.
+ */
+static const LoadStage load_stages[LOAD_STAGES] = {
+   { "Loading Commodities...", commodity_load, 0, 0 },
+   { "Loading Factions...", factions_load, 0, 0 },
+   { "Loading AI...", ai_load, LOAD_DEP(LOAD_FACTION), 0 },
+   { "Loading Missions...", missions_load, LOAD_DEP(LOAD_FACTION), 0 },
+   { "Loading Events...", events_load, 0, 0 },
+   /* Also sets up force feedback. */
+   { "Loading Special Effects...", spfx_load, 0, 1 },
+   { "Loading Outfits...", outfit_load, LOAD_DEP(LOAD_SPFX), 0 },
+   { "Loading Ships...", ships_load, LOAD_DEP(LOAD_OUTFIT), 0 },
+   { "Loading Fleets...", fleet_load,
+         LOAD_DEP(LOAD_FACTION) | LOAD_DEP(LOAD_SHIP), 0 },
+   { "Loading the Universe...", space_load,
+         LOAD_DEP(LOAD_COMMODITY) | LOAD_DEP(LOAD_FACTION) | LOAD_DEP(LOAD_FLEET), 0 }
+};
+
+
+/**
+ * @brief Progress of load_all.
+ */
+typedef struct LoadState_ {
+   SDL_mutex *lock; /**< Protects the state. */
+   SDL_cond *cond; /**< Signals a stage finished. */
+   unsigned int started; /**< Stages that have been started. */
+   unsigned int loaded; /**< Stages that have been loaded. */
+   int nloaded; /**< Number of stages loaded. */
+   unsigned int failed; /**< Stages that failed to load. */
+   const char *msg; /**< Message of the last stage started. */
+   RNGState rng[LOAD_STAGES]; /**< Random number generator of each stage. */
+} LoadState;
+
+
+/**
+ * @brief Gets a stage that can be loaded.
+ *
+ * The state must be locked.
+ *
+ *    @param ls State of the loading.
+ *    @param main Whether to get stages for the main thread or the workers.
+ *    @return Stage that can be loaded or -1 if none can be yet.
+ */
+static int load_next( LoadState *ls, int main )
+{
+   int i;
+
+   for (i=0; i<LOAD_STAGES; i++) {
+      if (ls->started & LOAD_DEP(i))
+         continue;
+      if ((load_stages[i].deps & ls->loaded) != load_stages[i].deps)
+         continue;
+      if (load_stages[i].main != main)
+         continue;
+      ls->started |= LOAD_DEP(i);
+      ls->msg      = load_stages[i].msg;
+      return i;
+   }
+   return -1;
+}
+
+
+/**
+ * @brief Loads a stage.
+ *
+ * Each stage has its own random number generator so the data comes out the
+ *  same no matter the order stages end up being loaded in.
+ *
+ *    @param ls State of the loading.
+ *    @param s Stage to load.
+ */
+static void load_stage( LoadState *ls, int s )
+{
+   int ret;
+
+   rng_setState( &ls->rng[s] );
+   ret = load_stages[s].load();
+   rng_setState( NULL );
+
+   SDL_mutexP( ls->lock );
+   if (ret != 0)
+      ls->failed |= LOAD_DEP(s);
+   ls->loaded |= LOAD_DEP(s);
+   ls->nloaded++;
+   SDL_CondBroadcast( ls->cond );
+   SDL_mutexV( ls->lock );
+}
+
+
+/**
+ * @brief Loads stages from a worker thread, one for each index.
+ */
+static void load_worker( void *data, int start, int end, int thread )
+{
+   LoadState *ls;
+   int i, s;
+   (void) thread;
+
+   ls = (LoadState*) data;
+   for (i=start; i<end; i++) {
+      SDL_mutexP( ls->lock );
+      while ((s = load_next( ls, 0 )) < 0)
+         SDL_CondWait( ls->cond, ls->lock );
+      SDL_mutexV( ls->lock );
+
+      load_stage( ls, s );
+   }
+}
+
+
 /**
  * @brief Loads all the data, makes main() simpler.
+ *
+ * Stages are loaded by the worker threads as soon as the stages they depend
+ *  on are loaded, while the main thread uploads the textures they load and
+ *  keeps the loading screen updated.  Without workers they're just loaded
+ *  in order.
  */
-#define LOADING_STAGES     10. /**< Amount of loading stages. */
 void load_all (void)
 {
-   /* order is very important as they're interdependent */
-   loadscreen_render( 1./LOADING_STAGES, "Loading Commodities..." );
-   commodity_load(); /* dep for space */
-   loadscreen_render( 2./LOADING_STAGES, "Loading Factions..." );
-   factions_load(); /* dep for fleet, space, missions, AI */
-   loadscreen_render( 2./LOADING_STAGES, "Loading AI..." );
-   ai_load(); /* dep for fleets */
-   loadscreen_render( 3./LOADING_STAGES, "Loading Missions..." );
-   missions_load(); /* no dep */
-   loadscreen_render( 4./LOADING_STAGES, "Loading Events..." );
-   events_load(); /* no dep */
-   loadscreen_render( 5./LOADING_STAGES, "Loading Special Effects..." );
-   spfx_load(); /* no dep */
-   loadscreen_render( 6./LOADING_STAGES, "Loading Outfits..." );
-   outfit_load(); /* dep for ships */
-   loadscreen_render( 7./LOADING_STAGES, "Loading Ships..." );
-   ships_load(); /* dep for fleet */
-   loadscreen_render( 8./LOADING_STAGES, "Loading Fleets..." );
-   fleet_load(); /* dep for space */
-   loadscreen_render( 9./LOADING_STAGES, "Loading the Universe..." );
-   space_load();
+   LoadState ls;
+   int i, s, n, parallel, nworker, done, rendered;
+   const char *msg, *renderedmsg;
+
+   memset( &ls, 0, sizeof(LoadState) );
+   ls.lock = SDL_CreateMutex();
+   ls.cond = SDL_CreateCond();
+   for (i=0; i<LOAD_STAGES; i++)
+      rng_stateSeed( &ls.rng[i], randint() );
+
+   /* Stages load from the cache if it's up to date. */
+   dcache_open();
+
+#if HAS_THREADLOCAL
+   parallel = (threadpool_threads() > 1);
+#else /* HAS_THREADLOCAL */
+   parallel = 0; /* Stages would share the random number generator. */
+#endif /* HAS_THREADLOCAL */
+
+   if (!parallel) {
+      for (i=0; i<LOAD_STAGES; i++) {
+         loadscreen_render( (double)i/LOAD_STAGES, load_stages[i].msg );
+         load_stage( &ls, i );
+      }
+   }
+   else {
+      /* Must be done from the main thread before parsing in parallel. */
+      xmlInitParser();
+      gl_texDefer( 1 );
+
+      nworker = 0;
+      for (i=0; i<LOAD_STAGES; i++)
+         if (!load_stages[i].main)
+            nworker++;
+      threadpool_start( load_worker, &ls, nworker, 1 );
+
+      rendered    = -1;
+      renderedmsg = NULL;
+      while (1) {
+         n = gl_texUpload( LOAD_UPLOADS );
+
+         SDL_mutexP( ls.lock );
+         s = load_next( &ls, 1 );
+         if ((s < 0) && (n == 0) && (ls.nloaded < LOAD_STAGES))
+            SDL_CondWaitTimeout( ls.cond, ls.lock, LOAD_POLL );
+         done = ls.nloaded;
+         msg  = ls.msg;
+         SDL_mutexV( ls.lock );
+
+         if ((done != rendered) || (msg != renderedmsg)) {
+            loadscreen_render( (double)done/LOAD_STAGES, msg );
+            rendered    = done;
+            renderedmsg = msg;
+         }
+
+         if (s >= 0)
+            load_stage( &ls, s );
+         else if ((done >= LOAD_STAGES) && (n == 0))
+            break;
+      }
+
+      threadpool_wait();
+      gl_texDefer( 0 );
+   }
+
+   SDL_DestroyCond( ls.cond );
+   SDL_DestroyMutex( ls.lock );
+
+   /* Don't cache data that didn't load properly. */
+   dcache_close( ls.failed == 0 );
+
    loadscreen_render( 1., "Loading Completed!" );
    xmlCleanupParser(); /* Only needed to be run after all the loading is done. */
 }
+
+
 /**
  * @brief Unloads all data, simplifies main().
  */
@@ -523,6 +747,7 @@ void unload_all (void)
    factions_free();
    commodity_free();
    var_cleanup(); /* cleans up mission variables */
+   nlua_chunkFree(); /* frees the compiled scripts */
 }
 
 /**
@@ -554,6 +779,9 @@ void main_loop (void)
 
    gl_checkErr(); /* check error every loop */
 
+   /* Lua garbage is collected between frames. */
+   nlua_gcUpdate();
+
    /* Draw buffer. */
    SDL_GL_SwapBuffers();
 }
@@ -637,8 +865,7 @@ static void update_routine( double dt )
    weapons_update(dt);
    spfx_update(dt);
    pilots_update(dt);
-   missions_update(dt);
-   events_update(dt);
+   timers_update(dt);
 }
 
 
@@ -64,6 +64,10 @@
 char *naev_version( int long_version );
 char *naev_binary (void);
 
+/* Data. */
+void load_all (void);
+void unload_all (void);
+
 
 #endif /* NAEV_H */
 
@@ -59,6 +59,21 @@
 #define HAS_LILENDIAN (SDL_BYTEORDER == SDL_LIL_ENDIAN)
 
 
+/* Compiler specific. */
+/**
+ * @brief Whether or not the compiler supports thread local variables.
+ */
+#define HAS_THREADLOCAL (defined(__GNUC__) && !HAS_MACOSX)
+/**
+ * @brief Gives each thread its own copy of a variable.
+ */
+#if HAS_THREADLOCAL
+#define NTHREADLOCAL __thread
+#else /* HAS_THREADLOCAL */
+#define NTHREADLOCAL
+#endif /* HAS_THREADLOCAL */
+
+
 /* Misc stuff - mainly for debugging. */
 /**
  * @brief Whether or not to use filedescriptors.
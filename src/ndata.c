@@ -64,12 +64,7 @@ static char* ndata_filename         = NULL; /**< Packfile name. */
 static Packcache_t *ndata_cache     = NULL; /**< Actual packfile. */
 static char* ndata_packName         = NULL; /**< Name of the ndata module. */
 static SDL_mutex *ndata_lock        = NULL; /**< Lock for ndata creation. */
-
-/*
- * File list.
- */
-static const char **ndata_fileList  = NULL; /**< List of files in the packfile. */
-static uint32_t ndata_fileNList     = 0; /**< Number of files in ndata_fileList. */
+static unsigned int ndata_gen       = 0; /**< Changes whenever the data source does. */
 
 
 /*
@@ -110,10 +105,26 @@ int ndata_setPath( const char* path )
    if (ndata_filename != NULL)
       free(ndata_filename);
    ndata_filename = (path == NULL) ? NULL : strdup(path);
+   ndata_gen++;
    return 0;
 }
 
 
+/**
+ * @brief Gets the generation of the ndata.
+ *
+ * Changes every time the ndata is opened, closed or pointed somewhere else,
+ *  anything derived from the ndata contents with an older generation may be
+ *  stale.
+ *
+ *    @return The current generation.
+ */
+unsigned int ndata_generation (void)
+{
+   return ndata_gen;
+}
+
+
 /**
  * @brief Get the current ndata path.
  */
@@ -334,6 +345,7 @@ static int ndata_openPackfile (void)
    ndata_cache = pack_openCache( ndata_filename );
    if (ndata_cache == NULL)
       WARN("Unable to create Packcache from '%s'.", ndata_filename );
+   ndata_gen++;
 
    /* Close lock. */
    SDL_mutexV(ndata_lock);
@@ -378,18 +390,12 @@ void ndata_close (void)
       ndata_packName = NULL;
    }
 
-   /* Destroy the list. */
-   if (ndata_fileList != NULL) {
-      /* No need to free memory since cache does that. */
-      ndata_fileList = NULL;
-      ndata_fileNList = 0;
-   }
-
    /* Close the packfile. */
    if (ndata_cache) {
       pack_closeCache(ndata_cache);
       ndata_cache = NULL;
    }
+   ndata_gen++;
 
    /* Destroy the lock. */
    if (ndata_lock != NULL) {
@@ -490,6 +496,51 @@ void* ndata_read( const char* filename, uint32_t *filesize )
 }
 
 
+/**
+ * @brief Gets the contents of a file in the ndata to parse.
+ *
+ * When the ndata is a mapped packfile the contents aren't copied, so unlike
+ *  ndata_read they can't be modified and aren't NUL terminated. They must be
+ *  given back with ndata_release.
+ *
+ *    @param filename Name of the file to get.
+ *    @param[out] filesize Stores the size of the file.
+ *    @return The file data or NULL on error.
+ */
+const void* ndata_borrow( const char* filename, uint32_t *filesize )
+{
+   const void *data;
+
+   /* Packfile that is mapped. */
+   if (ndata_cache != NULL) {
+      data = pack_mapfileCached( ndata_cache, filename, filesize );
+      if (data != NULL)
+         return data;
+   }
+
+   /* Have to copy it. */
+   return ndata_read( filename, filesize );
+}
+
+
+/**
+ * @brief Gives back the data gotten with ndata_borrow.
+ *
+ *    @param data Data to give back.
+ */
+void ndata_release( const void* data )
+{
+   if (data == NULL)
+      return;
+
+   /* Mapped data belongs to the packfile. */
+   if ((ndata_cache != NULL) && pack_isMapped( ndata_cache, data ))
+      return;
+
+   free( (void*)data );
+}
+
+
 /**
  * @brief Creates an rwops from a file in the ndata.
  *
@@ -572,14 +623,11 @@ static char** filterList( const char** list, int nlist,
  */
 char** ndata_list( const char* path, uint32_t* nfiles )
 {
-   (void) path;
    char **files;
+   const char **list;
+   uint32_t nlist;
    int n;
 
-   /* Already loaded the list. */
-   if (ndata_fileList != NULL)
-      return filterList( ndata_fileList, ndata_fileNList, path, nfiles );
-
    /* See if can load from local directory. */
    if (ndata_cache == NULL) {
       files = nfile_readDir( &n, path );
@@ -600,9 +648,9 @@ char** ndata_list( const char* path, uint32_t* nfiles )
       return NULL;
    }
 
-   /* Load list. */
-   ndata_fileList = pack_listfilesCached( ndata_cache, &ndata_fileNList );
+   /* Only the files under the path need filtering. */
+   list = pack_listdirCached( ndata_cache, path, &nlist );
 
-   return filterList( ndata_fileList, ndata_fileNList, path, nfiles );
+   return filterList( list, nlist, path, nfiles );
 }
 
@@ -25,11 +25,14 @@ int ndata_check( const char* path );
 int ndata_setPath( const char* path );
 const char* ndata_getPath (void);
 const char* ndata_name (void);
+unsigned int ndata_generation (void);
 
 /*
  * Individual file functions.
  */
 void* ndata_read( const char* filename, uint32_t *filesize );
+const void* ndata_borrow( const char* filename, uint32_t *filesize );
+void ndata_release( const void* data );
 char** ndata_list( const char *path, uint32_t* nfiles );
 
 
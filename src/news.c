@@ -235,7 +235,7 @@ void news_widget( unsigned int wid, int x, int y, int w, int h )
 int news_init (void)
 {
    lua_State *L;
-   char *buf;
+   const char *buf;
    uint32_t bufsize;
 
    /* Already initialized. */
@@ -245,6 +245,7 @@ int news_init (void)
    /* Create the state. */
    news_state = nlua_newState();
    L = news_state;
+   nlua_setOwner( L, "news", NULL );
 
    /* Load the libraries. */
    nlua_loadBasic(L);
@@ -252,7 +253,7 @@ int news_init (void)
    nlua_loadStandard(L, 1);
 
    /* Load the news file. */
-   buf = ndata_read( LUA_NEWS, &bufsize );
+   buf = ndata_borrow( LUA_NEWS, &bufsize );
    if (luaL_dobuffer(news_state, buf, bufsize, LUA_NEWS) != 0) {
       WARN("Failed to load news file: %s\n"
            "%s\n"
@@ -260,7 +261,7 @@ int news_init (void)
             LUA_NEWS, lua_tostring(L,-1));
       return -1;
    }
-   free(buf);
+   ndata_release(buf);
 
    return 0;
 }
@@ -319,7 +320,7 @@ void news_exit (void)
    news_mlines = 0;
 
    /* Clean up. */
-   lua_close(news_state);
+   nlua_close(news_state);
    news_state = NULL;
 }
 
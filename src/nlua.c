@@ -12,11 +12,23 @@
 
 #include "naev.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAS_POSIX
+#include <sys/time.h>
+#endif /* HAS_POSIX */
+
+#include "SDL.h"
+
 #include "lauxlib.h"
 
 #include "nluadef.h"
 #include "log.h"
 #include "ndata.h"
+#include "nfile.h"
+#include "conf.h"
+#include "md5.h"
 #include "nlua_rnd.h"
 #include "nlua_faction.h"
 #include "nlua_var.h"
@@ -29,32 +41,572 @@
 #include "nlua_diff.h"
 
 
+#define NLUA_CHUNK_DIR      "luacache/" /**< Directory to persist compiled chunks in. */
+#define NLUA_CHUNK_CHUNK    32 /**< Size to grow the chunk cache by. */
+
+#define NLUA_MEM_ALIGN      8 /**< Granularity of the small allocation sizes. */
+#define NLUA_MEM_CLASSES    32 /**< Number of small allocation sizes. */
+#define NLUA_MEM_SMALL      (NLUA_MEM_ALIGN*NLUA_MEM_CLASSES) /**< Largest small allocation. */
+#define NLUA_MEM_BLOCK      16384 /**< Size of the blocks small allocations are carved from. */
+
+#define NLUA_GC_MIN         65536 /**< Bytes a managed state may use before collecting. */
+#define NLUA_GC_PAUSE       2 /**< Growth since the last cycle that starts a new one. */
+#define NLUA_GC_URGENT      4 /**< Growth since the last cycle that ignores the budget. */
+#define NLUA_GC_STEPKB      8 /**< KiB of work of each incremental step. */
+
+
+/**
+ * @brief A compiled Lua chunk.
+ *
+ * Chunks are identified by the md5 of the script path and source so editing
+ * a script in the data directory invalidates it without any bookkeeping.
+ */
+typedef struct LuaChunk_ {
+   md5_byte_t md5[16]; /**< md5 of the path and source. */
+   char *code; /**< Bytecode from lua_dump. */
+   size_t len; /**< Length of the bytecode. */
+   char *name; /**< Path of the script. */
+   unsigned int gen; /**< ndata generation the source was last checked in. */
+} LuaChunk;
+static LuaChunk *nlua_chunks  = NULL; /**< Compiled chunk cache. */
+static int nlua_nchunks       = 0; /**< Number of compiled chunks. */
+static int nlua_mchunks       = 0; /**< Allocated compiled chunks. */
+static unsigned long nlua_chunkHits   = 0; /**< Loads that didn't need the source. */
+static unsigned long nlua_chunkReads  = 0; /**< Loads that read the source but not compile it. */
+static unsigned long nlua_chunkMisses = 0; /**< Loads that compiled the source. */
+static SDL_mutex *nlua_chunkLock = NULL; /**< Lock for the chunk cache. */
+
+
+/**
+ * @brief Buffer lua_dump writes to.
+ */
+typedef struct LuaDumpBuf_ {
+   char *data; /**< Data written. */
+   size_t len; /**< Length of the data. */
+   size_t size; /**< Allocated size. */
+} LuaDumpBuf;
+
+
+/**
+ * @brief Block small allocations are carved from.
+ */
+typedef struct LuaMemBlock_ {
+   struct LuaMemBlock_ *next; /**< Next block of the state. */
+   double pad; /**< Keeps the data aligned. */
+} LuaMemBlock;
+
+
+/**
+ * @brief Memory of a Lua state.
+ *
+ * Small allocations are rounded up to a size class and carved out of blocks
+ *  owned by the state, freed ones are kept in a list per class to be reused.
+ *  Lua always tells the allocator the size of what it frees so no header is
+ *  needed.  Larger allocations go to the system.
+ */
+typedef struct LuaMem_ {
+   char owner[64]; /**< What the state is used for. */
+   size_t used; /**< Bytes in use. */
+   size_t peak; /**< Most bytes ever in use. */
+   size_t limit; /**< Most bytes the state may use, 0 if unlimited. */
+   int warned; /**< Already warned about hitting the limit. */
+   void *free[NLUA_MEM_CLASSES]; /**< Freed small allocations of each class. */
+   LuaMemBlock *blocks; /**< Blocks of the state. */
+   char *bump; /**< Next unused byte of the current block. */
+   char *end; /**< End of the current block. */
+   lua_State *L; /**< The state itself. */
+   int gc; /**< Garbage is collected by nlua_gcUpdate instead of by Lua. */
+   int gcrun; /**< A collection cycle is in progress. */
+   size_t gcbase; /**< Bytes in use at the end of the last cycle. */
+   struct LuaMem_ *prev; /**< Previous state in the list. */
+   struct LuaMem_ *next; /**< Next state in the list. */
+} LuaMem;
+static LuaMem *nlua_mem       = NULL; /**< All the states. */
+static SDL_mutex *nlua_memLock = NULL; /**< Lock for the list of states. */
+static LuaMem *nlua_gcNext    = NULL; /**< State nlua_gcUpdate continues with. */
+static LuaGCStats nlua_gcStat; /**< Garbage collection statistics. */
+
+
 /*
  * prototypes
  */
+static void* nlua_alloc( void *ud, void *ptr, size_t osize, size_t nsize );
+static void* nlua_memSmall( LuaMem *mem, int c );
+static void* nlua_memLarger( LuaMem *mem, int c );
+static int nlua_panic( lua_State *L );
+static double nlua_timeMS (void);
 static int nlua_packfileLoader( lua_State* L );
+static void nlua_chunkHash( const char *filename, const char *buf,
+      uint32_t bufsize, md5_byte_t md5[16] );
+static void nlua_chunkPath( char *path, int len, const md5_byte_t md5[16] );
+static LuaChunk* nlua_chunkFind( const md5_byte_t md5[16] );
+static LuaChunk* nlua_chunkFindName( const char *filename );
+static LuaChunk* nlua_chunkAdd( const md5_byte_t md5[16], char *code, size_t len,
+      const char *filename );
+static void nlua_chunkRemove( LuaChunk *c, int unlink );
+static int nlua_chunkWriter( lua_State *L, const void *p, size_t sz, void *ud );
+static int nlua_loadChunkUnlocked( lua_State *L, const char *filename );
+
+
+/**
+ * @brief Gets a small allocation of a size class.
+ *
+ *    @param mem Memory of the state.
+ *    @param c Size class.
+ *    @return The allocation or NULL on failure.
+ */
+static void* nlua_memSmall( LuaMem *mem, int c )
+{
+   void *p;
+   size_t sz;
+   LuaMemBlock *b;
+
+   /* Reuse a freed one. */
+   p = mem->free[c];
+   if (p != NULL) {
+      mem->free[c] = *(void**)p;
+      return p;
+   }
+
+   /* Carve from the current block, the tail of a full one is lost. */
+   sz = (c+1) * NLUA_MEM_ALIGN;
+   if ((mem->bump == NULL) || (mem->bump + sz > mem->end)) {
+      b = malloc( NLUA_MEM_BLOCK );
+      if (b == NULL)
+         return NULL;
+      b->next     = mem->blocks;
+      mem->blocks = b;
+      mem->bump   = (char*)(b+1);
+      mem->end    = (char*)b + NLUA_MEM_BLOCK;
+   }
+   p          = mem->bump;
+   mem->bump += sz;
+   return p;
+}
+
+
+/**
+ * @brief Gets a freed small allocation of a class larger than needed.
+ *
+ *    @param mem Memory of the state.
+ *    @param c Size class needed.
+ *    @return The allocation or NULL if none are free.
+ */
+static void* nlua_memLarger( LuaMem *mem, int c )
+{
+   void *p;
+
+   for (c=c+1; c<NLUA_MEM_CLASSES; c++) {
+      p = mem->free[c];
+      if (p != NULL) {
+         mem->free[c] = *(void**)p;
+         return p;
+      }
+   }
+   return NULL;
+}
 
 
 /**
- * @brief Wrapper around luaL_newstate.
+ * @brief Allocator of the Lua states.
+ *
+ * Follows the lua_Alloc contract, osize is always the size of ptr.
+ */
+static void* nlua_alloc( void *ud, void *ptr, size_t osize, size_t nsize )
+{
+   LuaMem *mem;
+   void *p;
+   int oc, nc;
+
+   mem = (LuaMem*) ud;
+   oc  = ((ptr != NULL) && (osize > 0) && (osize <= NLUA_MEM_SMALL)) ?
+         (int)((osize-1) / NLUA_MEM_ALIGN) : -1;
+
+   /* Free. */
+   if (nsize == 0) {
+      if (ptr != NULL) {
+         if (oc >= 0) {
+            *(void**)ptr = mem->free[oc];
+            mem->free[oc] = ptr;
+         }
+         else
+            free(ptr);
+         mem->used -= osize;
+      }
+      return NULL;
+   }
+   if (ptr == NULL)
+      osize = 0;
+
+   /* Only check the limit when growing, Lua shrinks while collecting. */
+   if ((mem->limit > 0) && (nsize > osize) &&
+         (mem->used - osize + nsize > mem->limit)) {
+      if (!mem->warned) {
+         WARN("Lua state '%s' ran out of its %lu KiB of memory.",
+               mem->owner, (unsigned long) mem->limit / 1024);
+         mem->warned = 1;
+      }
+      return NULL;
+   }
+
+   nc = (nsize <= NLUA_MEM_SMALL) ? (int)((nsize-1) / NLUA_MEM_ALIGN) : -1;
+
+   /* Same size class or both big. */
+   if ((ptr != NULL) && (oc == nc)) {
+      p = (nc >= 0) ? ptr : realloc( ptr, nsize );
+      if (p == NULL)
+         return NULL;
+   }
+   else {
+      p = (nc >= 0) ? nlua_memSmall( mem, nc ) : malloc( nsize );
+
+      /* Lua 5.1 can't handle failing to shrink, so try harder.  A block of a
+       *  larger class works too, once freed it's reused for the smaller one. */
+      if ((p == NULL) && (ptr != NULL) && (nc >= 0) && (nsize < osize)) {
+         p = nlua_memLarger( mem, nc );
+         if ((p == NULL) && (oc >= 0)) {
+            mem->used -= osize - nsize;
+            return ptr;
+         }
+         /* Only a big allocation shrunk with no memory left at all fails. */
+      }
+
+      if (p == NULL)
+         return NULL;
+      if (ptr != NULL) {
+         memcpy( p, ptr, MIN( osize, nsize ) );
+         if (oc >= 0) {
+            *(void**)ptr = mem->free[oc];
+            mem->free[oc] = ptr;
+         }
+         else
+            free(ptr);
+      }
+   }
+
+   mem->used += nsize - osize;
+   if (mem->used > mem->peak)
+      mem->peak = mem->used;
+   return p;
+}
+
+
+/**
+ * @brief Handles errors outside of protected calls like luaL_newstate does.
+ */
+static int nlua_panic( lua_State *L )
+{
+   WARN("PANIC: unprotected error in call to Lua API (%s)",
+         lua_tostring(L, -1));
+   return 0;
+}
+
+
+/**
+ * @brief Initializes the Lua subsystem.
+ *
+ * Must be called from the main thread before any state is created, states
+ *  are created from the worker threads while loading.
+ *
+ *    @return 0 on success.
+ */
+int nlua_init (void)
+{
+   nlua_memLock   = SDL_CreateMutex();
+   nlua_chunkLock = SDL_CreateMutex();
+   if ((nlua_memLock == NULL) || (nlua_chunkLock == NULL)) {
+      WARN("Unable to create the Lua locks: %s", SDL_GetError());
+      nlua_exit();
+      return -1;
+   }
+   return 0;
+}
+
+
+/**
+ * @brief Cleans up the Lua subsystem, once every state is closed.
+ */
+void nlua_exit (void)
+{
+   if (nlua_memLock != NULL)
+      SDL_DestroyMutex( nlua_memLock );
+   if (nlua_chunkLock != NULL)
+      SDL_DestroyMutex( nlua_chunkLock );
+   nlua_memLock   = NULL;
+   nlua_chunkLock = NULL;
+}
+
+
+/**
+ * @brief Creates a new Lua state using the pooled allocator.
+ *
+ * States must be closed with nlua_close.
  *
  *    @return A newly created lua_State.
  */
 lua_State *nlua_newState (void)
 {
    lua_State *L;
+   LuaMem *mem;
+
+   mem = calloc( 1, sizeof(LuaMem) );
+   if (mem == NULL) {
+      WARN("Out of memory.");
+      return NULL;
+   }
+   snprintf( mem->owner, sizeof(mem->owner), "lua" );
+   mem->limit = (size_t) conf.lua_memlimit * 1024;
 
    /* try to create the new state */
-   L = luaL_newstate();
+   L = lua_newstate( nlua_alloc, mem );
    if (L == NULL) {
       WARN("Failed to create new lua state.");
+      free(mem);
       return NULL;
    }
+   lua_atpanic( L, nlua_panic );
+   mem->L = L;
+
+   /* Add to the list. */
+   SDL_mutexP( nlua_memLock );
+   mem->next = nlua_mem;
+   if (nlua_mem != NULL)
+      nlua_mem->prev = mem;
+   nlua_mem = mem;
+   SDL_mutexV( nlua_memLock );
 
    return L;
 }
 
 
+/**
+ * @brief Closes a Lua state created with nlua_newState.
+ *
+ *    @param L State to close.
+ */
+void nlua_close( lua_State *L )
+{
+   void *ud;
+   LuaMem *mem;
+   LuaMemBlock *b;
+
+   lua_getallocf( L, &ud );
+   mem = (LuaMem*) ud;
+   lua_close( L );
+
+   /* Remove from the list. */
+   SDL_mutexP( nlua_memLock );
+   if (nlua_gcNext == mem)
+      nlua_gcNext = mem->next;
+   if (mem->prev != NULL)
+      mem->prev->next = mem->next;
+   else
+      nlua_mem = mem->next;
+   if (mem->next != NULL)
+      mem->next->prev = mem->prev;
+   SDL_mutexV( nlua_memLock );
+
+   /* Everything small is in the blocks. */
+   while (mem->blocks != NULL) {
+      b           = mem->blocks;
+      mem->blocks = b->next;
+      free(b);
+   }
+   free(mem);
+}
+
+
+/**
+ * @brief Sets what a Lua state is used for, shown in the memory statistics.
+ *
+ *    @param L State to set owner of, may be a thread of it.
+ *    @param type Type of owner, like "mission" or "ai".
+ *    @param name Name of the owner or NULL.
+ */
+void nlua_setOwner( lua_State *L, const char *type, const char *name )
+{
+   void *ud;
+   LuaMem *mem;
+
+   lua_getallocf( L, &ud );
+   mem = (LuaMem*) ud;
+   if (name != NULL)
+      snprintf( mem->owner, sizeof(mem->owner), "%s: %s", type, name );
+   else
+      snprintf( mem->owner, sizeof(mem->owner), "%s", type );
+}
+
+
+/**
+ * @brief Gets the memory statistics of all the Lua states.
+ *
+ *    @param[out] n Number of states.
+ *    @return Statistics of each state, must be freed.
+ */
+LuaMemStats* nlua_memStats( int *n )
+{
+   int i;
+   LuaMem *mem;
+   LuaMemStats *stats;
+
+   *n = 0;
+   if (nlua_memLock == NULL)
+      return NULL;
+
+   SDL_mutexP( nlua_memLock );
+   for (mem=nlua_mem; mem!=NULL; mem=mem->next)
+      (*n)++;
+   stats = malloc( sizeof(LuaMemStats) * MAX(*n,1) );
+   i = 0;
+   for (mem=nlua_mem; mem!=NULL; mem=mem->next) {
+      strncpy( stats[i].owner, mem->owner, sizeof(stats[i].owner) );
+      stats[i].used  = mem->used;
+      stats[i].peak  = mem->peak;
+      stats[i].limit = mem->limit;
+      i++;
+   }
+   SDL_mutexV( nlua_memLock );
+
+   return stats;
+}
+
+
+/**
+ * @brief Gets the current time in milliseconds for measuring collections.
+ */
+static double nlua_timeMS (void)
+{
+#if HAS_POSIX
+   struct timeval tv;
+   gettimeofday( &tv, NULL );
+   return (double)tv.tv_sec * 1000. + (double)tv.tv_usec / 1000.;
+#else /* HAS_POSIX */
+   return (double)SDL_GetTicks();
+#endif /* HAS_POSIX */
+}
+
+
+/**
+ * @brief Makes nlua_gcUpdate collect the garbage of a state.
+ *
+ * Lua won't collect on its own anymore so the pauses happen between frames
+ *  instead of whenever the script allocates.  Does nothing when
+ *  conf.lua_gc_budget is 0 or the state has a memory limit, Lua 5.1 can't
+ *  collect when the allocator fails so those must keep collecting on their
+ *  own to not run out of memory that's just garbage.
+ *
+ *    @param L State to manage, must not be used while nlua_gcUpdate runs.
+ */
+void nlua_gcManage( lua_State *L )
+{
+   void *ud;
+   LuaMem *mem;
+
+   if (conf.lua_gc_budget <= 0.)
+      return;
+
+   lua_getallocf( L, &ud );
+   mem = (LuaMem*) ud;
+   if (mem->limit > 0)
+      return;
+   mem->gc     = 1;
+   mem->gcrun  = 0;
+   mem->gcbase = MAX( mem->used, NLUA_GC_MIN );
+   lua_gc( mem->L, LUA_GCSTOP, 0 );
+}
+
+
+/**
+ * @brief Collects garbage of the managed states within the frame budget.
+ *
+ * States that grew enough since their last cycle are stepped in turn, the
+ *  next call continues where the budget ran out.  States that grew far too
+ *  much are collected fully regardless of the budget.  If the budget was
+ *  set to 0 the states are given back to Lua.
+ */
+void nlua_gcUpdate (void)
+{
+   int i, n;
+   LuaMem *mem;
+   double start, t;
+
+   if (nlua_mem == NULL)
+      return;
+
+   /* Let Lua collect on its own again. */
+   if (conf.lua_gc_budget <= 0.) {
+      SDL_mutexP( nlua_memLock );
+      for (mem=nlua_mem; mem!=NULL; mem=mem->next) {
+         if (mem->gc) {
+            mem->gc    = 0;
+            mem->gcrun = 0;
+            lua_gc( mem->L, LUA_GCRESTART, 0 );
+         }
+      }
+      SDL_mutexV( nlua_memLock );
+      return;
+   }
+
+   start = nlua_timeMS();
+   SDL_mutexP( nlua_memLock );
+   n     = 0;
+   for (mem=nlua_mem; mem!=NULL; mem=mem->next)
+      n++;
+
+   /* Go over every state at most once. */
+   mem = (nlua_gcNext != NULL) ? nlua_gcNext : nlua_mem;
+   for (i=0; i<n; i++) {
+      if (mem->gc) {
+         if (mem->used >= mem->gcbase * NLUA_GC_URGENT) {
+            lua_gc( mem->L, LUA_GCCOLLECT, 0 );
+            mem->gcrun = 0;
+            mem->gcbase = MAX( mem->used, NLUA_GC_MIN );
+            nlua_gcStat.cycles++;
+            nlua_gcStat.urgent++;
+            lua_gc( mem->L, LUA_GCSTOP, 0 );
+         }
+         else if (mem->gcrun || (mem->used >= mem->gcbase * NLUA_GC_PAUSE)) {
+            mem->gcrun = 1;
+            do {
+               nlua_gcStat.steps++;
+               if (lua_gc( mem->L, LUA_GCSTEP, NLUA_GC_STEPKB )) {
+                  mem->gcrun  = 0;
+                  mem->gcbase = MAX( mem->used, NLUA_GC_MIN );
+                  nlua_gcStat.cycles++;
+                  break;
+               }
+            } while (nlua_timeMS() - start < conf.lua_gc_budget);
+            /* Stepping lets Lua collect on its own again. */
+            lua_gc( mem->L, LUA_GCSTOP, 0 );
+         }
+      }
+
+      mem = (mem->next != NULL) ? mem->next : nlua_mem;
+      if (nlua_timeMS() - start >= conf.lua_gc_budget)
+         break;
+   }
+   nlua_gcNext = mem;
+   SDL_mutexV( nlua_memLock );
+
+   t = nlua_timeMS() - start;
+   nlua_gcStat.frames++;
+   nlua_gcStat.total += t;
+   if (t > nlua_gcStat.max)
+      nlua_gcStat.max = t;
+}
+
+
+/**
+ * @brief Gets the garbage collection statistics.
+ *
+ *    @return Statistics of nlua_gcUpdate since the start.
+ */
+const LuaGCStats* nlua_gcStats (void)
+{
+   return &nlua_gcStat;
+}
+
+
 /**
  * @brief Opens a lua library.
  *
@@ -127,8 +679,7 @@ int nlua_loadBasic( lua_State* L )
 static int nlua_packfileLoader( lua_State* L )
 {
    const char *filename;
-   char *buf;
-   uint32_t bufsize;
+   int ret;
 
    /* Get parameters. */
    filename = luaL_checkstring(L,1);
@@ -151,16 +702,12 @@ static int nlua_packfileLoader( lua_State* L )
    }
    lua_pop(L,1);
 
-   /* Try to locate the data */
-   buf = ndata_read( filename, &bufsize );
-   if (buf == NULL) {
-      lua_pushfstring(L, "%s not found in ndata.", filename);
+   /* Run it, compiled once for all the states. */
+   ret = nlua_doChunk( L, filename );
+   if (ret == LUA_ERRFILE)
       return 1;
-   }
-   
-   /* run the buffer */
-   if (luaL_dobuffer(L, buf, bufsize, filename) != 0) {
-      /* will push the current error from the dobuffer */
+   else if (ret != 0) {
+      /* will push the current error from the chunk */
       lua_error(L);
       return 1;
    }
@@ -171,12 +718,306 @@ static int nlua_packfileLoader( lua_State* L )
    lua_setfield(L, -2, filename);
    lua_pop(L, 2);
 
-   /* cleanup, success */
-   free(buf);
+   /* success */
+   return 0;
+}
+
+
+/**
+ * @brief Hashes a script to identify its compiled chunk.
+ *
+ *    @param filename Path of the script, the chunk name depends on it.
+ *    @param buf Source of the script.
+ *    @param bufsize Length of the source.
+ *    @param[out] md5 Hash of the script.
+ */
+static void nlua_chunkHash( const char *filename, const char *buf,
+      uint32_t bufsize, md5_byte_t md5[16] )
+{
+   md5_state_t md5_state;
+
+   md5_init( &md5_state );
+   md5_append( &md5_state, (const md5_byte_t*)filename, strlen(filename)+1 );
+   md5_append( &md5_state, (const md5_byte_t*)buf, bufsize );
+   md5_finish( &md5_state, md5 );
+}
+
+
+/**
+ * @brief Gets the path a compiled chunk is persisted at.
+ *
+ *    @param[out] path Path of the chunk.
+ *    @param len Size of path.
+ *    @param md5 Hash of the chunk.
+ */
+static void nlua_chunkPath( char *path, int len, const md5_byte_t md5[16] )
+{
+   int i, l;
+
+   l = snprintf( path, len, "%s"NLUA_CHUNK_DIR, nfile_basePath() );
+   for (i=0; (i<16) && (l<len); i++)
+      l += snprintf( &path[l], len-l, "%02x", md5[i] );
+   if (l < len)
+      snprintf( &path[l], len-l, ".luac" );
+}
+
+
+/**
+ * @brief Finds a compiled chunk in memory.
+ *
+ *    @param md5 Hash of the chunk to find.
+ *    @return The chunk or NULL if not compiled yet.
+ */
+static LuaChunk* nlua_chunkFind( const md5_byte_t md5[16] )
+{
+   int i;
+
+   for (i=0; i<nlua_nchunks; i++)
+      if (memcmp( nlua_chunks[i].md5, md5, 16 ) == 0)
+         return &nlua_chunks[i];
+   return NULL;
+}
+
+
+/**
+ * @brief Finds a compiled chunk by the path of its script.
+ *
+ *    @param filename Path of the script.
+ *    @return The chunk or NULL if the script wasn't loaded since the ndata
+ *          last changed.
+ */
+static LuaChunk* nlua_chunkFindName( const char *filename )
+{
+   int i;
+   unsigned int gen;
+
+   gen = ndata_generation();
+   for (i=0; i<nlua_nchunks; i++)
+      if ((nlua_chunks[i].gen == gen) &&
+            (strcmp( nlua_chunks[i].name, filename ) == 0))
+         return &nlua_chunks[i];
+   return NULL;
+}
+
+
+/**
+ * @brief Adds a compiled chunk to the cache.
+ *
+ *    @param md5 Hash of the chunk.
+ *    @param code Bytecode of the chunk, the cache takes ownership of it.
+ *    @param len Length of the bytecode.
+ *    @param filename Path of the script.
+ *    @return The new chunk.
+ */
+static LuaChunk* nlua_chunkAdd( const md5_byte_t md5[16], char *code, size_t len,
+      const char *filename )
+{
+   LuaChunk *c;
+
+   if (nlua_nchunks >= nlua_mchunks) {
+      nlua_mchunks += NLUA_CHUNK_CHUNK;
+      nlua_chunks   = realloc( nlua_chunks, sizeof(LuaChunk) * nlua_mchunks );
+   }
+   c = &nlua_chunks[ nlua_nchunks++ ];
+   memcpy( c->md5, md5, 16 );
+   c->code = code;
+   c->len  = len;
+   c->name = strdup( filename );
+   c->gen  = ndata_generation();
+   return c;
+}
+
+
+/**
+ * @brief Drops a compiled chunk that failed to load.
+ *
+ *    @param c Chunk to drop.
+ *    @param unlink Whether to also remove the persisted copy.
+ */
+static void nlua_chunkRemove( LuaChunk *c, int unlink )
+{
+   char path[PATH_MAX];
+
+   if (unlink) {
+      nlua_chunkPath( path, sizeof(path), c->md5 );
+      remove( path );
+   }
+   free( c->code );
+   free( c->name );
+   nlua_nchunks--;
+   if (c != &nlua_chunks[ nlua_nchunks ])
+      memcpy( c, &nlua_chunks[ nlua_nchunks ], sizeof(LuaChunk) );
+}
+
+
+/**
+ * @brief Appends the output of lua_dump to a buffer.
+ */
+static int nlua_chunkWriter( lua_State *L, const void *p, size_t sz, void *ud )
+{
+   LuaDumpBuf *buf;
+   (void) L;
+
+   buf = (LuaDumpBuf*) ud;
+   if (buf->len + sz > buf->size) {
+      buf->size = MAX( 2*buf->size, buf->len + sz );
+      buf->data = realloc( buf->data, buf->size );
+   }
+   memcpy( &buf->data[ buf->len ], p, sz );
+   buf->len += sz;
    return 0;
 }
 
 
+/**
+ * @brief Loads a script from ndata as a Lua function.
+ *
+ * Works like luaL_loadbuffer but keeps the compiled bytecode around, so
+ *  scripts that get loaded over and over again like missions, events and
+ *  includes only get parsed once for all the states.  Until the ndata
+ *  changes the source isn't even read again.  If conf.lua_cache is set the
+ *  bytecode is also saved in the user's directory so it survives restarts.
+ *  The cache is locked so scripts can be loaded from several threads.
+ *
+ *    @param L State to load the script into.
+ *    @param filename Script to load.
+ *    @return 0 on success and the function is pushed onto the stack,
+ *            otherwise an error code with the error message pushed.
+ */
+int nlua_loadChunk( lua_State *L, const char *filename )
+{
+   int ret;
+
+   SDL_mutexP( nlua_chunkLock );
+   ret = nlua_loadChunkUnlocked( L, filename );
+   SDL_mutexV( nlua_chunkLock );
+   return ret;
+}
+
+
+/**
+ * @brief Does the work of nlua_loadChunk with the cache already locked.
+ */
+static int nlua_loadChunkUnlocked( lua_State *L, const char *filename )
+{
+   const char *buf;
+   char *code;
+   int len, ret, persisted;
+   uint32_t bufsize;
+   md5_byte_t md5[16];
+   char path[PATH_MAX];
+   LuaChunk *c;
+   LuaDumpBuf dump;
+
+   /* Loaded before with the same ndata. */
+   c = nlua_chunkFindName( filename );
+   if (c != NULL) {
+      if (luaL_loadbuffer( L, c->code, c->len, filename ) == 0) {
+         nlua_chunkHits++;
+         return 0;
+      }
+      lua_pop(L,1);
+      nlua_chunkRemove( c, conf.lua_cache );
+   }
+
+   /* Get the source. */
+   buf = ndata_borrow( filename, &bufsize );
+   if (buf == NULL) {
+      lua_pushfstring(L, "%s not found in ndata.", filename);
+      return LUA_ERRFILE;
+   }
+   nlua_chunkHash( filename, buf, bufsize, md5 );
+
+   /* See if it's already compiled. */
+   persisted = 0;
+   c = nlua_chunkFind( md5 );
+   if ((c == NULL) && conf.lua_cache) {
+      nlua_chunkPath( path, sizeof(path), md5 );
+      if (nfile_fileExists( "%s", path )) {
+         code = nfile_readFile( &len, "%s", path );
+         if (code != NULL) {
+            c = nlua_chunkAdd( md5, code, len, filename );
+            persisted = 1;
+         }
+      }
+   }
+   if (c != NULL) {
+      if (luaL_loadbuffer( L, c->code, c->len, filename ) == 0) {
+         c->gen = ndata_generation();
+         nlua_chunkReads++;
+         ndata_release(buf);
+         return 0;
+      }
+      /* Probably from another Lua build, just recompile. */
+      lua_pop(L,1);
+      nlua_chunkRemove( c, persisted );
+   }
+
+   /* Compile it. */
+   nlua_chunkMisses++;
+   ret = luaL_loadbuffer( L, buf, bufsize, filename );
+   ndata_release(buf);
+   if (ret != 0)
+      return ret;
+
+   /* Save the bytecode. */
+   memset( &dump, 0, sizeof(dump) );
+   if ((lua_dump( L, nlua_chunkWriter, &dump ) != 0) || (dump.len == 0)) {
+      free( dump.data );
+      return 0;
+   }
+   nlua_chunkAdd( md5, dump.data, dump.len, filename );
+   if (conf.lua_cache) {
+      nfile_dirMakeExist( "%s"NLUA_CHUNK_DIR, nfile_basePath() );
+      nlua_chunkPath( path, sizeof(path), md5 );
+      nfile_writeFile( dump.data, dump.len, "%s", path );
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Loads and runs a script from ndata.
+ *
+ *    @param L State to run the script in.
+ *    @param filename Script to run.
+ *    @return 0 on success, otherwise an error code with the error message
+ *            pushed onto the stack.
+ */
+int nlua_doChunk( lua_State *L, const char *filename )
+{
+   int ret;
+
+   ret = nlua_loadChunk( L, filename );
+   if (ret != 0)
+      return ret;
+   return lua_pcall( L, 0, LUA_MULTRET, 0 );
+}
+
+
+/**
+ * @brief Frees the compiled chunk cache.
+ */
+void nlua_chunkFree (void)
+{
+   int i;
+
+   if (nlua_chunkHits + nlua_chunkReads + nlua_chunkMisses > 0)
+      DEBUG("Lua chunks: %lu hits, %lu hits after reading, %lu compiled",
+            nlua_chunkHits, nlua_chunkReads, nlua_chunkMisses );
+
+   for (i=0; i<nlua_nchunks; i++) {
+      free( nlua_chunks[i].code );
+      free( nlua_chunks[i].name );
+   }
+   free( nlua_chunks );
+   nlua_chunks  = NULL;
+   nlua_nchunks = 0;
+   nlua_mchunks = 0;
+}
+
+
 /**
  * @brief Loads the standard NAEV Lua API.
  *
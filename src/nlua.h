@@ -10,15 +10,65 @@
 #include "lua.h"
 
 
+/**
+ * @brief Memory used by a Lua state.
+ */
+typedef struct LuaMemStats_ {
+   char owner[64]; /**< What the state is used for. */
+   size_t used; /**< Bytes in use. */
+   size_t peak; /**< Most bytes ever in use. */
+   size_t limit; /**< Most bytes the state may use, 0 if unlimited. */
+} LuaMemStats;
+
+
+/**
+ * @brief Garbage collection statistics.
+ */
+typedef struct LuaGCStats_ {
+   unsigned long frames; /**< Times nlua_gcUpdate ran. */
+   unsigned long steps; /**< Incremental steps done. */
+   unsigned long cycles; /**< Collection cycles finished. */
+   unsigned long urgent; /**< Cycles done at once ignoring the budget. */
+   double total; /**< Total time collecting in ms. */
+   double max; /**< Longest time collecting in a frame in ms. */
+} LuaGCStats;
+
+
 /*
  * standard lua stuff wrappers
  */
+int nlua_init (void);
+void nlua_exit (void);
 lua_State *nlua_newState (void); /* creates a new state */
+void nlua_close( lua_State *L );
 int nlua_load( lua_State* L, lua_CFunction f );
 int nlua_loadBasic( lua_State* L );
 int nlua_loadStandard( lua_State *L, int readonly );
 
 
+/*
+ * memory
+ */
+void nlua_setOwner( lua_State *L, const char *type, const char *name );
+LuaMemStats* nlua_memStats( int *n );
+
+
+/*
+ * garbage collection
+ */
+void nlua_gcManage( lua_State *L );
+void nlua_gcUpdate (void);
+const LuaGCStats* nlua_gcStats (void);
+
+
+/*
+ * compiled chunks
+ */
+int nlua_loadChunk( lua_State *L, const char *filename );
+int nlua_doChunk( lua_State *L, const char *filename );
+void nlua_chunkFree (void);
+
+
 #endif /* NLUA_H */
 
 
@@ -12,6 +12,8 @@
 
 #include "naev.h"
 
+#include <stdlib.h>
+
 #include "lauxlib.h"
 
 #include "nlua.h"
@@ -23,9 +25,13 @@
 /* CLI */
 static int cli_missionStart( lua_State *L );
 static int cli_missionTest( lua_State *L );
+static int cli_memory( lua_State *L );
+static int cli_gc( lua_State *L );
 static const luaL_reg cli_methods[] = {
    { "missionStart", cli_missionStart },
    { "missionTest", cli_missionTest },
+   { "memory", cli_memory },
+   { "gc", cli_gc },
    {0,0}
 }; /**< CLI Lua methods. */
 
@@ -94,3 +100,69 @@ static int cli_missionTest( lua_State *L )
    return 0;
 }
 
+
+/**
+ * @brief Gets the memory used by the Lua states.
+ *
+ * States with the same owner, like the copies of an AI profile used to think
+ *  in parallel, are added together.
+ *
+ * @usage total, owners = cli.memory()
+ * @usage for k,v in pairs(owners) do print( k, v ) end
+ *
+ *    @luareturn The total KiB used and a table of the KiB used by each owner.
+ * @luafunc memory()
+ */
+static int cli_memory( lua_State *L )
+{
+   int i, n;
+   size_t total;
+   LuaMemStats *stats;
+
+   stats = nlua_memStats( &n );
+   total = 0;
+   lua_newtable(L);
+   for (i=0; i<n; i++) {
+      total += stats[i].used;
+      lua_getfield( L, -1, stats[i].owner );
+      lua_pushnumber( L, lua_tonumber(L,-1) + (double)stats[i].used / 1024. );
+      lua_setfield( L, -3, stats[i].owner );
+      lua_pop(L,1);
+   }
+   free(stats);
+
+   lua_pushnumber( L, (double)total / 1024. );
+   lua_insert( L, -2 );
+   return 2;
+}
+
+
+/**
+ * @brief Gets the Lua garbage collection statistics.
+ *
+ * @usage s = cli.gc() -- s.max is the longest pause in ms
+ *
+ *    @luareturn Table with the frames, steps, cycles, urgent cycles, total
+ *               ms and max ms spent collecting garbage between frames.
+ * @luafunc gc()
+ */
+static int cli_gc( lua_State *L )
+{
+   const LuaGCStats *gc;
+
+   gc = nlua_gcStats();
+   lua_newtable(L);
+   lua_pushnumber( L, gc->frames );
+   lua_setfield( L, -2, "frames" );
+   lua_pushnumber( L, gc->steps );
+   lua_setfield( L, -2, "steps" );
+   lua_pushnumber( L, gc->cycles );
+   lua_setfield( L, -2, "cycles" );
+   lua_pushnumber( L, gc->urgent );
+   lua_setfield( L, -2, "urgent" );
+   lua_pushnumber( L, gc->total );
+   lua_setfield( L, -2, "total" );
+   lua_pushnumber( L, gc->max );
+   lua_setfield( L, -2, "max" );
+   return 1;
+}
@@ -195,7 +195,6 @@ static int evt_misnStart( lua_State *L )
  */
 static int evt_timerStart( lua_State *L )
 {
-   int i;
    const char *func;
    double delay;
 
@@ -203,22 +202,8 @@ static int evt_timerStart( lua_State *L )
    func  = luaL_checkstring(L,1);
    delay = luaL_checknumber(L,2);
 
-   /* Add timer */
-   for (i=0; i<EVENT_TIMER_MAX; i++) {
-      if (cur_event->timer[i] == 0.) {
-         cur_event->timer[i] = delay / 1000.;
-         cur_event->tfunc[i] = strdup(func);
-         break;
-      }
-   }
-
-   /* No timer found. */
-   if (i >= EVENT_TIMER_MAX) {
-      return 0;
-   }
-
    /* Returns the timer id. */
-   lua_pushnumber(L,i);
+   lua_pushnumber( L, event_timerStart( cur_event, func, delay / 1000. ) );
    return 1;
 }
 
@@ -236,13 +221,7 @@ static int evt_timerStop( lua_State *L )
    t = luaL_checkint(L,1);
 
    /* Stop the timer. */
-   if (cur_event->timer[t] != 0.) {
-      cur_event->timer[t] = 0.;
-      if (cur_event->tfunc[t] != NULL) {
-         free(cur_event->tfunc[t]);
-         cur_event->tfunc[t] = NULL;
-      }
-   }
+   event_timerStop( cur_event, t );
 
    return 0;
 }
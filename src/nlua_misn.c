@@ -512,6 +512,7 @@ static int misn_accept( lua_State *L )
       memset( cur_mission, 0, sizeof(Mission) );
       cur_mission = &player_missions[i];
       cur_mission->accepted = 1; /* Mark as accepted. */
+      mission_timerResume( cur_mission ); /* Timers start counting now. */
       setOSD(); /* Set OSD if applicable. */
       /* Needed to make sure hooks work. */
       nlua_hookTarget( cur_mission, NULL );
@@ -562,7 +563,6 @@ static int misn_finish( lua_State *L )
  */
 static int misn_timerStart( lua_State *L )
 {
-   int i;
    const char *func;
    double delay;
 
@@ -570,22 +570,8 @@ static int misn_timerStart( lua_State *L )
    func  = luaL_checkstring(L,1);
    delay = luaL_checknumber(L,2);
 
-   /* Add timer */
-   for (i=0; i<MISSION_TIMER_MAX; i++) {
-      if (cur_mission->timer[i] == 0.) {
-         cur_mission->timer[i] = delay / 1000.;
-         cur_mission->tfunc[i] = strdup(func);
-         break;
-      }
-   }
-
-   /* No timer found. */
-   if (i >= MISSION_TIMER_MAX) {
-      return 0;
-   }
-
    /* Returns the timer id. */
-   lua_pushnumber(L,i);
+   lua_pushnumber( L, mission_timerStart( cur_mission, func, delay / 1000. ) );
    return 1;
 }
 
@@ -603,13 +589,7 @@ static int misn_timerStop( lua_State *L )
    t = luaL_checkint(L,1);
 
    /* Stop the timer. */
-   if (cur_mission->timer[t] != 0.) {
-      cur_mission->timer[t] = 0.;
-      if (cur_mission->tfunc[t] != NULL) {
-         free(cur_mission->tfunc[t]);
-         cur_mission->tfunc[t] = NULL;
-      }
-   }
+   mission_timerStop( cur_mission, t );
 
    return 0;
 }
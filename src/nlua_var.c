@@ -40,6 +40,7 @@
  */
 typedef struct misn_var_ {
    char* name; /**< Name of the variable. */
+   unsigned int hash; /**< Hash of the name. */
    char type; /**< Type of the variable. */
    union {
       double num; /**< Used if type is number. */
@@ -57,12 +58,28 @@ static int var_nstack      = 0; /**< Number of mission variables. */
 static int var_mstack      = 0; /**< Memory size of the mission variable stack. */
 
 
+/*
+ * variable lookup
+ *
+ * The stack keeps the variables in the order they were created so they're
+ *  always saved the same way, the hash table maps names to their position in
+ *  the stack.
+ */
+#define VAR_HASH_MIN    64 /**< Minimum size of the hash table. */
+static int *var_hash       = NULL; /**< Positions in the stack by name, -1 if empty. */
+static int var_mhash       = 0; /**< Size of the hash table, power of two. */
+
+
 /*
  * prototypes
  */
 /* static */
 static int var_add( misn_var *var );
 static void var_free( misn_var* var );
+static unsigned int var_hashStr( const char *str );
+static void var_hashGrow (void);
+static int var_find( const char *str, unsigned int hash, unsigned int *slot );
+static void var_rm( int i );
 /* externed */
 int var_save( xmlTextWriterPtr writer );
 int var_load( xmlNodePtr parent );
@@ -198,6 +215,122 @@ int var_load( xmlNodePtr parent )
 }
 
 
+/**
+ * @brief Hashes the name of a variable.
+ *
+ *    @param str Name to hash.
+ *    @return The hash.
+ */
+static unsigned int var_hashStr( const char *str )
+{
+   unsigned int h;
+
+   /* FNV-1a. */
+   h = 2166136261U;
+   for ( ; *str != '\0'; str++) {
+      h ^= (unsigned char)*str;
+      h *= 16777619U;
+   }
+   return h;
+}
+
+
+/**
+ * @brief Makes the hash table big enough for the stack.
+ */
+static void var_hashGrow (void)
+{
+   int i;
+   unsigned int j, mask;
+
+   /* Keep it at most half full. */
+   if (2*var_nstack <= var_mhash)
+      return;
+
+   free(var_hash);
+   var_mhash = MAX( VAR_HASH_MIN, 2*var_mhash );
+   while (2*var_nstack > var_mhash)
+      var_mhash *= 2;
+   var_hash  = malloc( var_mhash * sizeof(int) );
+   for (i=0; i<var_mhash; i++)
+      var_hash[i] = -1;
+
+   mask = var_mhash-1;
+   for (i=0; i<var_nstack; i++) {
+      for (j=var_stack[i].hash & mask; var_hash[j]>=0; j=(j+1) & mask);
+      var_hash[j] = i;
+   }
+}
+
+
+/**
+ * @brief Finds a variable by name.
+ *
+ *    @param str Name of the variable.
+ *    @param hash Hash of the name.
+ *    @param[out] slot Slot of the hash table it's in or should go in.
+ *    @return Position in the stack or -1 if not found.
+ */
+static int var_find( const char *str, unsigned int hash, unsigned int *slot )
+{
+   unsigned int j, mask;
+   misn_var *v;
+
+   if (var_mhash == 0) {
+      *slot = 0;
+      return -1;
+   }
+
+   mask = var_mhash-1;
+   for (j=hash & mask; var_hash[j]>=0; j=(j+1) & mask) {
+      v = &var_stack[ var_hash[j] ];
+      if ((v->hash == hash) && (strcmp(v->name, str)==0)) {
+         *slot = j;
+         return var_hash[j];
+      }
+   }
+   *slot = j;
+   return -1;
+}
+
+
+/**
+ * @brief Removes a variable from the stack.
+ *
+ *    @param i Position of the variable in the stack.
+ */
+static void var_rm( int i )
+{
+   int n;
+   unsigned int j, k, l, mask;
+
+   mask = var_mhash-1;
+   var_find( var_stack[i].name, var_stack[i].hash, &j );
+
+   /* Shift back the variables that would no longer be found. */
+   k = j;
+   while (1) {
+      k = (k+1) & mask;
+      if (var_hash[k] < 0)
+         break;
+      l = var_stack[ var_hash[k] ].hash & mask;
+      if ((j <= k) ? ((l <= j) || (l > k)) : ((l <= j) && (l > k))) {
+         var_hash[j] = var_hash[k];
+         j = k;
+      }
+   }
+   var_hash[j] = -1;
+
+   /* Keep the order of the rest. */
+   var_free( &var_stack[i] );
+   memmove( &var_stack[i], &var_stack[i+1], sizeof(misn_var)*(var_nstack-i-1) );
+   var_nstack--;
+   for (n=0; n<var_mhash; n++)
+      if (var_hash[n] > i)
+         var_hash[n]--;
+}
+
+
 /**
  * @brief Adds a var to the stack, strings will be SHARED, don't free.
  *
@@ -207,23 +340,32 @@ int var_load( xmlNodePtr parent )
 static int var_add( misn_var *new_var )
 {
    int i;
+   unsigned int j;
+
+   new_var->hash = var_hashStr( new_var->name );
+
+   /* check if already exists */
+   i = var_find( new_var->name, new_var->hash, &j );
+   if (i >= 0) { /* overwrite */
+      var_free( &var_stack[i] );
+      memcpy( &var_stack[i], new_var, sizeof(misn_var) );
+      return 0;
+   }
 
    if (var_nstack+1 > var_mstack) { /* more memory */
       var_mstack += 64; /* overkill ftw */
       var_stack = realloc( var_stack, var_mstack * sizeof(misn_var) );
    }
 
-   /* check if already exists */
-   for (i=0; i<var_nstack; i++)
-      if (strcmp(new_var->name,var_stack[i].name)==0) { /* overwrite */
-         var_free( &var_stack[i] );
-         memcpy( &var_stack[i], new_var, sizeof(misn_var) );
-         return 0;
-      }
-   
    memcpy( &var_stack[var_nstack], new_var, sizeof(misn_var) );
    var_nstack++;
 
+   /* Add to the hash table, growing it puts everything in place. */
+   if (2*var_nstack > var_mhash)
+      var_hashGrow();
+   else
+      var_hash[j] = var_nstack-1;
+
    return 0;
 }
 
@@ -255,12 +397,9 @@ static int var_add( misn_var *new_var )
  */
 int var_checkflag( char* str )
 {
-   int i;
+   unsigned int j;
 
-   for (i=0; i<var_nstack; i++)
-      if (strcmp(var_stack[i].name,str)==0)
-         return 1;
-   return 0;
+   return (var_find( str, var_hashStr(str), &j ) >= 0);
 }
 /**
  * @brief Gets the mission variable value of a certain name.
@@ -274,31 +413,31 @@ static int var_peek( lua_State *L )
 {
    NLUA_MIN_ARGS(1);
    int i;
+   unsigned int j;
    const char *str;
 
    /* Get the parameter. */
    str = luaL_checkstring(L,1);
 
-   for (i=0; i<var_nstack; i++)
-      if (strcmp(str,var_stack[i].name)==0) {
-         switch (var_stack[i].type) {
-            case MISN_VAR_NIL:
-               lua_pushnil(L);
-               break;
-            case MISN_VAR_NUM:
-               lua_pushnumber(L,var_stack[i].d.num);
-               break;
-            case MISN_VAR_BOOL:
-               lua_pushboolean(L,var_stack[i].d.b);
-               break;
-            case MISN_VAR_STR:
-               lua_pushstring(L,var_stack[i].d.str);
-               break;
-         }
-         return 1;
-      }
+   i = var_find( str, var_hashStr(str), &j );
+   if (i < 0)
+      return 0;
 
-   return 0;
+   switch (var_stack[i].type) {
+      case MISN_VAR_NIL:
+         lua_pushnil(L);
+         break;
+      case MISN_VAR_NUM:
+         lua_pushnumber(L,var_stack[i].d.num);
+         break;
+      case MISN_VAR_BOOL:
+         lua_pushboolean(L,var_stack[i].d.b);
+         break;
+      case MISN_VAR_STR:
+         lua_pushstring(L,var_stack[i].d.str);
+         break;
+   }
+   return 1;
 }
 /**
  * @brief Pops a mission variable off the stack, destroying it.
@@ -310,17 +449,16 @@ static int var_pop( lua_State *L )
 {
    NLUA_MIN_ARGS(1);
    int i;
+   unsigned int j;
    const char* str;
 
    str = luaL_checkstring(L,1);
 
-   for (i=0; i<var_nstack; i++)
-      if (strcmp(str,var_stack[i].name)==0) {
-         var_free( &var_stack[i] );
-         memmove( &var_stack[i], &var_stack[i+1], sizeof(misn_var)*(var_nstack-i-1) );
-         var_nstack--;
-         return 0;
-      } 
+   i = var_find( str, var_hashStr(str), &j );
+   if (i >= 0) {
+      var_rm( i );
+      return 0;
+   }
 
    /*NLUA_DEBUG("Var '%s' not found in stack", str);*/
    return 0;
@@ -404,5 +542,9 @@ void var_cleanup (void)
    var_stack   = NULL;
    var_nstack  = 0;
    var_mstack  = 0;
+
+   free( var_hash );
+   var_hash    = NULL;
+   var_mhash   = 0;
 }
 
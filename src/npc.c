@@ -334,21 +334,23 @@ static void npc_sort (void)
 
 /**
  * @brief Generates the bar missions.
+ *
+ *    @param cand Bar missions to create.
+ *    @param ncand Number of bar missions to create.
  */
-void npc_generate (void)
+void npc_generate( const MissionCand *cand, int ncand )
 {
    int i;
    Mission *missions;
    int nmissions;
 
    /* Get the missions. */
-   missions = missions_genList( &nmissions,
-         land_planet->faction, land_planet->name, cur_system->name,
-         MIS_AVAIL_BAR );
+   missions = missions_createCand( &nmissions, cand, ncand );
 
    /* Add to the bar NPC stack - may be not empty. */
    for (i=0; i<nmissions; i++)
       npc_add_giver( &missions[i] );
+   free( missions );
 
    /* Sort NPC. */
    npc_sort();
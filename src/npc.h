@@ -31,7 +31,7 @@ int npc_rm_parentMission( Mission *misn );
 /*
  * Control.
  */
-void npc_generate (void);
+void npc_generate( const MissionCand *cand, int ncand );
 void npc_clear (void);
 void npc_freeAll (void);
 
@@ -290,6 +290,10 @@ void gl_checkHandleError( const char *func, int line )
    GLenum err;
    const char* errstr;
 
+   /* No context to check. */
+   if (gl_has(OPENGL_HEADLESS))
+      return;
+
    err = glGetError();
 
    /* No error. */
@@ -47,6 +47,7 @@
 #define OPENGL_FULLSCREEN  (1<<0) /**< Fullscreen. */
 #define OPENGL_DOUBLEBUF   (1<<1) /**< Doublebuffer. */
 #define OPENGL_VSYNC       (1<<2) /**< Sync to monitor vertical refresh rate. */
+#define OPENGL_HEADLESS    (1<<3) /**< No context, textures only keep their collision data. */
 #define gl_has(f)    (gl_screen.flags & (f)) /**< Check for the flag */
 /**
  * @brief Stores data about the current opengl environment.
@@ -14,6 +14,7 @@
 #include "naev.h"
 
 #include "SDL_image.h"
+#include "SDL_mutex.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -37,6 +38,28 @@ typedef struct glTexList_ {
    int used; /**< counts how many times texture is being used */
 } glTexList;
 static glTexList* texture_list = NULL; /**< Texture list. */
+static SDL_mutex *texture_lock = NULL; /**< Protects the texture list and the upload queue. */
+
+
+/*
+ * Deferred uploads.
+ */
+/**
+ * @brief Texture waiting for its data to be uploaded.
+ *
+ * While uploads are deferred images can be loaded from any thread, they're
+ *  decoded and prepared right away but only the main thread may touch
+ *  OpenGL so the upload waits for gl_texUpload.
+ */
+typedef struct glTexUpload_ {
+   glTexture *tex; /**< Texture to upload to. */
+   SDL_Surface *surface; /**< Prepared surface with the data. */
+   unsigned int flags; /**< Flags the texture was loaded with. */
+} glTexUpload;
+static int gl_texDeferred        = 0; /**< Uploads are queued instead of done. */
+static glTexUpload *gl_texQueue  = NULL; /**< Textures waiting to be uploaded. */
+static int gl_ntexQueue          = 0; /**< Number of textures waiting. */
+static int gl_mtexQueue          = 0; /**< Allocated size of the queue. */
 
 
 /*
@@ -54,7 +77,15 @@ static int SDL_IsTrans( SDL_Surface* s, int x, int y );
 static uint8_t* SDL_MapTrans( SDL_Surface* s );
 /* glTexture */
 static GLuint gl_loadSurface( SDL_Surface* surface, int *rw, int *rh, unsigned int flags );
+static GLuint gl_uploadSurface( SDL_Surface* surface, unsigned int flags );
 static glTexture* gl_loadNewImage( const char* path, unsigned int flags );
+static glTexture* gl_texListGet( const char* path );
+static void gl_texListAdd( glTexture* tex );
+static void gl_texQueueAdd( glTexture* tex, SDL_Surface* surface, unsigned int flags );
+static void gl_texUnqueue( glTexture* tex );
+static void gl_texFree( glTexture* tex );
+static void gl_mapMasks( glTexture* t );
+static void gl_freeMasks( glTexture* t );
 
 
 /**
@@ -294,9 +325,6 @@ int gl_texHasCompress (void)
  */
 static GLuint gl_loadSurface( SDL_Surface* surface, int *rw, int *rh, unsigned int flags )
 {
-   GLuint texture;
-   GLfloat param;
-
    /* Prepare the surface. */
    surface = gl_prepareSurface( surface );
    if (rw != NULL)
@@ -304,6 +332,30 @@ static GLuint gl_loadSurface( SDL_Surface* surface, int *rw, int *rh, unsigned i
    if (rh != NULL) 
       (*rh) = surface->h;
 
+   return gl_uploadSurface( surface, flags );
+}
+
+
+/**
+ * @brief Uploads a prepared surface into an opengl texture.
+ *
+ * Must be called from the main thread.
+ *
+ *    @param surface Surface to upload, it gets freed.
+ *    @param flags Flags to use.
+ *    @return The opengl texture id.
+ */
+static GLuint gl_uploadSurface( SDL_Surface* surface, unsigned int flags )
+{
+   GLuint texture;
+   GLfloat param;
+
+   /* Nothing to upload to. */
+   if (gl_has(OPENGL_HEADLESS)) {
+      SDL_FreeSurface( surface );
+      return 0;
+   }
+
    /* opengl texture binding */
    glGenTextures( 1, &texture ); /* Creates the texture */
    glBindTexture( GL_TEXTURE_2D, texture ); /* Loads the texture */
@@ -377,7 +429,16 @@ glTexture* gl_loadImage( SDL_Surface* surface, unsigned int flags )
    texture->sx    = 1.;
    texture->sy    = 1.;
 
-   texture->texture = gl_loadSurface( surface, &rw, &rh, flags );
+   /* Only the main thread may upload, the rest is done now. */
+   if (gl_texDeferred) {
+      surface = gl_prepareSurface( surface );
+      rw = surface->w;
+      rh = surface->h;
+      texture->texture = 0;
+      gl_texQueueAdd( texture, surface, flags );
+   }
+   else
+      texture->texture = gl_loadSurface( surface, &rw, &rh, flags );
 
    texture->rw    = (double)rw;
    texture->rh    = (double)rh;
@@ -387,6 +448,7 @@ glTexture* gl_loadImage( SDL_Surface* surface, unsigned int flags )
    texture->srh   = texture->sh / texture->rh;
 
    texture->trans = NULL;
+   texture->masks = NULL;
    texture->name  = NULL;
 
    return texture;
@@ -404,37 +466,80 @@ glTexture* gl_loadImage( SDL_Surface* surface, unsigned int flags )
  */
 glTexture* gl_newImage( const char* path, const unsigned int flags )
 {
-   glTexList *cur, *last;
+   glTexture *tex, *t;
 
    /* check to see if it already exists */
-   if (texture_list != NULL) {
-      for (cur=texture_list; cur!=NULL; cur=cur->next) {
-         if (strcmp(path,cur->tex->name)==0) {
-            cur->used += 1;
-            return cur->tex;
-         }
-         last = cur;
+   SDL_mutexP( texture_lock );
+   tex = gl_texListGet( path );
+   SDL_mutexV( texture_lock );
+   if (tex != NULL)
+      return tex;
+
+   /* Load the image, not locked so other threads can load at the same time. */
+   tex = gl_loadNewImage(path, flags);
+   if (tex == NULL)
+      return NULL;
+
+   /* Another thread may have loaded it in the meantime. */
+   SDL_mutexP( texture_lock );
+   t = gl_texListGet( path );
+   if (t != NULL) {
+      gl_texFree( tex );
+      tex = t;
+   }
+   else
+      gl_texListAdd( tex );
+   SDL_mutexV( texture_lock );
+
+   return tex;
+}
+
+
+/**
+ * @brief Gets a texture from the list by name and marks it as used again.
+ *
+ * The texture lock must be held.
+ *
+ *    @param path Name of the texture.
+ *    @return The texture or NULL if it isn't loaded.
+ */
+static glTexture* gl_texListGet( const char* path )
+{
+   glTexList *cur;
+
+   for (cur=texture_list; cur!=NULL; cur=cur->next) {
+      if (strcmp(path,cur->tex->name)==0) {
+         cur->used += 1;
+         return cur->tex;
       }
    }
+   return NULL;
+}
+
+
+/**
+ * @brief Adds a texture to the end of the list.
+ *
+ * The texture lock must be held.
+ *
+ *    @param tex Texture to add, it's marked as used once.
+ */
+static void gl_texListAdd( glTexture* tex )
+{
+   glTexList *cur, *last;
 
    /* Create the new node */
    cur = malloc(sizeof(glTexList));
    cur->next = NULL;
    cur->used = 1;
-
-   /* Load the image */
-   cur->tex = gl_loadNewImage(path, flags);
-   if (cur->tex == NULL) {
-      free(cur);
-      return NULL;
-   }
+   cur->tex  = tex;
 
    if (texture_list == NULL) /* special condition - creating new list */
       texture_list = cur;
-   else
+   else {
+      for (last=texture_list; last->next!=NULL; last=last->next);
       last->next = cur;
-
-   return cur->tex;
+   }
 }
 
 
@@ -492,6 +597,8 @@ static glTexture* gl_loadNewImage( const char* path, const unsigned int flags )
    t = gl_loadImage(surface, flags);
    t->trans = trans;
    t->name  = strdup(path);
+   if (t->trans != NULL)
+      gl_mapMasks(t);
    return t;
 }
 
@@ -514,16 +621,96 @@ glTexture* gl_newSprite( const char* path, const int sx, const int sy,
 
    /* will possibly overwrite an existing textur properties
     * so we have to load same texture always the same sprites */
+   SDL_mutexP( texture_lock );
    texture->sx    = (double)sx;
    texture->sy    = (double)sy;
    texture->sw    = texture->w/texture->sx;
    texture->sh    = texture->h/texture->sy;
    texture->srw   = texture->sw / texture->rw;
    texture->srh   = texture->sh / texture->rh;
+
+   /* Collision masks depend on the sprite layout. */
+   if (texture->trans != NULL)
+      gl_mapMasks(texture);
+   SDL_mutexV( texture_lock );
    return texture;
 }
 
 
+/**
+ * @brief Builds the collision masks of all the sprites of a texture.
+ *
+ * Does nothing if the masks already match the sprite layout.
+ *
+ *    @param t Texture to map, must have a transparency map.
+ */
+static void gl_mapMasks( glTexture* t )
+{
+   int i,j, x,y, sx,sy, bx,by;
+   glMask *m;
+
+   sx = (int)t->sx;
+   sy = (int)t->sy;
+
+   /* Already mapped. */
+   if ((t->masks != NULL) && (t->nmasks == sx*sy) &&
+         (t->masks[0].w == (int)t->sw) && (t->masks[0].h == (int)t->sh))
+      return;
+   gl_freeMasks(t);
+
+   t->nmasks = sx*sy;
+   t->masks  = calloc( t->nmasks, sizeof(glMask) );
+   for (j=0; j<sy; j++) {
+      for (i=0; i<sx; i++) {
+         m        = &t->masks[ j*sx + i ];
+         m->w     = (int)t->sw;
+         m->h     = (int)t->sh;
+         m->words = (m->w + 63) / 64;
+         m->bits  = calloc( m->words * m->h, sizeof(uint64_t) );
+         m->span  = malloc( 2 * m->h * sizeof(int) );
+
+         /* Sprites are stored flipped vertically in the sheet. */
+         bx = i * m->w;
+         by = (sy - j - 1) * m->h;
+         for (y=0; y<m->h; y++) {
+            m->span[2*y]   = m->w;
+            m->span[2*y+1] = -1;
+            for (x=0; x<m->w; x++) {
+               if (gl_isTrans( t, bx+x, by+y ))
+                  continue;
+               m->bits[ y*m->words + x/64 ] |= ((uint64_t)1) << (x%64);
+               if (m->span[2*y] > x)
+                  m->span[2*y] = x;
+               m->span[2*y+1] = x;
+            }
+         }
+      }
+   }
+}
+
+
+/**
+ * @brief Frees the collision masks of a texture.
+ *
+ *    @param t Texture to free masks of.
+ */
+static void gl_freeMasks( glTexture* t )
+{
+   int i;
+
+   if (t->masks == NULL)
+      return;
+
+   for (i=0; i<t->nmasks; i++) {
+      free(t->masks[i].bits);
+      free(t->masks[i].span);
+   }
+   free(t->masks);
+   t->masks  = NULL;
+   t->nmasks = 0;
+}
+
+
 /**
  * @brief Frees a texture.
  *
@@ -539,6 +726,8 @@ void gl_freeTexture( glTexture* texture )
       return;
    }
 
+   SDL_mutexP( texture_lock );
+
    /* see if we can find it in stack */
    last = NULL;
    for (cur=texture_list; cur!=NULL; cur=cur->next) {
@@ -546,12 +735,7 @@ void gl_freeTexture( glTexture* texture )
          cur->used--;
          if (cur->used <= 0) { /* not used anymore */
             /* free the texture */
-            glDeleteTextures( 1, &texture->texture );
-            if (texture->trans != NULL)
-               free(texture->trans);
-            if (texture->name != NULL)
-               free(texture->name);
-            free(texture);
+            gl_texFree( texture );
 
             /* free the list node */
             if (last == NULL) { /* case there's no texture before it */
@@ -564,6 +748,7 @@ void gl_freeTexture( glTexture* texture )
                last->next = cur->next;
             free(cur);
          }
+         SDL_mutexV( texture_lock );
          return; /* we already found it so we can exit */
       }
       last = cur;
@@ -574,12 +759,31 @@ void gl_freeTexture( glTexture* texture )
       WARN("Attempting to free texture '%s' not found in stack!", texture->name);
 
    /* Free anyways */
-   glDeleteTextures( 1, &texture->texture );
-   if (texture->trans != NULL) free(texture->trans);
-   if (texture->name != NULL) free(texture->name);
-   free(texture);
+   gl_texFree( texture );
+   SDL_mutexV( texture_lock );
+}
 
-   gl_checkErr();
+
+/**
+ * @brief Frees a texture that isn't in the list.
+ *
+ * The texture lock must be held.
+ *
+ *    @param tex Texture to free.
+ */
+static void gl_texFree( glTexture* tex )
+{
+   gl_texUnqueue( tex );
+   if (tex->texture != 0) {
+      glDeleteTextures( 1, &tex->texture );
+      gl_checkErr();
+   }
+   if (tex->trans != NULL)
+      free(tex->trans);
+   gl_freeMasks(tex);
+   if (tex->name != NULL)
+      free(tex->name);
+   free(tex);
 }
 
 
@@ -591,22 +795,22 @@ void gl_freeTexture( glTexture* texture )
  */
 glTexture* gl_dupTexture( glTexture *texture )
 {
-   glTexList *cur, *last;
+   glTexList *cur;
 
    /* No segfaults kthxbye. */
    if (texture == NULL)
       return NULL;
 
    /* check to see if it already exists */
-   if (texture_list != NULL) {
-      for (cur=texture_list; cur!=NULL; cur=cur->next) {
-         if (texture == cur->tex) {
-            cur->used += 1;
-            return cur->tex;
-         }
-         last = cur;
+   SDL_mutexP( texture_lock );
+   for (cur=texture_list; cur!=NULL; cur=cur->next) {
+      if (texture == cur->tex) {
+         cur->used += 1;
+         SDL_mutexV( texture_lock );
+         return cur->tex;
       }
    }
+   SDL_mutexV( texture_lock );
 
    /* Invalid texture. */
    return NULL;
@@ -632,6 +836,22 @@ int gl_isTrans( const glTexture* t, const int x, const int y )
 }
 
 
+/**
+ * @brief Gets the collision mask of a sprite.
+ *
+ *    @param t Texture to get mask of.
+ *    @param sx X sprite.
+ *    @param sy Y sprite.
+ *    @return The collision mask or NULL if the texture has none.
+ */
+const glMask* gl_getMask( const glTexture* t, const int sx, const int sy )
+{
+   if (t->masks == NULL)
+      return NULL;
+   return &t->masks[ sy*(int)t->sx + sx ];
+}
+
+
 /**
  * @brief Sets x and y to be the appropriate sprite for glTexture using dir.
  *
@@ -696,6 +916,9 @@ int gl_initTextures (void)
    if (gl_hasVersion(2,0) || gl_hasExt("GL_ARB_texture_non_power_of_two"))
       gl_tex_ext_npot = 1;
 
+   if (texture_lock == NULL)
+      texture_lock = SDL_CreateMutex();
+
    return 0;
 }
 
@@ -713,5 +936,114 @@ void gl_exitTextures (void)
       for (tex=texture_list; tex!=NULL; tex=tex->next)
          DEBUG("   '%s' opened %d times", tex->tex->name, tex->used );
    }
+
+   /* Nothing should be waiting by now. */
+   gl_texDefer( 0 );
+   free( gl_texQueue );
+   gl_texQueue  = NULL;
+   gl_mtexQueue = 0;
+
+   if (texture_lock != NULL) {
+      SDL_DestroyMutex( texture_lock );
+      texture_lock = NULL;
+   }
+}
+
+
+/**
+ * @brief Sets whether texture uploads are deferred.
+ *
+ * While deferred, images may be loaded from any thread and the main thread
+ *  uploads them with gl_texUpload.  Textures are usable once uploaded.
+ *  Turning it off uploads everything still waiting.  Must be called from
+ *  the main thread while no other threads are loading images.
+ *
+ *    @param enable Whether to defer uploads.
+ */
+void gl_texDefer( int enable )
+{
+   /* Headless runs never initialize the textures. */
+   if (enable && (texture_lock == NULL))
+      texture_lock = SDL_CreateMutex();
+
+   gl_texDeferred = enable;
+   if (!enable)
+      gl_texUpload( 0 );
+}
+
+
+/**
+ * @brief Uploads textures waiting for it.
+ *
+ * Must be called from the main thread.
+ *
+ *    @param max Maximum number of textures to upload, 0 uploads all of them.
+ *    @return Number of textures uploaded.
+ */
+int gl_texUpload( int max )
+{
+   int n;
+   glTexUpload *up;
+
+   n = 0;
+   while ((max <= 0) || (n < max)) {
+      /* Kept locked while uploading so the texture can't be freed under us. */
+      SDL_mutexP( texture_lock );
+      if (gl_ntexQueue <= 0) {
+         SDL_mutexV( texture_lock );
+         break;
+      }
+      up = &gl_texQueue[ --gl_ntexQueue ];
+      up->tex->texture = gl_uploadSurface( up->surface, up->flags );
+      SDL_mutexV( texture_lock );
+      n++;
+   }
+   return n;
+}
+
+
+/**
+ * @brief Queues a texture to be uploaded by the main thread.
+ *
+ *    @param tex Texture to upload to.
+ *    @param surface Prepared surface to upload, the queue takes ownership.
+ *    @param flags Flags the texture was loaded with.
+ */
+static void gl_texQueueAdd( glTexture* tex, SDL_Surface* surface, unsigned int flags )
+{
+   glTexUpload *up;
+
+   SDL_mutexP( texture_lock );
+   if (gl_ntexQueue >= gl_mtexQueue) {
+      gl_mtexQueue = MAX( 2*gl_mtexQueue, 64 );
+      gl_texQueue  = realloc( gl_texQueue, gl_mtexQueue * sizeof(glTexUpload) );
+   }
+   up = &gl_texQueue[ gl_ntexQueue++ ];
+   up->tex     = tex;
+   up->surface = surface;
+   up->flags   = flags;
+   SDL_mutexV( texture_lock );
+}
+
+
+/**
+ * @brief Drops a texture from the upload queue.
+ *
+ * The texture lock must be held.
+ *
+ *    @param tex Texture to drop, does nothing if it isn't queued.
+ */
+static void gl_texUnqueue( glTexture* tex )
+{
+   int i;
+
+   for (i=0; i<gl_ntexQueue; i++) {
+      if (gl_texQueue[i].tex == tex) {
+         SDL_FreeSurface( gl_texQueue[i].surface );
+         gl_ntexQueue--;
+         gl_texQueue[i] = gl_texQueue[ gl_ntexQueue ];
+         return;
+      }
+   }
 }
 
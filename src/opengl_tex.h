@@ -39,6 +39,21 @@
 #define OPENGL_TEX_MAPTRANS   (1<<0) /**< Create a transparency map. */
 #define OPENGL_TEX_MIPMAPS    (1<<1) /**< Creates mipmaps. */
 
+/**
+ * @brief Collision mask of a single sprite.
+ *
+ * Rows are packed into 64 bit words with the leftmost pixel in the lowest
+ *  bit so masks can be tested against each other a word at a time.
+ */
+typedef struct glMask_ {
+   int w; /**< Width in pixels. */
+   int h; /**< Height in pixels. */
+   int words; /**< Number of 64 bit words per row. */
+   uint64_t *bits; /**< Opaque pixels, h rows of words each. */
+   int *span; /**< First and last opaque pixel of each row, first > last if empty. */
+} glMask;
+
+
 /**
  * @brief Abstraction for rendering spriteshets.
  *
@@ -64,6 +79,8 @@ typedef struct glTexture_ {
    /* data */
    GLuint texture; /**< the opengl texture itself */
    uint8_t* trans; /**< maps the transparency */
+   glMask *masks; /**< Collision mask of each sprite, NULL if not mapped. */
+   int nmasks; /**< Number of collision masks. */
 
    /* properties */
    uint8_t flags; /**< flags used for texture properties */
@@ -92,6 +109,12 @@ glTexture* gl_newSprite( const char* path, const int sx, const int sy,
       const unsigned int flags );
 glTexture* gl_dupTexture( glTexture *texture );
 
+/*
+ * Deferred uploads.
+ */
+void gl_texDefer( int enable );
+int gl_texUpload( int max );
+
 /*
  * Clean up.
  */
@@ -107,6 +130,7 @@ int gl_texHasCompress (void);
  * Misc.
  */
 int gl_isTrans( const glTexture* t, const int x, const int y );
+const glMask* gl_getMask( const glTexture* t, const int sx, const int sy );
 void gl_getSpriteFromDir( int* x, int* y, const glTexture* t, const double dir );
 int gl_needPOT (void);
 
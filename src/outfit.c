@@ -73,6 +73,7 @@ static void outfit_parseSFighterBay( Outfit *temp, const xmlNodePtr parent );
 static void outfit_parseSFighter( Outfit *temp, const xmlNodePtr parent );
 static void outfit_parseSMap( Outfit *temp, const xmlNodePtr parent );
 static void outfit_parseSLicense( Outfit *temp, const xmlNodePtr parent );
+static int outfit_loadCache( DCache *dc );
 
 
 /**
@@ -1579,10 +1580,18 @@ int outfit_load (void)
 {
    int i;
    uint32_t bufsize;
-   char *buf = ndata_read( OUTFIT_DATA, &bufsize );
-
+   const char *buf;
    xmlNodePtr node;
-   xmlDocPtr doc = xmlParseMemory( buf, bufsize );
+   xmlDocPtr doc;
+
+   /* Try the cache first. */
+   if (dcache_load( DCACHE_OUTFIT, outfit_loadCache, outfit_free ) == 0) {
+      DEBUG("Loaded %d Outfit%s", array_size(outfit_stack), (array_size(outfit_stack)==1) ? "" : "s" );
+      return 0;
+   }
+
+   buf = ndata_borrow( OUTFIT_DATA, &bufsize );
+   doc = xmlParseMemory( buf, bufsize );
 
    node = doc->xmlChildrenNode;
    if (!xml_isNode(node,XML_OUTFIT_ID)) {
@@ -1614,7 +1623,7 @@ int outfit_load (void)
    }
 
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    DEBUG("Loaded %d Outfit%s", array_size(outfit_stack), (array_size(outfit_stack)==1) ? "" : "s" );
 
@@ -1622,6 +1631,133 @@ int outfit_load (void)
 }
 
 
+/**
+ * @brief Loads the outfits from the data cache.
+ *
+ *    @param dc Section of the cache to load from.
+ *    @return 0 on success.
+ */
+static int outfit_loadCache( DCache *dc )
+{
+   int i, n, id;
+   Outfit *o, *ammo;
+
+   outfit_stack = array_create(Outfit);
+   n = dcache_readCount( dc, sizeof(Outfit) );
+   if (dcache_error(dc))
+      return -1;
+
+   for (i=0; i<n; i++) {
+      o = &array_grow(&outfit_stack);
+      dcache_readData( dc, o, sizeof(Outfit) );
+
+      /* Fix the pointers. */
+      o->name        = dcache_readString( dc );
+      o->typename    = dcache_readString( dc );
+      o->license     = dcache_readString( dc );
+      o->description = dcache_readString( dc );
+      o->desc_short  = dcache_readString( dc );
+      o->gfx_store   = dcache_readTexture( dc, OPENGL_TEX_MIPMAPS );
+      if (outfit_isBolt(o)) {
+         o->u.blt.gfx_space = dcache_readTexture( dc,
+               OPENGL_TEX_MAPTRANS | OPENGL_TEX_MIPMAPS );
+         o->u.blt.gfx_end   = dcache_readTexture( dc,
+               OPENGL_TEX_MAPTRANS | OPENGL_TEX_MIPMAPS );
+      }
+      else if (outfit_isBeam(o))
+         o->u.bem.gfx = dcache_readTexture( dc, OPENGL_TEX_MIPMAPS );
+      else if (outfit_isLauncher(o)) {
+         o->u.lau.ammo_name = dcache_readString( dc );
+         o->u.lau.ammo      = NULL;
+      }
+      else if (outfit_isAmmo(o))
+         o->u.amm.gfx_space = dcache_readTexture( dc,
+               OPENGL_TEX_MAPTRANS | OPENGL_TEX_MIPMAPS );
+      else if (outfit_isFighterBay(o)) {
+         o->u.bay.ammo_name = dcache_readString( dc );
+         o->u.bay.ammo      = NULL;
+      }
+      else if (outfit_isFighter(o))
+         o->u.fig.ship = dcache_readString( dc );
+
+      if (dcache_error(dc))
+         return -1;
+   }
+
+   /* Set up ammunition relationships, stored by index. */
+   for (i=0; i<array_size(outfit_stack); i++) {
+      o = &outfit_stack[i];
+      if (!outfit_isLauncher(o) && !outfit_isFighterBay(o))
+         continue;
+      id = dcache_readInt( dc );
+      if (dcache_error(dc) || (id < -1) || (id >= n))
+         return -1;
+      ammo = (id >= 0) ? &outfit_stack[id] : NULL;
+      if (outfit_isLauncher(o))
+         o->u.lau.ammo = ammo;
+      else
+         o->u.bay.ammo = ammo;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Writes the outfits to the data cache.
+ *
+ *    @param dc Section of the cache to write to.
+ *    @return 0 on success.
+ */
+int outfit_saveCache( DCache *dc )
+{
+   int i;
+   Outfit *o, *ammo;
+
+   dcache_writeInt( dc, array_size(outfit_stack) );
+   for (i=0; i<array_size(outfit_stack); i++) {
+      o = &outfit_stack[i];
+      dcache_writeData( dc, o, sizeof(Outfit) );
+
+      /* Pointers must be written in the same order outfit_loadCache reads them. */
+      dcache_writeString( dc, o->name );
+      dcache_writeString( dc, o->typename );
+      dcache_writeString( dc, o->license );
+      dcache_writeString( dc, o->description );
+      dcache_writeString( dc, o->desc_short );
+      dcache_writeTexture( dc, o->gfx_store );
+      if (outfit_isBolt(o)) {
+         dcache_writeTexture( dc, o->u.blt.gfx_space );
+         dcache_writeTexture( dc, o->u.blt.gfx_end );
+      }
+      else if (outfit_isBeam(o))
+         dcache_writeTexture( dc, o->u.bem.gfx );
+      else if (outfit_isLauncher(o))
+         dcache_writeString( dc, o->u.lau.ammo_name );
+      else if (outfit_isAmmo(o))
+         dcache_writeTexture( dc, o->u.amm.gfx_space );
+      else if (outfit_isFighterBay(o))
+         dcache_writeString( dc, o->u.bay.ammo_name );
+      else if (outfit_isFighter(o))
+         dcache_writeString( dc, o->u.fig.ship );
+   }
+
+   /* Ammunition relationships. */
+   for (i=0; i<array_size(outfit_stack); i++) {
+      o = &outfit_stack[i];
+      if (outfit_isLauncher(o))
+         ammo = o->u.lau.ammo;
+      else if (outfit_isFighterBay(o))
+         ammo = o->u.bay.ammo;
+      else
+         continue;
+      dcache_writeInt( dc, (ammo != NULL) ? ammo - outfit_stack : -1 );
+   }
+
+   return 0;
+}
+
+
 /**
  * @brief Frees the outfit stack.
  */
@@ -1661,5 +1797,6 @@ void outfit_free (void)
    }
 
    array_free(outfit_stack);
+   outfit_stack = NULL;
 }
 
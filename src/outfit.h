@@ -10,6 +10,7 @@
 
 #include "opengl.h"
 #include "sound.h"
+#include "dcache.h"
 
 
 /*
@@ -415,6 +416,7 @@ int outfit_soundHit( const Outfit* o );
  */
 int outfit_load (void);
 void outfit_free (void);
+int outfit_saveCache( DCache *dc );
 
 
 #endif /* OUTFIT_H */
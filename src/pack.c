@@ -7,10 +7,30 @@
  *
  * @brief Stores data in funky format.
  *
- * Format Overview:
+ * Format Overview (version 2, "NAEVDAT2"):
+ *
+ *   1.1) Header
+ *     1.1.1) Magic Number (8 bytes)
+ *     1.1.2) Number of Files (uint32_t)
+ *     1.1.3) Size of the Index (uint32_t)
+ *   1.2) Index, for each file
+ *     1.2.1) File Name Length (uint16_t)
+ *     1.2.2) File Name (not NUL terminated)
+ *     1.2.3) Codec (uint8_t)
+ *     1.2.4) Data Location (uint64_t)
+ *     1.2.5) Stored Size (uint64_t)
+ *     1.2.6) File Size (uint64_t)
+ *     1.2.7) File CRC32 (uint32_t)
+ *   1.3) File data stored with its codec, one after another
+ *   1.4) EOF
+ *
+ * All numbers are big endian. The index is small and all at the front so it
+ *  can be read at once.
+ *
+ * Format Overview (version 1, "NAEVDATA"), can still be read:
  *
  *   1.1) Index
- *     1.1.1) Magic Number (16 bytes)
+ *     1.1.1) Magic Number (8 bytes)
  *     1.1.2) Number of Files (uint32_t)
  *     1.1.3) Files in format Name/Location
  *       1.1.3.1) File Name (128 bytes max, ended in NUL)
@@ -21,12 +41,12 @@
  *     1.2.3) File MD5 (16 byte char*)
  *   1.3) EOF
  *
- * 
+ *
  * Program Overview:
  *
- *   2.1) Write Magic Number and Number of Files (1.1 and 1.2 above)
- *   2,2) Write the Index
- *   3,3) Pack the files
+ *   2.1) Write Header with an empty Index (1.1 and 1.2 above)
+ *   2,2) Pack the files, compressing the ones that get smaller
+ *   3,3) Go back and write the Index
  */
 
 
@@ -40,6 +60,7 @@
 #if HAS_FD
 #include <sys/types.h> /* ssize_t */
 #include <sys/stat.h> /* S_IRUSR */
+#include <sys/mman.h> /* mmap() */
 #endif /* HAS_FD */
 #include <unistd.h> /* WRITE() */
 #include <errno.h> /* error numbers */
@@ -52,6 +73,8 @@
 #include <winsock2.h> /* ntohl */
 #endif /* HAS_WIN32 */
 
+#include <zlib.h>
+
 #include "log.h"
 #include "md5.h"
 
@@ -65,20 +88,53 @@
 #endif /* HAS_BIGENDIAN */
 
 
+/*
+ * Codecs.
+ */
+#define PACK_CODEC_NONE       0 /**< Stored as is. */
+#define PACK_CODEC_ZLIB       1 /**< Compressed with zlib. */
+
+
+/**
+ * @brief File in the index of a packfile.
+ */
+typedef struct PackEntry_ {
+   uint64_t start; /**< Where the data starts in the packfile. */
+   uint64_t stored; /**< Size of the data in the packfile. */
+   uint64_t size; /**< Size of the file. */
+   uint32_t crc; /**< CRC32 of the file, only version 2. */
+   uint8_t codec; /**< How the data is stored. */
+} PackEntry;
+
+
 /**
  * @brief Abstracts around packfiles.
+ *
+ * Positions of compressed files are in the decompressed data, start is 0 and
+ *  end is the size of the file.
  */
 struct Packfile_s {
 #if HAS_FD
-   int fd; /**< file descriptor */
+   int fd; /**< file descriptor, -1 if reading from the mapping */
 #else /* not HAS_FD */
    FILE* fp; /**< For non-posix. */
 #endif /* HAS_FD */
-   uint32_t pos; /**< cursor position */
-   uint32_t start; /**< File start. */
-   uint32_t end; /**< File end. */
+   uint64_t pos; /**< cursor position */
+   uint64_t start; /**< File start. */
+   uint64_t end; /**< File end. */
 
    uint32_t flags; /**< Special control flags. */
+   int version; /**< Version of the packfile. */
+   uint32_t crc; /**< CRC32 the file should have, only version 2. */
+
+   /* Compressed files. */
+   uint8_t codec; /**< How the data is stored. */
+   z_stream *z; /**< Decompression stream. */
+   uint64_t zstart; /**< Where the compressed data starts in the packfile. */
+   uint64_t zsize; /**< Size of the compressed data. */
+   uint64_t zread; /**< Compressed bytes fed to the stream. */
+   const uint8_t *zmap; /**< Compressed data if the packfile is mapped. */
+   uint8_t *zbuf; /**< Buffer for compressed data read from the packfile. */
 };
 
 
@@ -93,9 +149,20 @@ struct Packcache_s {
 #endif /* HAS_FD */
 
    char *name; /**< To open the file again. */
+   int version; /**< Version of the packfile. */
    char **index; /**< Cached index for faster lookups. */
-   uint32_t *start; /**< Cached index starts. */
+   PackEntry *entries; /**< Cached index entries. */
    uint32_t nindex; /**< Number of index entries. */
+
+   uint32_t *hash; /**< Hashes of the index entries. */
+   int32_t *table; /**< Index entries by hash, -1 if empty. */
+   uint32_t mtable; /**< Size of the table, power of two. */
+   const char **sorted; /**< Index entries sorted by name for listing directories. */
+
+#if HAS_FD
+   const uint8_t *map; /**< Whole packfile mapped read only, NULL if not mapped. */
+   size_t mapsize; /**< Size of the mapping. */
+#endif /* HAS_FD */
 };
 
 /*
@@ -116,6 +183,7 @@ struct Packcache_s {
 
 
 #define BLOCKSIZE    128*1024 /**< The read/write block size. */
+#define ZBUFSIZE     16*1024 /**< Compressed data read at once when streaming. */
 
 #ifndef PATH_MAX
 #define PATH_MAX     256   /**< maximum file name length. */
@@ -128,6 +196,12 @@ struct Packcache_s {
 
 
 static const uint64_t magic = 0x4e41455644415441ULL; /**< File magic number: NAEVDATA */
+static const uint64_t magic2 = 0x4e41455644415432ULL; /**< Version 2 magic number: NAEVDAT2 */
+
+#define PACK_HEADER_SIZE   (8+4+4) /**< Size of the version 2 header. */
+#define PACK_ENTRY_SIZE    (2+1+8+8+8+4) /**< Size of a version 2 index entry without the name. */
+#define PACK_ENTRY1_SIZE   (1+4) /**< Smallest possible version 1 index entry. */
+#define PACK_INDEX_MAX     (UINT32_MAX/4) /**< Most files a packfile can index. */
 
 
 /*
@@ -140,6 +214,27 @@ static const uint64_t magic = 0x4e41455644415441ULL; /**< File magic number: NAE
  * Prototypes.
  */
 static off_t getfilesize( const char* filename );
+static void pack_put16( uint8_t *p, uint16_t v );
+static void pack_put32( uint8_t *p, uint32_t v );
+static void pack_put64( uint8_t *p, uint64_t v );
+static uint16_t pack_get16( const uint8_t *p );
+static uint32_t pack_get32( const uint8_t *p );
+static uint64_t pack_get64( const uint8_t *p );
+static int pack_version( const void *buf );
+static uint32_t pack_hash( const char *str );
+static int pack_cmpName( const void *p1, const void *p2 );
+static int pack_indexCache( Packcache_t *cache );
+static int32_t pack_findCache( Packcache_t *cache, const char *filename );
+static Packcache_t* pack_openCacheMode( const char* packfile, int map );
+static Packcache_t* pack_readIndex1( Packcache_t *cache, uint64_t filesize );
+static Packcache_t* pack_readIndex2( Packcache_t *cache, uint64_t filesize );
+static Packcache_t* pack_readSizes1( Packcache_t *cache );
+static int pack_checkIndex( Packcache_t *cache, uint64_t filesize );
+static const uint8_t* pack_viewCache( Packcache_t *cache, int32_t i, uint32_t *filesize );
+static void pack_checkData( Packcache_t *cache, int32_t i, const void *data );
+static ssize_t pack_readZ( Packfile_t* file, void* buf, size_t count );
+static off_t pack_seekZ( Packfile_t* file, uint64_t target );
+static void* pack_readInput( const char *filename, uint64_t *size );
 /* RWops stuff. */
 #if SDL_VERSION_ATLEAST(1,3,0)
 static long packrw_seek( SDL_RWops *rw, long offset, int whence );
@@ -153,19 +248,467 @@ static int packrw_write( SDL_RWops *rw, const void *ptr, int size, int num );
 static int packrw_close( SDL_RWops *rw );
 
 
+/*
+ * Big endian numbers for the version 2 index.
+ */
+static void pack_put16( uint8_t *p, uint16_t v )
+{
+   p[0] = v >> 8;
+   p[1] = v;
+}
+static void pack_put32( uint8_t *p, uint32_t v )
+{
+   pack_put16( p, v >> 16 );
+   pack_put16( p+2, v );
+}
+static void pack_put64( uint8_t *p, uint64_t v )
+{
+   pack_put32( p, v >> 32 );
+   pack_put32( p+4, v );
+}
+static uint16_t pack_get16( const uint8_t *p )
+{
+   return ((uint16_t)p[0] << 8) | p[1];
+}
+static uint32_t pack_get32( const uint8_t *p )
+{
+   return ((uint32_t)pack_get16(p) << 16) | pack_get16(p+2);
+}
+static uint64_t pack_get64( const uint8_t *p )
+{
+   return ((uint64_t)pack_get32(p) << 32) | pack_get32(p+4);
+}
+
+
+/**
+ * @brief Gets the version of a packfile from its magic number.
+ *
+ *    @param buf First 8 bytes of the packfile.
+ *    @return The version or 0 if it isn't a packfile.
+ */
+static int pack_version( const void *buf )
+{
+   uint64_t end64;
+
+   end64 = ntohll(magic);
+   if (memcmp(buf, &end64, sizeof(magic))==0)
+      return 1;
+   end64 = ntohll(magic2);
+   if (memcmp(buf, &end64, sizeof(magic2))==0)
+      return 2;
+   return 0;
+}
+
+
+/**
+ * @brief Hashes a file name.
+ *
+ *    @param str Name to hash.
+ *    @return Hash of the name.
+ */
+static uint32_t pack_hash( const char *str )
+{
+   uint32_t h;
+
+   /* FNV-1a. */
+   h = 2166136261U;
+   for ( ; *str != '\0'; str++) {
+      h ^= (unsigned char)*str;
+      h *= 16777619U;
+   }
+   return h;
+}
+
+
+/**
+ * @brief Compares two file names for qsort.
+ */
+static int pack_cmpName( const void *p1, const void *p2 )
+{
+   return strcmp( *(const char**)p1, *(const char**)p2 );
+}
+
+
+/**
+ * @brief Builds the lookup tables of a Packcache.
+ *
+ * Files are found through an open addressing hash table kept at most half
+ *  full, directories are listed from a copy of the index sorted by name
+ *  where all the files under a path are next to each other.
+ *
+ *    @param cache Packcache to index.
+ *    @return 0 on success.
+ */
+static int pack_indexCache( Packcache_t *cache )
+{
+   uint32_t i, j, mask;
+
+   /* The table size must not overflow when doubling. */
+   if (cache->nindex > PACK_INDEX_MAX) {
+      WARN("Packfile has too many files (%u).", cache->nindex);
+      return -1;
+   }
+
+   cache->mtable = 64;
+   while (cache->mtable < 2*cache->nindex)
+      cache->mtable *= 2;
+   cache->table  = malloc( cache->mtable * sizeof(int32_t) );
+   cache->hash   = malloc( cache->nindex * sizeof(uint32_t) );
+   cache->sorted = malloc( cache->nindex * sizeof(char*) );
+   if ((cache->table == NULL) || (cache->hash == NULL) ||
+         ((cache->sorted == NULL) && (cache->nindex > 0))) {
+      WARN("Out of Memory.");
+      return -1;
+   }
+   for (i=0; i<cache->mtable; i++)
+      cache->table[i] = -1;
+
+   mask = cache->mtable-1;
+   for (i=0; i<cache->nindex; i++) {
+      cache->hash[i] = pack_hash( cache->index[i] );
+      for (j=cache->hash[i] & mask; cache->table[j] >= 0; j=(j+1) & mask);
+      cache->table[j] = i;
+   }
+
+   memcpy( cache->sorted, cache->index, cache->nindex * sizeof(char*) );
+   qsort( cache->sorted, cache->nindex, sizeof(char*), pack_cmpName );
+   return 0;
+}
+
+
+/**
+ * @brief Finds a file in a Packcache.
+ *
+ *    @param cache Packcache to look in.
+ *    @param filename Name of the file to find.
+ *    @return Position of the file in the index or -1 if not found.
+ */
+static int32_t pack_findCache( Packcache_t *cache, const char *filename )
+{
+   uint32_t h, j, mask;
+   int32_t i;
+
+   h    = pack_hash( filename );
+   mask = cache->mtable-1;
+   for (j=h & mask; (i=cache->table[j]) >= 0; j=(j+1) & mask)
+      if ((cache->hash[i] == h) && (strcmp(cache->index[i], filename)==0))
+         return i;
+   return -1;
+}
+
+
+/**
+ * @brief Gets the contents of a file in a mapped Packcache.
+ *
+ *    @param cache Packcache to get the file from.
+ *    @param i Position of the file in the index.
+ *    @param[out] filesize Size of the file.
+ *    @return The contents of the file in the mapping or NULL if not mapped
+ *            or compressed.
+ */
+static const uint8_t* pack_viewCache( Packcache_t *cache, int32_t i, uint32_t *filesize )
+{
+#if HAS_FD
+   PackEntry *e;
+
+   e = &cache->entries[i];
+   if ((cache->map == NULL) || (e->codec != PACK_CODEC_NONE))
+      return NULL;
+
+   *filesize = e->size;
+   return &cache->map[ e->start ];
+#else /* HAS_FD */
+   (void) cache;
+   (void) i;
+   (void) filesize;
+   return NULL;
+#endif /* HAS_FD */
+}
+
+
+/**
+ * @brief Checks the contents of a file read from a Packcache.
+ *
+ *    @param cache Packcache the file is from.
+ *    @param i Position of the file in the index.
+ *    @param data Contents of the file.
+ */
+static void pack_checkData( Packcache_t *cache, int32_t i, const void *data )
+{
+   PackEntry *e;
+   md5_state_t md5;
+   md5_byte_t md5val[16];
+
+   e = &cache->entries[i];
+   if (cache->version >= 2) {
+      if (crc32( crc32(0L, Z_NULL, 0), data, e->size ) != e->crc)
+         WARN("CRC32 of '%s' gives different value, possible memory corruption, continuing...",
+               cache->index[i]);
+      return;
+   }
+
+#if HAS_FD
+   /* Version 1 stores the MD5 after the data. */
+   if (cache->map != NULL) {
+      md5_init(&md5);
+      md5_append( &md5, data, e->size );
+      md5_finish(&md5, md5val);
+      if (memcmp( md5val, &cache->map[ e->start + e->size ], 16 ))
+         WARN("MD5 gives different value, possible memory corruption, continuing...");
+   }
+#else /* HAS_FD */
+   (void) md5;
+   (void) md5val;
+#endif /* HAS_FD */
+}
+
+
+/**
+ * @brief Reads the index of a version 1 packfile.
+ *
+ *    @param cache Packcache positioned after the magic number.
+ *    @param filesize Size of the packfile.
+ *    @return The cache or NULL on error.
+ */
+static Packcache_t* pack_readIndex1( Packcache_t *cache, uint64_t filesize )
+{
+   int j;
+   uint32_t i, start;
+   char buf[PATH_MAX];
+
+   /*
+    * Get number of files and allocate memory.
+    */
+   READ( cache, &cache->nindex, 4 );
+   cache->nindex  = htonl( cache->nindex );
+   if (cache->nindex > filesize / PACK_ENTRY1_SIZE) {
+      WARN("Index of packfile claims %u files, more than fit in it", cache->nindex);
+      cache->nindex = 0;
+      return NULL;
+   }
+   cache->index   = calloc( cache->nindex, sizeof(char*) );
+   cache->entries = calloc( cache->nindex, sizeof(PackEntry) );
+   if (((cache->index == NULL) || (cache->entries == NULL)) && (cache->nindex > 0)) {
+      WARN("Out of Memory.");
+      return NULL;
+   }
+
+   /*
+    * Read index.
+    */
+   for (i=0; i<cache->nindex; i++) { /* start to search files */
+      j = 0;
+      READ( cache, &buf[j], 1 ); /* get the name */
+      while ( buf[j++] != '\0' ) {
+         if (j >= PATH_MAX) {
+            WARN("File name in index is too long");
+            return NULL;
+         }
+         READ( cache, &buf[j], 1 );
+      }
+
+      cache->index[i] = strdup(buf);
+      READ( cache, &start, 4 );
+      /* The data comes after its size, filled in by pack_readSizes1. */
+      cache->entries[i].start = (uint64_t)htonl( start ) + 4;
+      cache->entries[i].codec = PACK_CODEC_NONE;
+      DEBUG("'%s' found at %d", cache->index[i], htonl(start));
+   }
+
+   return cache;
+}
+
+
+/**
+ * @brief Reads the sizes of the files in a version 1 packfile.
+ *
+ * They're stored with the data instead of in the index.
+ *
+ *    @param cache Packcache with the index read.
+ *    @return The cache or NULL on error.
+ */
+static Packcache_t* pack_readSizes1( Packcache_t *cache )
+{
+   uint32_t i, size;
+   PackEntry *e;
+
+   for (i=0; i<cache->nindex; i++) {
+      e = &cache->entries[i];
+#if HAS_FD
+      if (cache->map != NULL) {
+         if (e->start > cache->mapsize) {
+            WARN("File '%s' starts past the end of the packfile.", cache->index[i]);
+            return NULL;
+         }
+         memcpy( &size, &cache->map[ e->start-4 ], 4 );
+      }
+      else {
+         if (lseek( cache->fd, e->start-4, SEEK_SET ) != (off_t)e->start-4) {
+            WARN("Failure to seek to file start: %s", strerror(errno));
+            return NULL;
+         }
+         READ( cache, &size, 4 );
+      }
+#else /* not HAS_FD */
+      if (fseek( cache->fp, e->start-4, SEEK_SET )) {
+         WARN("Failure to seek to file start: %s", strerror(errno));
+         return NULL;
+      }
+      READ( cache, &size, 4 );
+#endif /* HAS_FD */
+      e->size   = htonl( size );
+      e->stored = e->size;
+   }
+
+   return cache;
+}
+
+
+/**
+ * @brief Reads the index of a version 2 packfile.
+ *
+ *    @param cache Packcache positioned after the magic number.
+ *    @param filesize Size of the packfile.
+ *    @return The cache or NULL on error.
+ */
+static Packcache_t* pack_readIndex2( Packcache_t *cache, uint64_t filesize )
+{
+   uint8_t head[8], *buf, *p, *end;
+   uint32_t i, size;
+   uint16_t len;
+   PackEntry *e;
+
+   /*
+    * Get number of files and allocate memory.
+    */
+   READ( cache, head, 8 );
+   cache->nindex  = pack_get32( &head[0] );
+   size           = pack_get32( &head[4] );
+   if ((size > filesize) || (cache->nindex > size / PACK_ENTRY_SIZE)) {
+      WARN("Index of packfile claims %u files in %u bytes, more than fit in it",
+            cache->nindex, size);
+      cache->nindex = 0;
+      return NULL;
+   }
+   cache->index   = calloc( cache->nindex, sizeof(char*) );
+   cache->entries = calloc( cache->nindex, sizeof(PackEntry) );
+   if (((cache->index == NULL) || (cache->entries == NULL)) && (cache->nindex > 0)) {
+      WARN("Out of Memory.");
+      return NULL;
+   }
+
+   /*
+    * Read the whole index at once.
+    */
+   buf = malloc( size+1 );
+   if (buf == NULL) {
+      WARN("Out of Memory.");
+      return NULL;
+   }
+#if HAS_FD
+   if (read( cache->fd, buf, size ) != (ssize_t)size) {
+#else /* not HAS_FD */
+   if (fread( buf, 1, size, cache->fp ) != size) {
+#endif /* HAS_FD */
+      WARN("Fewer bytes read than expected");
+      free(buf);
+      return NULL;
+   }
+
+   /*
+    * Parse it.
+    */
+   p   = buf;
+   end = buf + size;
+   for (i=0; i<cache->nindex; i++) {
+      if (end - p < PACK_ENTRY_SIZE) {
+         WARN("Index of packfile is truncated");
+         free(buf);
+         return NULL;
+      }
+      len = pack_get16( p );
+      if (end - p < PACK_ENTRY_SIZE + len) {
+         WARN("Index of packfile is truncated");
+         free(buf);
+         return NULL;
+      }
+      p += 2;
+
+      cache->index[i] = malloc( len+1 );
+      if (cache->index[i] == NULL) {
+         WARN("Out of Memory.");
+         free(buf);
+         return NULL;
+      }
+      memcpy( cache->index[i], p, len );
+      cache->index[i][len] = '\0';
+      p += len;
+
+      e = &cache->entries[i];
+      e->codec  = p[0];
+      e->start  = pack_get64( &p[1] );
+      e->stored = pack_get64( &p[9] );
+      e->size   = pack_get64( &p[17] );
+      e->crc    = pack_get32( &p[25] );
+      p += PACK_ENTRY_SIZE-2;
+      DEBUG("'%s' found at %llu", cache->index[i], (unsigned long long)e->start);
+   }
+   free(buf);
+
+   return cache;
+}
+
+
+/**
+ * @brief Makes sure the index of a packfile makes sense.
+ *
+ *    @param cache Packcache with the index read.
+ *    @param filesize Size of the packfile.
+ *    @return 0 if it's valid.
+ */
+static int pack_checkIndex( Packcache_t *cache, uint64_t filesize )
+{
+   uint32_t i;
+   uint64_t tail;
+   PackEntry *e;
+
+   tail = (cache->version < 2) ? 16 : 0; /* Version 1 has the MD5 after the data. */
+   for (i=0; i<cache->nindex; i++) {
+      e = &cache->entries[i];
+      if ((e->codec != PACK_CODEC_NONE) && (e->codec != PACK_CODEC_ZLIB)) {
+         WARN("File '%s' uses unknown codec %d.", cache->index[i], e->codec);
+         return -1;
+      }
+      if ((e->codec == PACK_CODEC_NONE) && (e->stored != e->size)) {
+         WARN("File '%s' has inconsistent sizes.", cache->index[i]);
+         return -1;
+      }
+      if ((e->start > filesize) || (e->stored > filesize - e->start) ||
+            (tail > filesize - e->start - e->stored)) {
+         WARN("File '%s' ends past the end of the packfile.", cache->index[i]);
+         return -1;
+      }
+      if (e->size >= UINT32_MAX) {
+         WARN("File '%s' is too big.", cache->index[i]);
+         return -1;
+      }
+   }
+   return 0;
+}
+
+
 /**
  * @brief Opens a Packfile as a cache.
  *
  *    @param packfile Name of the packfile to cache.
+ *    @param map Whether or not to map the packfile.
  *    @return NULL if an error occured or the Packcache.
  */
-Packcache_t* pack_openCache( const char* packfile )
+static Packcache_t* pack_openCacheMode( const char* packfile, int map )
 {
-   int j;
-   uint32_t i;
-   char buf[PATH_MAX];
+   char buf[sizeof(magic)];
    Packcache_t *cache;
-   uint64_t end64;
+   uint64_t filesize;
 
    /*
     * Allocate memory.
@@ -188,6 +731,8 @@ Packcache_t* pack_openCache( const char* packfile )
    if (cache->fp == NULL) {
 #endif /* HAS_FD */
       WARN("Erroring opening %s: %s", packfile, strerror(errno));
+      free(cache->name);
+      free(cache);
       return NULL;
    }
 
@@ -195,33 +740,48 @@ Packcache_t* pack_openCache( const char* packfile )
     * Check for validity.
     */
    READ( cache, buf, sizeof(magic));
-   end64 = ntohll(magic);
-   if (memcmp(buf, &end64, sizeof(magic))) {
+   cache->version = pack_version( buf );
+   if (cache->version == 0) {
       WARN("File %s is not a valid packfile", packfile);
+      pack_closeCache( cache );
       return NULL;
    }
 
    /*
-    * Get number of files and allocate memory.
+    * Read index, it can't be bigger than the file.
     */
-   READ( cache, &cache->nindex, 4 );
-   cache->nindex = htonl( cache->nindex );
-   cache->index = calloc( cache->nindex, sizeof(char*) );
-   cache->start = calloc( cache->nindex, sizeof(uint32_t) );
+   filesize = getfilesize( packfile );
+   if (((cache->version == 1) && (pack_readIndex1( cache, filesize ) == NULL)) ||
+         ((cache->version == 2) && (pack_readIndex2( cache, filesize ) == NULL)) ||
+         pack_indexCache( cache )) {
+      WARN("Unable to read the index of %s", packfile);
+      pack_closeCache( cache );
+      return NULL;
+   }
 
-   /*
-    * Read index.
-    */
-   for (i=0; i<cache->nindex; i++) { /* start to search files */
-      j = 0;
-      READ( cache, &buf[j], 1 ); /* get the name */
-      while ( buf[j++] != '\0' )
-         READ( cache, &buf[j], 1 );
+#if HAS_FD
+   /* Map the whole file so the contents can be used without copying. */
+   if (map) {
+      cache->mapsize = filesize;
+      cache->map     = mmap( NULL, cache->mapsize, PROT_READ, MAP_PRIVATE, cache->fd, 0 );
+      if (cache->map == MAP_FAILED) {
+         WARN("Unable to map '%s', reading it instead: %s", packfile, strerror(errno));
+         cache->map     = NULL;
+         cache->mapsize = 0;
+      }
+   }
+#else /* HAS_FD */
+   (void) map;
+#endif /* HAS_FD */
 
-      cache->index[i] = strdup(buf);
-      READ( cache, &cache->start[i], 4 );
-      cache->start[i] = htonl( cache->start[i] );
-      DEBUG("'%s' found at %d", cache->index[i], cache->start[i]);
+   /*
+    * Check the index.
+    */
+   if (((cache->version == 1) && (pack_readSizes1( cache ) == NULL)) ||
+         pack_checkIndex( cache, filesize )) {
+      WARN("Packfile %s is corrupt", packfile);
+      pack_closeCache( cache );
+      return NULL;
    }
 
    /*
@@ -231,6 +791,18 @@ Packcache_t* pack_openCache( const char* packfile )
 }
 
 
+/**
+ * @brief Opens a Packfile as a cache.
+ *
+ *    @param packfile Name of the packfile to cache.
+ *    @return NULL if an error occured or the Packcache.
+ */
+Packcache_t* pack_openCache( const char* packfile )
+{
+   return pack_openCacheMode( packfile, 1 );
+}
+
+
 /**
  * @brief Closes a Packcache.
  *
@@ -244,6 +816,8 @@ void pack_closeCache( Packcache_t* cache )
     * Close file.
     */
 #if HAS_FD
+   if (cache->map != NULL)
+      munmap( (void*)cache->map, cache->mapsize );
    close( cache->fd );
 #else /* not HAS_FD */
    fclose( cache->fp );
@@ -253,12 +827,15 @@ void pack_closeCache( Packcache_t* cache )
    /*
     * Free memory.
     */
-   if (cache->nindex > 0) {
+   if (cache->index != NULL) {
       for (i=0; i<cache->nindex; i++)
          free(cache->index[i]);
       free(cache->index);
-      free(cache->start);
    }
+   free(cache->entries);
+   free(cache->hash);
+   free(cache->table);
+   free(cache->sorted);
    free(cache);
 }
 
@@ -272,50 +849,76 @@ void pack_closeCache( Packcache_t* cache )
  */
 Packfile_t* pack_openFromCache( Packcache_t* cache, const char* filename )
 {
-   uint32_t i;
+   int32_t i;
+   PackEntry *e;
    Packfile_t *file;
 
+   i = pack_findCache( cache, filename );
+   if (i < 0) {
+      WARN("File '%s' not found in packfile.", filename);
+      return NULL;
+   }
+   e = &cache->entries[i];
+
    file = calloc( 1, sizeof(Packfile_t) );
 
-   for (i=0; i<cache->nindex; i++) {
-      if (strcmp(cache->index[i], filename)==0) {
-         /* Copy file. */
+   /* Copy information. */
+   file->flags  |= PACKFILE_FROMCACHE;
+   file->version = cache->version;
+   file->crc     = e->crc;
+   file->codec   = e->codec;
+
+   /* Compressed files decompress as they're read. */
+   if (file->codec == PACK_CODEC_ZLIB) {
+      file->z = calloc( 1, sizeof(z_stream) );
+      if (inflateInit( file->z ) != Z_OK) {
+         WARN("Unable to start decompressing '%s'.", filename);
+         free(file->z);
+         free(file);
+         return NULL;
+      }
+      file->start  = 0;
+      file->pos    = 0;
+      file->end    = e->size;
+      file->zstart = e->start;
+      file->zsize  = e->stored;
 #if HAS_FD
-         file->fd = open( cache->name, O_RDONLY );
-#else /* not HAS_FD */
-         file->fp = fopen( cache->name, "rb" );
+      /* Straight from the mapping without opening anything. */
+      if (cache->map != NULL) {
+         file->fd   = -1;
+         file->zmap = &cache->map[ e->start ];
+         return file;
+      }
 #endif /* HAS_FD */
+      file->zbuf = malloc( ZBUFSIZE );
+   }
+   else {
+      file->start  = e->start;
+      file->pos    = e->start;
+      file->end    = e->start + e->size;
+   }
 
-         /* Copy information. */
-         file->flags |= PACKFILE_FROMCACHE;
-         file->start  = cache->start[i];
-
-         /* Seek. */
-         if (file->start) { /* go to the beginning of the file */
+   /* Copy file. */
 #if HAS_FD
-            if ((uint32_t)lseek( file->fd, file->start, SEEK_SET ) != file->start) {
+   file->fd = open( cache->name, O_RDONLY );
 #else /* not HAS_FD */
-            if (fseek( file->fp, file->start, SEEK_SET )) {
+   file->fp = fopen( cache->name, "rb" );
 #endif /* HAS_FD */
-               WARN("Failure to seek to file start: %s", strerror(errno));
-               return NULL;
-            }
-            READ( file, &file->end, 4 );
-            file->end = htonl( file->end );
-            file->start += 4;
-            file->pos    = file->start;
-            file->end   += file->start;
-            DEBUG("Opened '%s' from cache from %u to %u (%u long)", filename,
-                  file->start, file->end, file->end - file->start);
-         }
 
-         return file;
-      }
+   /* Seek. */
+#if HAS_FD
+   if (lseek( file->fd, e->start, SEEK_SET ) != (off_t)e->start) {
+#else /* not HAS_FD */
+   if (fseek( file->fp, e->start, SEEK_SET )) {
+#endif /* HAS_FD */
+      WARN("Failure to seek to file start: %s", strerror(errno));
+      pack_close( file );
+      return NULL;
    }
+   DEBUG("Opened '%s' from cache from %llu (%llu long)", filename,
+         (unsigned long long)e->start, (unsigned long long)e->size);
 
-   free(file);
-   WARN("File '%s' not found in packfile.", filename);
-   return NULL;
+   return file;
 }
 
 
@@ -360,22 +963,20 @@ int pack_check( const char* filename )
 {
    int ret;
    char *buf;
-   uint64_t end64;
-   
-   buf = malloc(sizeof(magic));
 
-   /* Must convert magic. */
-   end64 = ntohll(magic);
+   buf = malloc(sizeof(magic));
 
 #if HAS_FD
    int fd = open( filename, O_RDONLY );
    if (fd == -1) {
       WARN("Erroring opening %s: %s", filename, strerror(errno));
+      free(buf);
       return -1;
    }
 
    if (read( fd, buf, sizeof(magic) ) != sizeof(magic)) {
       WARN("Error reading magic number: %s", strerror(errno));
+      close(fd);
       free(buf);
       return -1;
    }
@@ -385,11 +986,13 @@ int pack_check( const char* filename )
    FILE* file = fopen( filename, "rb" );
    if (file == NULL) {
       WARN("Erroring opening '%s': %s", filename, strerror(errno));
+      free(buf);
       return -1;
    }
 
    if (fread( buf, 1, sizeof(magic), file ) != sizeof(magic)) {
       WARN("Error reading magic number: %s", strerror(errno));
+      fclose( file );
       free(buf);
       return -1;
    }
@@ -398,7 +1001,7 @@ int pack_check( const char* filename )
 #endif /* HAS_FD */
 
    /* Compare. */
-   ret = (memcmp(buf,&end64,sizeof(magic))==0) ? 0 : 1 ;
+   ret = (pack_version(buf) != 0) ? 0 : 1 ;
 
    free(buf);
 
@@ -406,18 +1009,63 @@ int pack_check( const char* filename )
 }
 
 
+/**
+ * @brief Reads a whole file to pack it.
+ *
+ *    @param filename File to read.
+ *    @param[out] size Size of the file.
+ *    @return The contents of the file or NULL on error.
+ */
+static void* pack_readInput( const char *filename, uint64_t *size )
+{
+   FILE *fp;
+   char *buf;
+   size_t n, m;
+
+   fp = fopen( filename, "rb" );
+   if (fp == NULL) {
+      WARN("Erroring opening '%s': %s", filename, strerror(errno));
+      return NULL;
+   }
+
+   n   = 0;
+   m   = BLOCKSIZE;
+   buf = malloc( m );
+   while (1) {
+      n += fread( &buf[n], 1, m-n, fp );
+      if (n < m)
+         break;
+      m  *= 2;
+      buf = realloc( buf, m );
+   }
+   if (ferror(fp)) {
+      WARN("Error reading '%s': %s", filename, strerror(errno));
+      fclose(fp);
+      free(buf);
+      return NULL;
+   }
+   fclose(fp);
+
+   *size = n;
+   return buf;
+}
+
+
 #if HAS_FD
-#define WRITE(b,n)    if (write(outfd,b,n)==-1) { \
+#define WRITE(b,n)    if (write(outfd,b,n)!=(ssize_t)(n)) { \
    WARN("Error writing to file: %s", strerror(errno)); \
-   free(buf); return -1; } /**< Macro to help check for errors. */
+   goto err; } /**< Macro to help check for errors. */
 #else /* not HAS_FD */
-#define WRITE(b,n)    if (fwrite(b,1,n,outf)==0) { \
+#define WRITE(b,n)    if (fwrite(b,1,n,outf)!=(size_t)(n)) { \
    WARN("Error writing to file: %s", strerror(errno)); \
-   free(buf); return -1; } /**< Macro to help check for errors. */
+   goto err; } /**< Macro to help check for errors. */
 #endif /* HAS_FD */
 /**
  * @brief Packages files into a packfile.
  *
+ * Files are compressed with zlib when it makes them noticeably smaller, things
+ *  like images and music that are already compressed are stored as is.
+ *
  *    @param outfile Name of the file to output to.
  *    @param infiles Array of filenames to package.
  *    @param nfiles Number of filenames in infiles.
@@ -425,23 +1073,24 @@ int pack_check( const char* filename )
  */
 int pack_files( const char* outfile, const char** infiles, const uint32_t nfiles )
 {
-   void *buf;
 #if HAS_FD
    struct stat file;
-   int outfd, infd;
+   int outfd;
 #else /* HAS_FD */
-   FILE *outf, *inf;
+   FILE *outf;
 #endif /* HAS_FD */
    uint32_t i;
-   int namesize;
-   uint32_t indexsize, pointer;
-   int bytes;
-   const uint8_t b = '\0';
-   uint32_t end32;
+   size_t len;
+   uint32_t indexsize;
+   uint64_t pointer, size;
+   uLongf zsize;
+   uint8_t *index, *p, *data, *zdata;
+   const uint8_t *out;
+   PackEntry *entries;
    uint64_t end64;
 
-   
-   for (namesize=0,i=0; i < nfiles; i++) { /* make sure files exist before writing */
+
+   for (indexsize=0,i=0; i < nfiles; i++) { /* make sure files exist before writing */
 #if HAS_FD
       if (stat(infiles[i], &file)) {
 #else /* not HAS_FD */
@@ -455,11 +1104,8 @@ int pack_files( const char* outfile, const char** infiles, const uint32_t nfiles
                infiles[i], PATH_MAX );
          return -1;
       }
-      namesize += strlen(infiles[i]);
+      indexsize += PACK_ENTRY_SIZE + strlen(infiles[i]);
    }
-   indexsize = (sizeof(magic) + 4 + /* magic number and number of files */
-         namesize + /* total length of file names */
-         (1+4)*nfiles); /* file size and extra end of string char '\0' */
    DEBUG("Index size is %d", indexsize );
 
    /* creates the output file */
@@ -474,69 +1120,106 @@ int pack_files( const char* outfile, const char** infiles, const uint32_t nfiles
       return -1;
    }
 
+   index   = calloc( PACK_HEADER_SIZE + indexsize, 1 );
+   entries = calloc( nfiles, sizeof(PackEntry) );
+   data    = NULL;
+   zdata   = NULL;
+
    /*
-    * INDEX
+    * HEADER with an empty INDEX, filled in at the end.
     */
-   buf = malloc(BLOCKSIZE);
-   /* magic number */
-   end64 = htonll(magic);
-   WRITE( &end64, sizeof(magic));
-   DEBUG("Wrote magic number");
-   /* number of files */
-   end32 = htonl(nfiles);
-   WRITE( &end32, sizeof(nfiles));
-   DEBUG("Wrote number of files: %d", nfiles);
-   /* create file dependent index part */
-   pointer = indexsize;
-   for (i=0; i<nfiles; i++) {
-      WRITE( infiles[i], strlen(infiles[i]) );
-      DEBUG("File '%s' at %d", infiles[i], pointer);
-      WRITE( &b, 1 );
-      end32 = htonl(pointer);
-      WRITE( &end32, 4 );
-      pointer += 4 + getfilesize( infiles[i] ) + 16; /* set pointer to be next file pos */
-   }
+   end64 = htonll(magic2);
+   memcpy( index, &end64, sizeof(magic2) );
+   pack_put32( &index[8], nfiles );
+   pack_put32( &index[12], indexsize );
+   WRITE( index, PACK_HEADER_SIZE + indexsize );
+   DEBUG("Wrote header for %d files", nfiles);
+
    /*
     * DATA
     */
-   md5_state_t md5;
-   md5_byte_t *md5val = malloc(16);
+   pointer = PACK_HEADER_SIZE + indexsize;
    for (i=0; i<nfiles; i++) {
-      bytes = (uint32_t)getfilesize( infiles[i] );
-      end32 = htonl(bytes);
-      WRITE( &end32, 4 ); /* filesize */
-      DEBUG("About to write file '%s' of %d bytes", infiles[i], bytes);
-      md5_init(&md5);
-#if HAS_FD
-      infd = open( infiles[i], O_RDONLY );
-      while ((bytes = read( infd, buf, BLOCKSIZE ))) {
-#else /* not HAS_FD */
-      inf = fopen( infiles[i], "rb" );
-      while ((bytes = fread( buf, 1, BLOCKSIZE, inf ))) {
-#endif /* HAS_FD */
-         WRITE( buf, bytes ); /* data */
-         md5_append( &md5, buf, bytes );
+      data = pack_readInput( infiles[i], &size );
+      if (data == NULL)
+         goto err;
+      entries[i].start = pointer;
+      entries[i].size  = size;
+      entries[i].crc   = crc32( crc32(0L, Z_NULL, 0), data, size );
+
+      /* Only keep compressed if it saves at least a sixteenth. */
+      zsize = compressBound( size );
+      zdata = malloc( zsize );
+      if ((compress2( zdata, &zsize, data, size, Z_BEST_COMPRESSION ) == Z_OK) &&
+            (zsize < size - size/16)) {
+         entries[i].codec  = PACK_CODEC_ZLIB;
+         entries[i].stored = zsize;
+         out = zdata;
       }
-      md5_finish(&md5, md5val);
-      WRITE( md5val, 16 );
+      else {
+         entries[i].codec  = PACK_CODEC_NONE;
+         entries[i].stored = size;
+         out = data;
+      }
+      WRITE( out, entries[i].stored );
+      DEBUG("Wrote file '%s', %llu bytes stored as %llu", infiles[i],
+            (unsigned long long)size, (unsigned long long)entries[i].stored );
+      pointer += entries[i].stored;
+
+      free(data);
+      free(zdata);
+      data  = NULL;
+      zdata = NULL;
+   }
+
+   /*
+    * INDEX
+    */
+   p = &index[PACK_HEADER_SIZE];
+   for (i=0; i<nfiles; i++) {
+      len = strlen(infiles[i]);
+      pack_put16( p, len );
+      memcpy( &p[2], infiles[i], len );
+      p += 2 + len;
+      p[0] = entries[i].codec;
+      pack_put64( &p[1], entries[i].start );
+      pack_put64( &p[9], entries[i].stored );
+      pack_put64( &p[17], entries[i].size );
+      pack_put32( &p[25], entries[i].crc );
+      p += PACK_ENTRY_SIZE-2;
+   }
 #if HAS_FD
-      close(infd);
+   if (lseek( outfd, PACK_HEADER_SIZE, SEEK_SET ) != PACK_HEADER_SIZE) {
 #else /* not HAS_FD */
-      fclose(inf);
+   if (fseek( outf, PACK_HEADER_SIZE, SEEK_SET )) {
 #endif /* HAS_FD */
-      DEBUG("Wrote file '%s'", infiles[i]);
+      WARN("Unable to seek to the index: %s", strerror(errno));
+      goto err;
    }
-   free(md5val);
+   WRITE( &index[PACK_HEADER_SIZE], indexsize );
 
 #if HAS_FD
    close( outfd );
 #else /* not HAS_FD */
    fclose( outf );
 #endif /* HAS_FD */
-   free(buf);
+   free(index);
+   free(entries);
 
    DEBUG("Packfile success\n\t%d files\n\t%d bytes", nfiles, (int)getfilesize(outfile));
    return 0;
+
+err:
+#if HAS_FD
+   close( outfd );
+#else /* not HAS_FD */
+   fclose( outf );
+#endif /* HAS_FD */
+   free(data);
+   free(zdata);
+   free(index);
+   free(entries);
+   return -1;
 }
 #undef WRITE
 
@@ -550,77 +1233,85 @@ int pack_files( const char* outfile, const char** infiles, const uint32_t nfiles
  */
 Packfile_t* pack_open( const char* packfile, const char* filename )
 {
-   int j;
-   uint32_t nfiles, i;
-   char buf[PATH_MAX];
+   Packcache_t *cache;
    Packfile_t *file;
-   uint64_t end64;
-
-   /* Allocate memory. */
-   file = malloc(sizeof(Packfile_t));
-   memset( file, 0, sizeof(Packfile_t) );
 
-#if HAS_FD
-   file->fd = open( packfile, O_RDONLY );
-   if (file->fd == -1) {
-#else /* not HAS_FD */
-   file->fp = fopen( packfile, "rb" );
-   if (file->fp == NULL) {
-#endif /* HAS_FD */
-      WARN("Erroring opening %s: %s", filename, strerror(errno));
+   /* The file is opened again so the index isn't needed afterwards. */
+   cache = pack_openCacheMode( packfile, 0 );
+   if (cache == NULL)
       return NULL;
-   }
+   file = pack_openFromCache( cache, filename );
+   if (file == NULL)
+      WARN("File '%s' not found in packfile '%s'", filename, packfile);
+   else
+      file->flags &= ~PACKFILE_FROMCACHE;
+   pack_closeCache( cache );
 
-   READ( file, buf, sizeof(magic)); /* make sure it's a packfile */
-   end64 = ntohll(magic);
-   if (memcmp(buf, &end64, sizeof(magic))) {
-      WARN("File %s is not a valid packfile", filename);
-      return NULL;
-   }
+   return file;
+}
 
-   READ( file, &nfiles, 4 );
-   nfiles = htonl(nfiles);
-   for (i=0; i<nfiles; i++) { /* start to search files */
-      j = 0;
-      READ( file, &buf[j], 1 ); /* get the name */
-      while ( buf[j++] != '\0' )
-         READ( file, &buf[j], 1 );
-
-      if (strcmp(filename, buf)==0) { /* found file */
-         READ( file, &file->start, 4 );
-         file->start = htonl( file->start );
-         DEBUG("'%s' found at %d", filename, file->start);
-         break;
-      }
-#if HAS_FD
-      lseek( file->fd, 4, SEEK_CUR ); /* ignore the file location */
-#else /* not HAS_FD */
-      fseek( file->fp, 4, SEEK_CUR );
-#endif /* HAS_FD */
-   }
-   
-   if (file->start) { /* go to the beginning of the file */
+
+/**
+ * @brief Reads data from a compressed file.
+ *
+ *    @param file Opened packfile to read data from.
+ *    @param buf Allocated buffer to read into.
+ *    @param count Bytes to read.
+ *    @return Bytes read or -1 on error.
+ */
+static ssize_t pack_readZ( Packfile_t* file, void* buf, size_t count )
+{
+   int ret;
+   uint64_t n;
+   ssize_t bytes;
+
+   if ((file->pos + count) > file->end)
+      count = file->end - file->pos; /* can't go past end */
+   if (count == 0)
+      return 0;
+
+   file->z->next_out  = buf;
+   file->z->avail_out = count;
+   while (file->z->avail_out > 0) {
+
+      /* Feed it more compressed data. */
+      if ((file->z->avail_in == 0) && (file->zread < file->zsize)) {
+         n = file->zsize - file->zread;
+         if (file->zmap != NULL) {
+            n = MIN( n, 1<<30 );
+            file->z->next_in = (Bytef*)&file->zmap[ file->zread ];
+         }
+         else {
+            n = MIN( n, ZBUFSIZE );
 #if HAS_FD
-      if ((uint32_t)lseek( file->fd, file->start, SEEK_SET ) != file->start) {
+            bytes = read( file->fd, file->zbuf, n );
 #else /* not HAS_FD */
-      if (fseek( file->fp, file->start, SEEK_SET )) {
+            bytes = fread( file->zbuf, 1, n, file->fp );
 #endif /* HAS_FD */
-         WARN("Failure to seek to file start: %s", strerror(errno));
-         return NULL;
+            if (bytes <= 0) {
+               WARN("Error while reading file: %s", strerror(errno));
+               return -1;
+            }
+            n = bytes;
+            file->z->next_in = file->zbuf;
+         }
+         file->z->avail_in = n;
+         file->zread      += n;
+      }
+
+      ret = inflate( file->z, Z_NO_FLUSH );
+      if (ret == Z_STREAM_END)
+         break;
+      if (ret != Z_OK) {
+         WARN("Error while decompressing file: %s",
+               (file->z->msg != NULL) ? file->z->msg : "truncated data");
+         return -1;
       }
-      READ( file, &file->end, 4 );
-      file->end = htonl( file->end );
-      DEBUG("\t%d bytes", file->end);
-      file->start += 4;
-      file->pos    = file->start;
-      file->end   += file->start;
-   }
-   else {
-      WARN("File '%s' not found in packfile '%s'", filename, packfile);
-      return NULL;
    }
 
-   return file;
+   bytes = count - file->z->avail_out;
+   file->pos += bytes;
+   return bytes;
 }
 
 
@@ -638,6 +1329,9 @@ ssize_t pack_read( Packfile_t* file, void* buf, size_t count )
 {
    int bytes;
 
+   if (file->codec != PACK_CODEC_NONE)
+      return pack_readZ( file, buf, count );
+
    if ((file->pos + count) > file->end)
       count = MAX(file->end - file->pos, 0); /* can't go past end */
    if (count == 0)
@@ -661,6 +1355,52 @@ ssize_t pack_read( Packfile_t* file, void* buf, size_t count )
 }
 
 
+/**
+ * @brief Seeks within a compressed file.
+ *
+ * Seeking forward decompresses up to the target, seeking backwards starts
+ *  decompressing from the beginning again.
+ *
+ *    @param file File to seek.
+ *    @param target Position in the decompressed file to seek to.
+ *    @return The position moved to or -1 on error.
+ */
+static off_t pack_seekZ( Packfile_t* file, uint64_t target )
+{
+   char skip[4096];
+   ssize_t bytes;
+
+   if (target > file->end)
+      return -1;
+
+   /* Start over. */
+   if (target < file->pos) {
+      if (inflateReset( file->z ) != Z_OK)
+         return -1;
+      file->z->avail_in = 0;
+      file->zread       = 0;
+      file->pos         = 0;
+      if (file->zmap == NULL) {
+#if HAS_FD
+         if (lseek( file->fd, file->zstart, SEEK_SET ) != (off_t)file->zstart)
+#else /* not HAS_FD */
+         if (fseek( file->fp, file->zstart, SEEK_SET ))
+#endif /* HAS_FD */
+            return -1;
+      }
+   }
+
+   /* Decompress up to the target. */
+   while (file->pos < target) {
+      bytes = pack_readZ( file, skip, MIN( target - file->pos, sizeof(skip) ) );
+      if (bytes <= 0)
+         return -1;
+   }
+
+   return file->pos;
+}
+
+
 /**
  * @brief Seeks within a file inside a packfile.
  *
@@ -673,7 +1413,8 @@ ssize_t pack_read( Packfile_t* file, void* buf, size_t count )
  */
 off_t pack_seek( Packfile_t* file, off_t offset, int whence)
 {
-   uint32_t base, target, ret;
+   uint64_t base, target;
+   off_t ret;
 
    DEBUG("attempting to seek offset: %ld, whence: %d", offset, whence);
 
@@ -703,9 +1444,12 @@ off_t pack_seek( Packfile_t* file, off_t offset, int whence)
    if (target < file->start)
       return -1;
 
+   if (file->codec != PACK_CODEC_NONE)
+      return pack_seekZ( file, target );
+
 #if HAS_FD
    ret = lseek( file->fd, target, SEEK_SET );
-   if (ret != target)
+   if (ret != (off_t)target)
       return -1;
 #else /* not HAS_FD */
    ret = fseek( file->fp, target, SEEK_SET );
@@ -750,43 +1494,51 @@ static void* pack_readfilePack( Packfile_t *file,
    buf = malloc( size + 1 );
    if (buf == NULL) {
       WARN("Unable to allocate %d bytes of memory!", size+1);
-      free(file);
+      pack_close(file);
       return NULL;
    }
    if ((bytes = pack_read( file, buf, size)) != size) {
       WARN("Reading '%s' from packfile.  Expected %d bytes got %d bytes",
             filename, size, bytes );
       free(buf);
-      free(file);
+      pack_close(file);
       return NULL;
    }
    DEBUG("Read %d bytes from '%s'", bytes, filename );
    str = buf;
    str[size] = '\0'; /* append size '\0' for it to validate as a string */
 
+   /* check the crc */
+   if (file->version >= 2) {
+      if (crc32( crc32(0L, Z_NULL, 0), buf, size ) != file->crc)
+         WARN("CRC32 of '%s' gives different value, possible memory corruption, continuing...",
+               filename);
+   }
    /* check the md5 */
-   md5_state_t md5;
-   md5_byte_t *md5val = malloc(16);
-   md5_byte_t *md5fd  = malloc(16);
-   md5_init(&md5);
-   md5_append( &md5, buf, bytes );
-   md5_finish(&md5, md5val);
+   else {
+      md5_state_t md5;
+      md5_byte_t *md5val = malloc(16);
+      md5_byte_t *md5fd  = malloc(16);
+      md5_init(&md5);
+      md5_append( &md5, buf, bytes );
+      md5_finish(&md5, md5val);
 #if HAS_FD
-   if ((bytes = read( file->fd, md5fd, 16 )) == -1)
+      if ((bytes = read( file->fd, md5fd, 16 )) == -1)
 #else /* not HAS_FD */
-   if ((bytes = fread( md5fd, 1, 16, file->fp )) == -1)
+      if ((bytes = fread( md5fd, 1, 16, file->fp )) == -1)
 #endif /* HAS_FD */
-      WARN("Failure to read MD5 (Expected %d bytes got %d bytes), continuing anyways...", 16, bytes);
-   else if (memcmp( md5val, md5fd, 16 ))
-      WARN("MD5 gives different value, possible memory corruption, continuing...");
-   free(md5val);
-   free(md5fd);
+         WARN("Failure to read MD5 (Expected %d bytes got %d bytes), continuing anyways...", 16, bytes);
+      else if (memcmp( md5val, md5fd, 16 ))
+         WARN("MD5 gives different value, possible memory corruption, continuing...");
+      free(md5val);
+      free(md5fd);
+   }
 
 
    /* cleanup */
    if (pack_close( file ) == -1) {
       WARN("Closing packfile");
-      free(file);
+      free(buf);
       return NULL;
    }
    DEBUG("Closed '%s' in packfile", filename );
@@ -838,50 +1590,21 @@ void* pack_readfile( const char* packfile, const char* filename, uint32_t *files
  */
 char** pack_listfiles( const char* packfile, uint32_t* nfiles )
 {
-   int j;
    uint32_t i;
-   Packfile_t file;
+   Packcache_t *cache;
    char** filenames;
-   char* buf = malloc(sizeof(magic));
-   uint64_t end64;
 
    *nfiles = 0;
 
-#if HAS_FD
-   file.fd = open( packfile, O_RDONLY );
-   if (file.fd == -1) {
-#else /* not HAS_FD */
-   file.fp = fopen( packfile, "rb" );
-   if (file.fp == NULL) {
-#endif /* HAS_FD */
-      WARN("Erroring opening %s: %s", packfile, strerror(errno));
-      return NULL;
-   }
-
-   READ( &file, buf, sizeof(magic)); /* make sure it's a packfile */
-   end64 = ntohll( magic );
-   if (memcmp(buf, &end64, sizeof(magic))) {
-      WARN("File %s is not a valid packfile", packfile);
+   cache = pack_openCacheMode( packfile, 0 );
+   if (cache == NULL)
       return NULL;
-   }
 
-   READ( &file, nfiles, 4 );
-   *nfiles = htonl( *nfiles );
+   *nfiles = cache->nindex;
    filenames = malloc(((*nfiles)+1)*sizeof(char*));
-   for (i=0; i<*nfiles; i++) { /* start to search files */
-      j = 0;
-      filenames[i] = malloc(PATH_MAX*sizeof(char));
-      READ( &file, &filenames[i][j], 1 ); /* get the name */
-      while ( filenames[i][j++] != '\0' )
-         READ( &file, &filenames[i][j], 1 );
-      READ( &file, buf, 4 ); /* skip the location */
-   }
-   free(buf);
-#if HAS_FD
-   close(file.fd);
-#else /* not HAS_FD */
-   fclose(file.fp);
-#endif /* HAS_FD */
+   for (i=0; i<*nfiles; i++)
+      filenames[i] = strdup( cache->index[i] );
+   pack_closeCache( cache );
 
    return filenames;
 }
@@ -892,8 +1615,51 @@ char** pack_listfiles( const char* packfile, uint32_t* nfiles )
  */
 void* pack_readfileCached( Packcache_t* cache, const char* filename, uint32_t *filesize )
 {
+   int32_t i;
+   PackEntry *e;
+   char *buf;
+   uLongf size;
    Packfile_t *file;
 
+   i = pack_findCache( cache, filename );
+   if (i < 0) {
+      WARN("File '%s' not found in packfile.", filename);
+      return NULL;
+   }
+   e = &cache->entries[i];
+
+#if HAS_FD
+   /* Copy or decompress straight out of the mapping if possible. */
+   if (cache->map != NULL) {
+      buf = malloc( e->size + 1 );
+      if (buf == NULL) {
+         WARN("Unable to allocate %llu bytes of memory!", (unsigned long long)e->size+1);
+         return NULL;
+      }
+      if (e->codec == PACK_CODEC_ZLIB) {
+         size = e->size;
+         if ((uncompress( (Bytef*)buf, &size, &cache->map[ e->start ], e->stored ) != Z_OK) ||
+               (size != e->size)) {
+            WARN("Unable to decompress '%s' from packfile.", filename);
+            free(buf);
+            return NULL;
+         }
+      }
+      else
+         memcpy( buf, &cache->map[ e->start ], e->size );
+      buf[e->size] = '\0'; /* append size '\0' for it to validate as a string */
+
+      pack_checkData( cache, i, buf );
+      if (filesize)
+         *filesize = e->size;
+      return buf;
+   }
+#else /* HAS_FD */
+   (void) e;
+   (void) size;
+   (void) buf;
+#endif /* HAS_FD */
+
    file = pack_openFromCache( cache, filename );
    if (file == NULL) {
       WARN("Unable to create packfile from packcache.");
@@ -903,6 +1669,54 @@ void* pack_readfileCached( Packcache_t* cache, const char* filename, uint32_t *f
 }
 
 
+/**
+ * @brief Gets the contents of a file in the cache without copying them.
+ *
+ * The contents are a read only view of the mapped packfile that stays valid
+ *  until the cache is closed. Unlike pack_readfileCached they aren't NUL
+ *  terminated. Compressed files can't be viewed.
+ *
+ *    @param cache Cache to get the file from.
+ *    @param filename Name of the file to get.
+ *    @param[out] filesize Size of the file.
+ *    @return The contents of the file or NULL if not found, not mapped or
+ *            compressed.
+ */
+const void* pack_mapfileCached( Packcache_t* cache, const char* filename, uint32_t *filesize )
+{
+   int32_t i;
+
+   i = pack_findCache( cache, filename );
+   if (i < 0)
+      return NULL;
+   return pack_viewCache( cache, i, filesize );
+}
+
+
+/**
+ * @brief Checks to see if memory belongs to the mapping of a cache.
+ *
+ *    @param cache Cache to check.
+ *    @param ptr Memory to check.
+ *    @return 1 if ptr is part of the mapped packfile.
+ */
+int pack_isMapped( Packcache_t* cache, const void* ptr )
+{
+#if HAS_FD
+   const uint8_t *p;
+
+   if (cache->map == NULL)
+      return 0;
+   p = ptr;
+   return ((p >= cache->map) && (p < cache->map + cache->mapsize));
+#else /* HAS_FD */
+   (void) cache;
+   (void) ptr;
+   return 0;
+#endif /* HAS_FD */
+}
+
+
 /**
  * @brief Gets the list of files en a Packcache.
  *
@@ -917,6 +1731,43 @@ const char** pack_listfilesCached( Packcache_t* cache, uint32_t* nfiles )
 }
 
 
+/**
+ * @brief Gets the files in a Packcache that start with a path.
+ *
+ * This includes the files in subdirectories of the path.
+ *
+ *    @param cache Cache to get list of files from.
+ *    @param path Path the files must start with.
+ *    @param nfiles Number of files in the list.
+ *    @return A read only list of files from the pack cache sorted by name.
+ */
+const char** pack_listdirCached( Packcache_t* cache, const char* path, uint32_t* nfiles )
+{
+   uint32_t lo, hi, mid, end;
+   size_t len;
+
+   /* Find the first name not before the path. */
+   lo = 0;
+   hi = cache->nindex;
+   while (lo < hi) {
+      mid = lo + (hi-lo)/2;
+      if (strcmp( cache->sorted[mid], path ) < 0)
+         lo = mid+1;
+      else
+         hi = mid;
+   }
+
+   /* All the names with the path as prefix follow it. */
+   len = strlen(path);
+   for (end=lo; end<cache->nindex; end++)
+      if (strncmp( cache->sorted[end], path, len ) != 0)
+         break;
+
+   *nfiles = end - lo;
+   return &cache->sorted[lo];
+}
+
+
 /**
  * @brief Closes a packfile.
  *
@@ -928,13 +1779,21 @@ int pack_close( Packfile_t* file )
    int i;
 
    /* Close files. */
+   i = 0;
 #if HAS_FD
-   i = close( file->fd );
+   if (file->fd != -1)
+      i = close( file->fd );
 #else /* not HAS_FD */
-   i = fclose( file->fp );
+   if (file->fp != NULL)
+      i = fclose( file->fp );
 #endif /* HAS_FD */
 
    /* Free memory. */
+   if (file->z != NULL) {
+      inflateEnd( file->z );
+      free( file->z );
+   }
+   free(file->zbuf);
    free(file);
 
    DEBUG("Closing packfile.");
@@ -1063,8 +1922,15 @@ SDL_RWops *pack_rwops( const char* packfile, const char* filename )
  */
 SDL_RWops *pack_rwopsCached( Packcache_t* cache, const char* filename )
 {
+   const void *view;
+   uint32_t size;
    Packfile_t *packfile;
 
+   /* Read straight from the mapping without opening the file again. */
+   view = pack_mapfileCached( cache, filename, &size );
+   if (view != NULL)
+      return SDL_RWFromConstMem( view, size );
+
    /* Open the packfile. */
    packfile = pack_openFromCache( cache, filename );
    if (packfile == NULL)
@@ -48,7 +48,10 @@ int pack_close( Packfile_t* file );
 void* pack_readfile( const char* packfile, const char* filename, uint32_t *filesize );
 char** pack_listfiles( const char* packfile, uint32_t* nfiles );
 void* pack_readfileCached( Packcache_t* cache, const char* filename, uint32_t *filesize );
+const void* pack_mapfileCached( Packcache_t* cache, const char* filename, uint32_t *filesize );
+int pack_isMapped( Packcache_t* cache, const void* ptr );
 const char** pack_listfilesCached( Packcache_t* cache, uint32_t* nfiles );
+const char** pack_listdirCached( Packcache_t* cache, const char* path, uint32_t* nfiles );
 
 /*
  * for rwops.
@@ -0,0 +1,635 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+/**
+ * @file pgrid.c
+ *
+ * @brief Uniform grid broadphase over the pilot stack.
+ *
+ * Every pilot gets inserted into all the cells its sprite bounding box
+ *  overlaps.  Cells are hashed into a fixed number of buckets so that space
+ *  doesn't have to be bounded, and the buckets are stored packed so the
+ *  whole grid is just two flat arrays that get rebuilt every frame.
+ *
+ * Queries return pilot IDs sorted in ascending order, which is the same
+ *  order as the pilot stack, so looping over them behaves just like looping
+ *  over the stack, only skipping the pilots that are too far away.
+ *
+ * The grid is only rebuilt once a frame, so pilots can have moved a bit
+ *  since, queries that care about that are grown by how far the fastest
+ *  pilot can get in a tick.  Pilots created afterwards are kept in a list
+ *  that every query checks until the next rebuild.  Results are only
+ *  candidates, the caller must still check the actual positions, except for
+ *  the nearest pilot queries which do it themselves.
+ */
+
+
+#include "pgrid.h"
+
+#include "naev.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "pilot.h"
+
+
+#define PGRID_BUCKETS_MIN  64 /**< Minimum amount of buckets. */
+#define PGRID_CHUNK        64 /**< Chunk to grow query results with. */
+#define PGRID_PAD          1. /**< Padding to make up for integer rounding in the narrowphase. */
+#define PGRID_KNN_STACK    16 /**< Nearest pilot queries up to this size don't allocate. */
+
+#define pgrid_cell(x)      ((int)floor((x) / PGRID_CELL_SIZE)) /**< Gets the cell coordinate of a position. */
+
+
+/*
+ * pilot stuff
+ */
+extern Pilot** pilot_stack;
+extern int pilot_nstack;
+
+
+/**
+ * @brief Bounding box of a pilot in cell coordinates.
+ */
+typedef struct PGridBox_ {
+   unsigned int id; /**< ID of the pilot. */
+   int x1; /**< Left cell. */
+   int y1; /**< Bottom cell. */
+   int x2; /**< Right cell. */
+   int y2; /**< Top cell. */
+} PGridBox;
+
+
+static PGridBox *pgrid_boxes     = NULL; /**< Bounding boxes of the pilots. */
+static int pgrid_nboxes          = 0; /**< Number of bounding boxes. */
+static int pgrid_mboxes          = 0; /**< Memory allocated for bounding boxes. */
+static int *pgrid_start          = NULL; /**< Start of each bucket in pgrid_entries, has pgrid_nbuckets+1 elements. */
+static int pgrid_nbuckets        = 0; /**< Number of buckets, always a power of two. */
+static unsigned int *pgrid_entries = NULL; /**< Pilot IDs packed by bucket. */
+static int pgrid_mentries        = 0; /**< Memory allocated for entries. */
+static int pgrid_x1              = 0; /**< Left cell of all the pilots. */
+static int pgrid_y1              = 0; /**< Bottom cell of all the pilots. */
+static int pgrid_x2              = 0; /**< Right cell of all the pilots. */
+static int pgrid_y2              = 0; /**< Top cell of all the pilots. */
+static double pgrid_size         = 0.; /**< Largest pilot sprite width. */
+static double pgrid_slack        = 0.; /**< Furthest a pilot can move before the grid gets rebuilt. */
+static unsigned int *pgrid_added = NULL; /**< Pilots created since the grid was built. */
+static int pgrid_nadded          = 0; /**< Number of pilots created since the grid was built. */
+static int pgrid_madded          = 0; /**< Memory allocated for created pilots. */
+
+
+/*
+ * Prototypes.
+ */
+static int pgrid_hash( int x, int y );
+static int pgrid_addBucket( unsigned int **ids, int *mids, int n, int b );
+static int pgrid_addAll( unsigned int **ids, int *mids );
+static int pgrid_addAdded( unsigned int **ids, int *mids, int n );
+static int pgrid_finish( unsigned int *ids, int n );
+static int pgrid_cmp( const void *p1, const void *p2 );
+static int pgrid_nearestAdd( unsigned int *ids, double *dists, int n, int k,
+      unsigned int id, double x, double y, PGridFilter filter, void *data );
+static int pgrid_nearestBucket( unsigned int *ids, double *dists, int n, int k,
+      int b, double x, double y, PGridFilter filter, void *data );
+
+
+/**
+ * @brief Hashes a cell into a bucket.
+ */
+static int pgrid_hash( int x, int y )
+{
+   return (int)(((unsigned int)x * 73856093U) ^ ((unsigned int)y * 19349663U)) &
+         (pgrid_nbuckets-1);
+}
+
+
+/**
+ * @brief Rebuilds the grid from the current pilot positions.
+ *
+ * Should be called once a frame before doing any queries.
+ *
+ *    @param dt Tick the pilots will move for before the next rebuild.
+ */
+void pgrid_update( double dt )
+{
+   int i, x, y, n, nb, h;
+   Pilot *p;
+   PGridBox *b;
+   double hw, hh, v, vmax;
+
+   /* Make sure there's room for all the pilots. */
+   if (pilot_nstack > pgrid_mboxes) {
+      pgrid_mboxes = pilot_nstack;
+      pgrid_boxes  = realloc( pgrid_boxes, sizeof(PGridBox) * pgrid_mboxes );
+   }
+
+   /* Get the bounding boxes in cell coordinates. */
+   n = 0;
+   pgrid_nboxes = 0;
+   pgrid_nadded = 0;
+   pgrid_size   = 0.;
+   vmax         = 0.;
+   for (i=0; i<pilot_nstack; i++) {
+      p = pilot_stack[i];
+      if (pilot_isFlag(p, PILOT_DELETE))
+         continue;
+
+      hw = p->ship->gfx_space->sw/2. + PGRID_PAD;
+      hh = p->ship->gfx_space->sh/2. + PGRID_PAD;
+
+      b     = &pgrid_boxes[ pgrid_nboxes++ ];
+      b->id = p->id;
+      b->x1 = pgrid_cell( p->solid->pos.x - hw );
+      b->y1 = pgrid_cell( p->solid->pos.y - hh );
+      b->x2 = pgrid_cell( p->solid->pos.x + hw );
+      b->y2 = pgrid_cell( p->solid->pos.y + hh );
+      n    += (b->x2 - b->x1 + 1) * (b->y2 - b->y1 + 1);
+
+      /* Grow the bounds. */
+      if (pgrid_nboxes == 1) {
+         pgrid_x1 = b->x1;
+         pgrid_y1 = b->y1;
+         pgrid_x2 = b->x2;
+         pgrid_y2 = b->y2;
+      }
+      else {
+         pgrid_x1 = MIN( pgrid_x1, b->x1 );
+         pgrid_y1 = MIN( pgrid_y1, b->y1 );
+         pgrid_x2 = MAX( pgrid_x2, b->x2 );
+         pgrid_y2 = MAX( pgrid_y2, b->y2 );
+      }
+      pgrid_size = MAX( pgrid_size, p->ship->gfx_space->sw );
+
+      /* Leave room for speeding up during the tick, like with afterburners. */
+      v    = MAX( VMOD(p->solid->vel), p->speed );
+      vmax = MAX( vmax, v );
+   }
+   pgrid_slack = 2. * vmax * dt + PGRID_PAD;
+
+   /* Resize the buckets to keep them sparse. */
+   nb = PGRID_BUCKETS_MIN;
+   while (nb < n)
+      nb <<= 1;
+   if (nb != pgrid_nbuckets) {
+      pgrid_nbuckets = nb;
+      pgrid_start    = realloc( pgrid_start, sizeof(int) * (pgrid_nbuckets+1) );
+   }
+   if (n > pgrid_mentries) {
+      pgrid_mentries = n;
+      pgrid_entries  = realloc( pgrid_entries, sizeof(unsigned int) * pgrid_mentries );
+   }
+
+   /* Count the entries of each bucket. */
+   memset( pgrid_start, 0, sizeof(int) * (pgrid_nbuckets+1) );
+   for (i=0; i<pgrid_nboxes; i++) {
+      b = &pgrid_boxes[i];
+      for (y=b->y1; y<=b->y2; y++)
+         for (x=b->x1; x<=b->x2; x++)
+            pgrid_start[ pgrid_hash(x,y) ]++;
+   }
+
+   /* Turn counts into the end of each bucket. */
+   for (i=1; i<pgrid_nbuckets; i++)
+      pgrid_start[i] += pgrid_start[i-1];
+   pgrid_start[ pgrid_nbuckets ] = n;
+
+   /* Fill backwards so the end of each bucket ends up being its start. */
+   for (i=pgrid_nboxes-1; i>=0; i--) {
+      b = &pgrid_boxes[i];
+      for (y=b->y1; y<=b->y2; y++) {
+         for (x=b->x1; x<=b->x2; x++) {
+            h = pgrid_hash(x,y);
+            pgrid_entries[ --pgrid_start[h] ] = b->id;
+         }
+      }
+   }
+}
+
+
+/**
+ * @brief Adds a pilot created after the grid was built.
+ *
+ * The pilot will be in every query result until the grid is rebuilt.
+ *
+ *    @param p Pilot to add.
+ */
+void pgrid_add( const Pilot *p )
+{
+   if (pgrid_nadded >= pgrid_madded) {
+      pgrid_madded += PGRID_CHUNK;
+      pgrid_added   = realloc( pgrid_added, sizeof(unsigned int) * pgrid_madded );
+   }
+   pgrid_added[ pgrid_nadded++ ] = p->id;
+}
+
+
+/**
+ * @brief Frees the grid.
+ */
+void pgrid_free (void)
+{
+   free(pgrid_boxes);
+   pgrid_boxes    = NULL;
+   pgrid_nboxes   = 0;
+   pgrid_mboxes   = 0;
+   free(pgrid_start);
+   pgrid_start    = NULL;
+   pgrid_nbuckets = 0;
+   free(pgrid_entries);
+   pgrid_entries  = NULL;
+   pgrid_mentries = 0;
+   free(pgrid_added);
+   pgrid_added    = NULL;
+   pgrid_nadded   = 0;
+   pgrid_madded   = 0;
+}
+
+
+/**
+ * @brief Appends the contents of a bucket to the query results.
+ *
+ *    @param[in,out] ids Query results.
+ *    @param[in,out] mids Memory allocated for query results.
+ *    @param n Current number of results.
+ *    @param b Bucket to add.
+ *    @return New number of results.
+ */
+static int pgrid_addBucket( unsigned int **ids, int *mids, int n, int b )
+{
+   int len;
+
+   len = pgrid_start[b+1] - pgrid_start[b];
+   if (len == 0)
+      return n;
+
+   if (n + len > *mids) {
+      *mids = MAX( n + len, *mids + PGRID_CHUNK );
+      *ids  = realloc( *ids, sizeof(unsigned int) * (*mids) );
+   }
+   memcpy( &(*ids)[n], &pgrid_entries[ pgrid_start[b] ], sizeof(unsigned int) * len );
+   return n + len;
+}
+
+
+/**
+ * @brief Appends every bucket to the query results, used for huge queries.
+ */
+static int pgrid_addAll( unsigned int **ids, int *mids )
+{
+   int i, n;
+
+   n = 0;
+   for (i=0; i<pgrid_nbuckets; i++)
+      n = pgrid_addBucket( ids, mids, n, i );
+   return n;
+}
+
+
+/**
+ * @brief Appends the pilots created since the grid was built to the results.
+ */
+static int pgrid_addAdded( unsigned int **ids, int *mids, int n )
+{
+   if (pgrid_nadded == 0)
+      return n;
+
+   if (n + pgrid_nadded > *mids) {
+      *mids = MAX( n + pgrid_nadded, *mids + PGRID_CHUNK );
+      *ids  = realloc( *ids, sizeof(unsigned int) * (*mids) );
+   }
+   memcpy( &(*ids)[n], pgrid_added, sizeof(unsigned int) * pgrid_nadded );
+   return n + pgrid_nadded;
+}
+
+
+/**
+ * @brief Compares two pilot IDs for qsort.
+ */
+static int pgrid_cmp( const void *p1, const void *p2 )
+{
+   unsigned int a, b;
+   a = *(const unsigned int*) p1;
+   b = *(const unsigned int*) p2;
+   if (a < b)
+      return -1;
+   else if (a > b)
+      return +1;
+   return 0;
+}
+
+
+/**
+ * @brief Sorts the results and removes pilots found in multiple cells.
+ */
+static int pgrid_finish( unsigned int *ids, int n )
+{
+   int i, j;
+
+   if (n < 2)
+      return n;
+
+   qsort( ids, n, sizeof(unsigned int), pgrid_cmp );
+   j = 1;
+   for (i=1; i<n; i++)
+      if (ids[i] != ids[j-1])
+         ids[j++] = ids[i];
+   return j;
+}
+
+
+/**
+ * @brief Gets all the pilots that might overlap a rectangle.
+ *
+ * Results can contain pilots that don't overlap the rectangle, it's up to the
+ *  caller to do the actual collision check.
+ *
+ *    @param[in,out] ids Array to store pilot IDs in, gets grown as needed.
+ *    @param[in,out] mids Memory allocated for ids.
+ *    @param x1 Left edge of the rectangle.
+ *    @param y1 Bottom edge of the rectangle.
+ *    @param x2 Right edge of the rectangle.
+ *    @param y2 Top edge of the rectangle.
+ *    @return Number of pilot IDs found, sorted in stack order.
+ */
+int pgrid_queryRect( unsigned int **ids, int *mids,
+      double x1, double y1, double x2, double y2 )
+{
+   int x, y, n;
+   int cx1, cy1, cx2, cy2;
+
+   n = 0;
+   if (pgrid_nbuckets > 0) {
+      cx1 = pgrid_cell(x1);
+      cy1 = pgrid_cell(y1);
+      cx2 = pgrid_cell(x2);
+      cy2 = pgrid_cell(y2);
+
+      /* Covering more cells than buckets, just grab everything. */
+      if ((double)(cx2-cx1+1) * (double)(cy2-cy1+1) > (double)pgrid_nbuckets)
+         n = pgrid_addAll( ids, mids );
+      else {
+         for (y=cy1; y<=cy2; y++)
+            for (x=cx1; x<=cx2; x++)
+               n = pgrid_addBucket( ids, mids, n, pgrid_hash(x,y) );
+      }
+   }
+   n = pgrid_addAdded( ids, mids, n );
+
+   return pgrid_finish( *ids, n );
+}
+
+
+/**
+ * @brief Gets all the pilots that might be crossed by a segment.
+ *
+ * Walks the cells the segment goes through (Amanatides & Woo).
+ *
+ *    @param[in,out] ids Array to store pilot IDs in, gets grown as needed.
+ *    @param[in,out] mids Memory allocated for ids.
+ *    @param x1 X start point of the segment.
+ *    @param y1 Y start point of the segment.
+ *    @param x2 X end point of the segment.
+ *    @param y2 Y end point of the segment.
+ *    @return Number of pilot IDs found, sorted in stack order.
+ */
+int pgrid_queryLine( unsigned int **ids, int *mids,
+      double x1, double y1, double x2, double y2 )
+{
+   int i, n, ncells;
+   int cx, cy, stepx, stepy;
+   double dx, dy, tmx, tmy, tdx, tdy;
+
+   if (pgrid_nbuckets == 0)
+      return pgrid_finish( *ids, pgrid_addAdded( ids, mids, 0 ) );
+
+   cx     = pgrid_cell(x1);
+   cy     = pgrid_cell(y1);
+   ncells = ABS( pgrid_cell(x2) - cx ) + ABS( pgrid_cell(y2) - cy ) + 1;
+
+   /* Long segment, just grab everything. */
+   if (ncells > pgrid_nbuckets) {
+      n = pgrid_addAll( ids, mids );
+      return pgrid_finish( *ids, pgrid_addAdded( ids, mids, n ) );
+   }
+
+   /* Set up the traversal. */
+   dx    = x2 - x1;
+   dy    = y2 - y1;
+   stepx = (dx > 0.) ? 1 : -1;
+   stepy = (dy > 0.) ? 1 : -1;
+   if (dx != 0.) {
+      tdx = PGRID_CELL_SIZE / fabs(dx);
+      tmx = (((stepx > 0) ? cx+1 : cx) * PGRID_CELL_SIZE - x1) / dx;
+   }
+   else
+      tdx = tmx = HUGE_VAL;
+   if (dy != 0.) {
+      tdy = PGRID_CELL_SIZE / fabs(dy);
+      tmy = (((stepy > 0) ? cy+1 : cy) * PGRID_CELL_SIZE - y1) / dy;
+   }
+   else
+      tdy = tmy = HUGE_VAL;
+
+   /* Walk the cells. */
+   n = 0;
+   for (i=0; i<ncells; i++) {
+      n = pgrid_addBucket( ids, mids, n, pgrid_hash(cx,cy) );
+      if (tmx < tmy) {
+         tmx += tdx;
+         cx  += stepx;
+      }
+      else {
+         tmy += tdy;
+         cy  += stepy;
+      }
+   }
+   n = pgrid_addAdded( ids, mids, n );
+
+   return pgrid_finish( *ids, n );
+}
+
+
+/**
+ * @brief Gets all the pilots that might be within a radius of a point.
+ *
+ *    @param[in,out] ids Array to store pilot IDs in, gets grown as needed.
+ *    @param[in,out] mids Memory allocated for ids.
+ *    @param x X position of the center.
+ *    @param y Y position of the center.
+ *    @param r Radius to look in.
+ *    @return Number of pilot IDs found, sorted in stack order.
+ */
+int pgrid_queryRadius( unsigned int **ids, int *mids,
+      double x, double y, double r )
+{
+   r += pgrid_slack;
+   return pgrid_queryRect( ids, mids, x-r, y-r, x+r, y+r );
+}
+
+
+/**
+ * @brief Gets the width of the largest pilot in the grid.
+ *
+ * Useful to expand queries that take into account the size of the pilots.
+ */
+double pgrid_maxSize (void)
+{
+   return pgrid_size;
+}
+
+
+/**
+ * @brief Tries to add a pilot to the nearest pilots found so far.
+ *
+ *    @param[in,out] ids Nearest pilots found, nearest first.
+ *    @param[in,out] dists Squared distances of the nearest pilots.
+ *    @param n Number of nearest pilots found.
+ *    @param k Maximum number of nearest pilots.
+ *    @param id Pilot to add.
+ *    @param x X position of the center.
+ *    @param y Y position of the center.
+ *    @param filter Filter to use or NULL.
+ *    @param data Data to pass to the filter.
+ *    @return New number of nearest pilots found.
+ */
+static int pgrid_nearestAdd( unsigned int *ids, double *dists, int n, int k,
+      unsigned int id, double x, double y, PGridFilter filter, void *data )
+{
+   int i;
+   double d;
+   Pilot *p;
+
+   /* Pilots show up once per cell they overlap. */
+   for (i=0; i<n; i++)
+      if (ids[i] == id)
+         return n;
+
+   p = pilot_get(id);
+   if (p == NULL)
+      return n;
+
+   /* Distance is checked with the current position. */
+   d = pow2(p->solid->pos.x - x) + pow2(p->solid->pos.y - y);
+   if ((n == k) && ((d > dists[n-1]) || ((d == dists[n-1]) && (id > ids[n-1]))))
+      return n;
+
+   if ((filter != NULL) && !filter( p, data ))
+      return n;
+
+   /* Insert sorted, ties go to the lower ID like when looping the stack. */
+   if (n < k)
+      n++;
+   for (i=n-1; i>0; i--) {
+      if ((dists[i-1] < d) || ((dists[i-1] == d) && (ids[i-1] < id)))
+         break;
+      ids[i]   = ids[i-1];
+      dists[i] = dists[i-1];
+   }
+   ids[i]   = id;
+   dists[i] = d;
+   return n;
+}
+
+
+/**
+ * @brief Checks all the pilots of a bucket for the nearest pilots.
+ */
+static int pgrid_nearestBucket( unsigned int *ids, double *dists, int n, int k,
+      int b, double x, double y, PGridFilter filter, void *data )
+{
+   int i;
+   for (i=pgrid_start[b]; i<pgrid_start[b+1]; i++)
+      n = pgrid_nearestAdd( ids, dists, n, k, pgrid_entries[i],
+            x, y, filter, data );
+   return n;
+}
+
+
+/**
+ * @brief Gets the pilots nearest to a point.
+ *
+ * Searches in growing rings of cells around the point until nothing nearer
+ *  can be found.
+ *
+ *    @param[out] ids Array of at least k elements to store the pilot IDs in.
+ *    @param k Maximum number of pilots to get.
+ *    @param x X position to look around.
+ *    @param y Y position to look around.
+ *    @param filter Only pilots that pass the filter are considered, can be NULL.
+ *    @param data Data to pass to the filter.
+ *    @return Number of pilots found, sorted nearest first.
+ */
+int pgrid_queryNearest( unsigned int *ids, int k, double x, double y,
+      PGridFilter filter, void *data )
+{
+   int i, n, r, rmax;
+   int cx, cy;
+   double *dists, reach;
+   double buf[PGRID_KNN_STACK];
+
+   if (((pgrid_nboxes == 0) && (pgrid_nadded == 0)) || (k <= 0))
+      return 0;
+
+   dists = (k <= PGRID_KNN_STACK) ? buf : malloc( sizeof(double) * k );
+   n     = 0;
+   cx    = pgrid_cell(x);
+   cy    = pgrid_cell(y);
+
+   /* Pilots that aren't in the grid yet. */
+   for (i=0; i<pgrid_nadded; i++)
+      n = pgrid_nearestAdd( ids, dists, n, k, pgrid_added[i],
+            x, y, filter, data );
+
+   /* Rings needed to cover all the pilots. */
+   if (pgrid_nboxes > 0) {
+      rmax = MAX( MAX( cx - pgrid_x1, pgrid_x2 - cx ),
+            MAX( cy - pgrid_y1, pgrid_y2 - cy ) );
+      rmax = MAX( rmax, 0 );
+   }
+   else
+      rmax = -1;
+
+   for (r=0; r<=rmax; r++) {
+      /* Rings are getting too big, cheaper to check everyone. */
+      if ((double)(2*r+1) * (double)(2*r+1) > 4. * (double)pgrid_nboxes) {
+         for (i=0; i<pgrid_nboxes; i++)
+            n = pgrid_nearestAdd( ids, dists, n, k, pgrid_boxes[i].id,
+                  x, y, filter, data );
+         break;
+      }
+
+      /* Check the ring. */
+      if (r == 0)
+         n = pgrid_nearestBucket( ids, dists, n, k, pgrid_hash(cx,cy),
+               x, y, filter, data );
+      else {
+         for (i=-r; i<=r; i++) {
+            n = pgrid_nearestBucket( ids, dists, n, k, pgrid_hash(cx+i,cy-r),
+                  x, y, filter, data );
+            n = pgrid_nearestBucket( ids, dists, n, k, pgrid_hash(cx+i,cy+r),
+                  x, y, filter, data );
+         }
+         for (i=-r+1; i<r; i++) {
+            n = pgrid_nearestBucket( ids, dists, n, k, pgrid_hash(cx-r,cy+i),
+                  x, y, filter, data );
+            n = pgrid_nearestBucket( ids, dists, n, k, pgrid_hash(cx+r,cy+i),
+                  x, y, filter, data );
+         }
+      }
+
+      /* Anything not seen yet is at least this far. */
+      if (n == k) {
+         reach = r * PGRID_CELL_SIZE - pgrid_slack;
+         if ((reach > 0.) && (dists[n-1] <= pow2(reach)))
+            break;
+      }
+   }
+
+   if (dists != buf)
+      free(dists);
+   return n;
+}
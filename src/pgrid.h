@@ -0,0 +1,49 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+
+
+#ifndef PGRID_H
+#  define PGRID_H
+
+
+#include "pilot.h"
+
+
+#define PGRID_CELL_SIZE    256. /**< Size of a grid cell in space units. */
+
+
+/**
+ * @brief Filter for pilot queries.
+ *
+ *    @param p Pilot to check.
+ *    @param data User data passed to the query.
+ *    @return 1 if the pilot should be considered, 0 otherwise.
+ */
+typedef int (*PGridFilter)( const Pilot *p, void *data );
+
+
+/*
+ * Building.
+ */
+void pgrid_update( double dt );
+void pgrid_add( const Pilot *p );
+void pgrid_free (void);
+
+
+/*
+ * Queries.
+ */
+int pgrid_queryRect( unsigned int **ids, int *mids,
+      double x1, double y1, double x2, double y2 );
+int pgrid_queryLine( unsigned int **ids, int *mids,
+      double x1, double y1, double x2, double y2 );
+int pgrid_queryRadius( unsigned int **ids, int *mids,
+      double x, double y, double r );
+int pgrid_queryNearest( unsigned int *ids, int k, double x, double y,
+      PGridFilter filter, void *data );
+double pgrid_maxSize (void);
+
+
+#endif /* PGRID_H */
@@ -39,6 +39,7 @@
 #include "ai_extra.h"
 #include "faction.h"
 #include "font.h"
+#include "pgrid.h"
 
 
 #define PILOT_CHUNK_MIN 128 /**< Maximum chunks to increment pilot_stack by */
@@ -64,6 +65,10 @@ static double sensor_curRange    = 0.; /**< Current base sensor range, used to c
                                          what is in range and what isn't. */
 static double pilot_commTimeout  = 15.; /**< Time for text above pilot to time out. */
 static double pilot_commFade     = 5.; /**< Time for text above pilot to fade out. */
+static unsigned int *pilot_cand  = NULL; /**< Candidate pilots from the grid. */
+static int pilot_mcand           = 0; /**< Memory allocated for candidates. */
+static Pilot **pilot_thinkers    = NULL; /**< Pilots whose AI thinks this frame. */
+static int pilot_mthinkers       = 0; /**< Memory allocated for thinkers. */
 
 
 /*
@@ -85,6 +90,9 @@ static void pilot_dead( Pilot* p );
 static void pilot_setCommMsg( Pilot *p, const char *s );
 static int pilot_getStackPos( const unsigned int id );
 static void pilot_updateMass( Pilot *pilot );
+static int pilot_filterEnemy( const Pilot *target, void *data );
+static int pilot_filterTarget( const Pilot *target, void *data );
+static int pilot_canThink( const Pilot *p );
 
 
 /**
@@ -213,6 +221,40 @@ unsigned int pilot_getPrevID( const unsigned int id, int mode )
 }
 
 
+/**
+ * @brief Checks to see if a pilot is a valid nearest enemy.
+ *
+ *    @param target Pilot to check.
+ *    @param data Pilot looking for an enemy.
+ *    @return 1 if target is a valid enemy.
+ */
+static int pilot_filterEnemy( const Pilot *target, void *data )
+{
+   const Pilot *p;
+
+   p = (const Pilot*) data;
+
+   /* Must not be bribed. */
+   if ((target->faction == FACTION_PLAYER) && pilot_isFlag(p,PILOT_BRIBED))
+      return 0;
+
+   if (!areEnemies(p->faction, target->faction) && /* Enemy faction. */
+         !((target->id == PLAYER_ID) &&
+            pilot_isFlag(p,PILOT_HOSTILE))) /* Hostile to player. */
+      return 0;
+
+   /* Shouldn't be disabled. */
+   if (pilot_isDisabled(target))
+      return 0;
+
+   /* Must be in range. */
+   if (!pilot_inRangePilot( p, target ))
+      return 0;
+
+   return 1;
+}
+
+
 /**
  * @brief Gets the nearest enemy to the pilot.
  *
@@ -222,37 +264,44 @@ unsigned int pilot_getPrevID( const unsigned int id, int mode )
 unsigned int pilot_getNearestEnemy( const Pilot* p )
 {
    unsigned int tp;
-   int i;
-   double d, td;
 
-   tp = 0;
-   d = 0.;
-   for (i=0; i<pilot_nstack; i++) {
-      /* Must not be bribed. */
-      if ((pilot_stack[i]->faction == FACTION_PLAYER) && pilot_isFlag(p,PILOT_BRIBED))
-         continue;
+   if (pgrid_queryNearest( &tp, 1, p->solid->pos.x, p->solid->pos.y,
+            pilot_filterEnemy, (void*)p ) == 0)
+      return 0;
+   return tp;
+}
 
-      if ((areEnemies(p->faction, pilot_stack[i]->faction) || /* Enemy faction. */
-            ((pilot_stack[i]->id == PLAYER_ID) && 
-               pilot_isFlag(p,PILOT_HOSTILE)))) { /* Hostile to player. */
 
-         /* Shouldn't be disabled. */
-         if (pilot_isDisabled(pilot_stack[i]))
-            continue;
+/**
+ * @brief Checks to see if a pilot can be selected as a target.
+ *
+ *    @param target Pilot to check.
+ *    @param data Pilot doing the targeting.
+ *    @return 1 if target can be selected.
+ */
+static int pilot_filterTarget( const Pilot *target, void *data )
+{
+   const Pilot *p;
 
-         /* Must be in range. */
-         if (!pilot_inRangePilot( p, pilot_stack[i] ))
-            continue;
+   p = (const Pilot*) data;
 
-         /* Check distance. */
-         td = vect_dist2(&pilot_stack[i]->solid->pos, &p->solid->pos);
-         if (!tp || (td < d)) {
-            d = td;
-            tp = pilot_stack[i]->id;
-         }
-      }
-   }
-   return tp;
+   if (target == p)
+      return 0;
+
+   /* Player doesn't select escorts. */
+   if ((p->faction == FACTION_PLAYER) &&
+         (target->faction == FACTION_PLAYER))
+      return 0;
+
+   /* Shouldn't be disabled. */
+   if (pilot_isDisabled(target))
+      return 0;
+
+   /* Must be in range. */
+   if (!pilot_inRangePilot( p, target ))
+      return 0;
+
+   return 1;
 }
 
 
@@ -265,34 +314,11 @@ unsigned int pilot_getNearestEnemy( const Pilot* p )
 unsigned int pilot_getNearestPilot( const Pilot* p )
 {
    unsigned int tp;
-   int i;
-   double d, td;
-
-   tp=PLAYER_ID;
-   d=0;
-   for (i=0; i<pilot_nstack; i++) {
-      if (pilot_stack[i] == p)
-         continue;
-
-      /* Player doesn't select escorts. */
-      if ((p->faction == FACTION_PLAYER) &&
-            (pilot_stack[i]->faction == FACTION_PLAYER))
-         continue;
 
-      /* Shouldn't be disabled. */
-      if (pilot_isDisabled(pilot_stack[i]))
-         continue;
-
-      /* Must be in range. */
-      if (!pilot_inRangePilot( p, pilot_stack[i] ))
-         continue;
-
-      td = vect_dist2(&pilot_stack[i]->solid->pos, &player->solid->pos);       
-      if (((tp==PLAYER_ID) || (td < d))) {
-         d = td;
-         tp = pilot_stack[i]->id;
-      }
-   }
+   /* Distance is measured from the player. */
+   if (pgrid_queryNearest( &tp, 1, player->solid->pos.x, player->solid->pos.y,
+            pilot_filterTarget, (void*)p ) == 0)
+      return PLAYER_ID;
    return tp;
 }
 
@@ -1395,7 +1421,7 @@ int pilot_hasDeployed( Pilot *p )
 void pilot_explode( double x, double y, double radius,
       DamageType dtype, double damage, const Pilot *parent )
 {
-   int i;
+   int i, n;
    double rx, ry;
    double dist, rad2;
    Pilot *p;
@@ -1403,8 +1429,14 @@ void pilot_explode( double x, double y, double radius,
 
    rad2 = radius*radius;
 
-   for (i=0; i<pilot_nstack; i++) {
-      p = pilot_stack[i];
+   /* Ship size is taken into account so search a bit further. */
+   n = pgrid_queryRadius( &pilot_cand, &pilot_mcand, x, y,
+         radius + pgrid_maxSize() );
+
+   for (i=0; i<n; i++) {
+      p = pilot_get( pilot_cand[i] );
+      if (p == NULL)
+         continue;
 
       /* Calculate a bit. */
       rx = p->solid->pos.x - x;
@@ -1847,20 +1879,18 @@ void pilot_hyperspaceAbort( Pilot* p )
 
 
 /**
- * @brief Attempts to start refueling the pilot's target.
+ * @brief Checks to see if a pilot can start refueling its target right now.
  *
- *    @param p Pilot to try to start refueling.
+ *    @param p Pilot to check.
+ *    @return 1 if it can start refueling.
  */
-int pilot_refuelStart( Pilot *p )
+int pilot_canRefuel( const Pilot *p )
 {
    Pilot *target;
 
-   /* Check to see if target exists, remove flag if not. */
    target = pilot_get(p->target);
-   if (target == NULL) {
-      pilot_rmFlag(p, PILOT_REFUELING);
+   if (target == NULL)
       return 0;
-   }
 
    /* Conditions are the same as boarding, except disabled. */
    if (vect_dist(&p->solid->pos, &target->solid->pos) >
@@ -1871,6 +1901,26 @@ int pilot_refuelStart( Pilot *p )
          (double)pow2(MAX_HYPERSPACE_VEL))
       return 0;
 
+   return 1;
+}
+
+
+/**
+ * @brief Attempts to start refueling the pilot's target.
+ *
+ *    @param p Pilot to try to start refueling.
+ */
+int pilot_refuelStart( Pilot *p )
+{
+   /* Check to see if target exists, remove flag if not. */
+   if (pilot_get(p->target) == NULL) {
+      pilot_rmFlag(p, PILOT_REFUELING);
+      return 0;
+   }
+
+   if (!pilot_canRefuel(p))
+      return 0;
+
    /* Now start the boarding to refuel. */
    pilot_setFlag(p, PILOT_REFUELBOARDING);
    p->ptimer  = PILOT_REFUEL_TIME; /* Use timer to handle refueling. */
@@ -2984,36 +3034,34 @@ void pilot_addHook( Pilot *pilot, int type, unsigned int hook )
    pilot->hooks = realloc( pilot->hooks, sizeof(PilotHook) * pilot->nhooks );
    pilot->hooks[pilot->nhooks-1].type  = type;
    pilot->hooks[pilot->nhooks-1].id    = hook;
+
+   /* So the pilot can be found when the hook is removed. */
+   hook_setPilot( hook, pilot->id );
 }
 
 
 /**
- * @brief Removes a hook from all the pilots.
+ * @brief Removes a hook from a pilot.
  *
+ *    @param p Pilot to remove the hook from, may be NULL.
  *    @param hook Hook to remove.
  */
-void pilots_rmHook( unsigned int hook )
+void pilot_rmHook( Pilot *p, unsigned int hook )
 {
-   int i, j;
-   Pilot *p;
+   int j;
 
-   for (i=0; i<pilot_nstack; i++) {
-      p = pilot_stack[i];
-
-      /* Must have hooks. */
-      if (p->nhooks <= 0)
-         continue;
+   if (p == NULL)
+      return;
 
-      for (j=0; j<p->nhooks; j++) {
+   for (j=0; j<p->nhooks; j++) {
 
-         /* Hook not found. */
-         if (p->hooks[j].id != hook)
-            continue;
+      /* Hook not found. */
+      if (p->hooks[j].id != hook)
+         continue;
 
-         p->nhooks--;
-         memmove( &p->hooks[j], &p->hooks[j+1], sizeof(PilotHook) * (p->nhooks-j) );
-         j--; /* Dun like it but we have to keep iterator sane. */
-      }
+      p->nhooks--;
+      memmove( &p->hooks[j], &p->hooks[j+1], sizeof(PilotHook) * (p->nhooks-j) );
+      j--; /* Dun like it but we have to keep iterator sane. */
    }
 }
 
@@ -3236,6 +3284,9 @@ unsigned int pilot_create( Ship* ship, const char* name, int faction, const char
    /* Initialize the pilot. */
    pilot_init( dyn, ship, name, faction, ai, dir, pos, vel, flags );
 
+   /* Make it findable until the grid is rebuilt. */
+   pgrid_add( dyn );
+
    return dyn->id;
 }
 
@@ -3277,6 +3328,7 @@ Pilot* pilot_copy( Pilot* src )
 
    /* Copy data over, we'll have to reset all the pointers though. */
    memcpy( dest, src, sizeof(Pilot) );
+   memset( &dest->ai_cmd, 0, sizeof(AI_Commands) );
 
    /* Copy names. */
    if (src->name)
@@ -3347,13 +3399,19 @@ Pilot* pilot_copy( Pilot* src )
  */
 void pilot_free( Pilot* p )
 {
-   int i;
+   int i, nhooks;
+   PilotHook *hooks;
   
-   /* Clear up pilot hooks. */
+   /* Clear up pilot hooks, detached first since removing them looks for
+    * the pilot. */
    if (p->hooks) {
-      for (i=0; i<p->nhooks; i++)
-         hook_rm( p->hooks[i].id );
-      free(p->hooks);
+      hooks    = p->hooks;
+      nhooks   = p->nhooks;
+      p->hooks = NULL;
+      p->nhooks = 0;
+      for (i=0; i<nhooks; i++)
+         hook_rm( hooks[i].id );
+      free(hooks);
    }
 
    /* If hostile, must remove counter. */
@@ -3443,6 +3501,12 @@ void pilots_free (void)
    pilot_stack = NULL;
    player = NULL;
    pilot_nstack = 0;
+   free(pilot_cand);
+   pilot_cand  = NULL;
+   pilot_mcand = 0;
+   free(pilot_thinkers);
+   pilot_thinkers  = NULL;
+   pilot_mthinkers = 0;
 }
 
 
@@ -3507,6 +3571,22 @@ void pilot_updateSensorRange (void)
 }
 
 
+/**
+ * @brief Checks to see if pilots_update will have a pilot think.
+ *
+ *    @param p Pilot to check.
+ *    @return 1 if the pilot's think function would be run.
+ */
+static int pilot_canThink( const Pilot *p )
+{
+   return (p->think != NULL) && !pilot_isFlag(p, PILOT_DELETE) &&
+         !pilot_isDisabled(p) && !pilot_isFlag(p, PILOT_DEAD) &&
+         !pilot_isFlag(p, PILOT_HYP_PREP) && !pilot_isFlag(p, PILOT_HYP_END) &&
+         !pilot_isFlag(p, PILOT_BOARDING) &&
+         !pilot_isFlag(p, PILOT_REFUELBOARDING);
+}
+
+
 /**
  * @brief Updates all the pilots.
  *
@@ -3514,9 +3594,27 @@ void pilot_updateSensorRange (void)
  */
 void pilots_update( double dt )
 {
-   int i;
+   int i, n;
    Pilot *p;
 
+   /* Decide which pilots get to think. */
+   ai_schedule(dt);
+
+   /* Have the AI think ahead of time in parallel if possible. */
+   if (ai_isParallel()) {
+      if (pilot_mthinkers < pilot_nstack) {
+         pilot_mthinkers = pilot_mstack;
+         pilot_thinkers  = realloc( pilot_thinkers, sizeof(Pilot*) * pilot_mthinkers );
+      }
+      n = 0;
+      for (i=0; i < pilot_nstack; i++) {
+         p = pilot_stack[i];
+         if ((p->ai != NULL) && p->ai_think && pilot_canThink(p))
+            pilot_thinkers[n++] = p;
+      }
+      ai_thinkParallel( pilot_thinkers, n );
+   }
+
    /* Now update all the pilots. */
    for ( i=0; i < pilot_nstack; i++ ) {
       p = pilot_stack[i];
@@ -3540,8 +3638,13 @@ void pilots_update( double dt )
          }
          /* Must not be boarding to think. */
          else if (!pilot_isFlag(p, PILOT_BOARDING) &&
-               !pilot_isFlag(p, PILOT_REFUELBOARDING))
-            p->think(p, dt);
+               !pilot_isFlag(p, PILOT_REFUELBOARDING)) {
+            /* AI that didn't get scheduled keeps doing what it was doing. */
+            if ((p->ai == NULL) || p->ai_think)
+               p->think(p, dt);
+            else
+               ai_coast(p);
+         }
       }
 
       /* Just update the pilot. */
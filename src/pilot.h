@@ -279,6 +279,11 @@ typedef struct Pilot_ {
    double tcontrol; /**< timer for control tick */
    double timer[MAX_AI_TIMERS]; /**< timers for AI */
    Task* task; /**< current action */
+   double ai_wait; /**< Time since the AI last thought. */
+   int ai_think; /**< Whether the AI gets to think this frame. */
+   unsigned int ai_fire; /**< Weapons the AI keeps firing until it thinks again. */
+   int ai_firemode; /**< Primary weapon mode the AI keeps firing with. */
+   AI_Commands ai_cmd; /**< Results of a think that was run in parallel. */
 
    /* Misc */
    double comm_msgTimer; /**< Message timer for the comm. */
@@ -364,6 +369,7 @@ int pilot_rmMissionCargo( Pilot* pilot, unsigned int cargo_id, int jettison );
 /* Misc. */
 int pilot_hasCredits( Pilot *p, int amount );
 unsigned long pilot_modCredits( Pilot *p, int amount );
+int pilot_canRefuel( const Pilot *p );
 int pilot_refuelStart( Pilot *p );
 void pilot_hyperspaceAbort( Pilot* p );
 void pilot_clearTimers( Pilot *pilot );
@@ -449,7 +455,7 @@ char pilot_getFactionColourChar( const Pilot *p );
  */
 void pilot_addHook( Pilot *pilot, int type, unsigned int hook );
 int pilot_runHook( Pilot* p, int hook_type );
-void pilots_rmHook( unsigned int hook );
+void pilot_rmHook( Pilot *p, unsigned int hook );
 
 
 #endif /* PILOT_H */
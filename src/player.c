@@ -49,6 +49,7 @@
 #include "event.h"
 #include "conf.h"
 #include "nebula.h"
+#include "pgrid.h"
 
 
 #define XML_START_ID "Start" /**< Module start xml document identifier. */
@@ -182,6 +183,8 @@ extern int map_npath;
  * internal
  */
 static void player_updateZoom( double dt );
+/* targeting */
+static int player_filterHostile( const Pilot *p, void *data );
 /* creation */
 static int player_newMake (void);
 static void player_newShipMake( char *name );
@@ -291,7 +294,7 @@ static int player_newMake (void)
    Ship *ship;
    char *sysname;;
    uint32_t bufsize;
-   char *buf;
+   const char *buf;
    int l,h, tl,th;
    double x,y;
    xmlNodePtr node, cur, tmp;
@@ -307,7 +310,7 @@ static int player_newMake (void)
    th             = 0;
 
    /* Try to read teh file. */
-   buf = ndata_read( START_DATA, &bufsize );
+   buf = ndata_borrow( START_DATA, &bufsize );
    if (buf == NULL)
       return -1;
 
@@ -370,7 +373,7 @@ static int player_newMake (void)
 
    /* Clean up. */
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
    xmlCleanupParser();
 
    /* Time. */
@@ -1668,35 +1671,36 @@ void player_soundResume (void)
 }
 
 
+/**
+ * @brief Checks to see if a pilot can be targeted as a hostile.
+ */
+static int player_filterHostile( const Pilot *p, void *data )
+{
+   (void) data;
+
+   /* Don't get if is bribed. */
+   if (pilot_isFlag(p,PILOT_BRIBED))
+      return 0;
+
+   /* Must be in range. */
+   if (!pilot_inRangePilot( player, p ))
+      return 0;
+
+   /* Normal unbribed check. */
+   return pilot_isHostile(p) && !pilot_isDisabled(p);
+}
+
+
 /**
  * @brief Targets the nearest hostile enemy to the player.
  */
 void player_targetHostile (void)
 {  
    unsigned int tp;
-   int i;
-   double d, td;
-
-   tp=PLAYER_ID;
-   d=0;
-   for (i=0; i<pilot_nstack; i++) {
-      /* Don't get if is bribed. */
-      if (pilot_isFlag(pilot_stack[i],PILOT_BRIBED))
-         continue;
- 
-      /* Must be in range. */
-      if (!pilot_inRangePilot( player, pilot_stack[i] ))
-         continue;
 
-      /* Normal unbribed check. */
-      if (pilot_isHostile(pilot_stack[i])) {
-         td = vect_dist(&pilot_stack[i]->solid->pos, &player->solid->pos);       
-         if (!pilot_isDisabled(pilot_stack[i]) && ((tp==PLAYER_ID) || (td < d))) {
-            d = td;
-            tp = pilot_stack[i]->id;
-         }
-      }
-   }
+   if (pgrid_queryNearest( &tp, 1, player->solid->pos.x, player->solid->pos.y,
+            player_filterHostile, NULL ) == 0)
+      tp = PLAYER_ID;
 
    if ((tp != PLAYER_ID) && (tp != player->target))
       player_playSound( snd_target, 1 );
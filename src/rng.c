@@ -37,9 +37,8 @@
 /*
  * mersenne twister state
  */
-static uint32_t MT[624]; /**< Mersenne twister state. */
-static uint32_t mt_y; /**< Internal mersenne twister variable. */
-static int mt_pos = 0; /**< Current number being used. */
+static RNGState rng_global; /**< Global mersenne twister state. */
+static NTHREADLOCAL RNGState *rng_cur = NULL; /**< State the thread uses, NULL is the global one. */
 
 
 /*
@@ -47,9 +46,9 @@ static int mt_pos = 0; /**< Current number being used. */
  */
 static uint32_t rng_timeEntropy (void);
 /* mersenne twister */
-static void mt_initArray( uint32_t seed );
-static void mt_genArray (void);
-static uint32_t mt_getInt (void);
+static void mt_initArray( RNGState *s, uint32_t seed );
+static void mt_genArray( RNGState *s );
+static uint32_t mt_getInt( RNGState *s );
 
 
 /**
@@ -68,7 +67,7 @@ void rng_init (void)
    fd = open("/dev/urandom", O_RDONLY); /* /dev/urandom is better than time seed */
    if (fd != -1) {
       i = sizeof(uint32_t)*624;
-      if (read( fd, &MT, i ) == (ssize_t)i)
+      if (read( fd, &rng_global.MT, i ) == (ssize_t)i)
          need_init = 0;
       else
          i = rng_timeEntropy();
@@ -81,9 +80,52 @@ void rng_init (void)
 #endif /* HAS_LINUX */
 
    if (need_init)
-      mt_initArray( i );
+      mt_initArray( &rng_global, i );
    for (i=0; i<10; i++) /* generate numbers to get away from poor initial values */
-      mt_genArray();
+      mt_genArray( &rng_global );
+}
+
+
+/**
+ * @brief Reseeds the random subsystem with a fixed seed.
+ *
+ * Makes the random numbers repeatable, mainly useful for benchmarking.
+ *
+ *    @param seed Seed to use.
+ */
+void rng_seed( unsigned int seed )
+{
+   rng_stateSeed( &rng_global, seed );
+}
+
+
+/**
+ * @brief Seeds a random number generator state.
+ *
+ *    @param s State to seed.
+ *    @param seed Seed to use.
+ */
+void rng_stateSeed( RNGState *s, unsigned int seed )
+{
+   int i;
+
+   mt_initArray( s, (uint32_t)seed );
+   for (i=0; i<10; i++) /* generate numbers to get away from poor initial values */
+      mt_genArray( s );
+}
+
+
+/**
+ * @brief Sets the generator the current thread uses.
+ *
+ * Lets threads generate random numbers without touching the global
+ *  generator, which isn't thread safe.
+ *
+ *    @param s State to use, NULL goes back to the global generator.
+ */
+void rng_setState( RNGState *s )
+{
+   rng_cur = s;
 }
 
 
@@ -113,30 +155,34 @@ static uint32_t rng_timeEntropy (void)
 
 
 /**
- * @fn static void mt_initArray( uint32_t seed )
+ * @fn static void mt_initArray( RNGState *s, uint32_t seed )
  *
  * @brief Generates the initial mersenne twister based on seed.
  */
-static void mt_initArray( uint32_t seed )
+static void mt_initArray( RNGState *s, uint32_t seed )
 {
    int i;
+   uint32_t *MT;
 
+   MT    = s->MT;
    MT[0] = seed;
    for (i=1; i<624; i++)
       MT[i] = 1812433253 * (MT[i-1] ^ (((MT[i-1])) + i) >> 30);
-   mt_pos = 0;
+   s->pos = 0;
 }
 
 
 /**
- * @fn static void mt_genArray (void)
+ * @fn static void mt_genArray( RNGState *s )
  *
  * @brief Generates a new set of random numbers for the mersenne twister.
  */
-static void mt_genArray (void)
+static void mt_genArray( RNGState *s )
 {
    int i;
+   uint32_t mt_y, *MT;
 
+   MT = s->MT;
    for (i=0; i<624; i++ ) {
       mt_y = (MT[i] & 0x80000000) + ((MT[i] % 624) & 0x7FFFFFFF);
       if (mt_y % 2) /* odd */
@@ -144,22 +190,24 @@ static void mt_genArray (void)
       else /* even */
          MT[i] = MT[(i+397) % 624] ^ (mt_y >> 1);
    }
-   mt_pos = 0;
+   s->pos = 0;
 }
 
 
 /**
- * @fn static uint32_t mt_getInt (void)
+ * @fn static uint32_t mt_getInt( RNGState *s )
  *
  * @brief Gets the next int.
  *
  *    @return A random 4 byte number.
  */
-static uint32_t mt_getInt (void)
+static uint32_t mt_getInt( RNGState *s )
 {
-   if (mt_pos >= 624) mt_genArray();
+   uint32_t mt_y;
+
+   if (s->pos >= 624) mt_genArray( s );
 
-   mt_y = MT[mt_pos++];
+   mt_y = s->MT[s->pos++];
    mt_y ^= mt_y >> 11;
    mt_y ^= (mt_y << 7) & 2636928640U;
    mt_y ^= (mt_y << 15) & 4022730752U;
@@ -178,7 +226,7 @@ static uint32_t mt_getInt (void)
  */
 unsigned int randint (void)
 {
-   return mt_getInt();
+   return mt_getInt( (rng_cur != NULL) ? rng_cur : &rng_global );
 }
 
 
@@ -192,7 +240,7 @@ unsigned int randint (void)
 static double m_div = (double)(0xFFFFFFFF); /**< Number to divide by. */
 double randfp (void)
 {
-   double m = (double)mt_getInt();
+   double m = (double)mt_getInt( (rng_cur != NULL) ? rng_cur : &rng_global );
    return m / m_div;
 }
 
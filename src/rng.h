@@ -44,8 +44,28 @@
 #define RNG_3SIGMA()       NormalInverse(0.001 + RNGF()*(1.-0.001*2.))
 
 
+#include <stdint.h>
+
+
+/**
+ * @brief State of a random number generator.
+ *
+ * Only needed for threads that need their own generator, everything else
+ *  uses the global one.
+ */
+typedef struct RNGState_ {
+   uint32_t MT[624]; /**< Mersenne twister state. */
+   int pos; /**< Current number being used. */
+} RNGState;
+
+
 /* Init */
 void rng_init (void);
+void rng_seed( unsigned int seed );
+
+/* Thread generators */
+void rng_stateSeed( RNGState *s, unsigned int seed );
+void rng_setState( RNGState *s );
 
 /* Random functions */
 unsigned int randint (void);
@@ -54,6 +54,9 @@ static Ship* ship_stack = NULL; /**< Stack of ships available in the game. */
  */
 static int ship_compareTech( const void *arg1, const void *arg2 );
 static int ship_parse( Ship *temp, xmlNodePtr parent );
+static int ships_loadCache( DCache *dc );
+static ShipOutfitSlot* ship_loadCacheSlots( DCache *dc, int *n );
+static void ship_saveCacheSlots( DCache *dc, const ShipOutfitSlot *slots, int n );
 
 
 /**
@@ -643,10 +646,18 @@ static int ship_parse( Ship *temp, xmlNodePtr parent )
 int ships_load (void)
 {
    uint32_t bufsize;
-   char *buf = ndata_read( SHIP_DATA, &bufsize);
-
+   const char *buf;
    xmlNodePtr node;
-   xmlDocPtr doc = xmlParseMemory( buf, bufsize );
+   xmlDocPtr doc;
+
+   /* Try the cache first. */
+   if (dcache_load( DCACHE_SHIP, ships_loadCache, ships_free ) == 0) {
+      DEBUG("Loaded %d Ship%s", array_size(ship_stack), (array_size(ship_stack)==1) ? "" : "s" );
+      return 0;
+   }
+
+   buf = ndata_borrow( SHIP_DATA, &bufsize);
+   doc = xmlParseMemory( buf, bufsize );
 
    node = doc->xmlChildrenNode; /* Ships node */
    if (strcmp((char*)node->name,XML_ID)) {
@@ -669,7 +680,7 @@ int ships_load (void)
    array_shrink(&ship_stack);
 
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    DEBUG("Loaded %d Ship%s", array_size(ship_stack), (array_size(ship_stack)==1) ? "" : "s" );
 
@@ -677,6 +688,132 @@ int ships_load (void)
 }
 
 
+/**
+ * @brief Loads the ships from the data cache.
+ *
+ *    @param dc Section of the cache to load from.
+ *    @return 0 on success.
+ */
+static int ships_loadCache( DCache *dc )
+{
+   int i, n;
+   Ship *s;
+
+   ship_stack = array_create(Ship);
+   n = dcache_readCount( dc, sizeof(Ship) );
+   if (dcache_error(dc))
+      return -1;
+
+   for (i=0; i<n; i++) {
+      s = &array_grow(&ship_stack);
+      dcache_readData( dc, s, sizeof(Ship) );
+
+      /* Fix the pointers. */
+      s->name        = dcache_readString( dc );
+      s->base_type   = dcache_readString( dc );
+      s->license     = dcache_readString( dc );
+      s->fabricator  = dcache_readString( dc );
+      s->description = dcache_readString( dc );
+      s->gfx_comm    = dcache_readString( dc );
+      s->gui         = dcache_readString( dc );
+      s->desc_stats  = dcache_readString( dc );
+      s->gfx_space   = dcache_readTexture( dc,
+            OPENGL_TEX_MAPTRANS | OPENGL_TEX_MIPMAPS );
+      s->gfx_engine  = dcache_readTexture( dc, OPENGL_TEX_MIPMAPS );
+      s->gfx_target  = dcache_readTexture( dc, 0 );
+      s->outfit_low     = ship_loadCacheSlots( dc, &s->outfit_nlow );
+      s->outfit_medium  = ship_loadCacheSlots( dc, &s->outfit_nmedium );
+      s->outfit_high    = ship_loadCacheSlots( dc, &s->outfit_nhigh );
+
+      if (dcache_error(dc))
+         return -1;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Loads outfit slots from the data cache.
+ *
+ *    @param dc Section of the cache to load from.
+ *    @param[out] n Number of slots loaded.
+ *    @return The slots.
+ */
+static ShipOutfitSlot* ship_loadCacheSlots( DCache *dc, int *n )
+{
+   int i;
+   const char *name;
+   ShipOutfitSlot *slots;
+
+   *n    = dcache_readCount( dc, sizeof(ShipOutfitSlot) );
+   slots = calloc( *n, sizeof(ShipOutfitSlot) );
+   dcache_readData( dc, slots, sizeof(ShipOutfitSlot) * *n );
+
+   /* Default outfits are stored by name. */
+   for (i=0; i<*n; i++) {
+      name = dcache_readName( dc );
+      slots[i].data = (name != NULL) ? outfit_get( name ) : NULL;
+   }
+   return slots;
+}
+
+
+/**
+ * @brief Writes the ships to the data cache.
+ *
+ *    @param dc Section of the cache to write to.
+ *    @return 0 on success.
+ */
+int ships_saveCache( DCache *dc )
+{
+   int i;
+   Ship *s;
+
+   dcache_writeInt( dc, array_size(ship_stack) );
+   for (i=0; i<array_size(ship_stack); i++) {
+      s = &ship_stack[i];
+      dcache_writeData( dc, s, sizeof(Ship) );
+
+      /* Pointers must be written in the same order ships_loadCache reads them. */
+      dcache_writeString( dc, s->name );
+      dcache_writeString( dc, s->base_type );
+      dcache_writeString( dc, s->license );
+      dcache_writeString( dc, s->fabricator );
+      dcache_writeString( dc, s->description );
+      dcache_writeString( dc, s->gfx_comm );
+      dcache_writeString( dc, s->gui );
+      dcache_writeString( dc, s->desc_stats );
+      dcache_writeTexture( dc, s->gfx_space );
+      dcache_writeTexture( dc, s->gfx_engine );
+      dcache_writeTexture( dc, s->gfx_target );
+      ship_saveCacheSlots( dc, s->outfit_low, s->outfit_nlow );
+      ship_saveCacheSlots( dc, s->outfit_medium, s->outfit_nmedium );
+      ship_saveCacheSlots( dc, s->outfit_high, s->outfit_nhigh );
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Writes outfit slots to the data cache.
+ *
+ *    @param dc Section of the cache to write to.
+ *    @param slots Slots to write.
+ *    @param n Number of slots.
+ */
+static void ship_saveCacheSlots( DCache *dc, const ShipOutfitSlot *slots, int n )
+{
+   int i;
+
+   dcache_writeInt( dc, n );
+   dcache_writeData( dc, slots, sizeof(ShipOutfitSlot) * n );
+   for (i=0; i<n; i++)
+      dcache_writeString( dc, (slots[i].data != NULL) ? slots[i].data->name : NULL );
+}
+
+
 /**
  * @brief Frees all the ships.
  */
@@ -12,6 +12,7 @@
 #include "outfit.h"
 #include "sound.h"
 #include "nxml.h"
+#include "dcache.h"
 
 
 /* target gfx dimensions */
@@ -143,6 +144,7 @@ typedef struct Ship_ {
  */
 int ships_load (void);
 void ships_free (void);
+int ships_saveCache( DCache *dc );
 
 /*
  * stats
@@ -337,6 +337,21 @@ double sound_length( int sound )
 }
 
 
+/**
+ * @brief Gets the name of a sound.
+ *
+ *    @param sound ID of the sound to get the name of.
+ *    @return Name of the sound or NULL if there is no such sound.
+ */
+const char* sound_name( int sound )
+{
+   if (sound_disabled || (sound < 0) || (sound >= sound_nlist))
+      return NULL;
+
+   return sound_list[sound].name;
+}
+
+
 /**
  * @brief Plays the sound in the first available channel.
  *
@@ -35,6 +35,7 @@ void sound_resume (void);
  */
 int sound_get( char* name );
 double sound_length( int sound );
+const char* sound_name( int sound );
 int sound_volume( const double vol );
 double sound_getVolume (void);
 int sound_play( int sound );
@@ -34,6 +34,7 @@
 #include "fleet.h"
 #include "mission.h"
 #include "conf.h"
+#include "pgrid.h"
 
 
 #define XML_PLANET_ID         "Planets" /**< Planet xml document tag. */
@@ -134,6 +135,7 @@ static int planet_parse( Planet* planet, const xmlNodePtr parent );
 /* system load */
 static int systems_load (void);
 static StarSystem* system_parse( StarSystem *system, const xmlNodePtr parent );
+static int space_loadCache( DCache *dc );
 static void system_parseJumps( const xmlNodePtr parent );
 /* misc */
 static int system_calcSecurity( StarSystem *sys );
@@ -800,6 +802,9 @@ void space_init ( const char* sysname )
    /* start the spawn timer */
    spawn_timer = -1.;
 
+   /* Index the new pilots so they can be found before the first update. */
+   pgrid_update( 0. );
+
    /* we now know this system */
    sys_setFlag(cur_system,SYSTEM_KNOWN);
 }
@@ -813,11 +818,11 @@ void space_init ( const char* sysname )
 static int planets_load ( void )
 {
    uint32_t bufsize;
-   char *buf;
+   const char *buf;
    xmlNodePtr node;
    xmlDocPtr doc;
 
-   buf = ndata_read( PLANET_DATA, &bufsize );
+   buf = ndata_borrow( PLANET_DATA, &bufsize );
    doc = xmlParseMemory( buf, bufsize );
 
    node = doc->xmlChildrenNode;
@@ -857,7 +862,7 @@ static int planets_load ( void )
     * free stuff
     */
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    return 0;
 }
@@ -1499,18 +1504,42 @@ static void system_parseJumps( const xmlNodePtr parent )
  */
 int space_load (void)
 {
-   int i;
+   int i, j;
    int ret;
 
    /* Loading. */
    systems_loading = 1;
 
-   ret = planets_load();
-   if (ret < 0)
-      return ret;
-   ret = systems_load();
-   if (ret < 0)
-      return ret;
+   /* Try the cache first. */
+   if (dcache_load( DCACHE_SPACE, space_loadCache, space_exit ) == 0) {
+      /* Add planet <-> star system to name stack. */
+      for (i=0; i<systems_nstack; i++) {
+         for (j=0; j<systems_stack[i].nplanets; j++) {
+            spacename_nstack++;
+            if (spacename_nstack > spacename_mstack) {
+               spacename_mstack += CHUNK_SIZE;
+               planetname_stack = realloc(planetname_stack,
+                     sizeof(char*) * spacename_mstack);
+               systemname_stack = realloc(systemname_stack,
+                     sizeof(char*) * spacename_mstack);
+            }
+            planetname_stack[spacename_nstack-1] = systems_stack[i].planets[j]->name;
+            systemname_stack[spacename_nstack-1] = systems_stack[i].name;
+         }
+      }
+
+      DEBUG("Loaded %d Star System%s with %d Planet%s",
+            systems_nstack, (systems_nstack==1) ? "" : "s",
+            planet_nstack, (planet_nstack==1) ? "" : "s" );
+   }
+   else {
+      ret = planets_load();
+      if (ret < 0)
+         return ret;
+      ret = systems_load();
+      if (ret < 0)
+         return ret;
+   }
 
    /* Done loading. */
    systems_loading = 0;
@@ -1523,6 +1552,143 @@ int space_load (void)
 }
 
 
+/**
+ * @brief Loads the planets and systems from the data cache.
+ *
+ *    @param dc Section of the cache to load from.
+ *    @return 0 on success.
+ */
+static int space_loadCache( DCache *dc )
+{
+   int i, j, n, id;
+   const char *name;
+   Planet *p;
+   StarSystem *sys;
+
+   /* Planets, commodities are stored by name. */
+   n = dcache_readCount( dc, sizeof(Planet) );
+   planet_stack   = calloc( MAX(n,1), sizeof(Planet) );
+   planet_mstack  = MAX(n,1);
+   for (i=0; i<n; i++) {
+      p = &planet_stack[i];
+      dcache_readData( dc, p, sizeof(Planet) );
+      p->name              = dcache_readString( dc );
+      p->description       = dcache_readString( dc );
+      p->bar_description   = dcache_readString( dc );
+      p->gfx_exterior      = dcache_readString( dc );
+      p->gfx_space         = dcache_readTexture( dc, OPENGL_TEX_MIPMAPS );
+      p->ncommodities      = dcache_readCount( dc, sizeof(int) );
+      p->commodities       = malloc( sizeof(Commodity*) * p->ncommodities );
+      for (j=0; j<p->ncommodities; j++) {
+         name = dcache_readName( dc );
+         p->commodities[j] = (name != NULL) ? commodity_get( name ) : NULL;
+      }
+      planet_nstack++;
+      if (dcache_error(dc))
+         return -1;
+   }
+
+   /* Systems, planets are stored by index and fleets by name. */
+   n = dcache_readCount( dc, sizeof(StarSystem) );
+   systems_stack  = calloc( MAX(n,1), sizeof(StarSystem) );
+   systems_mstack = MAX(n,1);
+   for (i=0; i<n; i++) {
+      sys = &systems_stack[i];
+      dcache_readData( dc, sys, sizeof(StarSystem) );
+      sys->name      = dcache_readString( dc );
+      sys->prices    = NULL;
+      sys->njumps    = dcache_readCount( dc, sizeof(int) );
+      sys->jumps     = malloc( sizeof(int) * sys->njumps );
+      dcache_readData( dc, sys->jumps, sizeof(int) * sys->njumps );
+      sys->nplanets  = dcache_readCount( dc, sizeof(int) );
+      /* system_addPlanet expects at least a small chunk. */
+      sys->planets   = calloc( MAX(sys->nplanets,CHUNK_SIZE_SMALL), sizeof(Planet*) );
+      for (j=0; j<sys->nplanets; j++) {
+         id = dcache_readInt( dc );
+         sys->planets[j] = ((id >= 0) && (id < planet_nstack)) ?
+               &planet_stack[id] : NULL;
+      }
+      sys->nfleets   = dcache_readCount( dc, 2*sizeof(int) );
+      sys->fleets    = malloc( sizeof(SystemFleet) * sys->nfleets );
+      for (j=0; j<sys->nfleets; j++) {
+         name = dcache_readName( dc );
+         sys->fleets[j].fleet  = (name != NULL) ? fleet_get( name ) : NULL;
+         sys->fleets[j].chance = dcache_readInt( dc );
+      }
+      systems_nstack++;
+      if (dcache_error(dc))
+         return -1;
+
+      /* Dangling references mean the cache doesn't match the data. */
+      for (j=0; j<sys->nplanets; j++)
+         if (sys->planets[j] == NULL)
+            return -1;
+      for (j=0; j<sys->nfleets; j++)
+         if (sys->fleets[j].fleet == NULL)
+            return -1;
+   }
+
+   /* Make sure the jumps are valid. */
+   for (i=0; i<systems_nstack; i++)
+      for (j=0; j<systems_stack[i].njumps; j++)
+         if ((systems_stack[i].jumps[j] < 0) ||
+               (systems_stack[i].jumps[j] >= systems_nstack))
+            return -1;
+
+   return 0;
+}
+
+
+/**
+ * @brief Writes the planets and systems to the data cache.
+ *
+ *    @param dc Section of the cache to write to.
+ *    @return 0 on success.
+ */
+int space_saveCache( DCache *dc )
+{
+   int i, j;
+   Planet *p;
+   StarSystem *sys;
+
+   dcache_writeInt( dc, planet_nstack );
+   for (i=0; i<planet_nstack; i++) {
+      p = &planet_stack[i];
+      dcache_writeData( dc, p, sizeof(Planet) );
+
+      /* Pointers must be written in the same order space_loadCache reads them. */
+      dcache_writeString( dc, p->name );
+      dcache_writeString( dc, p->description );
+      dcache_writeString( dc, p->bar_description );
+      dcache_writeString( dc, p->gfx_exterior );
+      dcache_writeTexture( dc, p->gfx_space );
+      dcache_writeInt( dc, p->ncommodities );
+      for (j=0; j<p->ncommodities; j++)
+         dcache_writeString( dc, (p->commodities[j] != NULL) ?
+               p->commodities[j]->name : NULL );
+   }
+
+   dcache_writeInt( dc, systems_nstack );
+   for (i=0; i<systems_nstack; i++) {
+      sys = &systems_stack[i];
+      dcache_writeData( dc, sys, sizeof(StarSystem) );
+      dcache_writeString( dc, sys->name );
+      dcache_writeInt( dc, sys->njumps );
+      dcache_writeData( dc, sys->jumps, sizeof(int) * sys->njumps );
+      dcache_writeInt( dc, sys->nplanets );
+      for (j=0; j<sys->nplanets; j++)
+         dcache_writeInt( dc, sys->planets[j] - planet_stack );
+      dcache_writeInt( dc, sys->nfleets );
+      for (j=0; j<sys->nfleets; j++) {
+         dcache_writeString( dc, sys->fleets[j].fleet->name );
+         dcache_writeInt( dc, sys->fleets[j].chance );
+      }
+   }
+
+   return 0;
+}
+
+
 /**
  * @brief Calculates the security in a star system.
  *
@@ -1579,12 +1745,12 @@ static int system_calcSecurity( StarSystem *sys )
 static int systems_load (void)
 {
    uint32_t bufsize;
-   char *buf;
+   const char *buf;
    xmlNodePtr node;
    xmlDocPtr doc;
 
    /* Load the file. */
-   buf = ndata_read( SYSTEM_DATA, &bufsize );
+   buf = ndata_borrow( SYSTEM_DATA, &bufsize );
    if (buf == NULL)
       return -1;
 
@@ -1646,7 +1812,7 @@ static int systems_load (void)
     * cleanup
     */
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    DEBUG("Loaded %d Star System%s with %d Planet%s",
          systems_nstack, (systems_nstack==1) ? "" : "s",
@@ -1820,7 +1986,10 @@ void space_exit (void)
       free(planetname_stack);
    if (systemname_stack)
       free(systemname_stack);
+   planetname_stack = NULL;
+   systemname_stack = NULL;
    spacename_nstack = 0;
+   spacename_mstack = 0;
 
    /* Free the planets. */
    for (i=0; i < planet_nstack; i++) {
@@ -14,6 +14,7 @@
 #include "economy.h"
 #include "fleet.h"
 #include "mission.h"
+#include "dcache.h"
 
 
 #define MAX_HYPERSPACE_VEL    25 /**< Speed to brake to before jumping. */
@@ -185,6 +186,7 @@ void space_initStars( int n );
 void space_init( const char* sysname );
 int space_load (void);
 void space_exit (void);
+int space_saveCache( DCache *dc );
 
 /*
  * planet stuff
@@ -212,12 +212,12 @@ int spfx_load (void)
 {
    int mem;
    uint32_t bufsize;
-   char *buf;
+   const char *buf;
    xmlNodePtr node;
    xmlDocPtr doc;
 
    /* Load and read the data. */
-   buf = ndata_read( SPFX_DATA, &bufsize );
+   buf = ndata_borrow( SPFX_DATA, &bufsize );
    doc = xmlParseMemory( buf, bufsize );
 
    /* Check to see if document exists. */
@@ -252,7 +252,7 @@ int spfx_load (void)
 
    /* Clean up. */
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
 
    /*
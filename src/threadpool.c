@@ -0,0 +1,312 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+/**
+ * @file threadpool.c
+ *
+ * @brief Pool of worker threads for running loops in parallel.
+ *
+ * The pool only runs one loop at a time and the main thread works on it too,
+ *  threadpool_for doesn't return until the whole loop is done.  A loop can
+ *  also be left to the workers with threadpool_start while the main thread
+ *  does something else, like keeping the screen alive.  Ranges are
+ *  handed out in order, but which thread gets which range isn't
+ *  deterministic so anything that depends on order must be stored by index
+ *  and processed afterwards.
+ */
+
+
+#include "threadpool.h"
+
+#include "naev.h"
+
+#include "SDL.h"
+#include "SDL_thread.h"
+#include "SDL_mutex.h"
+
+#if HAS_POSIX
+#include <unistd.h>
+#endif /* HAS_POSIX */
+
+#include "log.h"
+#include "ncompat.h"
+
+
+#define THREADPOOL_MAX     64 /**< Maximum amount of threads to use. */
+
+
+/**
+ * @brief Worker thread.
+ */
+typedef struct ThreadWorker_ {
+   SDL_Thread *thread; /**< Actual thread. */
+   int id; /**< Index of the worker, starts at 1. */
+} ThreadWorker;
+
+
+static ThreadWorker *threadpool_workers = NULL; /**< Worker threads. */
+static int threadpool_nworkers   = 0; /**< Number of worker threads. */
+static SDL_mutex *threadpool_lock = NULL; /**< Protects the pool state. */
+static SDL_cond *threadpool_work = NULL; /**< Signals there's a new loop. */
+static SDL_cond *threadpool_done = NULL; /**< Signals the workers are done. */
+static int threadpool_quit       = 0; /**< Workers should quit. */
+static unsigned int threadpool_gen = 0; /**< Generation of the current loop. */
+static int threadpool_pending    = 0; /**< Workers still working on the loop. */
+
+/* Current loop. */
+static ThreadForFunc threadpool_func = NULL; /**< Function to run. */
+static void *threadpool_data     = NULL; /**< Data to pass. */
+static int threadpool_n          = 0; /**< Size of the loop. */
+static int threadpool_chunk      = 1; /**< Size of a range. */
+static int threadpool_next       = 0; /**< Next index to hand out. */
+
+
+/*
+ * Prototypes.
+ */
+static int threadpool_cpus (void);
+static void threadpool_runLoop( int thread );
+static int threadpool_worker( void *data );
+
+
+/**
+ * @brief Gets the number of processors available.
+ */
+static int threadpool_cpus (void)
+{
+#if HAS_POSIX && defined(_SC_NPROCESSORS_ONLN)
+   long n;
+   n = sysconf( _SC_NPROCESSORS_ONLN );
+   if (n > 0)
+      return (int)n;
+#endif /* HAS_POSIX && defined(_SC_NPROCESSORS_ONLN) */
+   return 1;
+}
+
+
+/**
+ * @brief Takes ranges of the current loop until there are none left.
+ *
+ *    @param thread Index of the thread running.
+ */
+static void threadpool_runLoop( int thread )
+{
+   int start, end;
+
+   while (1) {
+      SDL_mutexP( threadpool_lock );
+      start = threadpool_next;
+      threadpool_next += threadpool_chunk;
+      SDL_mutexV( threadpool_lock );
+
+      if (start >= threadpool_n)
+         break;
+
+      end = MIN( start + threadpool_chunk, threadpool_n );
+      threadpool_func( threadpool_data, start, end, thread );
+   }
+}
+
+
+/**
+ * @brief Main function of the worker threads.
+ */
+static int threadpool_worker( void *data )
+{
+   ThreadWorker *w;
+   unsigned int gen;
+
+   w   = (ThreadWorker*) data;
+   gen = 0;
+
+   SDL_mutexP( threadpool_lock );
+   while (1) {
+      /* Wait for a new loop. */
+      while (!threadpool_quit && (gen == threadpool_gen))
+         SDL_CondWait( threadpool_work, threadpool_lock );
+      if (threadpool_quit)
+         break;
+      gen = threadpool_gen;
+      SDL_mutexV( threadpool_lock );
+
+      threadpool_runLoop( w->id );
+
+      /* Tell the main thread we're done. */
+      SDL_mutexP( threadpool_lock );
+      threadpool_pending--;
+      if (threadpool_pending == 0)
+         SDL_CondSignal( threadpool_done );
+   }
+   SDL_mutexV( threadpool_lock );
+
+   return 0;
+}
+
+
+/**
+ * @brief Initializes the thread pool.
+ *
+ *    @param nthreads Total threads to use including the main thread, 0 uses
+ *           one per processor.
+ *    @return 0 on success.
+ */
+int threadpool_init( int nthreads )
+{
+   int i;
+
+   if (nthreads <= 0)
+      nthreads = threadpool_cpus();
+   nthreads = CLAMP( 1, THREADPOOL_MAX, nthreads );
+
+   threadpool_lock = SDL_CreateMutex();
+   threadpool_work = SDL_CreateCond();
+   threadpool_done = SDL_CreateCond();
+   threadpool_quit = 0;
+
+   /* Main thread is a worker too. */
+   threadpool_nworkers = nthreads-1;
+   if (threadpool_nworkers > 0)
+      threadpool_workers = calloc( threadpool_nworkers, sizeof(ThreadWorker) );
+   for (i=0; i<threadpool_nworkers; i++) {
+      threadpool_workers[i].id     = i+1;
+      threadpool_workers[i].thread = SDL_CreateThread( threadpool_worker,
+            &threadpool_workers[i] );
+      if (threadpool_workers[i].thread == NULL) {
+         WARN("Unable to create worker thread: %s", SDL_GetError());
+         threadpool_nworkers = i;
+         break;
+      }
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Stops all the workers and cleans up the thread pool.
+ */
+void threadpool_exit (void)
+{
+   int i;
+
+   if (threadpool_lock == NULL)
+      return;
+
+   SDL_mutexP( threadpool_lock );
+   threadpool_quit = 1;
+   SDL_CondBroadcast( threadpool_work );
+   SDL_mutexV( threadpool_lock );
+
+   for (i=0; i<threadpool_nworkers; i++)
+      SDL_WaitThread( threadpool_workers[i].thread, NULL );
+   free( threadpool_workers );
+   threadpool_workers  = NULL;
+   threadpool_nworkers = 0;
+
+   SDL_DestroyCond( threadpool_done );
+   SDL_DestroyCond( threadpool_work );
+   SDL_DestroyMutex( threadpool_lock );
+   threadpool_done = NULL;
+   threadpool_work = NULL;
+   threadpool_lock = NULL;
+}
+
+
+/**
+ * @brief Gets the number of threads that can run a loop.
+ *
+ * Useful for allocating per thread buffers.
+ *
+ *    @return Number of threads including the main thread.
+ */
+int threadpool_threads (void)
+{
+   return threadpool_nworkers+1;
+}
+
+
+/**
+ * @brief Starts running a loop on the worker threads.
+ *
+ * Unlike threadpool_for the main thread doesn't help, so it's free to do
+ *  other things until it calls threadpool_wait.  No other loop may be run
+ *  until then.  Without workers the loop is run right away.  Must only be
+ *  called from the main thread.
+ *
+ *    @param func Function to run on each range.
+ *    @param data Data to pass to the function.
+ *    @param n Number of indices to process.
+ *    @param chunk Number of indices in each range.
+ */
+void threadpool_start( ThreadForFunc func, void *data, int n, int chunk )
+{
+   if (n <= 0)
+      return;
+   chunk = MAX( 1, chunk );
+
+   /* Nobody to hand it to. */
+   if (threadpool_nworkers == 0) {
+      func( data, 0, n, 0 );
+      return;
+   }
+
+   /* Set up the loop. */
+   SDL_mutexP( threadpool_lock );
+   threadpool_func    = func;
+   threadpool_data    = data;
+   threadpool_n       = n;
+   threadpool_chunk   = chunk;
+   threadpool_next    = 0;
+   threadpool_pending = threadpool_nworkers;
+   threadpool_gen++;
+   SDL_CondBroadcast( threadpool_work );
+   SDL_mutexV( threadpool_lock );
+}
+
+
+/**
+ * @brief Waits for the loop started by threadpool_start to finish.
+ */
+void threadpool_wait (void)
+{
+   if (threadpool_nworkers == 0)
+      return;
+
+   SDL_mutexP( threadpool_lock );
+   while (threadpool_pending > 0)
+      SDL_CondWait( threadpool_done, threadpool_lock );
+   threadpool_func = NULL;
+   threadpool_data = NULL;
+   SDL_mutexV( threadpool_lock );
+}
+
+
+/**
+ * @brief Runs a loop in parallel.
+ *
+ * Blocks until all the indices have been processed.  Must only be called
+ *  from the main thread.
+ *
+ *    @param func Function to run on each range.
+ *    @param data Data to pass to the function.
+ *    @param n Number of indices to process.
+ *    @param chunk Number of indices in each range.
+ */
+void threadpool_for( ThreadForFunc func, void *data, int n, int chunk )
+{
+   if (n <= 0)
+      return;
+   chunk = MAX( 1, chunk );
+
+   /* Not worth waking up the workers. */
+   if ((threadpool_nworkers == 0) || (n <= chunk)) {
+      func( data, 0, n, 0 );
+      return;
+   }
+
+   /* Help out and wait for the stragglers. */
+   threadpool_start( func, data, n, chunk );
+   threadpool_runLoop( 0 );
+   threadpool_wait();
+}
@@ -0,0 +1,38 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+
+
+#ifndef THREADPOOL_H
+#  define THREADPOOL_H
+
+
+/**
+ * @brief Function run on a range of a parallel loop.
+ *
+ *    @param data User data passed to threadpool_for.
+ *    @param start First index to process.
+ *    @param end One past the last index to process.
+ *    @param thread Index of the thread running it, 0 is the main thread.
+ */
+typedef void (*ThreadForFunc)( void *data, int start, int end, int thread );
+
+
+/*
+ * Init/exit.
+ */
+int threadpool_init( int nthreads );
+void threadpool_exit (void);
+
+
+/*
+ * Running.
+ */
+int threadpool_threads (void);
+void threadpool_for( ThreadForFunc func, void *data, int n, int chunk );
+void threadpool_start( ThreadForFunc func, void *data, int n, int chunk );
+void threadpool_wait (void);
+
+
+#endif /* THREADPOOL_H */
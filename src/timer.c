@@ -0,0 +1,386 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+/**
+ * @file timer.c
+ *
+ * @brief Game time timers.
+ *
+ * Timers live in a hierarchical timing wheel with millisecond ticks.  The
+ *  first level has a slot for each of the next 256 ticks, every level above
+ *  covers 256 times the time of the one below.  Each tick only looks at one
+ *  slot of the first level, and every 256 ticks a slot of the next level is
+ *  spread out over the level below.  Updating doesn't depend on the number
+ *  of timers armed, only the ones that are up get touched.
+ *
+ * The clock only advances with timers_update so timers stop while the game
+ *  is paused like the rest of the simulation.
+ */
+
+
+#include "timer.h"
+
+#include "naev.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "log.h"
+
+
+#define TIMER_BITS      8 /**< Bits of a level of the wheel. */
+#define TIMER_SLOTS     (1<<TIMER_BITS) /**< Slots in a level of the wheel. */
+#define TIMER_MASK      (TIMER_SLOTS-1) /**< Mask of a level. */
+#define TIMER_LEVELS    4 /**< Levels of the wheel. */
+#define TIMER_PENDING   (TIMER_LEVELS*TIMER_SLOTS) /**< List of timers being run. */
+#define TIMER_FIRST     (TIMER_PENDING+1) /**< First node that can be a timer. */
+#define TIMER_CHUNK     64 /**< Nodes to grow by. */
+#define TIMER_IDXBITS   20 /**< Bits of an ID used for the node index. */
+#define TIMER_IDXMASK   ((1<<TIMER_IDXBITS)-1) /**< Mask of the node index. */
+#define TIMER_MAXTICKS  UINT64_C(0xFFFFFFFF) /**< Furthest the wheel can reach. */
+
+
+/**
+ * @brief Node of the wheel.
+ *
+ * The first TIMER_FIRST nodes are the heads of the slot lists, the rest are
+ *  timers or free.  Nodes are linked by index since the array can move.
+ */
+typedef struct TimerNode_ {
+   int prev; /**< Previous node in the list. */
+   int next; /**< Next node in the list or next free node. */
+   unsigned int id; /**< ID of the timer, 0 if free. */
+   unsigned int gen; /**< Times the node has been used. */
+   uint64_t expire; /**< Tick the timer is up at. */
+   TimerFunc func; /**< Function to run. */
+   unsigned int owner; /**< Owner to pass to the function. */
+   void *data; /**< Data to pass to the function. */
+} TimerNode;
+
+
+static TimerNode *timer_nodes = NULL; /**< Nodes of the wheel. */
+static int timer_nnodes       = 0; /**< Used nodes. */
+static int timer_mnodes       = 0; /**< Allocated nodes. */
+static int timer_free         = -1; /**< First free node. */
+static uint64_t timer_tick    = 0; /**< Last tick processed. */
+static double timer_time      = 0.; /**< Game time in ms. */
+
+
+/*
+ * Prototypes.
+ */
+static void timer_init (void);
+static int timer_get( unsigned int id );
+static void timer_link( int head, int n );
+static void timer_unlink( int n );
+static void timer_release( int n );
+static void timer_place( int n );
+static void timer_cascade( int level, int slot );
+static void timer_run( uint64_t tick );
+
+
+/**
+ * @brief Sets up the list heads.
+ */
+static void timer_init (void)
+{
+   int i;
+
+   timer_mnodes = TIMER_FIRST + TIMER_CHUNK;
+   timer_nodes  = calloc( timer_mnodes, sizeof(TimerNode) );
+   for (i=0; i<TIMER_FIRST; i++) {
+      timer_nodes[i].prev = i;
+      timer_nodes[i].next = i;
+   }
+   timer_nnodes = TIMER_FIRST;
+   timer_free   = -1;
+}
+
+
+/**
+ * @brief Gets the node of a timer.
+ *
+ *    @param id ID of the timer.
+ *    @return Index of the node or -1 if the timer isn't armed.
+ */
+static int timer_get( unsigned int id )
+{
+   int n;
+
+   if (timer_nodes == NULL)
+      return -1;
+
+   n = id & TIMER_IDXMASK;
+   if ((n < TIMER_FIRST) || (n >= timer_nnodes) || (timer_nodes[n].id != id))
+      return -1;
+   return n;
+}
+
+
+/**
+ * @brief Adds a node to the end of a list.
+ */
+static void timer_link( int head, int n )
+{
+   timer_nodes[n].next = head;
+   timer_nodes[n].prev = timer_nodes[head].prev;
+   timer_nodes[ timer_nodes[head].prev ].next = n;
+   timer_nodes[head].prev = n;
+}
+
+
+/**
+ * @brief Removes a node from the list it's in.
+ */
+static void timer_unlink( int n )
+{
+   timer_nodes[ timer_nodes[n].prev ].next = timer_nodes[n].next;
+   timer_nodes[ timer_nodes[n].next ].prev = timer_nodes[n].prev;
+   timer_nodes[n].prev = n;
+   timer_nodes[n].next = n;
+}
+
+
+/**
+ * @brief Puts a node back in the free list.
+ */
+static void timer_release( int n )
+{
+   timer_nodes[n].id   = 0;
+   timer_nodes[n].func = NULL;
+   timer_nodes[n].data = NULL;
+   timer_nodes[n].gen++;
+   timer_nodes[n].next = timer_free;
+   timer_free = n;
+}
+
+
+/**
+ * @brief Puts a timer in the slot it belongs in.
+ *
+ *    @param n Node of the timer.
+ */
+static void timer_place( int n )
+{
+   uint64_t expire, delta;
+   int level;
+
+   expire = timer_nodes[n].expire;
+   if (expire < timer_tick)
+      expire = timer_tick;
+   delta = expire - timer_tick;
+
+   /* Too far away, park it as far as possible and it'll get placed again. */
+   if (delta > TIMER_MAXTICKS) {
+      delta  = TIMER_MAXTICKS;
+      expire = timer_tick + delta;
+   }
+
+   for (level=0; level<TIMER_LEVELS-1; level++)
+      if (delta < (UINT64_C(1) << (TIMER_BITS*(level+1))))
+         break;
+
+   timer_link( level*TIMER_SLOTS +
+         (int)((expire >> (TIMER_BITS*level)) & TIMER_MASK), n );
+}
+
+
+/**
+ * @brief Spreads out a slot over the levels below.
+ *
+ *    @param level Level of the slot.
+ *    @param slot Slot to spread out.
+ */
+static void timer_cascade( int level, int slot )
+{
+   int head, n;
+
+   head = level*TIMER_SLOTS + slot;
+
+   /* Move it to the pending list first since timers can end up in the
+    * same slot again. */
+   while (timer_nodes[head].next != head) {
+      n = timer_nodes[head].next;
+      timer_unlink( n );
+      timer_link( TIMER_PENDING, n );
+   }
+   while (timer_nodes[TIMER_PENDING].next != TIMER_PENDING) {
+      n = timer_nodes[TIMER_PENDING].next;
+      timer_unlink( n );
+      timer_place( n );
+   }
+}
+
+
+/**
+ * @brief Runs the timers that are up at a tick.
+ *
+ *    @param tick Tick to process.
+ */
+static void timer_run( uint64_t tick )
+{
+   int level, head, n, ret;
+   unsigned int id;
+
+   timer_tick = tick;
+
+   /* Spread out the upper levels when the lower one wraps around. */
+   for (level=1; level<TIMER_LEVELS; level++) {
+      if (((tick >> (TIMER_BITS*(level-1))) & TIMER_MASK) != 0)
+         break;
+      timer_cascade( level, (int)((tick >> (TIMER_BITS*level)) & TIMER_MASK) );
+   }
+
+   /* Take the timers that are up. */
+   head = (int)(tick & TIMER_MASK);
+   while (timer_nodes[head].next != head) {
+      n = timer_nodes[head].next;
+      timer_unlink( n );
+      timer_link( TIMER_PENDING, n );
+   }
+
+   /* Run them, they may add or cancel timers. */
+   while (timer_nodes[TIMER_PENDING].next != TIMER_PENDING) {
+      n     = timer_nodes[TIMER_PENDING].next;
+      id    = timer_nodes[n].id;
+      timer_unlink( n );
+      ret   = timer_nodes[n].func( timer_nodes[n].owner, timer_nodes[n].data );
+
+      /* Function may have cancelled it. */
+      if (timer_nodes[n].id != id)
+         continue;
+
+      /* Try again next tick. */
+      if (ret) {
+         timer_nodes[n].expire = tick+1;
+         timer_place( n );
+      }
+      else
+         timer_release( n );
+   }
+}
+
+
+/**
+ * @brief Arms a timer.
+ *
+ *    @param delay Seconds of game time until the timer is up.
+ *    @param func Function to run when the timer is up.
+ *    @param owner Owner to pass to the function.
+ *    @param data Data to pass to the function.
+ *    @return ID of the timer, never 0.
+ */
+unsigned int timer_add( double delay, TimerFunc func, unsigned int owner, void *data )
+{
+   int n;
+   uint64_t ticks;
+   TimerNode *t;
+
+   if (timer_nodes == NULL)
+      timer_init();
+
+   /* Get a node. */
+   if (timer_free >= 0) {
+      n          = timer_free;
+      timer_free = timer_nodes[n].next;
+   }
+   else {
+      if (timer_nnodes >= TIMER_IDXMASK) {
+         WARN("Too many timers armed.");
+         return 0;
+      }
+      if (timer_nnodes >= timer_mnodes) {
+         timer_mnodes += TIMER_CHUNK;
+         timer_nodes   = realloc( timer_nodes, sizeof(TimerNode) * timer_mnodes );
+      }
+      n = timer_nnodes++;
+      timer_nodes[n].gen = 0;
+   }
+
+   /* Up on the first tick after the delay, rounded to the nearest tick. */
+   ticks = (delay > 0.) ? (uint64_t)(delay * 1000. + 0.5) : 0;
+   t         = &timer_nodes[n];
+   t->id     = ((t->gen << TIMER_IDXBITS) | (unsigned int)n);
+   t->expire = timer_tick + MAX( ticks, 1 );
+   t->func   = func;
+   t->owner  = owner;
+   t->data   = data;
+   t->prev   = n;
+   t->next   = n;
+   timer_place( n );
+
+   return t->id;
+}
+
+
+/**
+ * @brief Stops a timer without running it.
+ *
+ *    @param id ID of the timer to stop.
+ *    @return 0 on success, -1 if it wasn't armed.
+ */
+int timer_cancel( unsigned int id )
+{
+   int n;
+
+   n = timer_get( id );
+   if (n < 0)
+      return -1;
+
+   timer_unlink( n );
+   timer_release( n );
+   return 0;
+}
+
+
+/**
+ * @brief Gets the time left on a timer.
+ *
+ *    @param id ID of the timer.
+ *    @return Seconds until the timer is up or 0 if it isn't armed.
+ */
+double timer_left( unsigned int id )
+{
+   int n;
+
+   n = timer_get( id );
+   if (n < 0)
+      return 0.;
+
+   return MAX( 0., ((double)timer_nodes[n].expire - timer_time) / 1000. );
+}
+
+
+/**
+ * @brief Advances the game time running the timers that are up.
+ *
+ *    @param dt Game time elapsed in seconds.
+ */
+void timers_update( double dt )
+{
+   uint64_t target;
+
+   timer_time += dt * 1000.;
+   if (timer_nodes == NULL) {
+      timer_tick = (uint64_t)timer_time;
+      return;
+   }
+
+   target = (uint64_t)timer_time;
+   while (timer_tick < target)
+      timer_run( timer_tick+1 );
+}
+
+
+/**
+ * @brief Frees all the timers without running them.
+ */
+void timers_exit (void)
+{
+   free( timer_nodes );
+   timer_nodes  = NULL;
+   timer_nnodes = 0;
+   timer_mnodes = 0;
+   timer_free   = -1;
+}
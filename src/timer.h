@@ -0,0 +1,35 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+
+
+#ifndef TIMER_H
+#  define TIMER_H
+
+
+/**
+ * @brief Function run when a timer is up.
+ *
+ *    @param owner Owner passed to timer_add.
+ *    @param data Data passed to timer_add.
+ *    @return 0 if done, otherwise the timer runs again next tick.
+ */
+typedef int (*TimerFunc)( unsigned int owner, void *data );
+
+
+/*
+ * Adding/removing.
+ */
+unsigned int timer_add( double delay, TimerFunc func, unsigned int owner, void *data );
+int timer_cancel( unsigned int id );
+double timer_left( unsigned int id );
+
+/*
+ * Updating.
+ */
+void timers_update( double dt );
+void timers_exit (void);
+
+
+#endif /* TIMER_H */
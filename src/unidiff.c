@@ -186,14 +186,14 @@ int diff_apply( const char *name )
    xmlNodePtr node;
    xmlDocPtr doc;
    uint32_t bufsize;
-   char *buf;
+   const char *buf;
    char *diffname;
 
    /* Check if already applied. */
    if (diff_isApplied(name))
       return 0;
 
-   buf = ndata_read( DIFF_DATA, &bufsize );
+   buf = ndata_borrow( DIFF_DATA, &bufsize );
    doc = xmlParseMemory( buf, bufsize );
 
    node = doc->xmlChildrenNode;
@@ -219,7 +219,7 @@ int diff_apply( const char *name )
             /* Clean up. */
             free(diffname);
             xmlFreeDoc(doc);
-            free(buf);
+            ndata_release(buf);
 
             return 0;
          }
@@ -229,7 +229,7 @@ int diff_apply( const char *name )
 
    /* More clean up. */
    xmlFreeDoc(doc);
-   free(buf);
+   ndata_release(buf);
 
    WARN("UniDiff '%s' not found in "DIFF_DATA".", name);
    return -1;
@@ -31,12 +31,16 @@
 #include "gui.h"
 #include "ai.h"
 #include "ai_extra.h"
+#include "pgrid.h"
+#include "threadpool.h"
 
 
 #define weapon_isSmart(w)     (w->think != NULL) /**< Checks if the weapon w is smart. */
 
 #define WEAPON_CHUNK_MAX      16384 /**< Maximum size to increase array with */
 #define WEAPON_CHUNK_MIN      256 /**< Minimum size to increase array with */
+#define WEAPON_POOL_CHUNK     256 /**< Weapons allocated at once by the pool. */
+#define WEAPON_DETECT_CHUNK   64 /**< Weapons each thread checks for collisions at once. */
 
 /* Weapon status */
 #define WEAPON_STATUS_OK         0 /**< Weapon is fine */
@@ -64,7 +68,7 @@ static int weapon_safety = 1; /**< Enables shooting friendlies. */
  * @brief In-game representation of a weapon.
  */
 typedef struct Weapon_ {
-   Solid *solid; /**< Actually has its own solid :) */
+   Solid solid; /**< Actually has its own solid :) */
    int ID; /**< Only used for beam weapons. */
 
    int faction; /**< faction of pilot that shot it */
@@ -90,9 +94,33 @@ typedef struct Weapon_ {
    void (*think)(struct Weapon_*, const double); /**< for the smart missiles */
 
    char status; /**< Weapon status - to check for jamming */
+
+   unsigned int serial; /**< Changes every time the weapon is reused, 0 if free. */
+   struct Weapon_ *next; /**< Next free weapon in the pool. */
 } Weapon;
 
 
+/**
+ * @brief Collision found while detecting, gets applied afterwards.
+ */
+typedef struct WeaponHit_ {
+   Weapon *w; /**< Weapon that collided. */
+   unsigned int serial; /**< Serial of the weapon when it collided. */
+   unsigned int pilot; /**< ID of the pilot collided with. */
+   Vector2d crash[2]; /**< Collision points, only beams use the second. */
+} WeaponHit;
+
+
+/**
+ * @brief Collisions found by a range of weapons.
+ */
+typedef struct WeaponHitList_ {
+   WeaponHit *hits; /**< Collisions in the order they must be applied. */
+   int nhits; /**< Number of collisions. */
+   int mhits; /**< Memory allocated for collisions. */
+} WeaponHitList;
+
+
 /* behind pilot_nstack layer */
 static Weapon** wbackLayer = NULL; /**< behind pilots */
 static int nwbackLayer = 0; /**< number of elements */
@@ -102,6 +130,12 @@ static Weapon** wfrontLayer = NULL; /**< infront of pilots, behind player */
 static int nwfrontLayer = 0; /**< number of elements */
 static int mwfrontLayer = 0; /**< alloced memory size */
 
+/* Pool of weapons, chunks never move so weapon pointers stay valid. */
+static Weapon **weapon_pool = NULL; /**< Chunks of weapons. */
+static int weapon_npool = 0; /**< Number of chunks. */
+static Weapon *weapon_freeList = NULL; /**< Free weapons ready to be reused. */
+static unsigned int weapon_serial = 0; /**< Last serial handed out. */
+
 /* Graphics. */
 static gl_vbo  *weapon_vbo     = NULL; /**< Weapon VBO. */
 static GLfloat *weapon_vboData = NULL; /**< Data of weapon VBO. */
@@ -111,6 +145,13 @@ static int weapon_vboSize      = 0; /**< Size of the VBO. */
 /* Internal stuff. */
 static int beam_idgen = 0; /**< Beam identifier generator. */
 
+/* Collision detection. */
+static unsigned int **weapon_cand = NULL; /**< Candidate pilots to collide with, one per thread. */
+static int *weapon_mcand = NULL; /**< Memory allocated for candidates, one per thread. */
+static int weapon_ncand = 0; /**< Number of candidate buffers. */
+static WeaponHitList *weapon_hitList = NULL; /**< Collisions found, one per range of weapons. */
+static int weapon_nhitList = 0; /**< Number of collision lists. */
+
 
 /*
  * Prototypes
@@ -122,10 +163,17 @@ static Weapon* weapon_create( const Outfit* outfit,
 static void weapon_render( Weapon* w, const double dt );
 static void weapons_updateLayer( const double dt, const WeaponLayer layer );
 static void weapon_update( Weapon* w, const double dt, WeaponLayer layer );
+static void weapons_detect( void *data, int start, int end, int thread );
+static void weapon_detect( Weapon* w, WeaponHitList *list,
+      unsigned int **cand, int *mcand );
+static void weapon_addHit( WeaponHitList *list, Weapon *w, Pilot *p,
+      Vector2d crash[2] );
+static int weapon_canNeverHit( Weapon* w, Pilot *p );
 static void weapon_hit( Weapon* w, Pilot* p, WeaponLayer layer, Vector2d* pos );
 static void weapon_hitBeam( Weapon* w, Pilot* p, WeaponLayer layer,
       Vector2d pos[2], const double dt );
 static void weapon_destroy( Weapon* w, WeaponLayer layer );
+static Weapon* weapon_alloc (void);
 static void weapon_free( Weapon* w );
 static void weapon_explodeLayer( WeaponLayer layer,
       double x, double y, double radius,
@@ -172,12 +220,12 @@ void weapon_minimap( const double res, const double w,
       wp = wbackLayer[i];
 
       /* Make sure is in range. */
-      if (!pilot_inRange( player, wp->solid->pos.x, wp->solid->pos.y ))
+      if (!pilot_inRange( player, wp->solid.pos.x, wp->solid.pos.y ))
          continue;
 
       /* Get radar position. */
-      x = (wp->solid->pos.x - player->solid->pos.x) / res;
-      y = (wp->solid->pos.y - player->solid->pos.y) / res;
+      x = (wp->solid.pos.x - player->solid->pos.x) / res;
+      y = (wp->solid.pos.y - player->solid->pos.y) / res;
 
       /* Make sure in range. */
       if (shape==RADAR_RECT && (ABS(x)>w/2. || ABS(y)>h/2.))
@@ -211,12 +259,12 @@ void weapon_minimap( const double res, const double w,
       wp = wfrontLayer[i];
 
       /* Make sure is in range. */
-      if (!pilot_inRange( player, wp->solid->pos.x, wp->solid->pos.y ))
+      if (!pilot_inRange( player, wp->solid.pos.x, wp->solid.pos.y ))
          continue;
 
       /* Get radar position. */
-      x = (wp->solid->pos.x - player->solid->pos.x) / res;
-      y = (wp->solid->pos.y - player->solid->pos.y) / res;
+      x = (wp->solid.pos.x - player->solid->pos.x) / res;
+      y = (wp->solid.pos.y - player->solid->pos.y) / res;
 
       /* Make sure in range. */
       if (shape==RADAR_RECT && (ABS(x)>w/2. || ABS(y)>h/2.))
@@ -286,7 +334,7 @@ void weapon_toggleSafety (void)
  */
 static void weapon_setThrust( Weapon *w, double thrust )
 {
-   w->solid->force_x = thrust;
+   w->solid.force_x = thrust;
 }
 
 
@@ -295,7 +343,7 @@ static void weapon_setThrust( Weapon *w, double thrust )
  */
 static void weapon_setTurn( Weapon *w, double turn )
 {
-   w->solid->dir_vel = turn;
+   w->solid.dir_vel = turn;
 }
 
 
@@ -333,7 +381,7 @@ static void think_seeker( Weapon* w, const double dt )
 
       case WEAPON_STATUS_LOCKEDON: /* Check to see if can get jammed */
          if ((p->jam_range != 0.) &&  /* Target has jammer and weapon is in range */
-               (vect_dist(&w->solid->pos,&p->solid->pos) < p->jam_range)) {
+               (vect_dist(&w->solid.pos,&p->solid->pos) < p->jam_range)) {
 
             /* Check to see if weapon gets jammed */
             if (RNGF() < p->jam_chance - w->outfit->u.amm.resist) {
@@ -364,21 +412,21 @@ static void think_seeker( Weapon* w, const double dt )
          if (w->outfit->u.amm.ai == 2) {
 
             /* Calculate time to reach target. */
-            vect_cset( &v, p->solid->pos.x - w->solid->pos.x,
-                  p->solid->pos.y - w->solid->pos.y );
+            vect_cset( &v, p->solid->pos.x - w->solid.pos.x,
+                  p->solid->pos.y - w->solid.pos.y );
             t = vect_odist( &v ) / w->outfit->u.amm.speed;
 
             /* Calculate target's movement. */
-            vect_cset( &v, v.x + t*(p->solid->vel.x - w->solid->vel.x),
-                  v.y + t*(p->solid->vel.y - w->solid->vel.y) );
+            vect_cset( &v, v.x + t*(p->solid->vel.x - w->solid.vel.x),
+                  v.y + t*(p->solid->vel.y - w->solid.vel.y) );
 
             /* Get the angle now. */
-            diff = angle_diff(w->solid->dir, VANGLE(v) );
+            diff = angle_diff(w->solid.dir, VANGLE(v) );
          }
          /* Other seekers are stupid. */
          else {
-            diff = angle_diff(w->solid->dir, /* Get angle to target pos */
-                  vect_angle(&w->solid->pos, &p->solid->pos));
+            diff = angle_diff(w->solid.dir, /* Get angle to target pos */
+                  vect_angle(&w->solid.pos, &p->solid->pos));
          }
 
          /* Set turn. */
@@ -396,9 +444,9 @@ static void think_seeker( Weapon* w, const double dt )
    }
 
    /* Limit speed here */
-   vel = MIN(w->outfit->u.amm.speed, VMOD(w->solid->vel) + w->outfit->u.amm.thrust*dt);
-   vect_pset( &w->solid->vel, vel, w->solid->dir );
-   /*limit_speed( &w->solid->vel, w->outfit->u.amm.speed, dt );*/
+   vel = MIN(w->outfit->u.amm.speed, VMOD(w->solid.vel) + w->outfit->u.amm.thrust*dt);
+   vect_pset( &w->solid.vel, vel, w->solid.dir );
+   /*limit_speed( &w->solid.vel, w->outfit->u.amm.speed, dt );*/
 }
 
 
@@ -432,13 +480,13 @@ static void think_beam( Weapon* w, const double dt )
 
    /* Use mount position. */
    pilot_getMount( p, w->mount, &v );
-   w->solid->pos.x = p->solid->pos.x + v.x;
-   w->solid->pos.y = p->solid->pos.y + v.y;
+   w->solid.pos.x = p->solid->pos.x + v.x;
+   w->solid.pos.y = p->solid->pos.y + v.y;
 
    /* Handle aiming. */
    switch (w->outfit->type) {
       case OUTFIT_TYPE_BEAM:
-         w->solid->dir = p->solid->dir;
+         w->solid.dir = p->solid->dir;
          break;
 
       case OUTFIT_TYPE_TURRET_BEAM:
@@ -450,10 +498,10 @@ static void think_beam( Weapon* w, const double dt )
          }
 
          if (w->target == w->parent) /* Invalid target, tries to follow shooter. */
-            diff = angle_diff(w->solid->dir, p->solid->dir);
+            diff = angle_diff(w->solid.dir, p->solid->dir);
          else
-            diff = angle_diff(w->solid->dir, /* Get angle to target pos */
-                  vect_angle(&w->solid->pos, &t->solid->pos));
+            diff = angle_diff(w->solid.dir, /* Get angle to target pos */
+                  vect_angle(&w->solid.pos, &t->solid->pos));
          weapon_setTurn( w, CLAMP( -w->outfit->u.bem.turn, w->outfit->u.bem.turn,
                   10 * diff *  w->outfit->u.bem.turn ));
          break;
@@ -471,6 +519,9 @@ static void think_beam( Weapon* w, const double dt )
  */
 void weapons_update( const double dt )
 {
+   /* Pilots don't move while weapons update so grid only needs building once. */
+   pgrid_update( dt );
+
    weapons_updateLayer(dt,WEAPON_LAYER_BG);
    weapons_updateLayer(dt,WEAPON_LAYER_FG);
 }
@@ -487,9 +538,11 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
    Weapon **wlayer;
    int *nlayer;
    Weapon *w;
-   int i;
+   int i, j, n;
    int spfx;
    int s;
+   WeaponHit *hit;
+   Pilot *p;
 
    /* Choose layer. */
    switch (layer) {
@@ -518,7 +571,7 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
             if (w->lockon > 0.) /* decrement lockon */
                w->lockon -= dt;
 
-            limit_speed( &w->solid->vel, w->outfit->u.amm.speed, dt );
+            limit_speed( &w->solid.vel, w->outfit->u.amm.speed, dt );
             w->timer -= dt;
             if (w->timer < 0.) {
                spfx = -1;
@@ -530,17 +583,17 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
                   spfx = outfit_spfxShield(w->outfit);
                /* Add death sprite if needed. */
                if (spfx != -1) {
-                  spfx_add( spfx, w->solid->pos.x, w->solid->pos.y,
-                        w->solid->vel.x, w->solid->vel.y,
+                  spfx_add( spfx, w->solid.pos.x, w->solid.pos.y,
+                        w->solid.vel.x, w->solid.vel.y,
                         SPFX_LAYER_BACK ); /* presume back. */
                   /* Add sound if explodes and has it. */
                   s = outfit_soundHit(w->outfit);
                   if (s != -1)
                      w->voice = sound_playPos(s,
-                           w->solid->pos.x,
-                           w->solid->pos.y,
-                           w->solid->vel.x,
-                           w->solid->vel.y);
+                           w->solid.pos.x,
+                           w->solid.pos.y,
+                           w->solid.vel.x,
+                           w->solid.vel.y);
                }
                weapon_destroy(w,layer);
                break;
@@ -560,17 +613,17 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
                   spfx = outfit_spfxShield(w->outfit);
                /* Add death sprite if needed. */
                if (spfx != -1) {
-                  spfx_add( spfx, w->solid->pos.x, w->solid->pos.y,
-                        w->solid->vel.x, w->solid->vel.y,
+                  spfx_add( spfx, w->solid.pos.x, w->solid.pos.y,
+                        w->solid.vel.x, w->solid.vel.y,
                         SPFX_LAYER_BACK ); /* presume back. */
                   /* Add sound if explodes and has it. */
                   s = outfit_soundHit(w->outfit);
                   if (s != -1)
                      w->voice = sound_playPos(s,
-                           w->solid->pos.x,
-                           w->solid->pos.y,
-                           w->solid->vel.x,
-                           w->solid->vel.y);
+                           w->solid.pos.x,
+                           w->solid.pos.y,
+                           w->solid.vel.x,
+                           w->solid.vel.y);
                }
                weapon_destroy(w,layer);
                break;
@@ -607,12 +660,73 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
          break;
 
       /* Only increment if weapon wasn't deleted. */
-      if (w == wlayer[i]) {
-         weapon_update(w,dt,layer);
-         if ((i < *nlayer) && (w == wlayer[i]))
-            i++;
+      if (w == wlayer[i])
+         i++;
+   }
+
+   /* Make sure there's a candidate buffer per thread. */
+   n = threadpool_threads();
+   if (n > weapon_ncand) {
+      weapon_cand  = realloc( weapon_cand, sizeof(unsigned int*) * n );
+      weapon_mcand = realloc( weapon_mcand, sizeof(int) * n );
+      for (i=weapon_ncand; i<n; i++) {
+         weapon_cand[i]  = NULL;
+         weapon_mcand[i] = 0;
       }
+      weapon_ncand = n;
+   }
+
+   /* Make sure there's a collision list per range of weapons. */
+   n = (*nlayer + WEAPON_DETECT_CHUNK - 1) / WEAPON_DETECT_CHUNK;
+   if (n > weapon_nhitList) {
+      weapon_hitList = realloc( weapon_hitList, sizeof(WeaponHitList) * n );
+      memset( &weapon_hitList[weapon_nhitList], 0,
+            sizeof(WeaponHitList) * (n - weapon_nhitList) );
+      weapon_nhitList = n;
+   }
+   for (i=0; i<n; i++)
+      weapon_hitList[i].nhits = 0;
+
+   /* Detect collisions, nothing gets modified except the lists. */
+   threadpool_for( weapons_detect, wlayer, *nlayer, WEAPON_DETECT_CHUNK );
+
+   /* Apply the collisions in order so results don't depend on threads. */
+   for (i=0; i<n; i++) {
+      for (j=0; j<weapon_hitList[i].nhits; j++) {
+         hit = &weapon_hitList[i].hits[j];
+         w   = hit->w;
+
+         /* Weapon already destroyed. */
+         if (w->serial != hit->serial)
+            continue;
+
+         /* Earlier hits can change who can be hit. */
+         p = pilot_get( hit->pilot );
+         if ((p == NULL) || !weapon_checkCanHit(w,p))
+            continue;
+
+         if (outfit_isBeam(w->outfit))
+            weapon_hitBeam( w, p, layer, hit->crash, dt );
+         else
+            weapon_hit( w, p, layer, &hit->crash[0] );
+      }
+   }
+
+   /* Hits can create or destroy weapons so get the layer again. */
+   switch (layer) {
+      case WEAPON_LAYER_BG:
+         wlayer = wbackLayer;
+         break;
+      case WEAPON_LAYER_FG:
+         wlayer = wfrontLayer;
+         break;
+      default:
+         break;
    }
+
+   /* Move the weapons that survived. */
+   for (i=0; i<*nlayer; i++)
+      weapon_update( wlayer[i], dt, layer );
 }
 
 
@@ -689,10 +803,10 @@ static void weapon_render( Weapon* w, const double dt )
             if (outfit_isBolt(w->outfit) && w->outfit->u.blt.gfx_end)
                gl_blitSpriteInterpolate( gfx, w->outfit->u.blt.gfx_end,
                      w->timer / w->life,
-                     w->solid->pos.x, w->solid->pos.y,
+                     w->solid.pos.x, w->solid.pos.y,
                      w->sprite % (int)gfx->sx, w->sprite / (int)gfx->sx, &c );
             else
-               gl_blitSprite( gfx, w->solid->pos.x, w->solid->pos.y,
+               gl_blitSprite( gfx, w->solid.pos.x, w->solid.pos.y,
                      w->sprite % (int)gfx->sx, w->sprite / (int)gfx->sx, &c );
          }
          /* Outfit faces direction. */
@@ -700,9 +814,9 @@ static void weapon_render( Weapon* w, const double dt )
             if (outfit_isBolt(w->outfit) && w->outfit->u.blt.gfx_end)
                gl_blitSpriteInterpolate( gfx, w->outfit->u.blt.gfx_end,
                      w->timer / w->life,
-                     w->solid->pos.x, w->solid->pos.y, w->sx, w->sy, &c );
+                     w->solid.pos.x, w->solid.pos.y, w->sx, w->sy, &c );
             else
-               gl_blitSprite( gfx, w->solid->pos.x, w->solid->pos.y, w->sx, w->sy, &c );
+               gl_blitSprite( gfx, w->solid.pos.x, w->solid.pos.y, w->sx, w->sy, &c );
          }
          break;
 
@@ -717,14 +831,14 @@ static void weapon_render( Weapon* w, const double dt )
          /* Position. */
          gl_cameraGet( &cx, &cy );
          gui_getOffset( &gx, &gy );
-         x = (w->solid->pos.x - cx)*z + gx;
-         y = (w->solid->pos.y - cy)*z + gy;
+         x = (w->solid.pos.x - cx)*z + gx;
+         y = (w->solid.pos.y - cy)*z + gy;
 
          /* Set up the matrix. */
          glMatrixMode(GL_PROJECTION);
          glPushMatrix();
             glTranslated( x, y, 0. );
-            glRotated( 270. + w->solid->dir / M_PI * 180., 0., 0., 1. );
+            glRotated( 270. + w->solid.dir / M_PI * 180., 0., 0., 1. );
 
          /* Preparatives. */
          glEnable(GL_TEXTURE_2D);
@@ -856,15 +970,98 @@ static int weapon_checkCanHit( Weapon* w, Pilot *p )
 
 
 /**
- * @brief Updates an individual weapon.
+ * @brief Checks to see if the weapon can never hit the pilot.
  *
- *    @param w Weapon to update.
- *    @param dt Current delta tick.
- *    @param layer Layer to which the weapon belongs.
+ * Unlike weapon_checkCanHit this only checks things that can't change while
+ *  the hits are applied, so it's safe to use while detecting collisions.
+ *
+ *    @param w Weapon to check if hits pilot.
+ *    @param p Pilot to check if is hit by weapon.
+ *    @return 1 if it can never be hit, 0 if it might be.
  */
-static void weapon_update( Weapon* w, const double dt, WeaponLayer layer )
+static int weapon_canNeverHit( Weapon* w, Pilot *p )
 {
-   int i, psx,psy;
+   /* Pilot is self. */
+   if (w->parent == p->id)
+      return 1;
+
+   /* Can never hit same faction. */
+   if (p->faction == w->faction)
+      return 1;
+
+   /* Go "through" dead pilots, they don't come back to life. */
+   if (pilot_isFlag(p, PILOT_DEAD))
+      return 1;
+
+   /* Only the player's standing can change, other factions only ever hit
+    *  their enemies. */
+   if ((w->faction != FACTION_PLAYER) && (p->faction != FACTION_PLAYER) &&
+         !areEnemies(w->faction, p->faction))
+      return 1;
+
+   return 0;
+}
+
+
+/**
+ * @brief Adds a collision to a list.
+ */
+static void weapon_addHit( WeaponHitList *list, Weapon *w, Pilot *p,
+      Vector2d crash[2] )
+{
+   WeaponHit *hit;
+
+   if (list->nhits >= list->mhits) {
+      list->mhits = MAX( 2*list->mhits, WEAPON_DETECT_CHUNK );
+      list->hits  = realloc( list->hits, sizeof(WeaponHit) * list->mhits );
+   }
+
+   hit          = &list->hits[ list->nhits++ ];
+   hit->w       = w;
+   hit->serial  = w->serial;
+   hit->pilot   = p->id;
+   hit->crash[0] = crash[0];
+   hit->crash[1] = crash[1];
+}
+
+
+/**
+ * @brief Detects the collisions of a range of weapons.
+ *
+ * Run by the thread pool, must not modify anything shared.
+ *
+ *    @param data Layer being updated.
+ *    @param start First weapon to check.
+ *    @param end One past the last weapon to check.
+ *    @param thread Thread running.
+ */
+static void weapons_detect( void *data, int start, int end, int thread )
+{
+   int i;
+   Weapon **wlayer;
+
+   wlayer = (Weapon**) data;
+   for (i=start; i<end; i++)
+      weapon_detect( wlayer[i], &weapon_hitList[ i / WEAPON_DETECT_CHUNK ],
+            &weapon_cand[thread], &weapon_mcand[thread] );
+}
+
+
+/**
+ * @brief Detects the collisions of an individual weapon.
+ *
+ * Every pilot the weapon touches gets stored in the list in stack order,
+ *  whether or not it actually gets hit is decided when the list is applied.
+ *
+ *    @param w Weapon to check.
+ *    @param list List to add collisions to.
+ *    @param[in,out] cand Buffer for candidate pilots.
+ *    @param[in,out] mcand Memory allocated for candidate pilots.
+ */
+static void weapon_detect( Weapon* w, WeaponHitList *list,
+      unsigned int **cand, int *mcand )
+{
+   int i, n, psx,psy;
    glTexture *gfx;
    Vector2d crash[2];
    Pilot *p;
@@ -872,69 +1069,98 @@ static void weapon_update( Weapon* w, const double dt, WeaponLayer layer )
    /* Get the sprite direction to speed up calculations. */
    if (!outfit_isBeam(w->outfit)) {
       gfx = outfit_gfx(w->outfit);
-      gl_getSpriteFromDir( &w->sx, &w->sy, gfx, w->solid->dir );
+      gl_getSpriteFromDir( &w->sx, &w->sy, gfx, w->solid.dir );
    }
 
-   for (i=0; i<pilot_nstack; i++) {
-
-      p = pilot_stack[i];
+   /* Beam weapons have special collisions. */
+   if (outfit_isBeam(w->outfit)) {
+      /* Only check pilots in the cells the beam crosses. */
+      n = pgrid_queryLine( cand, mcand,
+            w->solid.pos.x, w->solid.pos.y,
+            w->solid.pos.x + w->outfit->u.bem.range*cos(w->solid.dir),
+            w->solid.pos.y + w->outfit->u.bem.range*sin(w->solid.dir) );
 
-      psx = pilot_stack[i]->tsx;
-      psy = pilot_stack[i]->tsy;
+      for (i=0; i<n; i++) {
+         p = pilot_get( (*cand)[i] );
+         if ((p == NULL) || weapon_canNeverHit(w,p))
+            continue;
 
-      if (w->parent == pilot_stack[i]->id) continue; /* pilot is self */
+         psx = p->tsx;
+         psy = p->tsy;
 
-      /* Beam weapons have special collisions. */
-      if (outfit_isBeam(w->outfit)) {
          /* Check for collision. */
-         if (weapon_checkCanHit(w,p) &&
-               CollideLineSprite( &w->solid->pos, w->solid->dir,
+         if (CollideLineSprite( &w->solid.pos, w->solid.dir,
                      w->outfit->u.bem.range,
                      p->ship->gfx_space, psx, psy,
                      &p->solid->pos,
-                     crash)) {
-            weapon_hitBeam( w, p, layer, crash, dt );
-            /* No return because beam can still think, it's not
-             * destroyed like the other weapons.*/
-         }
+                     crash))
+            weapon_addHit( list, w, p, crash );
       }
-      /* smart weapons only collide with their target */
-      else if (weapon_isSmart(w)) {
-
-         if ((pilot_stack[i]->id == w->target) &&
-               (w->status != WEAPON_STATUS_OK) && /* Must not be locking on. */
-               weapon_checkCanHit(w,p) &&
-               CollideSprite( gfx, w->sx, w->sy, &w->solid->pos,
-                     p->ship->gfx_space, psx, psy,
-                     &p->solid->pos,
-                     &crash[0] )) {
-            weapon_hit( w, p, layer, &crash[0] );
-            return; /* Weapon is destroyed. */
-         }
+   }
+   /* smart weapons only collide with their target */
+   else if (weapon_isSmart(w)) {
+
+      p = pilot_get( w->target );
+      if ((p != NULL) && !weapon_canNeverHit(w,p) &&
+            (w->status != WEAPON_STATUS_OK) && /* Must not be locking on. */
+            CollideSprite( gfx, w->sx, w->sy, &w->solid.pos,
+                  p->ship->gfx_space, p->tsx, p->tsy,
+                  &p->solid->pos,
+                  &crash[0] )) {
+         crash[1] = crash[0];
+         weapon_addHit( list, w, p, crash );
       }
-      /* dumb weapons hit anything not of the same faction */
-      else {
-         if (weapon_checkCanHit(w,p) &&
-               CollideSprite( gfx, w->sx, w->sy, &w->solid->pos,
+   }
+   /* dumb weapons hit anything not of the same faction */
+   else {
+      /* Only check pilots in the cells the weapon overlaps. */
+      n = pgrid_queryRect( cand, mcand,
+            w->solid.pos.x - gfx->sw/2., w->solid.pos.y - gfx->sh/2.,
+            w->solid.pos.x + gfx->sw/2., w->solid.pos.y + gfx->sh/2. );
+
+      for (i=0; i<n; i++) {
+         p = pilot_get( (*cand)[i] );
+         if ((p == NULL) || weapon_canNeverHit(w,p))
+            continue;
+
+         psx = p->tsx;
+         psy = p->tsy;
+
+         if (CollideSprite( gfx, w->sx, w->sy, &w->solid.pos,
                      p->ship->gfx_space, psx, psy,
                      &p->solid->pos,
                      &crash[0] )) {
-            weapon_hit( w, p, layer, &crash[0] );
-            return; /* Weapon is destroyed. */
+            crash[1] = crash[0];
+            weapon_addHit( list, w, p, crash );
          }
       }
    }
+}
+
+
+/**
+ * @brief Updates an individual weapon.
+ *
+ * Collisions have already been handled by the time this is called.
+ *
+ *    @param w Weapon to update.
+ *    @param dt Current delta tick.
+ *    @param layer Layer to which the weapon belongs.
+ */
+static void weapon_update( Weapon* w, const double dt, WeaponLayer layer )
+{
+   (void) layer;
 
    /* smart weapons also get to think their next move */
    if (weapon_isSmart(w))
       (*w->think)(w,dt);
 
    /* Update the solid position. */
-   (*w->solid->update)(w->solid, dt);
+   (*w->solid.update)(&w->solid, dt);
 
    /* Update the sound. */
-   sound_updatePos(w->voice, w->solid->pos.x, w->solid->pos.y,
-         w->solid->vel.x, w->solid->vel.y);
+   sound_updatePos(w->voice, w->solid.pos.x, w->solid.pos.y,
+         w->solid.vel.x, w->solid.vel.y);
 }
 
 
@@ -1005,13 +1231,13 @@ static void weapon_hit( Weapon* w, Pilot* p, WeaponLayer layer, Vector2d* pos )
    s = outfit_soundHit(w->outfit);
    if (s != -1)
       w->voice = sound_playPos( s,
-            w->solid->pos.x,
-            w->solid->pos.y,
-            w->solid->vel.x,
-            w->solid->vel.y);
+            w->solid.pos.x,
+            w->solid.pos.y,
+            w->solid.vel.x,
+            w->solid.vel.y);
 
    /* Have pilot take damage and get real damage done. */
-   damage = pilot_hit( p, w->solid, w->parent, dtype, MAX(0.,w->dam_mod*damage) );
+   damage = pilot_hit( p, &w->solid, w->parent, dtype, MAX(0.,w->dam_mod*damage) );
 
    /* Get the layer. */
    spfx_layer = (p==player) ? SPFX_LAYER_FRONT : SPFX_LAYER_BACK;
@@ -1057,7 +1283,7 @@ static void weapon_hitBeam( Weapon* w, Pilot* p, WeaponLayer layer,
    dtype  = outfit_damageType(w->outfit);
 
    /* Have pilot take damage and get real damage done. */
-   damage = pilot_hit( p, w->solid, w->parent, dtype, MAX(0.,w->dam_mod*damage) );
+   damage = pilot_hit( p, &w->solid, w->parent, dtype, MAX(0.,w->dam_mod*damage) );
 
    /* Add sprite, layer depends on whether player shot or not. */
    if (w->lockon == -1.) {
@@ -1105,8 +1331,7 @@ static Weapon* weapon_create( const Outfit* outfit,
    Weapon* w;
 
    /* Create basic features */
-   w = malloc(sizeof(Weapon));
-   memset(w, 0, sizeof(Weapon));
+   w = weapon_alloc();
    w->dam_mod = 1.; /* Default of 100% damage. */
    w->faction = parent->faction; /* non-changeable */
    w->parent = parent->id; /* non-changeable */
@@ -1183,12 +1408,12 @@ static Weapon* weapon_create( const Outfit* outfit,
          vect_cadd( &v, outfit->u.blt.speed*cos(rdir), outfit->u.blt.speed*sin(rdir));
          w->timer = outfit->u.blt.range / outfit->u.blt.speed;
          w->falloff = w->timer - outfit->u.blt.falloff / outfit->u.blt.speed;
-         w->solid = solid_create( mass, rdir, pos, &v );
+         solid_init( &w->solid, mass, rdir, pos, &v );
          w->voice = sound_playPos( w->outfit->u.blt.sound,
-               w->solid->pos.x,
-               w->solid->pos.y,
-               w->solid->vel.x,
-               w->solid->vel.y);
+               w->solid.pos.x,
+               w->solid.pos.y,
+               w->solid.vel.x,
+               w->solid.vel.y);
          break;
 
       /* Beam weapons are treated together. */
@@ -1206,14 +1431,14 @@ static Weapon* weapon_create( const Outfit* outfit,
          else if (rdir >= 2.*M_PI)
             rdir -= 2.*M_PI;
          mass = 1.; /**< Needs a mass. */
-         w->solid = solid_create( mass, rdir, pos, NULL );
+         solid_init( &w->solid, mass, rdir, pos, NULL );
          w->think = think_beam;
          w->timer = outfit->u.bem.duration;
          w->voice = sound_playPos( w->outfit->u.bem.sound,
-               w->solid->pos.x,
-               w->solid->pos.y,
-               w->solid->vel.x,
-               w->solid->vel.y);
+               w->solid.pos.x,
+               w->solid.pos.y,
+               w->solid.vel.x,
+               w->solid.vel.y);
          break;
 
       /* Treat seekers together. */
@@ -1269,7 +1494,7 @@ static Weapon* weapon_create( const Outfit* outfit,
          mass        = w->outfit->mass;
          w->lockon   = outfit->u.amm.lockon;
          w->timer    = outfit->u.amm.duration;
-         w->solid    = solid_create( mass, rdir, pos, &v );
+         solid_init( &w->solid, mass, rdir, pos, &v );
          if (w->outfit->u.amm.thrust != 0.)
             weapon_setThrust( w, w->outfit->u.amm.thrust * mass );
 
@@ -1285,17 +1510,17 @@ static Weapon* weapon_create( const Outfit* outfit,
 
          /* Play sound. */
          w->voice    = sound_playPos(w->outfit->u.amm.sound,
-               w->solid->pos.x,
-               w->solid->pos.y,
-               w->solid->vel.x,
-               w->solid->vel.y);
+               w->solid.pos.x,
+               w->solid.pos.y,
+               w->solid.vel.x,
+               w->solid.vel.y);
          break;
 
       /* just dump it where the player is */
       default:
          WARN("Weapon of type '%s' has no create implemented yet!",
                w->outfit->name);
-         w->solid = solid_create( 1., dir, pos, vel );
+         solid_init( &w->solid, 1., dir, pos, vel );
          break;
    }
 
@@ -1531,10 +1756,10 @@ static void weapon_destroy( Weapon* w, WeaponLayer layer )
    if (outfit_isBeam(w->outfit)) {
       sound_stop( w->voice );
       sound_playPos(w->outfit->u.bem.sound_off,
-            w->solid->pos.x,
-            w->solid->pos.y,
-            w->solid->vel.x,
-            w->solid->vel.y);
+            w->solid.pos.x,
+            w->solid.pos.y,
+            w->solid.vel.x,
+            w->solid.vel.y);
    }
 
    switch (layer) {
@@ -1567,20 +1792,61 @@ static void weapon_destroy( Weapon* w, WeaponLayer layer )
 }
 
 
+/**
+ * @brief Gets a clean weapon from the pool.
+ *
+ * Only allocates memory when the pool runs out of weapons.
+ *
+ *    @return A zeroed out weapon.
+ */
+static Weapon* weapon_alloc (void)
+{
+   int i;
+   Weapon *w, *chunk;
+
+   /* Grow the pool. */
+   if (weapon_freeList == NULL) {
+      chunk = malloc( sizeof(Weapon) * WEAPON_POOL_CHUNK );
+      if (chunk == NULL)
+         ERR("Out of Memory");
+      weapon_pool = realloc( weapon_pool, sizeof(Weapon*) * (weapon_npool+1) );
+      weapon_pool[ weapon_npool++ ] = chunk;
+
+      /* Thread in reverse so the chunk gets used in order. */
+      for (i=WEAPON_POOL_CHUNK-1; i>=0; i--) {
+         chunk[i].next   = weapon_freeList;
+         weapon_freeList = &chunk[i];
+      }
+   }
+
+   w = weapon_freeList;
+   weapon_freeList = w->next;
+   memset(w, 0, sizeof(Weapon));
+
+   /* Serial tells apart reuses of the same weapon, 0 is reserved for free. */
+   if (++weapon_serial == 0)
+      weapon_serial = 1;
+   w->serial = weapon_serial;
+   return w;
+}
+
+
 /**
  * @brief Frees the weapon.
  *
+ * The weapon goes back to the pool to be reused.
+ *
  *    @param w Weapon to free.
  */
 static void weapon_free( Weapon* w )
 {
-   solid_free(w->solid);
-
 #ifdef DEBUGGING
    memset(w, 0, sizeof(Weapon));
 #endif /* DEBUGGING */
 
-   free(w);
+   w->serial = 0;
+   w->next = weapon_freeList;
+   weapon_freeList = w;
 }
 
 /**
@@ -1607,6 +1873,8 @@ void weapon_clear (void)
  */
 void weapon_exit (void)
 {
+   int i;
+
    weapon_clear();
 
    /* Destroy front layer. */
@@ -1623,6 +1891,29 @@ void weapon_exit (void)
       mwfrontLayer = 0;
    }
 
+   /* Destroy pool. */
+   for (i=0; i<weapon_npool; i++)
+      free( weapon_pool[i] );
+   free( weapon_pool );
+   weapon_pool     = NULL;
+   weapon_npool    = 0;
+   weapon_freeList = NULL;
+
+   /* Destroy collision detection. */
+   for (i=0; i<weapon_ncand; i++)
+      free( weapon_cand[i] );
+   free( weapon_cand );
+   free( weapon_mcand );
+   weapon_cand  = NULL;
+   weapon_mcand = NULL;
+   weapon_ncand = 0;
+   for (i=0; i<weapon_nhitList; i++)
+      free( weapon_hitList[i].hits );
+   free( weapon_hitList );
+   weapon_hitList  = NULL;
+   weapon_nhitList = 0;
+   pgrid_free();
+
    /* Destroy VBO. */
    if (weapon_vbo != NULL) {
       free( weapon_vboData );
@@ -1683,8 +1974,8 @@ static void weapon_explodeLayer( WeaponLayer layer,
       if (((mode & EXPL_MODE_MISSILE) && outfit_isAmmo(curLayer[i]->outfit)) ||
             ((mode & EXPL_MODE_BOLT) && outfit_isBolt(curLayer[i]->outfit))) {
 
-         dist = pow2(curLayer[i]->solid->pos.x - x) +
-               pow2(curLayer[i]->solid->pos.y - y);
+         dist = pow2(curLayer[i]->solid.pos.x - x) +
+               pow2(curLayer[i]->solid.pos.y - y);
 
          if (dist < rad2) {
             weapon_destroy(curLayer[i], layer);